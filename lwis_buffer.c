@@ -11,6 +11,7 @@
 #define pr_fmt(fmt) KBUILD_MODNAME "-buffer: " fmt
 
 #include <linux/fs.h>
+#include <linux/sizes.h>
 #include <linux/slab.h>
 #include <soc/google/pt.h>
 
@@ -53,10 +54,348 @@ enrollment_list_find_or_create(struct lwis_client *client, dma_addr_t dma_vaddr)
 	return (list == NULL) ? enrollment_list_create(client, dma_vaddr) : list;
 }
 
+static void mapping_release(struct lwis_client *client, struct dma_buf *dma_buf,
+			    struct dma_buf_attachment *attachment, struct sg_table *sg_table,
+			    enum dma_data_direction dma_direction, dma_addr_t dma_vaddr)
+{
+	lwis_platform_dma_buffer_unmap(client->lwis_dev, attachment, dma_vaddr);
+	dma_buf_unmap_attachment(attachment, sg_table, dma_direction);
+	dma_buf_detach(dma_buf, attachment);
+	dma_buf_put(dma_buf);
+}
+
+/* Releases the least recently cached mappings until at most max_mappings are
+ * left. Calling this requires holding client->lock. */
+static unsigned long buffer_cache_shrink(struct lwis_client *client, uint32_t max_mappings)
+{
+	struct lwis_buffer_cached_mapping *mapping;
+	unsigned long freed = 0;
+
+	while (client->buffer_cache_size > max_mappings) {
+		mapping = list_first_entry(&client->buffer_cache, struct lwis_buffer_cached_mapping,
+					   node);
+		list_del(&mapping->node);
+		WRITE_ONCE(client->buffer_cache_size, client->buffer_cache_size - 1);
+		mapping_release(client, mapping->dma_buf, mapping->dma_buf_attachment,
+				mapping->sg_table, mapping->dma_direction,
+				sg_dma_address(mapping->sg_table->sgl));
+		kfree(mapping);
+		freed++;
+	}
+	return freed;
+}
+
+/* Moves the cached mapping of the buffer's dma_buf and direction, if any, to
+ * the buffer, which then holds the reference of the cache. Calling this
+ * requires holding client->lock. */
+static bool buffer_cache_take(struct lwis_client *client, struct lwis_enrolled_buffer *buffer)
+{
+	struct lwis_buffer_cached_mapping *mapping;
+
+	list_for_each_entry (mapping, &client->buffer_cache, node) {
+		if (mapping->dma_buf == buffer->dma_buf &&
+		    mapping->dma_direction == buffer->dma_direction) {
+			buffer->dma_buf_attachment = mapping->dma_buf_attachment;
+			buffer->sg_table = mapping->sg_table;
+			list_del(&mapping->node);
+			WRITE_ONCE(client->buffer_cache_size, client->buffer_cache_size - 1);
+			kfree(mapping);
+			/* The buffer already got its own reference */
+			dma_buf_put(buffer->dma_buf);
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Keeps the mapping of a buffer being disenrolled, along with its dma_buf
+ * reference. Calling this requires holding client->lock. */
+static bool buffer_cache_put(struct lwis_client *client, struct lwis_enrolled_buffer *buffer)
+{
+	struct lwis_buffer_cached_mapping *mapping;
+
+	if (client->buffer_cache_max == 0) {
+		return false;
+	}
+	mapping = kmalloc(sizeof(struct lwis_buffer_cached_mapping), GFP_KERNEL);
+	if (!mapping) {
+		return false;
+	}
+	mapping->dma_buf = buffer->dma_buf;
+	mapping->dma_direction = buffer->dma_direction;
+	mapping->dma_buf_attachment = buffer->dma_buf_attachment;
+	mapping->sg_table = buffer->sg_table;
+	list_add_tail(&mapping->node, &client->buffer_cache);
+	WRITE_ONCE(client->buffer_cache_size, client->buffer_cache_size + 1);
+	buffer_cache_shrink(client, client->buffer_cache_max);
+	return true;
+}
+
+static unsigned long buffer_cache_count_objects(struct shrinker *shrinker,
+						struct shrink_control *sc)
+{
+	struct lwis_client *client =
+		container_of(shrinker, struct lwis_client, buffer_cache_shrinker);
+
+	return READ_ONCE(client->buffer_cache_size);
+}
+
+static unsigned long buffer_cache_scan_objects(struct shrinker *shrinker,
+					       struct shrink_control *sc)
+{
+	struct lwis_client *client =
+		container_of(shrinker, struct lwis_client, buffer_cache_shrinker);
+	unsigned long freed;
+
+	/* Reclaim can come from an allocation made with the client lock held */
+	if (!mutex_trylock(&client->lock)) {
+		return SHRINK_STOP;
+	}
+	freed = min_t(unsigned long, sc->nr_to_scan, client->buffer_cache_size);
+	freed = buffer_cache_shrink(client, client->buffer_cache_size - freed);
+	mutex_unlock(&client->lock);
+	return freed;
+}
+
+/* Returns the number of bytes of DMA address space the sg_table maps */
+static size_t sg_table_dma_size(struct sg_table *sg_table)
+{
+	struct scatterlist *sg;
+	size_t size = 0;
+	int i;
+
+	for_each_sg (sg_table->sgl, sg, sg_table->nents, i) {
+		size += sg_dma_len(sg);
+	}
+	return size;
+}
+
+/* Releases the least recently freed buffers until the pool holds at most
+ * max_size bytes. Calling this requires holding pool->lock. */
+static unsigned long buffer_pool_shrink(struct lwis_buffer_pool *pool, size_t max_size)
+{
+	struct lwis_pooled_buffer *pooled;
+	unsigned long freed = 0;
+
+	while (pool->size > max_size) {
+		pooled = list_first_entry(&pool->buffers, struct lwis_pooled_buffer, node);
+		list_del(&pooled->node);
+		pool->size -= pooled->size;
+		WRITE_ONCE(pool->num_buffers, pool->num_buffers - 1);
+		dma_buf_put(pooled->dma_buf);
+		kfree(pooled);
+		freed++;
+	}
+	return freed;
+}
+
+static bool buffer_pool_accepts(struct lwis_buffer_pool *pool, size_t size, uint32_t flags)
+{
+	return pool && (flags & LWIS_DMA_BUFFER_UNINITIALIZED) &&
+	       !(flags & LWIS_DMA_SYSTEM_CACHE_RESERVATION) && size <= pool->max_size;
+}
+
+/* Takes a pooled buffer of the size and flags that nobody else refers to
+ * anymore, freed by the client or never handed out, returning the pool's
+ * reference to it. */
+static struct dma_buf *buffer_pool_take(struct lwis_buffer_pool *pool,
+					struct lwis_client *client, size_t size, uint32_t flags)
+{
+	struct lwis_pooled_buffer *pooled;
+	struct dma_buf *dma_buf = NULL;
+
+	if (!buffer_pool_accepts(pool, size, flags)) {
+		return NULL;
+	}
+
+	mutex_lock(&pool->lock);
+	list_for_each_entry (pooled, &pool->buffers, node) {
+		/* Userspace may still hold the fd of a freed buffer */
+		if (pooled->size == size && pooled->flags == flags &&
+		    (!pooled->owner || pooled->owner == client) &&
+		    file_count(pooled->dma_buf->file) == 1) {
+			dma_buf = pooled->dma_buf;
+			list_del(&pooled->node);
+			pool->size -= pooled->size;
+			WRITE_ONCE(pool->num_buffers, pool->num_buffers - 1);
+			kfree(pooled);
+			break;
+		}
+	}
+	mutex_unlock(&pool->lock);
+	return dma_buf;
+}
+
+/* Keeps a reference to a buffer freed by the client, or NULL if it was never
+ * handed out, in the pool, returns false if the pool does not take it. */
+static bool buffer_pool_put(struct lwis_buffer_pool *pool, struct lwis_client *client,
+			    struct dma_buf *dma_buf, size_t size, uint32_t flags)
+{
+	struct lwis_pooled_buffer *pooled;
+
+	if (!buffer_pool_accepts(pool, size, flags)) {
+		return false;
+	}
+	pooled = kmalloc(sizeof(struct lwis_pooled_buffer), GFP_KERNEL);
+	if (!pooled) {
+		return false;
+	}
+	pooled->dma_buf = dma_buf;
+	pooled->size = size;
+	pooled->flags = flags;
+	pooled->owner = client;
+
+	mutex_lock(&pool->lock);
+	buffer_pool_shrink(pool, pool->max_size - size);
+	list_add_tail(&pooled->node, &pool->buffers);
+	pool->size += size;
+	WRITE_ONCE(pool->num_buffers, pool->num_buffers + 1);
+	mutex_unlock(&pool->lock);
+	return true;
+}
+
+/* Releases the buffers the client freed into the pool */
+static void buffer_pool_client_release(struct lwis_buffer_pool *pool, struct lwis_client *client)
+{
+	struct lwis_pooled_buffer *pooled;
+	struct lwis_pooled_buffer *n;
+
+	if (!pool) {
+		return;
+	}
+	mutex_lock(&pool->lock);
+	list_for_each_entry_safe (pooled, n, &pool->buffers, node) {
+		if (pooled->owner != client) {
+			continue;
+		}
+		list_del(&pooled->node);
+		pool->size -= pooled->size;
+		WRITE_ONCE(pool->num_buffers, pool->num_buffers - 1);
+		dma_buf_put(pooled->dma_buf);
+		kfree(pooled);
+	}
+	mutex_unlock(&pool->lock);
+}
+
+static unsigned long buffer_pool_count_objects(struct shrinker *shrinker,
+					       struct shrink_control *sc)
+{
+	struct lwis_buffer_pool *pool = container_of(shrinker, struct lwis_buffer_pool, shrinker);
+
+	return READ_ONCE(pool->num_buffers);
+}
+
+static unsigned long buffer_pool_scan_objects(struct shrinker *shrinker,
+					      struct shrink_control *sc)
+{
+	struct lwis_buffer_pool *pool = container_of(shrinker, struct lwis_buffer_pool, shrinker);
+	struct lwis_pooled_buffer *pooled;
+	unsigned long freed = 0;
+
+	if (!mutex_trylock(&pool->lock)) {
+		return SHRINK_STOP;
+	}
+	while (freed < sc->nr_to_scan && !list_empty(&pool->buffers)) {
+		pooled = list_first_entry(&pool->buffers, struct lwis_pooled_buffer, node);
+		freed += buffer_pool_shrink(pool, pool->size - pooled->size);
+	}
+	mutex_unlock(&pool->lock);
+	return freed;
+}
+
+int lwis_buffer_pool_create(struct lwis_device *lwis_dev)
+{
+	struct lwis_buffer_pool *pool;
+	int ret;
+
+	if (lwis_dev->buffer_pool_kb == 0) {
+		return 0;
+	}
+
+	pool = kzalloc(sizeof(struct lwis_buffer_pool), GFP_KERNEL);
+	if (!pool) {
+		return -ENOMEM;
+	}
+	pool->lwis_dev = lwis_dev;
+	mutex_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->buffers);
+	pool->max_size = (size_t)lwis_dev->buffer_pool_kb * SZ_1K;
+	pool->shrinker.count_objects = buffer_pool_count_objects;
+	pool->shrinker.scan_objects = buffer_pool_scan_objects;
+	pool->shrinker.seeks = DEFAULT_SEEKS;
+	ret = register_shrinker(&pool->shrinker);
+	if (ret) {
+		pr_err("Failed to register buffer pool shrinker (%d)\n", ret);
+		kfree(pool);
+		return ret;
+	}
+	lwis_dev->buffer_pool = pool;
+	return 0;
+}
+
+void lwis_buffer_pool_destroy(struct lwis_device *lwis_dev)
+{
+	struct lwis_buffer_pool *pool = lwis_dev->buffer_pool;
+
+	if (!pool) {
+		return;
+	}
+	unregister_shrinker(&pool->shrinker);
+	mutex_lock(&pool->lock);
+	buffer_pool_shrink(pool, 0);
+	mutex_unlock(&pool->lock);
+	kfree(pool);
+	lwis_dev->buffer_pool = NULL;
+}
+
+int lwis_buffer_pool_prewarm(struct lwis_device *lwis_dev, size_t size, uint32_t flags,
+			     uint32_t count)
+{
+	struct lwis_buffer_pool *pool = lwis_dev->buffer_pool;
+	struct lwis_pooled_buffer *pooled;
+	struct dma_buf *dma_buf;
+	uint32_t num_pooled = 0;
+
+	size = PAGE_ALIGN(size);
+	if (!pool) {
+		dev_err(lwis_dev->dev, "No buffer pool to prewarm\n");
+		return -EOPNOTSUPP;
+	}
+	if (!buffer_pool_accepts(pool, size, flags) || size == 0 ||
+	    (size_t)count > pool->max_size / size) {
+		dev_err(lwis_dev->dev, "Cannot pool %u buffers of %zu bytes with flags 0x%x\n",
+			count, size, flags);
+		return -EINVAL;
+	}
+
+	/* Only allocate the buffers that are missing */
+	mutex_lock(&pool->lock);
+	list_for_each_entry (pooled, &pool->buffers, node) {
+		if (pooled->size == size && pooled->flags == flags && !pooled->owner) {
+			num_pooled++;
+		}
+	}
+	mutex_unlock(&pool->lock);
+
+	for (; num_pooled < count; ++num_pooled) {
+		dma_buf = lwis_platform_dma_buffer_alloc(size, flags);
+		if (IS_ERR_OR_NULL(dma_buf)) {
+			dev_err(lwis_dev->dev, "Failed to allocate buffer to prewarm the pool\n");
+			return -ENOMEM;
+		}
+		if (!buffer_pool_put(pool, NULL, dma_buf, size, flags)) {
+			dma_buf_put(dma_buf);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
 int lwis_buffer_alloc(struct lwis_client *lwis_client, struct lwis_alloc_buffer_info *alloc_info,
 		      struct lwis_allocated_buffer *buffer)
 {
 	struct dma_buf *dma_buf;
+	struct lwis_allocated_buffer *stale;
 	int ret = 0;
 
 	if (!lwis_client) {
@@ -81,7 +420,12 @@ int lwis_buffer_alloc(struct lwis_client *lwis_client, struct lwis_alloc_buffer_
 		}
 	} else {
 		alloc_info->size = PAGE_ALIGN(alloc_info->size);
-		dma_buf = lwis_platform_dma_buffer_alloc(alloc_info->size, alloc_info->flags);
+		dma_buf = buffer_pool_take(lwis_client->lwis_dev->buffer_pool, lwis_client,
+					   alloc_info->size, alloc_info->flags);
+		if (!dma_buf) {
+			dma_buf = lwis_platform_dma_buffer_alloc(alloc_info->size,
+								 alloc_info->flags);
+		}
 		if (IS_ERR_OR_NULL(dma_buf)) {
 			pr_err("lwis_platform_dma_buffer_alloc failed (%ld)\n", PTR_ERR(dma_buf));
 			return -ENOMEM;
@@ -106,8 +450,22 @@ int lwis_buffer_alloc(struct lwis_client *lwis_client, struct lwis_alloc_buffer_
 
 	buffer->fd = alloc_info->dma_fd;
 	buffer->size = alloc_info->size;
+	buffer->flags = alloc_info->flags;
 	buffer->dma_buf = dma_buf;
-	hash_add(lwis_client->allocated_buffers, &buffer->node, buffer->fd);
+	stale = xa_store(&lwis_client->allocated_buffers, buffer->fd, buffer, GFP_KERNEL);
+	if (xa_is_err(stale)) {
+		pr_err("Failed to index allocated buffer\n");
+		lwis_buffer_free(lwis_client, buffer);
+		return xa_err(stale);
+	}
+	/* The fd of an allocated buffer is only reused once userspace closed
+	 * it, so the buffer replaced could not be freed by fd anymore */
+	if (stale) {
+		if (lwis_client->lwis_dev->type != DEVICE_TYPE_SLC) {
+			lwis_buffer_free(lwis_client, stale);
+		}
+		kfree(stale);
+	}
 
 	return 0;
 }
@@ -130,10 +488,11 @@ int lwis_buffer_free(struct lwis_client *lwis_client, struct lwis_allocated_buff
 			pr_err("Unexpected NULL dma_buf\n");
 			return -EINVAL;
 		}
-	} else {
+	} else if (!buffer_pool_put(lwis_client->lwis_dev->buffer_pool, lwis_client,
+				    buffer->dma_buf, buffer->size, buffer->flags)) {
 		dma_buf_put(buffer->dma_buf);
 	}
-	hash_del(&buffer->node);
+	xa_cmpxchg(&lwis_client->allocated_buffers, buffer->fd, buffer, NULL, 0);
 	return 0;
 }
 
@@ -160,16 +519,6 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
 		return PTR_ERR(buffer->dma_buf);
 	}
 
-	buffer->dma_buf_attachment =
-		dma_buf_attach(buffer->dma_buf, &lwis_client->lwis_dev->plat_dev->dev);
-	if (IS_ERR_OR_NULL(buffer->dma_buf_attachment)) {
-		dev_err(lwis_client->lwis_dev->dev,
-			"Could not attach dma buffer for fd: %d (errno: %ld)", buffer->info.fd,
-			PTR_ERR(buffer->dma_buf_attachment));
-		dma_buf_put(buffer->dma_buf);
-		return PTR_ERR(buffer->dma_buf_attachment);
-	}
-
 	if (buffer->info.dma_read && buffer->info.dma_write) {
 		buffer->dma_direction = DMA_BIDIRECTIONAL;
 	} else if (buffer->info.dma_read) {
@@ -180,6 +529,21 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
 		buffer->dma_direction = DMA_NONE;
 	}
 
+	/* Skip attaching and mapping a buffer enrolled before */
+	if (buffer_cache_take(lwis_client, buffer)) {
+		goto mapped;
+	}
+
+	buffer->dma_buf_attachment =
+		dma_buf_attach(buffer->dma_buf, &lwis_client->lwis_dev->plat_dev->dev);
+	if (IS_ERR_OR_NULL(buffer->dma_buf_attachment)) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"Could not attach dma buffer for fd: %d (errno: %ld)", buffer->info.fd,
+			PTR_ERR(buffer->dma_buf_attachment));
+		dma_buf_put(buffer->dma_buf);
+		return PTR_ERR(buffer->dma_buf_attachment);
+	}
+
 	buffer->sg_table =
 		dma_buf_map_attachment(buffer->dma_buf_attachment, buffer->dma_direction);
 	if (IS_ERR_OR_NULL(buffer->sg_table)) {
@@ -191,6 +555,7 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
 		return PTR_ERR(buffer->sg_table);
 	}
 
+mapped:
 	buffer->info.dma_vaddr = sg_dma_address(buffer->sg_table->sgl);
 	if (IS_ERR_OR_NULL((void *)buffer->info.dma_vaddr)) {
 		dev_err(lwis_client->lwis_dev->dev, "Could not map dma vaddr for fd: %d",
@@ -218,6 +583,10 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
 
 	list_add_tail(&buffer->list_node, &enrollment_list->list);
 	buffer->enrollment_list = enrollment_list;
+	buffer->range_node.start = buffer->info.dma_vaddr;
+	buffer->range_node.last =
+		buffer->info.dma_vaddr + max_t(size_t, sg_table_dma_size(buffer->sg_table), 1) - 1;
+	interval_tree_insert(&buffer->range_node, &lwis_client->enrolled_buffer_ranges);
 
 	return 0;
 err:
@@ -239,12 +608,11 @@ int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_
 		return -EINVAL;
 	}
 
-	lwis_platform_dma_buffer_unmap(lwis_client->lwis_dev, buffer->dma_buf_attachment,
-				       buffer->info.dma_vaddr);
-	dma_buf_unmap_attachment(buffer->dma_buf_attachment, buffer->sg_table,
-				 buffer->dma_direction);
-	dma_buf_detach(buffer->dma_buf, buffer->dma_buf_attachment);
-	dma_buf_put(buffer->dma_buf);
+	if (!buffer_cache_put(lwis_client, buffer)) {
+		mapping_release(lwis_client, buffer->dma_buf, buffer->dma_buf_attachment,
+				buffer->sg_table, buffer->dma_direction, buffer->info.dma_vaddr);
+	}
+	interval_tree_remove(&buffer->range_node, &lwis_client->enrolled_buffer_ranges);
 	/* Delete the node from the hash table */
 	list_del(&buffer->list_node);
 	if (list_empty(&buffer->enrollment_list->list)) {
@@ -254,6 +622,93 @@ int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_
 	return 0;
 }
 
+/* Returns whether the client allocated or enrolled the dma-buf */
+static bool client_has_dma_buf(struct lwis_client *lwis_client, int fd, struct dma_buf *dma_buf)
+{
+	struct lwis_allocated_buffer *allocated;
+	struct lwis_buffer_enrollment_list *enrollment_list;
+	struct lwis_enrolled_buffer *enrolled;
+	int i;
+
+	allocated = lwis_client_allocated_buffer_find(lwis_client, fd);
+	if (allocated && allocated->dma_buf == dma_buf) {
+		return true;
+	}
+	hash_for_each (lwis_client->enrolled_buffers, i, enrollment_list, node) {
+		list_for_each_entry (enrolled, &enrollment_list->list, list_node) {
+			if (enrolled->dma_buf == dma_buf) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+struct dma_buf *lwis_client_dma_buf_get(struct lwis_client *lwis_client, int fd)
+{
+	struct dma_buf *dma_buf;
+
+	dma_buf = dma_buf_get(fd);
+	if (IS_ERR_OR_NULL(dma_buf)) {
+		pr_err("Could not get dma buffer for fd %d\n", fd);
+		return ERR_PTR(-EINVAL);
+	}
+	if (!client_has_dma_buf(lwis_client, fd, dma_buf)) {
+		pr_err("fd %d is neither allocated nor enrolled\n", fd);
+		dma_buf_put(dma_buf);
+		return ERR_PTR(-ENOENT);
+	}
+	return dma_buf;
+}
+
+int lwis_buffer_cpu_access(struct lwis_client *lwis_client, int fd, uint32_t flags, size_t offset,
+			   size_t length)
+{
+	struct dma_buf *dma_buf;
+	enum dma_data_direction direction;
+	int ret;
+
+	if (!lwis_client) {
+		pr_err("CPU access: LWIS client is NULL\n");
+		return -ENODEV;
+	}
+
+	switch (flags & (LWIS_BUFFER_SYNC_READ | LWIS_BUFFER_SYNC_WRITE)) {
+	case LWIS_BUFFER_SYNC_READ:
+		direction = DMA_FROM_DEVICE;
+		break;
+	case LWIS_BUFFER_SYNC_WRITE:
+		direction = DMA_TO_DEVICE;
+		break;
+	case LWIS_BUFFER_SYNC_READ | LWIS_BUFFER_SYNC_WRITE:
+		direction = DMA_BIDIRECTIONAL;
+		break;
+	default:
+		pr_err("CPU access: Invalid flags 0x%x\n", flags);
+		return -EINVAL;
+	}
+
+	dma_buf = lwis_client_dma_buf_get(lwis_client, fd);
+	if (IS_ERR(dma_buf)) {
+		return PTR_ERR(dma_buf);
+	}
+	if (length == 0 || offset >= dma_buf->size || length > dma_buf->size - offset) {
+		pr_err("CPU access: Range %zu+%zu outside of buffer of %zu bytes\n", offset,
+		       length, dma_buf->size);
+		ret = -EINVAL;
+		goto out;
+	}
+
+	if (flags & LWIS_BUFFER_SYNC_END) {
+		ret = dma_buf_end_cpu_access_partial(dma_buf, direction, offset, length);
+	} else {
+		ret = dma_buf_begin_cpu_access_partial(dma_buf, direction, offset, length);
+	}
+out:
+	dma_buf_put(dma_buf);
+	return ret;
+}
+
 struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find(struct lwis_client *lwis_client,
 							      int fd, dma_addr_t dma_vaddr)
 {
@@ -281,6 +736,29 @@ struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find(struct lwis_client
 	return NULL;
 }
 
+struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find_range(struct lwis_client *lwis_client,
+								    dma_addr_t dma_vaddr,
+								    size_t size)
+{
+	struct interval_tree_node *node;
+	unsigned long last = dma_vaddr + max_t(size_t, size, 1) - 1;
+
+	if (!lwis_client) {
+		pr_err("lwis_client_enrolled_buffer_find_range: LWIS client is NULL\n");
+		return NULL;
+	}
+
+	/* Enrollments of the same buffer may overlap, find one spanning the
+	 * whole range */
+	for (node = interval_tree_iter_first(&lwis_client->enrolled_buffer_ranges, dma_vaddr, last);
+	     node; node = interval_tree_iter_next(node, dma_vaddr, last)) {
+		if (node->start <= dma_vaddr && last <= node->last) {
+			return container_of(node, struct lwis_enrolled_buffer, range_node);
+		}
+	}
+	return NULL;
+}
+
 int lwis_client_enrolled_buffers_clear(struct lwis_client *lwis_client)
 {
 	/* Our hash table iterator */
@@ -311,42 +789,70 @@ int lwis_client_enrolled_buffers_clear(struct lwis_client *lwis_client)
 	return 0;
 }
 
+int lwis_client_buffer_cache_set(struct lwis_client *lwis_client, uint32_t max_mappings)
+{
+	int ret;
+
+	if (max_mappings > 0 && !lwis_client->buffer_cache_shrinker_registered) {
+		lwis_client->buffer_cache_shrinker.count_objects = buffer_cache_count_objects;
+		lwis_client->buffer_cache_shrinker.scan_objects = buffer_cache_scan_objects;
+		lwis_client->buffer_cache_shrinker.seeks = DEFAULT_SEEKS;
+		ret = register_shrinker(&lwis_client->buffer_cache_shrinker);
+		if (ret) {
+			dev_err(lwis_client->lwis_dev->dev,
+				"Failed to register buffer cache shrinker (%d)\n", ret);
+			return ret;
+		}
+		lwis_client->buffer_cache_shrinker_registered = true;
+	}
+	lwis_client->buffer_cache_max = max_mappings;
+	buffer_cache_shrink(lwis_client, max_mappings);
+	return 0;
+}
+
+void lwis_client_buffer_cache_clear(struct lwis_client *lwis_client)
+{
+	lwis_client->buffer_cache_max = 0;
+	buffer_cache_shrink(lwis_client, 0);
+	if (lwis_client->buffer_cache_shrinker_registered) {
+		unregister_shrinker(&lwis_client->buffer_cache_shrinker);
+		lwis_client->buffer_cache_shrinker_registered = false;
+	}
+}
+
 struct lwis_allocated_buffer *lwis_client_allocated_buffer_find(struct lwis_client *lwis_client,
 								int fd)
 {
-	struct lwis_allocated_buffer *p;
-
 	if (!lwis_client) {
 		pr_err("lwis_client_allocated_buffer_find: LWIS client is NULL\n");
 		return NULL;
 	}
 
-	hash_for_each_possible (lwis_client->allocated_buffers, p, node, fd) {
-		if (p->fd == fd) {
-			return p;
-		}
+	if (fd < 0) {
+		return NULL;
 	}
-	return NULL;
+	return xa_load(&lwis_client->allocated_buffers, fd);
 }
 
 int lwis_client_allocated_buffers_clear(struct lwis_client *lwis_client)
 {
 	struct lwis_allocated_buffer *buffer;
-	struct hlist_node *n;
-	int i;
+	unsigned long fd;
 
 	if (!lwis_client) {
 		pr_err("lwis_client_allocated_buffers_clear: LWIS client is NULL\n");
 		return -ENODEV;
 	}
 
-	hash_for_each_safe (lwis_client->allocated_buffers, i, n, buffer, node) {
+	xa_for_each (&lwis_client->allocated_buffers, fd, buffer) {
 		if (lwis_client->lwis_dev->type != DEVICE_TYPE_SLC) {
 			lwis_buffer_free(lwis_client, buffer);
 		} else {
-			hash_del(&buffer->node);
+			xa_erase(&lwis_client->allocated_buffers, fd);
 		}
 		kfree(buffer);
 	}
+	xa_destroy(&lwis_client->allocated_buffers);
+	buffer_pool_client_release(lwis_client->lwis_dev->buffer_pool, lwis_client);
 	return 0;
 }
@@ -14,6 +14,7 @@
 
 #include <linux/dma-buf.h>
 #include <linux/dma-direction.h>
+#include <linux/interval_tree.h>
 #include <linux/list.h>
 
 #include "lwis_commands.h"
@@ -27,13 +28,45 @@ struct lwis_enrolled_buffer {
 	struct sg_table *sg_table;
 	struct list_head list_node;
 	struct lwis_buffer_enrollment_list *enrollment_list;
+	/* Node in lwis_client->enrolled_buffer_ranges, spanning the DMA
+	 * addresses the sg_table maps */
+	struct interval_tree_node range_node;
 };
 
 struct lwis_allocated_buffer {
 	int fd;
 	size_t size;
+	uint32_t flags;
 	struct dma_buf *dma_buf;
-	struct hlist_node node;
+};
+
+/*
+ * Pool of the buffers freed by the clients of a device, reused by allocations
+ * of the same size and flags. Only LWIS_DMA_BUFFER_UNINITIALIZED buffers are
+ * pooled, since a reused buffer keeps its contents, and only reused by the
+ * client that freed them, so that no client reads the data of another.
+ */
+struct lwis_buffer_pool {
+	struct lwis_device *lwis_dev;
+	struct mutex lock;
+	/* Pooled buffers, least recently freed first */
+	struct list_head buffers;
+	int num_buffers;
+	size_t size;
+	/* High-water mark of size, the least recently freed buffers are
+	 * released past it */
+	size_t max_size;
+	/* Releases pooled buffers under memory pressure */
+	struct shrinker shrinker;
+};
+
+struct lwis_pooled_buffer {
+	struct dma_buf *dma_buf;
+	size_t size;
+	uint32_t flags;
+	/* Client that freed the buffer, NULL if it was never handed out */
+	struct lwis_client *owner;
+	struct list_head node;
 };
 
 struct lwis_buffer_enrollment_list {
@@ -42,6 +75,19 @@ struct lwis_buffer_enrollment_list {
 	struct hlist_node node;
 };
 
+/*
+ * Mapping of a disenrolled buffer kept for a later enrollment of the same
+ * dma_buf in the same direction. Holds a reference to the dma_buf.
+ */
+struct lwis_buffer_cached_mapping {
+	struct dma_buf *dma_buf;
+	enum dma_data_direction dma_direction;
+	struct dma_buf_attachment *dma_buf_attachment;
+	struct sg_table *sg_table;
+	/* Node in lwis_client->buffer_cache */
+	struct list_head node;
+};
+
 /*
  * lwis_buffer_alloc: Allocates a DMA buffer represented by alloc_info.
  *
@@ -61,6 +107,33 @@ int lwis_buffer_alloc(struct lwis_client *lwis_client, struct lwis_alloc_buffer_
  */
 int lwis_buffer_free(struct lwis_client *lwis_client, struct lwis_allocated_buffer *buffer);
 
+/*
+ * lwis_buffer_pool_create: Creates the buffer pool of the device if its
+ * device tree gave it a size.
+ *
+ * Alloc: Yes
+ * Returns: 0 on success
+ */
+int lwis_buffer_pool_create(struct lwis_device *lwis_dev);
+
+/*
+ * lwis_buffer_pool_destroy: Releases the pooled buffers and the pool of the
+ * device.
+ *
+ * Alloc: Free only
+ */
+void lwis_buffer_pool_destroy(struct lwis_device *lwis_dev);
+
+/*
+ * lwis_buffer_pool_prewarm: Allocates buffers into the pool of the device so
+ * that as many allocations of the given size and flags are served from it.
+ *
+ * Alloc: Yes
+ * Returns: 0 on success
+ */
+int lwis_buffer_pool_prewarm(struct lwis_device *lwis_dev, size_t size, uint32_t flags,
+			     uint32_t count);
+
 /*
  * lwis_buffer_enroll: Maps the DMA buffer represented by the file descriptor
  * passed in buffer->info.fd into IO space and adds the buffer object into
@@ -82,6 +155,18 @@ int lwis_buffer_enroll(struct lwis_client *lwis_client, struct lwis_enrolled_buf
  */
 int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_buffer *buffer);
 
+/*
+ * lwis_buffer_cpu_access: Begins or ends the CPU access to a byte range of a
+ * buffer the client allocated or enrolled, maintaining the caches over that
+ * range only
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: No
+ * Returns: 0 on success
+ */
+int lwis_buffer_cpu_access(struct lwis_client *lwis_client, int fd, uint32_t flags, size_t offset,
+			   size_t length);
+
 /*
  * lwis_client_enrolled_buffer_find: Finds the enrolled buffer based on
  * dma_vaddr passed, and returns it
@@ -93,6 +178,18 @@ int lwis_buffer_disenroll(struct lwis_client *lwis_client, struct lwis_enrolled_
 struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find(struct lwis_client *lwis_client,
 							      int fd, dma_addr_t dma_vaddr);
 
+/*
+ * lwis_client_enrolled_buffer_find_range: Finds an enrolled buffer whose
+ * mapping contains the size bytes from dma_vaddr, and returns it
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: No
+ * Returns: Pointer on success, NULL otherwise
+ */
+struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find_range(struct lwis_client *lwis_client,
+								    dma_addr_t dma_vaddr,
+								    size_t size);
+
 /*
  * lwis_client_enrolled_buffers_clear: Frees all items in
  * lwisclient->enrolled_buffers and clears the hash table. Used for client
@@ -104,6 +201,36 @@ struct lwis_enrolled_buffer *lwis_client_enrolled_buffer_find(struct lwis_client
  */
 int lwis_client_enrolled_buffers_clear(struct lwis_client *lwis_client);
 
+/*
+ * lwis_client_buffer_cache_set: Sets the number of buffer mappings the client
+ * keeps cached once disenrolled, 0 to disable the cache. The mappings over the
+ * new limit are released.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: No
+ * Returns: 0 on success
+ */
+int lwis_client_buffer_cache_set(struct lwis_client *lwis_client, uint32_t max_mappings);
+
+/*
+ * lwis_client_buffer_cache_clear: Releases all cached buffer mappings and
+ * disables the cache. Used for client shutdown only.
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: Free only
+ */
+void lwis_client_buffer_cache_clear(struct lwis_client *lwis_client);
+
+/*
+ * lwis_client_dma_buf_get: Gets a reference to the dma-buf of fd, provided
+ * the client allocated or enrolled it
+ *
+ * Assumes: lwisclient->lock is locked
+ * Alloc: No
+ * Returns: dma-buf on success, ERR_PTR otherwise
+ */
+struct dma_buf *lwis_client_dma_buf_get(struct lwis_client *lwis_client, int fd);
+
 /*
  * lwis_client_allocated_buffer_find: Finds the allocated buffer based on
  * file desciptor passed, and returns it
@@ -117,8 +244,8 @@ struct lwis_allocated_buffer *lwis_client_allocated_buffer_find(struct lwis_clie
 
 /*
  * lwis_client_allocated_buffers_clear: Frees all items in
- * lwisclient->allocated_buffers and clears the hash table. Used for client
- * shutdown only.
+ * lwisclient->allocated_buffers and empties it, and releases the buffers the
+ * client returned to the pool of the device. Used for client shutdown only.
  *
  * Assumes: lwisclient->lock is locked
  * Alloc: Free only
@@ -70,6 +70,23 @@ struct lwis_clk_setting {
 	uint32_t frequency;
 };
 
+struct lwis_qos_setting {
+	// Frequency in hz.
+	int64_t frequency_hz;
+	// Device id for this vote.
+	int32_t device_id;
+	// Target clock family.
+	int32_t clock_family;
+	// read BW
+	int64_t read_bw;
+	// write BW
+	int64_t write_bw;
+	// peak BW
+	int64_t peak_bw;
+	// RT BW (total peak)
+	int64_t rt_bw;
+};
+
 struct lwis_device_info {
 	int id;
 	int32_t type;
@@ -90,6 +107,9 @@ enum lwis_dma_alloc_flags {
 	LWIS_DMA_SYSTEM_CACHE_RESERVATION = 1UL << 3,
 	// Allocates a secure buffer.
 	LWIS_DMA_BUFFER_SECURE = 1UL << 4,
+	// Along with LWIS_DMA_SYSTEM_CACHE_RESERVATION, attaches the buffer to a
+	// partition already enabled for other shared buffers if one fits.
+	LWIS_DMA_SYSTEM_CACHE_SHARED = 1UL << 5,
 };
 
 struct lwis_alloc_buffer_info {
@@ -115,6 +135,119 @@ struct lwis_enrolled_buffer_info {
 	uint64_t dma_vaddr;
 };
 
+/*
+ * Buffers enrolled together with LWIS_BUFFER_ENROLL_BATCH. The dma_vaddr of
+ * each enrolled buffer is written back to its buffers element, and its error
+ * code to the matching errors element.
+ */
+struct lwis_buffer_enroll_batch {
+	// IOCTL Inputs
+	size_t num_buffers;
+	struct lwis_buffer_info *buffers;
+	// Optional, NULL if the per-buffer error codes are not needed
+	int32_t *errors;
+	// IOCTL Outputs
+	size_t num_enrolled;
+};
+
+/*
+ * Buffers disenrolled together with LWIS_BUFFER_DISENROLL_BATCH, the error code
+ * of each is written to the matching errors element.
+ */
+struct lwis_buffer_disenroll_batch {
+	// IOCTL Inputs
+	size_t num_buffers;
+	struct lwis_enrolled_buffer_info *buffers;
+	// Optional, NULL if the per-buffer error codes are not needed
+	int32_t *errors;
+	// IOCTL Outputs
+	size_t num_disenrolled;
+};
+
+struct lwis_slc_partition_info {
+	uint32_t size_kb;
+	// Partition id of the buffers attached to it, -1 when not enabled
+	int32_t partition_id;
+	uint32_t num_buffers;
+	uint32_t shared;
+	// Number of times the partition was enabled and total time enabled
+	uint32_t enable_count;
+	uint64_t enabled_ns;
+};
+
+/*
+ * SLC partition occupancy, on the SLC device
+ */
+struct lwis_slc_partition_query {
+	// IOCTL Inputs
+	size_t max_partitions;
+	struct lwis_slc_partition_info *partitions;
+	// IOCTL Outputs
+	// Number of partitions of the device, only the first max_partitions of
+	// which are written
+	size_t num_partitions;
+};
+
+enum lwis_buffer_sync_flags {
+	// CPU reads the range
+	LWIS_BUFFER_SYNC_READ = 1UL << 0,
+	// CPU writes the range
+	LWIS_BUFFER_SYNC_WRITE = 1UL << 1,
+	// Ends the CPU access, which begins without this flag
+	LWIS_BUFFER_SYNC_END = 1UL << 2,
+};
+
+struct lwis_buffer_sync_range {
+	// Allocated or enrolled buffer
+	int fd;
+	uint32_t flags; // lwis_buffer_sync_flags
+	size_t offset;
+	size_t length;
+};
+
+/*
+ * Cache maintenance on byte ranges of cached buffers, a cheaper alternative
+ * to DMA_BUF_IOCTL_SYNC when the CPU only accesses a part of a buffer
+ */
+struct lwis_buffer_sync {
+	// IOCTL Inputs
+	size_t num_ranges;
+	struct lwis_buffer_sync_range *ranges;
+	// IOCTL Outputs
+	// Number of ranges maintained, the failed one excluded
+	size_t num_synced;
+};
+
+struct lwis_buffer_pool_prewarm {
+	// IOCTL Inputs
+	size_t size;
+	uint32_t flags;
+	uint32_t count;
+};
+
+/*
+ * Group device enable, on the top device
+ *
+ * Enables the client behind each fd as LWIS_DEVICE_ENABLE would, overlapping
+ * the power sequence delays of the devices. Each device runs its own sequence
+ * in order, and starts it only once the device it depends on is enabled.
+ */
+struct lwis_device_enable_group_entry {
+	// File descriptor of the LWIS client to enable
+	int32_t fd;
+	// Index of an earlier entry that must be enabled first, or -1
+	int32_t depends_on;
+};
+
+struct lwis_device_enable_group {
+	// IOCTL Inputs
+	size_t num_entries;
+	struct lwis_device_enable_group_entry *entries;
+	// IOCTL Outputs
+	// Result of each entry, -ECANCELED if its dependency failed, may be NULL
+	int32_t *errors;
+};
+
 enum lwis_io_entry_types {
 	LWIS_IO_ENTRY_READ,
 	LWIS_IO_ENTRY_READ_BATCH,
@@ -122,7 +255,12 @@ enum lwis_io_entry_types {
 	LWIS_IO_ENTRY_WRITE_BATCH,
 	LWIS_IO_ENTRY_MODIFY,
 	LWIS_IO_ENTRY_POLL,
-	LWIS_IO_ENTRY_READ_ASSERT
+	LWIS_IO_ENTRY_READ_ASSERT,
+	LWIS_IO_ENTRY_POLL_US,
+	LWIS_IO_ENTRY_WRITE_SCATTER,
+	LWIS_IO_ENTRY_QOS,
+	LWIS_IO_ENTRY_READ_TO_BUFFER,
+	LWIS_IO_ENTRY_READ_ASSERT_SKIP
 };
 
 // For io_entry read and write types.
@@ -156,6 +294,68 @@ struct lwis_io_entry_read_assert {
 	uint64_t timeout_ms;
 };
 
+// For io_entry poll_us type. The register is re-read back to back for up to
+// spin_us, then every interval_us or, if wake_event_id is not
+// LWIS_EVENT_ID_NONE, every time the device emits that event, until it
+// matches or timeout_us elapsed. The event must be enabled by the client.
+struct lwis_io_entry_poll {
+	int bid;
+	uint64_t offset;
+	uint64_t val;
+	uint64_t mask;
+	uint64_t timeout_us;
+	// 0 for the default of 1ms
+	uint32_t interval_us;
+	// Capped by the driver
+	uint32_t spin_us;
+	int64_t wake_event_id;
+};
+
+// For io_entry write_scatter type. buf holds size_in_bytes / pair_size packed
+// (offset, value) pairs, where pair_size is the native address width plus the
+// native value width of the device in bytes. Both fields are in host order.
+struct lwis_io_entry_write_scatter {
+	int bid;
+	size_t size_in_bytes;
+	uint8_t *buf;
+};
+
+// For io_entry qos type. Only valid in transactions on the DPM device. The
+// bandwidth and clock vote is applied the same way as by LWIS_DPM_QOS_UPDATE
+// when the entry is processed, so that a transaction triggered by an event can
+// raise or drop a vote on a given frame. bid is unused.
+struct lwis_io_entry_qos {
+	int bid;
+	struct lwis_qos_setting setting;
+};
+
+// For io_entry read_to_buffer type. Only valid in transactions. Reads like
+// read_batch, but into the buffer fd, allocated or enrolled by the client, at
+// buf_offset instead of the response. The lwis_io_result of the entry in the
+// response only carries bid and offset, with num_value_bytes of 0. The data is
+// written through a kernel mapping of the buffer, so cached buffers need a CPU
+// access sync before being read.
+struct lwis_io_entry_read_to_buffer {
+	int bid;
+	uint64_t offset;
+	size_t size_in_bytes;
+	int fd;
+	size_t buf_offset;
+};
+
+// For io_entry read_assert_skip type. Only valid in transactions. Reads the
+// register once, and if (value & mask) != (val & mask), skips the next
+// num_skip entries of the transaction instead of failing it. The skipped
+// read entries have no lwis_io_result in the response, whose num_entries and
+// results_size_bytes only account for the entries that ran.
+struct lwis_io_entry_read_assert_skip {
+	int bid;
+	uint64_t offset;
+	uint64_t val;
+	uint64_t mask;
+	uint32_t num_skip;
+};
+
 struct lwis_io_entry {
 	int type;
 	union {
@@ -163,14 +363,81 @@ struct lwis_io_entry {
 		struct lwis_io_entry_rw_batch rw_batch;
 		struct lwis_io_entry_modify mod;
 		struct lwis_io_entry_read_assert read_assert;
+		struct lwis_io_entry_poll poll;
+		struct lwis_io_entry_write_scatter scatter;
+		struct lwis_io_entry_qos qos;
+		struct lwis_io_entry_read_to_buffer read_to_buffer;
+		struct lwis_io_entry_read_assert_skip read_assert_skip;
 	};
 };
 
+// Skip the writes to registers the device shadows as already holding the
+// value being written. Only devices with a register shadow skip any write.
+#define LWIS_IO_ENTRIES_FLAG_SKIP_UNCHANGED_WRITES (1U << 0)
+
 struct lwis_io_entries {
 	uint32_t num_io_entries;
+	// LWIS_IO_ENTRIES_FLAG_*, unused bits must be 0
+	uint32_t flags;
 	struct lwis_io_entry *io_entries;
 };
 
+// Handle of no uploaded io entries
+#define LWIS_IO_ENTRIES_HANDLE_NONE 0
+
+// IO entries uploaded with LWIS_IO_ENTRIES_UPLOAD, which transactions and
+// periodic ios then reference by handle instead of passing io_entries.
+struct lwis_io_entries_upload {
+	// Input
+	size_t num_io_entries;
+	struct lwis_io_entry *io_entries;
+	// Output
+	int64_t handle;
+};
+
+// Replaces the value of the WRITE or MODIFY entry at index of the uploaded
+// io entries for one submission.
+struct lwis_io_entry_patch {
+	uint32_t index;
+	uint64_t val;
+};
+
+// Header of a record streamed by the ioctl_trace debugfs file of a device,
+// which records the ioctls of the device clients while 1 is written to it.
+// The header is followed by payload_size bytes: the ioctl argument as it was
+// when the ioctl returned, then the arrays it points to, in order:
+// - Commands with io entries: the entries, then the write buffers of the
+//   entries that have one, in entry order. Transactions and periodic ios of
+//   uploaded io entries have their patches instead.
+//   The _V1 commands have struct lwis_io_entry_v1 entries.
+// - LWIS_TRANSACTION_SUBMIT_BATCH: the transaction infos, then the arrays of
+//   every transaction.
+// - LWIS_TRANSACTION_GROUP_SUBMIT: the members, then the arrays of every
+//   member transaction.
+// - LWIS_EVENT_CONTROL_SET: the event controls.
+// - LWIS_EVENT_EVENTFD_BIND: the event IDs.
+// - LWIS_EVENT_FILTER_SET: the event filters.
+// Pointers in the payload are the userspace ones of the recorded process.
+// Records are padded to size, a multiple of 8 bytes.
+struct lwis_ioctl_trace_record {
+	uint32_t size;
+	uint32_t cmd;
+	// Client of the device, numbered from 1 in order of first record
+	uint32_t client_id;
+	int32_t ret;
+	// Start of the ioctl, in the clock of LWIS_TIME_QUERY
+	int64_t start_timestamp_ns;
+	int64_t duration_ns;
+	uint32_t payload_size;
+	uint32_t flags;
+	// Records dropped since the previous one, as the trace was full
+	uint32_t num_dropped;
+	uint32_t reserved;
+};
+
+// The payload only has the ioctl argument, the arrays did not fit in a record
+#define LWIS_IOCTL_TRACE_RECORD_FLAG_TRUNCATED (1U << 0)
+
 struct lwis_echo {
 	size_t size;
 	const char *msg;
@@ -187,12 +454,17 @@ struct lwis_echo {
 #define LWIS_EVENT_ID_INVALID 0
 #define LWIS_EVENT_ID_HEARTBEAT 1
 #define LWIS_EVENT_ID_CLIENT_CLEANUP 2
+// Emitted once the device enable of LWIS_DEVICE_ENABLE_ASYNC completes, with
+// an int32_t error code as payload, 0 on success
+#define LWIS_EVENT_ID_DEVICE_ENABLED 3
 // ...
 // Error event defines
 #define LWIS_EVENT_ID_START_OF_ERROR_RANGE 2048
 #define LWIS_ERROR_EVENT_ID_MEMORY_PAGE_FAULT 2048
 #define LWIS_ERROR_EVENT_ID_SYSTEM_SUSPEND 2049
 #define LWIS_ERROR_EVENT_ID_EVENT_QUEUE_OVERFLOW 2050
+#define LWIS_ERROR_EVENT_ID_BANDWIDTH_OVER_BUDGET 2051
+#define LWIS_ERROR_EVENT_ID_TRANSACTION_DEADLINE_MISSED 2052
 // ...
 #define LWIS_EVENT_ID_START_OF_SPECIALIZED_RANGE 4096
 
@@ -220,6 +492,83 @@ struct lwis_event_info {
 	size_t payload_size;
 };
 
+/*
+ * Event ring
+ *
+ * Once set up with LWIS_EVENT_RING_SETUP, events that are queue-enabled are
+ * written into a ring buffer that userspace maps with mmap() at offset 0,
+ * instead of being queued for LWIS_EVENT_DEQUEUE. Error events are still
+ * delivered through LWIS_EVENT_DEQUEUE only.
+ *
+ * Userspace sets read_index to the number of events it consumed, and poll()
+ * reports the ring readable while write_index differs from it. Nothing else
+ * in the mapping is meant to be written by userspace.
+ *
+ * The driver never waits for userspace, older slots are overwritten when
+ * the reader falls behind. Event number n is held by slot n % num_slots, and
+ * the slot is valid when its sequence is n + 1. Readers should read the
+ * sequence before and after copying a slot and discard the copy if they
+ * differ. If the payload did not fit in a slot,
+ * LWIS_EVENT_RING_SLOT_FLAG_PAYLOAD_QUEUED is set and the full event is also
+ * queued for LWIS_EVENT_DEQUEUE.
+ */
+#define LWIS_EVENT_RING_SLOT_FLAG_PAYLOAD_QUEUED (1U << 0)
+
+struct lwis_event_ring_header {
+	// Number of events written into the ring so far
+	uint64_t write_index;
+	uint32_t num_slots;
+	// Size of each slot in bytes, including struct lwis_event_ring_slot
+	uint32_t slot_size;
+	// Offset in bytes of the first slot from the start of the mapping
+	uint32_t slots_offset;
+	uint32_t reserved;
+	// Written by userspace, number of events consumed so far
+	uint64_t read_index;
+};
+
+struct lwis_event_ring_slot {
+	uint64_t sequence;
+	int64_t event_id;
+	int64_t event_counter;
+	int64_t timestamp_ns;
+	uint32_t payload_size;
+	uint32_t flags;
+	uint8_t payload[];
+};
+
+struct lwis_event_ring_info {
+	// IOCTL Inputs
+	// Must be a power of 2
+	uint32_t num_slots;
+	uint32_t slot_payload_size;
+	// IOCTL Outputs
+	size_t mmap_size;
+};
+
+/*
+ * Batched event dequeue
+ *
+ * Fills event_infos with up to max_events events, error events first. The
+ * payloads are packed into payload_buffer, each one starting at an 8-byte
+ * aligned offset, and the payload_buffer of each event info points at its
+ * payload. If the payload of the first event does not fit, no event is
+ * dequeued, next_payload_size is set and -EAGAIN is returned, same as
+ * LWIS_EVENT_DEQUEUE. -ENOENT is returned if no event is pending.
+ */
+struct lwis_event_dequeue_batch {
+	// IOCTL Inputs
+	size_t max_events;
+	struct lwis_event_info *event_infos;
+	size_t payload_buffer_size;
+	void *payload_buffer;
+	// IOCTL Outputs
+	size_t num_events;
+	// Payload size of the first event left in the queue because the payload
+	// buffer is full, 0 otherwise
+	size_t next_payload_size;
+};
+
 #define LWIS_EVENT_CONTROL_FLAG_IRQ_ENABLE (1ULL << 0)
 #define LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE (1ULL << 1)
 
@@ -235,10 +584,98 @@ struct lwis_event_control_list {
 	struct lwis_event_control *event_controls;
 };
 
+// The bound events are signaled on the eventfd, but not queued
+#define LWIS_EVENT_EVENTFD_FLAG_NOTIFY_ONLY (1U << 0)
+
+// Binds events of the client to an eventfd, or unbinds them if fd is -1.
+// Emitting a bound event that has LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE set
+// adds 1 to the eventfd counter instead of waking up the pollers of the
+// client, so that a thread can wait for its own events only.
+struct lwis_event_eventfd_binding {
+	// IOCTL Inputs
+	int32_t fd;
+	// LWIS_EVENT_EVENTFD_FLAG_*, unused bits must be 0
+	uint32_t flags;
+	// At most 256, either all the events are bound or none is
+	size_t num_event_ids;
+	int64_t *event_ids;
+};
+
+// Delivers every occurrence, the default
+#define LWIS_EVENT_FILTER_NONE 0
+// Delivers one of every divisor occurrences received by the client
+#define LWIS_EVENT_FILTER_EVERY_NTH 1
+// Delivers the occurrences whose event counter modulo divisor is remainder
+#define LWIS_EVENT_FILTER_COUNTER_MODULO 2
+// Keeps the latest occurrence only: an occurrence replaces the one still
+// queued, so at most one is pending between dequeues. These occurrences are
+// always queued, rather than written to the event ring.
+#define LWIS_EVENT_FILTER_LATEST 3
+
+// Filters the occurrences of an event delivered to the client, which has
+// LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE set on it. Filtered out occurrences
+// are neither queued nor signaled on a bound eventfd, but the transactions
+// they trigger are still run on every occurrence.
+struct lwis_event_filter {
+	// IOCTL Inputs
+	int64_t event_id;
+	// LWIS_EVENT_FILTER_*
+	uint32_t mode;
+	// Used by LWIS_EVENT_FILTER_EVERY_NTH and LWIS_EVENT_FILTER_COUNTER_MODULO
+	uint32_t divisor;
+	// Used by LWIS_EVENT_FILTER_COUNTER_MODULO, less than divisor
+	uint32_t remainder;
+	// Must be 0
+	uint32_t reserved;
+};
+
+struct lwis_event_filter_list {
+	// At most 256
+	size_t num_event_filters;
+	struct lwis_event_filter *event_filters;
+};
+
+// Record of an emitted device event, as streamed by the event_history debugfs
+// file of the device. Reads block until records are available, unless the
+// file is opened with O_NONBLOCK, and return whole records. Records of the
+// same CPU are in emission order, the CPUs are merged by timestamp_ns.
+struct lwis_event_history_record {
+	int64_t event_id;
+	int64_t event_counter;
+	int64_t timestamp_ns;
+	// CPU the event was emitted on
+	uint32_t cpu;
+	// Records of this CPU overwritten before the reader could read them,
+	// since its previous record
+	uint32_t num_dropped;
+};
+
 // Invalid ID for Transaction id and Periodic IO id
 #define LWIS_ID_INVALID (-1LL)
 #define LWIS_EVENT_COUNTER_ON_NEXT_OCCURRENCE (-1LL)
+// Repeating transactions have at most 8 iterations in flight, or the
+// transaction-instance-pool-size of the device tree node of the device. The
+// triggers occurring meanwhile are dropped, each emitting the error event of
+// the transaction with error_code -ENOSPC and completion_index -1
 #define LWIS_EVENT_COUNTER_EVERY_TIME (-2LL)
+
+// Conditions on the completion of the parent transaction for a chained
+// transaction to run
+#define LWIS_TRANSACTION_CHAIN_NONE 0
+#define LWIS_TRANSACTION_CHAIN_ON_SUCCESS 1
+#define LWIS_TRANSACTION_CHAIN_ON_ERROR 2
+#define LWIS_TRANSACTION_CHAIN_ALWAYS 3
+// Longest chain of transactions, the first one included
+#define LWIS_TRANSACTION_CHAIN_MAX_DEPTH 8
+
+// Cancels the transaction with -ETIME instead of running it late
+#define LWIS_TRANSACTION_DEADLINE_FLAG_DROP (1U << 0)
+
+// Second layout of the transaction info. It takes all the fields added since
+// struct lwis_transaction_info_v1 at once, from skip_unchanged_writes to
+// deadline_flags, and changes size only with a new version. Binaries built
+// against the first layout use LWIS_TRANSACTION_SUBMIT_V1 and
+// LWIS_TRANSACTION_REPLACE_V1.
 struct lwis_transaction_info {
 	// Input
 	int64_t trigger_event_id;
@@ -246,10 +683,34 @@ struct lwis_transaction_info {
 	size_t num_io_entries;
 	struct lwis_io_entry *io_entries;
 	bool run_in_event_context;
+	// Runs on the real-time worker of the device, if its device tree node
+	// sets rt-worker, instead of the normal priority worker of the client
 	bool run_at_real_time;
 	int64_t emit_success_event_id;
 	int64_t emit_error_event_id;
 	bool allow_counter_eq;
+	// Same as LWIS_IO_ENTRIES_FLAG_SKIP_UNCHANGED_WRITES
+	bool skip_unchanged_writes;
+	// If not LWIS_IO_ENTRIES_HANDLE_NONE, the uploaded io entries to run
+	// instead of num_io_entries and io_entries, with the patched values
+	int64_t io_entries_handle;
+	size_t num_patches;
+	struct lwis_io_entry_patch *patches;
+	// If not LWIS_TRANSACTION_CHAIN_NONE, the transaction is not triggered by
+	// an event, trigger_event_id being LWIS_EVENT_ID_NONE, but runs right
+	// after the transaction chain_parent_id completes, in the same context,
+	// if its outcome matches chain_condition. It is cancelled otherwise, or
+	// if its parent is. The parent must be waiting for its trigger event, and
+	// not be a LWIS_EVENT_COUNTER_EVERY_TIME transaction.
+	uint32_t chain_condition;
+	int64_t chain_parent_id;
+	// If not 0, the transaction is to start within deadline_us of its
+	// trigger, or of its submission if immediate. The transactions deferred
+	// to the workers run earliest deadline first, the ones without deadline
+	// last. Starting late emits LWIS_ERROR_EVENT_ID_TRANSACTION_DEADLINE_MISSED.
+	uint32_t deadline_us;
+	// LWIS_TRANSACTION_DEADLINE_FLAG_*, unused bits must be 0
+	uint32_t deadline_flags;
 	// Output
 	int64_t id;
 	// Only will be set if trigger_event_id is specified.
@@ -258,6 +719,58 @@ struct lwis_transaction_info {
 	int64_t submission_timestamp_ns;
 };
 
+/*
+ * Transactions submitted together with LWIS_TRANSACTION_SUBMIT_BATCH, at most
+ * 64. They are all queued under one lock acquisition, so no trigger is
+ * processed between two of them. Either all of them are submitted, or none is
+ * and the ioctl fails with the error of the first failing one, found in the
+ * matching errors element, the other elements being -ECANCELED. The outputs
+ * of each transaction are written back to its transaction_infos element, with
+ * id set to LWIS_ID_INVALID if the batch was not submitted.
+ */
+struct lwis_transaction_submit_batch {
+	// IOCTL Inputs
+	size_t num_transactions;
+	struct lwis_transaction_info *transaction_infos;
+	// Optional, NULL if the per-transaction error codes are not needed
+	int32_t *errors;
+	// IOCTL Outputs
+	// num_transactions, or 0 if the batch was not submitted
+	size_t num_submitted;
+};
+
+// Most devices a transaction group spans
+#define LWIS_TRANSACTION_GROUP_MAX_MEMBERS 8
+
+// Transaction of a group, run by the LWIS device client fd refers to.
+struct lwis_transaction_group_member {
+	int32_t fd;
+	int32_t reserved;
+	// The trigger_event_id and trigger_event_counter of the info are the ones
+	// of the group. Members cannot be chained, nor be repeating.
+	struct lwis_transaction_info info;
+};
+
+/*
+ * Transactions of several devices submitted with LWIS_TRANSACTION_GROUP_SUBMIT
+ * on the top device, which are all triggered by the same event occurrence.
+ * The trigger counter of every member is checked under the locks of all the
+ * member clients, so the group is either queued as a whole or not at all. Once
+ * triggered, each member runs on its own device as any other transaction,
+ * emitting its own events, and emit_event_id is emitted by the top device
+ * with a struct lwis_transaction_group_response once all of them completed.
+ * The outputs of each member are written back to its info.
+ */
+struct lwis_transaction_group_submit {
+	// IOCTL Inputs
+	int64_t trigger_event_id;
+	int64_t trigger_event_counter;
+	// LWIS_EVENT_ID_NONE if the completion of the group is not needed
+	int64_t emit_event_id;
+	size_t num_members;
+	struct lwis_transaction_group_member *members;
+};
+
 // Actual size of this struct depends on num_entries
 struct lwis_transaction_response_header {
 	int64_t id;
@@ -274,6 +787,27 @@ struct lwis_io_result {
 	uint8_t values[];
 };
 
+/*
+ * Periodic IO flags
+ *
+ * By default, periods that expire while the timer interrupt is held off are
+ * skipped and only counted in missed_periods of the response header. With
+ * LWIS_PERIODIC_IO_FLAG_ABSOLUTE_DEADLINE the periodic io runs once for every
+ * deadline that passed, so the N-th period of the periodic io always belongs
+ * to the N-th deadline since submission. missed_periods then counts the
+ * periods that ran late.
+ */
+#define LWIS_PERIODIC_IO_FLAG_ABSOLUTE_DEADLINE (1U << 0)
+/*
+ * With LWIS_PERIODIC_IO_FLAG_RING the results of every period are written as
+ * one record into the periodic io ring of the client, which must have been set
+ * up with LWIS_PERIODIC_IO_RING_SETUP, instead of being copied into the event
+ * payload. The success and error events then carry the response header only,
+ * with results_size_bytes set to 0 and the range of ring offsets holding the
+ * records written since the previous response.
+ */
+#define LWIS_PERIODIC_IO_FLAG_RING (1U << 1)
+
 struct lwis_periodic_io_info {
 	// Input
 	int batch_size;
@@ -282,6 +816,11 @@ struct lwis_periodic_io_info {
 	struct lwis_io_entry *io_entries;
 	int64_t emit_success_event_id;
 	int64_t emit_error_event_id;
+	uint32_t flags;
+	// Same as in lwis_transaction_info
+	int64_t io_entries_handle;
+	size_t num_patches;
+	struct lwis_io_entry_patch *patches;
 	// Output
 	int64_t id;
 };
@@ -294,6 +833,14 @@ struct lwis_periodic_io_response_header {
 	int batch_size;
 	size_t num_entries_per_period;
 	size_t results_size_bytes;
+	// Number of periods missed since the previous response. With
+	// LWIS_PERIODIC_IO_FLAG_RING this includes the periods dropped because
+	// the ring was full.
+	int64_t missed_periods;
+	// Range [ring_start_offset, ring_end_offset) of the periodic io ring
+	// written since the previous response, with LWIS_PERIODIC_IO_FLAG_RING
+	uint64_t ring_start_offset;
+	uint64_t ring_end_offset;
 };
 
 struct lwis_periodic_io_result {
@@ -301,28 +848,62 @@ struct lwis_periodic_io_result {
 	struct lwis_io_result io_result;
 };
 
+/*
+ * Periodic IO ring
+ *
+ * A ring shared by all the periodic ios of a client submitted with
+ * LWIS_PERIODIC_IO_FLAG_RING, mapped by userspace with mmap() at the
+ * mmap_offset returned by LWIS_PERIODIC_IO_RING_SETUP. The mapping starts with
+ * struct lwis_periodic_io_ring_header, and data_size bytes of records start at
+ * data_offset.
+ *
+ * write_offset and read_offset count the bytes written and consumed since the
+ * ring was set up, the record at offset n starts at byte n % data_size of the
+ * data. The driver advances write_offset after the records are written and
+ * userspace advances read_offset once it is done with them. Periods that do
+ * not fit in the space left are dropped and counted as missed.
+ *
+ * Records never wrap around the end of the data. A record with
+ * LWIS_PERIODIC_IO_RING_RECORD_FLAG_PADDING fills the end of the data when the
+ * next record does not fit there, and readers skip to the start of the data if
+ * the space left before its end is smaller than a record header.
+ */
+#define LWIS_PERIODIC_IO_RING_RECORD_FLAG_PADDING (1U << 0)
+
+struct lwis_periodic_io_ring_header {
+	// Written by the driver
+	uint64_t write_offset;
+	// Written by userspace
+	uint64_t read_offset;
+	uint32_t data_size;
+	uint32_t data_offset;
+};
+
+// One period of one periodic io, holding num_entries_per_period pairs of
+// lwis_periodic_io_result and its values
+struct lwis_periodic_io_ring_record {
+	int64_t id;
+	// Size in bytes of the record including this header, multiple of 8
+	uint32_t size;
+	uint32_t flags;
+	uint8_t results[];
+};
+
+struct lwis_periodic_io_ring_info {
+	// IOCTL Inputs
+	// Must be a power of 2
+	uint32_t data_size;
+	uint32_t reserved;
+	// IOCTL Outputs
+	size_t mmap_size;
+	uint64_t mmap_offset;
+};
+
 struct lwis_dpm_clk_settings {
 	struct lwis_clk_setting *settings;
 	size_t num_settings;
 };
 
-struct lwis_qos_setting {
-	// Frequency in hz.
-	int64_t frequency_hz;
-	// Device id for this vote.
-	int32_t device_id;
-	// Target clock family.
-	int32_t clock_family;
-	// read BW
-	int64_t read_bw;
-	// write BW
-	int64_t write_bw;
-	// peak BW
-	int64_t peak_bw;
-	// RT BW (total peak)
-	int64_t rt_bw;
-};
-
 struct lwis_dpm_qos_requirements {
 	// qos entities from user.
 	struct lwis_qos_setting *qos_settings;
@@ -330,6 +911,70 @@ struct lwis_dpm_qos_requirements {
 	size_t num_settings;
 };
 
+/*
+ * First version layouts
+ *
+ * The structures of the first version of the interface, taken by the _V1
+ * IOCTLs at the command values that binaries built against it still issue.
+ * Their fields mean the same as in the current structures, the fields added
+ * since then take their default values.
+ */
+
+// Only holds the io_entry types up to LWIS_IO_ENTRY_READ_ASSERT
+struct lwis_io_entry_v1 {
+	int type;
+	union {
+		struct lwis_io_entry_rw rw;
+		struct lwis_io_entry_rw_batch rw_batch;
+		struct lwis_io_entry_modify mod;
+		struct lwis_io_entry_read_assert read_assert;
+	};
+};
+
+struct lwis_io_entries_v1 {
+	uint32_t num_io_entries;
+	struct lwis_io_entry_v1 *io_entries;
+};
+
+struct lwis_periodic_io_info_v1 {
+	// Input
+	int batch_size;
+	int64_t period_ns;
+	size_t num_io_entries;
+	struct lwis_io_entry_v1 *io_entries;
+	int64_t emit_success_event_id;
+	int64_t emit_error_event_id;
+	// Output
+	int64_t id;
+};
+
+struct lwis_transaction_info_v1 {
+	// Input
+	int64_t trigger_event_id;
+	int64_t trigger_event_counter;
+	size_t num_io_entries;
+	struct lwis_io_entry_v1 *io_entries;
+	bool run_in_event_context;
+	bool run_at_real_time;
+	int64_t emit_success_event_id;
+	int64_t emit_error_event_id;
+	bool allow_counter_eq;
+	// Output
+	int64_t id;
+	int64_t current_trigger_event_counter;
+	int64_t submission_timestamp_ns;
+};
+
+// Responses of periodic ios submitted with LWIS_PERIODIC_IO_SUBMIT_V1 start
+// with this header instead of struct lwis_periodic_io_response_header
+struct lwis_periodic_io_response_header_v1 {
+	int64_t id;
+	int error_code;
+	int batch_size;
+	size_t num_entries_per_period;
+	size_t results_size_bytes;
+};
+
 /*
  *  IOCTL Commands
  */
@@ -340,29 +985,71 @@ struct lwis_dpm_qos_requirements {
 #define LWIS_BUFFER_ENROLL _IOWR(LWIS_IOC_TYPE, 2, struct lwis_buffer_info)
 #define LWIS_BUFFER_DISENROLL _IOWR(LWIS_IOC_TYPE, 3, struct lwis_enrolled_buffer_info)
 #define LWIS_DEVICE_ENABLE _IO(LWIS_IOC_TYPE, 6)
+// The device reads as disabled on return, but is only powered down once its
+// LWIS_DEVICE_POWER_DOWN_DELAY elapses, if set, and power down errors are then
+// only logged
 #define LWIS_DEVICE_DISABLE _IO(LWIS_IOC_TYPE, 7)
+#define LWIS_DEVICE_ENABLE_GROUP _IOWR(LWIS_IOC_TYPE, 14, struct lwis_device_enable_group)
+// Time in ms the device stays powered up once disabled by its last client, so
+// enabling it again skips the power up, 0 to power down right away
+#define LWIS_DEVICE_POWER_DOWN_DELAY _IOW(LWIS_IOC_TYPE, 15, uint32_t)
+// Same as LWIS_DEVICE_ENABLE without waiting for the power up, which emits
+// LWIS_EVENT_ID_DEVICE_ENABLED on completion. Immediate transactions submitted
+// meanwhile run once the device is enabled.
+#define LWIS_DEVICE_ENABLE_ASYNC _IO(LWIS_IOC_TYPE, 16)
+// Number of buffer mappings kept once disenrolled, so that enrolling the same
+// dma-buf again in the same direction skips mapping it, 0 (the default) to
+// keep none. Cached mappings hold their buffer until released, least recently
+// disenrolled first, under memory pressure or when the client is closed.
+#define LWIS_BUFFER_ENROLL_CACHE _IOW(LWIS_IOC_TYPE, 17, uint32_t)
+#define LWIS_BUFFER_ENROLL_BATCH _IOWR(LWIS_IOC_TYPE, 18, struct lwis_buffer_enroll_batch)
+#define LWIS_BUFFER_DISENROLL_BATCH _IOWR(LWIS_IOC_TYPE, 19, struct lwis_buffer_disenroll_batch)
 #define LWIS_BUFFER_ALLOC _IOWR(LWIS_IOC_TYPE, 8, struct lwis_alloc_buffer_info)
 #define LWIS_BUFFER_FREE _IOWR(LWIS_IOC_TYPE, 9, int)
+// Fills the buffer pool of the device, which LWIS_BUFFER_FREE returns
+// LWIS_DMA_BUFFER_UNINITIALIZED buffers to, so that as many LWIS_BUFFER_ALLOC
+// of the given size and flags are served without allocating. A freed buffer
+// is only reused by the client that freed it, and released once it is closed.
+#define LWIS_BUFFER_POOL_PREWARM _IOW(LWIS_IOC_TYPE, 4, struct lwis_buffer_pool_prewarm)
+#define LWIS_SLC_PARTITION_QUERY _IOWR(LWIS_IOC_TYPE, 5, struct lwis_slc_partition_query)
+#define LWIS_BUFFER_SYNC _IOWR(LWIS_IOC_TYPE, 80, struct lwis_buffer_sync)
 #define LWIS_TIME_QUERY _IOWR(LWIS_IOC_TYPE, 10, int64_t)
-#define LWIS_REG_IO _IOWR(LWIS_IOC_TYPE, 11, struct lwis_io_entries)
+// The first version of LWIS_REG_IO and LWIS_DEVICE_RESET took 11 and 13
+#define LWIS_REG_IO _IOWR(LWIS_IOC_TYPE, 70, struct lwis_io_entries)
 #define LWIS_ECHO _IOWR(LWIS_IOC_TYPE, 12, struct lwis_echo)
-#define LWIS_DEVICE_RESET _IOWR(LWIS_IOC_TYPE, 13, struct lwis_io_entries)
+#define LWIS_DEVICE_RESET _IOWR(LWIS_IOC_TYPE, 71, struct lwis_io_entries)
 
 #define LWIS_EVENT_CONTROL_GET _IOWR(LWIS_IOC_TYPE, 20, struct lwis_event_control)
 #define LWIS_EVENT_CONTROL_SET _IOW(LWIS_IOC_TYPE, 21, struct lwis_event_control_list)
 #define LWIS_EVENT_DEQUEUE _IOWR(LWIS_IOC_TYPE, 22, struct lwis_event_info)
+#define LWIS_EVENT_RING_SETUP _IOWR(LWIS_IOC_TYPE, 23, struct lwis_event_ring_info)
+#define LWIS_EVENT_DEQUEUE_BATCH _IOWR(LWIS_IOC_TYPE, 24, struct lwis_event_dequeue_batch)
+#define LWIS_EVENT_EVENTFD_BIND _IOW(LWIS_IOC_TYPE, 25, struct lwis_event_eventfd_binding)
+#define LWIS_EVENT_FILTER_SET _IOW(LWIS_IOC_TYPE, 26, struct lwis_event_filter_list)
 
 #define LWIS_TRANSACTION_SUBMIT _IOWR(LWIS_IOC_TYPE, 30, struct lwis_transaction_info)
 #define LWIS_TRANSACTION_CANCEL _IOWR(LWIS_IOC_TYPE, 31, int64_t)
 #define LWIS_TRANSACTION_REPLACE _IOWR(LWIS_IOC_TYPE, 32, struct lwis_transaction_info)
+#define LWIS_IO_ENTRIES_UPLOAD _IOWR(LWIS_IOC_TYPE, 33, struct lwis_io_entries_upload)
+#define LWIS_IO_ENTRIES_RELEASE _IOWR(LWIS_IOC_TYPE, 34, int64_t)
+#define LWIS_TRANSACTION_SUBMIT_BATCH _IOWR(LWIS_IOC_TYPE, 35, struct lwis_transaction_submit_batch)
+#define LWIS_TRANSACTION_GROUP_SUBMIT _IOWR(LWIS_IOC_TYPE, 36, struct lwis_transaction_group_submit)
 
 #define LWIS_PERIODIC_IO_SUBMIT _IOWR(LWIS_IOC_TYPE, 40, struct lwis_periodic_io_info)
 #define LWIS_PERIODIC_IO_CANCEL _IOWR(LWIS_IOC_TYPE, 41, int64_t)
+#define LWIS_PERIODIC_IO_RING_SETUP _IOWR(LWIS_IOC_TYPE, 42, struct lwis_periodic_io_ring_info)
 
 #define LWIS_DPM_CLK_UPDATE _IOW(LWIS_IOC_TYPE, 50, struct lwis_dpm_clk_settings)
 #define LWIS_DPM_QOS_UPDATE _IOW(LWIS_IOC_TYPE, 51, struct lwis_dpm_qos_requirements)
 #define LWIS_DPM_GET_CLOCK _IOW(LWIS_IOC_TYPE, 52, struct lwis_qos_setting)
 
+// First version layouts, see above
+#define LWIS_REG_IO_V1 _IOWR(LWIS_IOC_TYPE, 11, struct lwis_io_entries_v1)
+#define LWIS_DEVICE_RESET_V1 _IOWR(LWIS_IOC_TYPE, 13, struct lwis_io_entries_v1)
+#define LWIS_PERIODIC_IO_SUBMIT_V1 _IOWR(LWIS_IOC_TYPE, 40, struct lwis_periodic_io_info_v1)
+#define LWIS_TRANSACTION_SUBMIT_V1 _IOWR(LWIS_IOC_TYPE, 30, struct lwis_transaction_info_v1)
+#define LWIS_TRANSACTION_REPLACE_V1 _IOWR(LWIS_IOC_TYPE, 32, struct lwis_transaction_info_v1)
+
 /*
  * Event payloads
  */
@@ -373,6 +1060,38 @@ struct lwis_mem_page_fault_event_payload {
 	uint64_t fault_flags;
 };
 
+/* For LWIS_ERROR_EVENT_ID_BANDWIDTH_OVER_BUDGET, emitted by the top device.
+ * Bandwidths are in KB/s, ordered as peak, read, write and rt. */
+struct lwis_bandwidth_over_budget_event_payload {
+	// Device whose bandwidth request exceeded the budget
+	int32_t device_id;
+	// Nonzero if the request was rejected because the budget is enforced
+	int32_t rejected;
+	// Pipeline totals including the request
+	uint64_t total[4];
+	// Pipeline budget, 0 for the unlimited ones
+	uint64_t budget[4];
+};
+
+/* For LWIS_ERROR_EVENT_ID_TRANSACTION_DEADLINE_MISSED */
+struct lwis_transaction_deadline_missed_event_payload {
+	int64_t id;
+	// Time between the deadline and the start of the transaction
+	int64_t lateness_ns;
+	// Nonzero if the transaction was cancelled with -ETIME rather than run
+	int32_t dropped;
+	int32_t reserved;
+};
+
+/* For the emit_event_id of LWIS_TRANSACTION_GROUP_SUBMIT, in member order */
+struct lwis_transaction_group_response {
+	uint32_t num_members;
+	uint32_t reserved;
+	int64_t ids[LWIS_TRANSACTION_GROUP_MAX_MEMBERS];
+	// Error code of the response of each member, -ECANCELED if cancelled
+	int32_t error_codes[LWIS_TRANSACTION_GROUP_MAX_MEMBERS];
+};
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif /* __cplusplus */
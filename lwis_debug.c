@@ -12,12 +12,16 @@
 #include <linux/fs.h>
 #include <linux/hashtable.h>
 #include <linux/list.h>
+#include <linux/mutex.h>
+#include <linux/sort.h>
 #include <linux/string.h>
+#include <linux/uaccess.h>
 
 #include "lwis_buffer.h"
 #include "lwis_debug.h"
 #include "lwis_device.h"
 #include "lwis_event.h"
+#include "lwis_ioctl_trace.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
 
@@ -42,6 +46,20 @@ static void print_to_log(char *buffer)
 	}
 }
 
+static void print_transaction(struct lwis_transaction *transaction, char *tmp_buf,
+			      size_t tmp_buf_size, char *k_buf, size_t k_buf_size)
+{
+	scnprintf(tmp_buf, tmp_buf_size,
+		  "ID: 0x%llx Trigger Event: 0x%llx Count: 0x%llx Submitted: %lld\n",
+		  transaction->info.id, transaction->info.trigger_event_id,
+		  transaction->info.trigger_event_counter,
+		  transaction->info.submission_timestamp_ns);
+	strlcat(k_buf, tmp_buf, k_buf_size);
+	scnprintf(tmp_buf, tmp_buf_size, "  Emit Success: 0x%llx Error: %llx\n",
+		  transaction->info.emit_success_event_id, transaction->info.emit_error_event_id);
+	strlcat(k_buf, tmp_buf, k_buf_size);
+}
+
 static void list_transactions(struct lwis_client *client, char *k_buf, size_t k_buf_size)
 {
 	/* Temporary buffer to be concatenated to the main buffer. */
@@ -60,7 +78,8 @@ static void list_transactions(struct lwis_client *client, char *k_buf, size_t k_
 	}
 	strlcat(k_buf, "Pending Transactions:\n", k_buf_size);
 	hash_for_each (client->transaction_list, i, transaction_list, node) {
-		if (list_empty(&transaction_list->list)) {
+		if (list_empty(&transaction_list->list) &&
+		    list_empty(&transaction_list->counter_list)) {
 			scnprintf(tmp_buf, sizeof(tmp_buf),
 				  "No pending transaction for event 0x%llx\n",
 				  transaction_list->event_id);
@@ -69,17 +88,11 @@ static void list_transactions(struct lwis_client *client, char *k_buf, size_t k_
 		}
 		list_for_each (it_tran, &transaction_list->list) {
 			transaction = list_entry(it_tran, struct lwis_transaction, event_list_node);
-			scnprintf(
-				tmp_buf, sizeof(tmp_buf),
-				"ID: 0x%llx Trigger Event: 0x%llx Count: 0x%llx Submitted: %lld\n",
-				transaction->info.id, transaction->info.trigger_event_id,
-				transaction->info.trigger_event_counter,
-				transaction->info.submission_timestamp_ns);
-			strlcat(k_buf, tmp_buf, k_buf_size);
-			scnprintf(tmp_buf, sizeof(tmp_buf), "  Emit Success: 0x%llx Error: %llx\n",
-				  transaction->info.emit_success_event_id,
-				  transaction->info.emit_error_event_id);
-			strlcat(k_buf, tmp_buf, k_buf_size);
+			print_transaction(transaction, tmp_buf, sizeof(tmp_buf), k_buf, k_buf_size);
+		}
+		list_for_each (it_tran, &transaction_list->counter_list) {
+			transaction = list_entry(it_tran, struct lwis_transaction, event_list_node);
+			print_transaction(transaction, tmp_buf, sizeof(tmp_buf), k_buf, k_buf_size);
 		}
 	}
 
@@ -118,16 +131,16 @@ static void list_allocated_buffers(struct lwis_client *client, char *k_buf, size
 {
 	char tmp_buf[64] = {};
 	struct lwis_allocated_buffer *buffer;
-	int i;
+	unsigned long fd;
 	int idx = 0;
 
-	if (hash_empty(client->allocated_buffers)) {
+	if (xa_empty(&client->allocated_buffers)) {
 		strlcat(k_buf, "Allocated buffers: None\n", k_buf_size);
 		return;
 	}
 
 	strlcat(k_buf, "Allocated buffers:\n", k_buf_size);
-	hash_for_each (client->allocated_buffers, i, buffer, node) {
+	xa_for_each (&client->allocated_buffers, fd, buffer) {
 		scnprintf(tmp_buf, sizeof(tmp_buf), "[%2d] FD: %d Size: %zu\n", idx++, buffer->fd,
 			  buffer->size);
 		strlcat(k_buf, tmp_buf, k_buf_size);
@@ -176,6 +189,17 @@ static int generate_device_info(struct lwis_device *lwis_dev, char *buffer, size
 	return 0;
 }
 
+static int event_history_record_cmp(const void *a, const void *b)
+{
+	const struct lwis_event_history_record *record_a = a;
+	const struct lwis_event_history_record *record_b = b;
+
+	if (record_a->timestamp_ns == record_b->timestamp_ns) {
+		return 0;
+	}
+	return record_a->timestamp_ns < record_b->timestamp_ns ? -1 : 1;
+}
+
 static int generate_event_states_info(struct lwis_device *lwis_dev, char *buffer,
 				      size_t buffer_size)
 {
@@ -185,6 +209,10 @@ static int generate_event_states_info(struct lwis_device *lwis_dev, char *buffer
 	int idx = 0;
 	unsigned long flags;
 	struct lwis_device_event_state *state;
+	struct lwis_event_history_reader reader;
+	struct lwis_event_history_record *records;
+	size_t num_records, first, j;
+	const size_t max_records = EVENT_DEBUG_HISTORY_SIZE * num_possible_cpus();
 	bool enabled_event_present = false;
 
 	if (lwis_dev == NULL) {
@@ -203,7 +231,7 @@ static int generate_event_states_info(struct lwis_device *lwis_dev, char *buffer
 	hash_for_each (lwis_dev->event_states, i, state, node) {
 		if (state->enable_counter > 0) {
 			scnprintf(tmp_buf, sizeof(tmp_buf), "[%2d] ID: 0x%llx Counter: 0x%llx\n",
-				  idx++, state->event_id, state->event_counter);
+				  idx++, state->event_id, atomic64_read(&state->event_counter));
 			strlcat(buffer, tmp_buf, buffer_size);
 			enabled_event_present = true;
 		}
@@ -211,23 +239,32 @@ static int generate_event_states_info(struct lwis_device *lwis_dev, char *buffer
 	if (!enabled_event_present) {
 		strlcat(buffer, "No enabled events\n", buffer_size);
 	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+
 	strlcat(buffer, "Last Events:\n", buffer_size);
-	idx = lwis_dev->debug_info.cur_event_hist_idx;
-	for (i = 0; i < EVENT_DEBUG_HISTORY_SIZE; ++i) {
-		state = &lwis_dev->debug_info.event_hist[idx].state;
-		/* Skip uninitialized entries */
-		if (state->event_id != 0) {
-			scnprintf(tmp_buf, sizeof(tmp_buf),
-				  "[%2d] ID: 0x%llx Counter: 0x%llx Timestamp: %lld\n", i,
-				  state->event_id, state->event_counter,
-				  lwis_dev->debug_info.event_hist[idx].timestamp);
-			strlcat(buffer, tmp_buf, buffer_size);
-		}
-		idx++;
-		if (idx >= EVENT_DEBUG_HISTORY_SIZE) {
-			idx = 0;
-		}
+	records = kmalloc_array(max_records, sizeof(*records), GFP_KERNEL);
+	if (!records) {
+		return -ENOMEM;
+	}
+	/* Take the last events of every CPU, and keep the last ones overall */
+	if (lwis_event_history_reader_init(&lwis_dev->debug_info.event_hist, &reader,
+					   EVENT_DEBUG_HISTORY_SIZE)) {
+		kfree(records);
+		return 0;
+	}
+	num_records = lwis_event_history_read(&lwis_dev->debug_info.event_hist, &reader, records,
+					      max_records);
+	lwis_event_history_reader_free(&reader);
+	sort(records, num_records, sizeof(*records), event_history_record_cmp, NULL);
+	first = num_records > EVENT_DEBUG_HISTORY_SIZE ? num_records - EVENT_DEBUG_HISTORY_SIZE : 0;
+	for (j = first; j < num_records; ++j) {
+		scnprintf(tmp_buf, sizeof(tmp_buf),
+			  "[%2zu] ID: 0x%llx Counter: 0x%llx Timestamp: %lld\n", j - first,
+			  records[j].event_id, records[j].event_counter, records[j].timestamp_ns);
+		strlcat(buffer, tmp_buf, buffer_size);
 	}
+	kfree(records);
+	return 0;
 
 exit:
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
@@ -365,9 +402,51 @@ exit:
 	return ret;
 }
 
+void lwis_debug_print_buffer_at(struct lwis_device *lwis_dev, dma_addr_t dma_vaddr)
+{
+	struct lwis_client *client;
+	struct lwis_enrolled_buffer *buffer;
+	unsigned long flags;
+	bool found = false;
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	list_for_each_entry (client, &lwis_dev->clients, node) {
+		buffer = lwis_client_enrolled_buffer_find_range(client, dma_vaddr, 1);
+		if (buffer) {
+			pr_err("Address %pad is in enrolled buffer FD: %d Addr: %pad Size: %zu\n",
+			       &dma_vaddr, buffer->info.fd, &buffer->info.dma_vaddr,
+			       buffer->dma_buf->size);
+			found = true;
+		}
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+
+	if (!found) {
+		pr_err("Address %pad is not in any enrolled buffer\n", &dma_vaddr);
+	}
+}
+
 /* DebugFS specific functions */
 #ifdef CONFIG_DEBUG_FS
 
+static void generate_latency_info(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+{
+	/* Name of the histogram owner */
+	char owner[32];
+	struct lwis_client *client;
+	int idx = 0;
+	unsigned long flags;
+
+	lwis_latency_print(&lwis_dev->latency, "device", buffer, buffer_size);
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	list_for_each_entry (client, &lwis_dev->clients, node) {
+		scnprintf(owner, sizeof(owner), "client%d", idx);
+		lwis_latency_print(&client->latency, owner, buffer, buffer_size);
+		idx++;
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+}
+
 static ssize_t dev_info_read(struct file *fp, char __user *user_buf, size_t count, loff_t *position)
 {
 	int ret = 0;
@@ -447,6 +526,170 @@ exit:
 	return ret;
 }
 
+static ssize_t latency_read(struct file *fp, char __user *user_buf, size_t count, loff_t *position)
+{
+	int ret = 0;
+	/* Buffer to store information */
+	const size_t buffer_size = 16384;
+	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+
+	if (!buffer) {
+		return -ENOMEM;
+	}
+	generate_latency_info(lwis_dev, buffer, buffer_size);
+	ret = simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
+	kfree(buffer);
+	return ret;
+}
+
+/* Any write resets the histograms of the device and of its clients */
+static ssize_t latency_write(struct file *fp, const char __user *user_buf, size_t count,
+			     loff_t *position)
+{
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+	struct lwis_client *client;
+	unsigned long flags;
+
+	lwis_latency_reset(&lwis_dev->latency);
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	list_for_each_entry (client, &lwis_dev->clients, node) {
+		lwis_latency_reset(&client->latency);
+	}
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+	return count;
+}
+
+static ssize_t stats_read(struct file *fp, char __user *user_buf, size_t count, loff_t *position)
+{
+	int ret = 0;
+	/* Buffer to store information */
+	const size_t buffer_size = 2048;
+	char *buffer = kzalloc(buffer_size, GFP_KERNEL);
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+
+	if (!buffer) {
+		return -ENOMEM;
+	}
+	lwis_stats_print(lwis_dev, buffer, buffer_size);
+	ret = simple_read_from_buffer(user_buf, count, position, buffer, strlen(buffer));
+	kfree(buffer);
+	return ret;
+}
+
+/* Maximum number of event history records returned by one read */
+#define EVENT_HISTORY_READ_MAX 64
+
+/* Streaming reader of the event history, starting at the oldest record */
+struct event_history_file {
+	struct lwis_device *lwis_dev;
+	/* Serializes the reads of the file */
+	struct mutex lock;
+	struct lwis_event_history_reader reader;
+};
+
+static int event_history_open(struct inode *inode, struct file *fp)
+{
+	int ret;
+	struct lwis_device *lwis_dev = inode->i_private;
+	struct lwis_event_history *hist = &lwis_dev->debug_info.event_hist;
+	struct event_history_file *file;
+
+	file = kzalloc(sizeof(*file), GFP_KERNEL);
+	if (!file) {
+		return -ENOMEM;
+	}
+	ret = lwis_event_history_reader_init(hist, &file->reader, hist->depth);
+	if (ret) {
+		kfree(file);
+		return ret;
+	}
+	file->lwis_dev = lwis_dev;
+	mutex_init(&file->lock);
+	fp->private_data = file;
+	return stream_open(inode, fp);
+}
+
+static ssize_t event_history_read(struct file *fp, char __user *user_buf, size_t count,
+				  loff_t *position)
+{
+	ssize_t ret;
+	struct event_history_file *file = fp->private_data;
+	struct lwis_event_history *hist = &file->lwis_dev->debug_info.event_hist;
+	struct lwis_event_history_record *records;
+	size_t max_records = min_t(size_t, count / sizeof(*records), EVENT_HISTORY_READ_MAX);
+	size_t num_records;
+
+	if (max_records == 0) {
+		return -EINVAL;
+	}
+	records = kmalloc_array(max_records, sizeof(*records), GFP_KERNEL);
+	if (!records) {
+		return -ENOMEM;
+	}
+
+	mutex_lock(&file->lock);
+	while ((num_records = lwis_event_history_read(hist, &file->reader, records,
+						      max_records)) == 0) {
+		if (fp->f_flags & O_NONBLOCK) {
+			ret = -EAGAIN;
+			goto exit;
+		}
+		ret = wait_event_interruptible(hist->wait_queue,
+					       lwis_event_history_pending(hist, &file->reader));
+		if (ret) {
+			goto exit;
+		}
+	}
+
+	ret = num_records * sizeof(*records);
+	if (copy_to_user(user_buf, records, ret)) {
+		ret = -EFAULT;
+	}
+exit:
+	mutex_unlock(&file->lock);
+	kfree(records);
+	return ret;
+}
+
+static int event_history_release(struct inode *inode, struct file *fp)
+{
+	struct event_history_file *file = fp->private_data;
+
+	lwis_event_history_reader_free(&file->reader);
+	kfree(file);
+	return 0;
+}
+
+/* Writing 1 or 0 starts or stops the recording, reads move whole records out
+ * of the trace */
+static ssize_t ioctl_trace_read(struct file *fp, char __user *user_buf, size_t count,
+				loff_t *position)
+{
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+
+	return lwis_ioctl_trace_read(&lwis_dev->ioctl_trace, user_buf, count,
+				     fp->f_flags & O_NONBLOCK);
+}
+
+static ssize_t ioctl_trace_write(struct file *fp, const char __user *user_buf, size_t count,
+				 loff_t *position)
+{
+	struct lwis_device *lwis_dev = fp->f_inode->i_private;
+	bool enable;
+	int ret;
+
+	ret = kstrtobool_from_user(user_buf, count, &enable);
+	if (ret) {
+		return ret;
+	}
+	ret = lwis_ioctl_trace_enable(&lwis_dev->ioctl_trace, enable);
+	if (ret) {
+		return ret;
+	}
+	return count;
+}
+
 static struct file_operations dev_info_fops = {
 	.owner = THIS_MODULE,
 	.read = dev_info_read,
@@ -467,6 +710,33 @@ static struct file_operations buffer_info_fops = {
 	.read = buffer_info_read,
 };
 
+static struct file_operations latency_fops = {
+	.owner = THIS_MODULE,
+	.read = latency_read,
+	.write = latency_write,
+};
+
+static struct file_operations stats_fops = {
+	.owner = THIS_MODULE,
+	.read = stats_read,
+};
+
+static struct file_operations event_history_fops = {
+	.owner = THIS_MODULE,
+	.open = event_history_open,
+	.read = event_history_read,
+	.release = event_history_release,
+	.llseek = no_llseek,
+};
+
+static struct file_operations ioctl_trace_fops = {
+	.owner = THIS_MODULE,
+	.open = stream_open,
+	.read = ioctl_trace_read,
+	.write = ioctl_trace_write,
+	.llseek = no_llseek,
+};
+
 int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_root)
 {
 	struct dentry *dbg_dir;
@@ -474,6 +744,10 @@ int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_r
 	struct dentry *dbg_event_file;
 	struct dentry *dbg_transaction_file;
 	struct dentry *dbg_buffer_file;
+	struct dentry *dbg_latency_file;
+	struct dentry *dbg_stats_file;
+	struct dentry *dbg_event_history_file;
+	struct dentry *dbg_ioctl_trace_file;
 
 	/* DebugFS not present, just return */
 	if (dbg_root == NULL) {
@@ -519,11 +793,46 @@ int lwis_device_debugfs_setup(struct lwis_device *lwis_dev, struct dentry *dbg_r
 		dbg_buffer_file = NULL;
 	}
 
+	dbg_latency_file =
+		debugfs_create_file("latency", 0644, dbg_dir, lwis_dev, &latency_fops);
+	if (IS_ERR_OR_NULL(dbg_latency_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS latency - %ld",
+			 PTR_ERR(dbg_latency_file));
+		dbg_latency_file = NULL;
+	}
+
+	dbg_stats_file = debugfs_create_file("stats", 0444, dbg_dir, lwis_dev, &stats_fops);
+	if (IS_ERR_OR_NULL(dbg_stats_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS stats - %ld",
+			 PTR_ERR(dbg_stats_file));
+		dbg_stats_file = NULL;
+	}
+
+	dbg_event_history_file = debugfs_create_file("event_history", 0444, dbg_dir, lwis_dev,
+						     &event_history_fops);
+	if (IS_ERR_OR_NULL(dbg_event_history_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS event_history - %ld",
+			 PTR_ERR(dbg_event_history_file));
+		dbg_event_history_file = NULL;
+	}
+
+	dbg_ioctl_trace_file =
+		debugfs_create_file("ioctl_trace", 0600, dbg_dir, lwis_dev, &ioctl_trace_fops);
+	if (IS_ERR_OR_NULL(dbg_ioctl_trace_file)) {
+		dev_warn(lwis_dev->dev, "Failed to create DebugFS ioctl_trace - %ld",
+			 PTR_ERR(dbg_ioctl_trace_file));
+		dbg_ioctl_trace_file = NULL;
+	}
+
 	lwis_dev->dbg_dir = dbg_dir;
 	lwis_dev->dbg_dev_info_file = dbg_dev_info_file;
 	lwis_dev->dbg_event_file = dbg_event_file;
 	lwis_dev->dbg_transaction_file = dbg_transaction_file;
 	lwis_dev->dbg_buffer_file = dbg_buffer_file;
+	lwis_dev->dbg_latency_file = dbg_latency_file;
+	lwis_dev->dbg_stats_file = dbg_stats_file;
+	lwis_dev->dbg_event_history_file = dbg_event_history_file;
+	lwis_dev->dbg_ioctl_trace_file = dbg_ioctl_trace_file;
 
 	return 0;
 }
@@ -540,6 +849,10 @@ int lwis_device_debugfs_cleanup(struct lwis_device *lwis_dev)
 	lwis_dev->dbg_event_file = NULL;
 	lwis_dev->dbg_transaction_file = NULL;
 	lwis_dev->dbg_buffer_file = NULL;
+	lwis_dev->dbg_latency_file = NULL;
+	lwis_dev->dbg_stats_file = NULL;
+	lwis_dev->dbg_event_history_file = NULL;
+	lwis_dev->dbg_ioctl_trace_file = NULL;
 	return 0;
 }
 
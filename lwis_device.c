@@ -14,10 +14,13 @@
 
 #include <linux/delay.h>
 #include <linux/device.h>
+#include <linux/file.h>
 #include <linux/hashtable.h>
 #include <linux/init.h>
 #include <linux/module.h>
 #include <linux/pinctrl/consumer.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
 #include <linux/uaccess.h>
 
@@ -31,12 +34,18 @@
 #include "lwis_dt.h"
 #include "lwis_event.h"
 #include "lwis_gpio.h"
+#include "lwis_i2c.h"
 #include "lwis_init.h"
 #include "lwis_ioctl.h"
 #include "lwis_periodic_io.h"
 #include "lwis_pinctrl.h"
 #include "lwis_platform.h"
 #include "lwis_transaction.h"
+#include "lwis_uploaded_io.h"
+#include "lwis_util.h"
+
+#define CREATE_TRACE_POINTS
+#include "lwis_trace.h"
 
 #ifdef CONFIG_OF
 #include "lwis_dt.h"
@@ -45,19 +54,46 @@
 #define LWIS_CLASS_NAME "lwis"
 #define LWIS_DEVICE_NAME "lwis"
 #define LWIS_MAX_DEVICES (1U << MINORBITS)
+
+/* Time for all pins to be ready once a device is powered up */
+#define POWER_UP_SETTLE_US 2000
+/* Time between attempts to start a group device whose locks are held */
+#define POWER_GROUP_RETRY_US 100
+
 #define MCLK_ON_STRING "mclk_on"
 #define MCLK_OFF_STRING "mclk_off"
 
 /* Define this to help debug power sequence */
 #undef LWIS_PWR_SEQ_DEBUG
 
+enum power_group_state {
+	POWER_GROUP_PENDING,
+	POWER_GROUP_SEQUENCING,
+	POWER_GROUP_SETTLING,
+	POWER_GROUP_DONE,
+	POWER_GROUP_FAILED,
+};
+
 /* Global declaration for core lwis structure */
 static struct lwis_core core;
 
+/*
+ *  struct lwis_i2c_lock
+ *  Power lock shared by I2C devices, keyed by adapter for the bus lock and by
+ *  lock group for the group lock.
+ */
+struct lwis_i2c_lock {
+	struct i2c_adapter *adapter;
+	uint32_t group;
+	struct mutex lock;
+	struct list_head node;
+};
+
 static int lwis_open(struct inode *node, struct file *fp);
 static int lwis_release(struct inode *node, struct file *fp);
 static long lwis_ioctl(struct file *fp, unsigned int type, unsigned long param);
 static unsigned int lwis_poll(struct file *fp, poll_table *wait);
+static int lwis_mmap(struct file *fp, struct vm_area_struct *vma);
 
 static struct file_operations lwis_fops = {
 	.owner = THIS_MODULE,
@@ -65,31 +101,20 @@ static struct file_operations lwis_fops = {
 	.release = lwis_release,
 	.unlocked_ioctl = lwis_ioctl,
 	.poll = lwis_poll,
+	.mmap = lwis_mmap,
 };
 
-/*
- *  lwis_open: Opening an instance of a LWIS device
- */
-static int lwis_open(struct inode *node, struct file *fp)
+struct lwis_client *lwis_client_create(struct lwis_device *lwis_dev)
 {
-	struct lwis_device *lwis_dev;
 	struct lwis_client *lwis_client;
 	unsigned long flags;
-
-	/* Making sure the minor number associated with fp exists */
-	mutex_lock(&core.lock);
-	lwis_dev = idr_find(core.idr, iminor(node));
-	mutex_unlock(&core.lock);
-	if (!lwis_dev) {
-		pr_err("No device %d found\n", iminor(node));
-		return -ENODEV;
-	}
-	dev_dbg(lwis_dev->dev, "Opening instance %d\n", iminor(node));
+	unsigned long slot;
+	int ret;
 
 	lwis_client = kzalloc(sizeof(struct lwis_client), GFP_KERNEL);
 	if (!lwis_client) {
 		dev_err(lwis_dev->dev, "Failed to allocate lwis client\n");
-		return -ENOMEM;
+		return ERR_PTR(-ENOMEM);
 	}
 
 	lwis_client->lwis_dev = lwis_dev;
@@ -108,14 +133,28 @@ static int lwis_open(struct inode *node, struct file *fp)
 	/* Initialize the wait queue for the event queue */
 	init_waitqueue_head(&lwis_client->event_wait_queue);
 
-	/* Empty hash table for client allocated buffers */
-	hash_init(lwis_client->allocated_buffers);
+	/* No asynchronous device enable is pending */
+	INIT_WORK(&lwis_client->enable_work, lwis_ioctl_device_enable_work);
+
+	/* No allocated buffers */
+	xa_init(&lwis_client->allocated_buffers);
 
 	/* Empty hash table for client enrolled buffers */
 	hash_init(lwis_client->enrolled_buffers);
+	lwis_client->enrolled_buffer_ranges = RB_ROOT_CACHED;
+
+	/* Buffer mappings are not cached until the client asks for it */
+	INIT_LIST_HEAD(&lwis_client->buffer_cache);
+
+	/* Empty hash table for client uploaded io entries */
+	hash_init(lwis_client->uploaded_io);
 
 	/* Start transaction processor task */
-	lwis_transaction_init(lwis_client);
+	ret = lwis_transaction_init(lwis_client);
+	if (ret) {
+		kfree(lwis_client);
+		return ERR_PTR(ret);
+	}
 
 	/* Start periodic io processor task */
 	lwis_periodic_io_init(lwis_client);
@@ -124,12 +163,47 @@ static int lwis_open(struct inode *node, struct file *fp)
 
 	spin_lock_irqsave(&lwis_dev->lock, flags);
 	list_add(&lwis_client->node, &lwis_dev->clients);
+	/* Take a slot so event emission can visit only the listening clients */
+	slot = find_first_zero_bit(&lwis_dev->used_client_slots, LWIS_MAX_CLIENT_SLOTS);
+	if (slot < LWIS_MAX_CLIENT_SLOTS) {
+		__set_bit(slot, &lwis_dev->used_client_slots);
+		rcu_assign_pointer(lwis_dev->client_slots[slot], lwis_client);
+		lwis_client->slot = slot;
+	} else {
+		lwis_dev->num_unslotted_clients++;
+		lwis_client->slot = -1;
+	}
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 
+	lwis_client->is_enabled = false;
+	return lwis_client;
+}
+
+/*
+ *  lwis_open: Opening an instance of a LWIS device
+ */
+static int lwis_open(struct inode *node, struct file *fp)
+{
+	struct lwis_device *lwis_dev;
+	struct lwis_client *lwis_client;
+
+	/* Making sure the minor number associated with fp exists */
+	mutex_lock(&core.lock);
+	lwis_dev = idr_find(core.idr, iminor(node));
+	mutex_unlock(&core.lock);
+	if (!lwis_dev) {
+		pr_err("No device %d found\n", iminor(node));
+		return -ENODEV;
+	}
+	dev_dbg(lwis_dev->dev, "Opening instance %d\n", iminor(node));
+
+	lwis_client = lwis_client_create(lwis_dev);
+	if (IS_ERR(lwis_client)) {
+		return PTR_ERR(lwis_client);
+	}
+
 	/* Storing the client handle in fp private_data for easy access */
 	fp->private_data = lwis_client;
-
-	lwis_client->is_enabled = false;
 	return 0;
 }
 
@@ -157,9 +231,13 @@ static int lwis_cleanup_client(struct lwis_client *lwis_client)
 	/* Run cleanup transactions. */
 	lwis_transaction_client_cleanup(lwis_client);
 
+	/* Release the uploaded io entries, in-flight submissions keep theirs */
+	lwis_uploaded_io_clear(lwis_client);
+
 	/* Disenroll and clear the table of allocated and enrolled buffers */
 	lwis_client_allocated_buffers_clear(lwis_client);
 	lwis_client_enrolled_buffers_clear(lwis_client);
+	lwis_client_buffer_cache_clear(lwis_client);
 
 	mutex_unlock(&lwis_client->lock);
 
@@ -179,14 +257,12 @@ static inline bool check_client_exists(const struct lwis_device *lwis_dev,
 	return false;
 }
 
-/* Release client and deletes its entry from the device's client list,
- * this assumes that LWIS device still exists and will hold LWIS device
- * and LWIS client locks. */
-static int lwis_release_client(struct lwis_client *lwis_client)
+int lwis_release_client(struct lwis_client *lwis_client)
 {
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
 	int rc = 0;
 	unsigned long flags;
+
 	rc = lwis_cleanup_client(lwis_client);
 	if (rc) {
 		return rc;
@@ -196,12 +272,30 @@ static int lwis_release_client(struct lwis_client *lwis_client)
 	spin_lock_irqsave(&lwis_dev->lock, flags);
 	if (check_client_exists(lwis_dev, lwis_client)) {
 		list_del(&lwis_client->node);
+		if (lwis_client->slot >= 0) {
+			/* Drop the listener bits before the slot is handed out again */
+			lwis_device_event_listeners_release_locked(lwis_client);
+			RCU_INIT_POINTER(lwis_dev->client_slots[lwis_client->slot], NULL);
+			__clear_bit(lwis_client->slot, &lwis_dev->used_client_slots);
+		} else {
+			lwis_dev->num_unslotted_clients--;
+		}
 	} else {
 		dev_err(lwis_dev->dev, "Trying to release a client tied to this device, "
 				       "but the entry was not found on the clients list.");
 	}
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 
+	/* Wait for the emitters that picked this client from its slot */
+	if (lwis_client->slot >= 0) {
+		synchronize_rcu();
+	}
+
+	/* No more events can be emitted to this client */
+	lwis_client_event_ring_free(lwis_client);
+	/* Periodic ios were cleaned up with the client */
+	lwis_periodic_io_ring_free(lwis_client);
+
 	kfree(lwis_client);
 	return 0;
 }
@@ -214,10 +308,15 @@ static int lwis_release(struct inode *node, struct file *fp)
 	struct lwis_client *lwis_client = fp->private_data;
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
 	int rc = 0;
-	bool is_client_enabled = lwis_client->is_enabled;
+	bool is_client_enabled;
+	unsigned long flags;
 
 	dev_info(lwis_dev->dev, "Closing instance %d\n", iminor(node));
 
+	/* Let a pending asynchronous device enable complete */
+	flush_work(&lwis_client->enable_work);
+	is_client_enabled = lwis_client->is_enabled;
+
 	rc = lwis_release_client(lwis_client);
 	mutex_lock(&lwis_dev->client_lock);
 	/* Release power if client closed without power down called */
@@ -225,19 +324,17 @@ static int lwis_release(struct inode *node, struct file *fp)
 		lwis_dev->enabled--;
 		if (lwis_dev->enabled == 0) {
 			dev_info(lwis_dev->dev, "No more client, power down\n");
-			rc = lwis_dev_power_down_locked(lwis_dev);
+			rc = lwis_dev_power_down_deferred_locked(lwis_dev);
 		}
 	}
 
 	if (lwis_dev->enabled == 0) {
-		if (lwis_dev->bts_index != BTS_UNSUPPORTED) {
-			lwis_platform_update_bts(lwis_dev, /*bw_peak=*/0,
-						 /*bw_read=*/0, /*bw_write=*/0, /*bw_rt=*/0);
-		}
-		/* remove voted qos */
-		lwis_platform_remove_qos(lwis_dev);
+		/* remove voted bandwidth and qos */
+		lwis_dpm_remove_votes(lwis_dev);
 		/* Release device event states if no more client is using */
+		spin_lock_irqsave(&lwis_dev->lock, flags);
 		lwis_device_event_states_clear_locked(lwis_dev);
+		spin_unlock_irqrestore(&lwis_dev->lock, flags);
 	}
 	mutex_unlock(&lwis_dev->client_lock);
 
@@ -261,6 +358,8 @@ static long lwis_ioctl(struct file *fp, unsigned int type, unsigned long param)
 	int ret = 0;
 	struct lwis_client *lwis_client;
 	struct lwis_device *lwis_dev;
+	bool traced;
+	int64_t start_timestamp_ns = 0;
 
 	lwis_client = fp->private_data;
 	if (!lwis_client) {
@@ -274,9 +373,21 @@ static long lwis_ioctl(struct file *fp, unsigned int type, unsigned long param)
 		return -ENODEV;
 	}
 
+	/* Let a pending asynchronous device enable complete before disabling */
+	if (type == LWIS_DEVICE_DISABLE) {
+		flush_work(&lwis_client->enable_work);
+	}
+
 	mutex_lock(&lwis_client->lock);
 
+	traced = lwis_ioctl_trace_enabled(&lwis_dev->ioctl_trace);
+	if (traced) {
+		start_timestamp_ns = ktime_to_ns(lwis_get_time());
+	}
 	ret = lwis_ioctl_handler(lwis_client, type, param);
+	if (traced) {
+		lwis_ioctl_trace_record(lwis_client, type, param, ret, start_timestamp_ns);
+	}
 
 	mutex_unlock(&lwis_client->lock);
 
@@ -313,11 +424,42 @@ static unsigned int lwis_poll(struct file *fp, poll_table *wait)
 		mask |= POLLIN;
 	}
 
+	/* Check if the event ring holds events userspace did not consume */
+	if (lwis_client_event_ring_poll(lwis_client)) {
+		mask |= POLLIN;
+	}
+
 	mutex_unlock(&lwis_client->lock);
 
 	return mask;
 }
 
+/*
+ *  lwis_mmap: Maps the client event ring or periodic io ring to userspace
+ *
+ */
+static int lwis_mmap(struct file *fp, struct vm_area_struct *vma)
+{
+	int ret;
+	struct lwis_client *lwis_client;
+
+	lwis_client = fp->private_data;
+	if (!lwis_client) {
+		pr_err("Cannot find client instance\n");
+		return -ENODEV;
+	}
+
+	mutex_lock(&lwis_client->lock);
+	if (vma->vm_pgoff == PERIODIC_IO_RING_MMAP_PGOFF) {
+		ret = lwis_periodic_io_ring_mmap(lwis_client, vma);
+	} else {
+		ret = lwis_client_event_ring_mmap(lwis_client, vma);
+	}
+	mutex_unlock(&lwis_client->lock);
+
+	return ret;
+}
+
 static int lwis_base_setup(struct lwis_device *lwis_dev)
 {
 	int ret = 0;
@@ -336,6 +478,37 @@ static int lwis_base_setup(struct lwis_device *lwis_dev)
 	return ret;
 }
 
+/*
+ *  lwis_rt_worker_create: Create the real-time worker of the device, if the
+ *  device tree asked for one.
+ */
+static int lwis_rt_worker_create(struct lwis_device *lwis_dev)
+{
+	struct kthread_worker *worker;
+
+	lwis_dev->rt_worker = NULL;
+	if (!lwis_dev->rt_worker_enabled) {
+		return 0;
+	}
+
+	if (lwis_dev->rt_worker_cpu >= 0) {
+		worker = kthread_create_worker_on_cpu(lwis_dev->rt_worker_cpu, 0, "lwis_rt_%s",
+						      lwis_dev->name);
+	} else {
+		worker = kthread_create_worker(0, "lwis_rt_%s", lwis_dev->name);
+	}
+	if (IS_ERR(worker)) {
+		pr_err("Failed to create rt worker for %s\n", lwis_dev->name);
+		return PTR_ERR(worker);
+	}
+
+	/* Modules can only pick the SCHED_FIFO priority sched_set_fifo() sets */
+	sched_set_fifo(worker->task);
+
+	lwis_dev->rt_worker = worker;
+	return 0;
+}
+
 /*
  *  lwis_assign_top_to_other: Assign top device to the devices probed before.
  */
@@ -350,123 +523,148 @@ static void lwis_assign_top_to_other(struct lwis_device *top_dev)
 	mutex_unlock(&core.lock);
 }
 
-static int lwis_dev_power_up_by_seqs(struct lwis_device *lwis_dev)
+/*
+ *  dev_is_powered: A device disabled by its clients stays powered up until its
+ *  deferred power down runs.
+ */
+static bool dev_is_powered(struct lwis_device *lwis_dev)
 {
-	struct lwis_device_power_sequence_list *list;
-	int ret;
-	int i;
-
-	if (lwis_dev == NULL) {
-		pr_err("lwis_dev is NULL\n");
-		return -ENODEV;
-	}
+	return lwis_dev->enabled || lwis_dev->power_down_pending;
+}
 
-	list = lwis_dev->power_up_sequence;
-	if (list == NULL || list->count == 0) {
-		dev_err(lwis_dev->dev, "No power_up_sequence defined\n");
-		return -EINVAL;
-	}
+/*
+ *  power_up_seq_step: Run one step of the power up sequence, without its delay.
+ */
+static int power_up_seq_step(struct lwis_device *lwis_dev, int i)
+{
+	struct lwis_device_power_sequence_list *list = lwis_dev->power_up_sequence;
+	int ret;
 
-	for (i = 0; i < list->count; ++i) {
 #ifdef LWIS_PWR_SEQ_DEBUG
-		dev_info(lwis_dev->dev, "%s: %d - type:%s name:%s delay_us:%d", __func__, i,
-			 list->seq_info[i].type, list->seq_info[i].name,
-			 list->seq_info[i].delay_us);
+	dev_info(lwis_dev->dev, "%s: %d - type:%s name:%s delay_us:%d", __func__, i,
+		 list->seq_info[i].type, list->seq_info[i].name,
+		 list->seq_info[i].delay_us);
 #endif
-		if (strcmp(list->seq_info[i].type, "regulator") == 0) {
-			if (lwis_dev->regulators == NULL) {
-				dev_err(lwis_dev->dev, "No regulators defined\n");
-				return -EINVAL;
-			}
-			ret = lwis_regulator_enable_by_name(lwis_dev->regulators,
-							    list->seq_info[i].name);
-			if (ret) {
-				dev_err(lwis_dev->dev, "Error enabling regulators (%d)\n", ret);
-				return ret;
-			}
-		} else if (strcmp(list->seq_info[i].type, "gpio") == 0) {
-			struct gpio_descs *gpios = NULL;
-			struct lwis_gpios_info *gpios_info = NULL;
-
-			gpios_info = lwis_gpios_get_info_by_name(lwis_dev->gpios_list,
-								 list->seq_info[i].name);
-			if (IS_ERR(gpios_info)) {
-				dev_err(lwis_dev->dev, "Get %s gpios info failed\n",
-					list->seq_info[i].name);
-				return PTR_ERR(gpios_info);
-			}
+	if (strcmp(list->seq_info[i].type, "regulator") == 0) {
+		if (lwis_dev->regulators == NULL) {
+			dev_err(lwis_dev->dev, "No regulators defined\n");
+			return -EINVAL;
+		}
+		ret = lwis_regulator_enable_by_name(lwis_dev->regulators,
+						    list->seq_info[i].name);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Error enabling regulators (%d)\n", ret);
+			return ret;
+		}
+	} else if (strcmp(list->seq_info[i].type, "gpio") == 0) {
+		struct gpio_descs *gpios = NULL;
+		struct lwis_gpios_info *gpios_info = NULL;
+
+		gpios_info = lwis_gpios_get_info_by_name(lwis_dev->gpios_list,
+							 list->seq_info[i].name);
+		if (IS_ERR(gpios_info)) {
+			dev_err(lwis_dev->dev, "Get %s gpios info failed\n",
+				list->seq_info[i].name);
+			return PTR_ERR(gpios_info);
+		}
 
-			gpios = lwis_gpio_list_get(&lwis_dev->plat_dev->dev,
-						   list->seq_info[i].name);
-			if (IS_ERR_OR_NULL(gpios)) {
-				if (PTR_ERR(gpios) == -EBUSY && gpios_info->is_shared) {
-					dev_warn(lwis_dev->dev,
-						 "Shared gpios requested by another device\n");
-				} else {
-					dev_err(lwis_dev->dev, "Failed to obtain gpio list (%ld)\n",
-						PTR_ERR(gpios));
-					return PTR_ERR(gpios);
-				}
-				gpios_info->gpios = NULL;
+		gpios = lwis_gpio_list_get(&lwis_dev->plat_dev->dev,
+					   list->seq_info[i].name);
+		if (IS_ERR_OR_NULL(gpios)) {
+			if (PTR_ERR(gpios) == -EBUSY && gpios_info->is_shared) {
+				dev_warn(lwis_dev->dev,
+					 "Shared gpios requested by another device\n");
 			} else {
-				if (gpios_info->is_pulse) {
-					ret = lwis_gpio_list_set_output_value(gpios, 0);
-					if (ret) {
-						dev_err(lwis_dev->dev, "Error set GPIO pins (%d)\n",
-							ret);
-						return ret;
-					}
-					usleep_range(1000, 1500);
-				}
-				ret = lwis_gpio_list_set_output_value(gpios, 1);
+				dev_err(lwis_dev->dev, "Failed to obtain gpio list (%ld)\n",
+					PTR_ERR(gpios));
+				return PTR_ERR(gpios);
+			}
+			gpios_info->gpios = NULL;
+		} else {
+			if (gpios_info->is_pulse) {
+				ret = lwis_gpio_list_set_output_value(gpios, 0);
 				if (ret) {
-					dev_err(lwis_dev->dev, "Error set GPIO pins (%d)\n", ret);
+					dev_err(lwis_dev->dev, "Error set GPIO pins (%d)\n",
+						ret);
 					return ret;
 				}
-				gpios_info->gpios = gpios;
+				usleep_range(1000, 1500);
 			}
-		} else if (strcmp(list->seq_info[i].type, "pinctrl") == 0) {
-			bool activate_mclk = true;
-
-			lwis_dev->mclk_ctrl = devm_pinctrl_get(&lwis_dev->plat_dev->dev);
-			if (IS_ERR(lwis_dev->mclk_ctrl)) {
-				dev_err(lwis_dev->dev, "Failed to get mclk\n");
-				ret = PTR_ERR(lwis_dev->mclk_ctrl);
-				lwis_dev->mclk_ctrl = NULL;
+			ret = lwis_gpio_list_set_output_value(gpios, 1);
+			if (ret) {
+				dev_err(lwis_dev->dev, "Error set GPIO pins (%d)\n", ret);
 				return ret;
 			}
+			gpios_info->gpios = gpios;
+		}
+	} else if (strcmp(list->seq_info[i].type, "pinctrl") == 0) {
+		bool activate_mclk = true;
 
-			if (lwis_dev->shared_pinctrl > 0) {
-				struct lwis_device *lwis_dev_it;
-				/* Look up if pinctrl it's already enabled */
-				mutex_lock(&core.lock);
-				list_for_each_entry (lwis_dev_it, &core.lwis_dev_list, dev_list) {
-					if ((lwis_dev->id != lwis_dev_it->id) &&
-					    (lwis_dev_it->shared_pinctrl ==
-					     lwis_dev->shared_pinctrl) &&
-					    lwis_dev_it->enabled) {
-						activate_mclk = false;
-						devm_pinctrl_put(lwis_dev->mclk_ctrl);
-						lwis_dev->mclk_ctrl = NULL;
-						dev_info(lwis_dev->dev, "mclk already acquired\n");
-						break;
-					}
-				}
-				mutex_unlock(&core.lock);
-			}
+		lwis_dev->mclk_ctrl = devm_pinctrl_get(&lwis_dev->plat_dev->dev);
+		if (IS_ERR(lwis_dev->mclk_ctrl)) {
+			dev_err(lwis_dev->dev, "Failed to get mclk\n");
+			ret = PTR_ERR(lwis_dev->mclk_ctrl);
+			lwis_dev->mclk_ctrl = NULL;
+			return ret;
+		}
 
-			if (activate_mclk) {
-				/* Set MCLK state to on */
-				ret = lwis_pinctrl_set_state(lwis_dev->mclk_ctrl,
-							     list->seq_info[i].name);
-				if (ret) {
-					dev_err(lwis_dev->dev, "Error setting %s state (%d)\n",
-						list->seq_info[i].name, ret);
+		if (lwis_dev->shared_pinctrl > 0) {
+			struct lwis_device *lwis_dev_it;
+			/* Look up if pinctrl it's already enabled */
+			mutex_lock(&core.lock);
+			list_for_each_entry (lwis_dev_it, &core.lwis_dev_list, dev_list) {
+				if ((lwis_dev->id != lwis_dev_it->id) &&
+				    (lwis_dev_it->shared_pinctrl ==
+				     lwis_dev->shared_pinctrl) &&
+				    dev_is_powered(lwis_dev_it)) {
+					activate_mclk = false;
 					devm_pinctrl_put(lwis_dev->mclk_ctrl);
 					lwis_dev->mclk_ctrl = NULL;
-					return ret;
+					dev_info(lwis_dev->dev, "mclk already acquired\n");
+					break;
 				}
 			}
+			mutex_unlock(&core.lock);
+		}
+
+		if (activate_mclk) {
+			/* Set MCLK state to on */
+			ret = lwis_pinctrl_set_state(lwis_dev->mclk_ctrl,
+						     list->seq_info[i].name);
+			if (ret) {
+				dev_err(lwis_dev->dev, "Error setting %s state (%d)\n",
+					list->seq_info[i].name, ret);
+				devm_pinctrl_put(lwis_dev->mclk_ctrl);
+				lwis_dev->mclk_ctrl = NULL;
+				return ret;
+			}
+		}
+	}
+
+	return 0;
+}
+
+static int lwis_dev_power_up_by_seqs(struct lwis_device *lwis_dev)
+{
+	struct lwis_device_power_sequence_list *list;
+	int ret;
+	int i;
+
+	if (lwis_dev == NULL) {
+		pr_err("lwis_dev is NULL\n");
+		return -ENODEV;
+	}
+
+	list = lwis_dev->power_up_sequence;
+	if (list == NULL || list->count == 0) {
+		dev_err(lwis_dev->dev, "No power_up_sequence defined\n");
+		return -EINVAL;
+	}
+
+	for (i = 0; i < list->count; ++i) {
+		ret = power_up_seq_step(lwis_dev, i);
+		if (ret) {
+			return ret;
 		}
 		usleep_range(list->seq_info[i].delay_us, list->seq_info[i].delay_us);
 	}
@@ -563,7 +761,7 @@ static int lwis_dev_power_up_by_default(struct lwis_device *lwis_dev)
 			list_for_each_entry (lwis_dev_it, &core.lwis_dev_list, dev_list) {
 				if ((lwis_dev->id != lwis_dev_it->id) &&
 				    (lwis_dev_it->shared_pinctrl == lwis_dev->shared_pinctrl) &&
-				    lwis_dev_it->enabled) {
+				    dev_is_powered(lwis_dev_it)) {
 					activate_mclk = false;
 					devm_pinctrl_put(lwis_dev->mclk_ctrl);
 					lwis_dev->mclk_ctrl = NULL;
@@ -587,35 +785,136 @@ static int lwis_dev_power_up_by_default(struct lwis_device *lwis_dev)
 		}
 	}
 
-	if (lwis_dev->reset_gpios_present) {
-		struct gpio_descs *gpios;
+	if (lwis_dev->reset_gpios_present) {
+		struct gpio_descs *gpios;
+
+		gpios = lwis_gpio_list_get(&lwis_dev->plat_dev->dev, "reset");
+		if (IS_ERR_OR_NULL(gpios)) {
+			dev_err(lwis_dev->dev, "Failed to obtain reset gpio list (%ld)\n",
+				PTR_ERR(gpios));
+			return PTR_ERR(gpios);
+		}
+		/*
+		 * Setting reset_gpios to non-NULL to indicate that this lwis
+		 * device is holding onto the GPIO pins.
+		 */
+		lwis_dev->reset_gpios = gpios;
+
+		/* Set reset pin to 0 (i.e. deasserted) */
+		ret = lwis_gpio_list_set_output_value(gpios, 0);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to set reset GPIOs to ACTIVE (%d)\n", ret);
+			return ret;
+		}
+
+		usleep_range(1000, 1500);
+
+		/* Set reset pin to 1 (i.e. asserted) */
+		ret = lwis_gpio_list_set_output_value(gpios, 1);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to set reset GPIOs to DE-ACTIVE (%d)\n",
+				ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/*
+ *  i2c_power_lock: Serialize the power sequence of an i2c device with the
+ *  devices sharing its bus, then with the devices of its lock group.
+ */
+static void i2c_power_lock(struct lwis_device *lwis_dev)
+{
+	if (lwis_dev->type != DEVICE_TYPE_I2C || lwis_dev->i2c_bus_lock == NULL) {
+		return;
+	}
+	mutex_lock(lwis_dev->i2c_bus_lock);
+	if (lwis_dev->i2c_group_lock) {
+		mutex_lock_nested(lwis_dev->i2c_group_lock, SINGLE_DEPTH_NESTING);
+	}
+}
+
+/*
+ *  i2c_power_trylock: Same as i2c_power_lock() without sleeping, returns false
+ *  when a lock is held elsewhere.
+ */
+static bool i2c_power_trylock(struct lwis_device *lwis_dev)
+{
+	if (lwis_dev->type != DEVICE_TYPE_I2C || lwis_dev->i2c_bus_lock == NULL) {
+		return true;
+	}
+	if (!mutex_trylock(lwis_dev->i2c_bus_lock)) {
+		return false;
+	}
+	if (lwis_dev->i2c_group_lock && !mutex_trylock(lwis_dev->i2c_group_lock)) {
+		mutex_unlock(lwis_dev->i2c_bus_lock);
+		return false;
+	}
+	return true;
+}
+
+static void i2c_power_unlock(struct lwis_device *lwis_dev)
+{
+	if (lwis_dev->type != DEVICE_TYPE_I2C || lwis_dev->i2c_bus_lock == NULL) {
+		return;
+	}
+	if (lwis_dev->i2c_group_lock) {
+		mutex_unlock(lwis_dev->i2c_group_lock);
+	}
+	mutex_unlock(lwis_dev->i2c_bus_lock);
+}
+
+/*
+ *  power_up_begin: Enable what the power sequence of a device relies on.
+ */
+static int power_up_begin(struct lwis_device *lwis_dev)
+{
+	int ret;
+
+	/* Let's do the platform-specific enable call */
+	ret = lwis_platform_device_enable(lwis_dev);
+	/* The platform votes the default clocks of the device */
+	lwis_dpm_votes_invalidate(lwis_dev);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Platform-specific device enable fail: %d\n", ret);
+		return ret;
+	}
+
+	if (lwis_dev->clocks) {
+		/* Enable clocks */
+		ret = lwis_clock_enable_all(lwis_dev->clocks);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Error enabling clocks (%d)\n", ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
 
-		gpios = lwis_gpio_list_get(&lwis_dev->plat_dev->dev, "reset");
-		if (IS_ERR_OR_NULL(gpios)) {
-			dev_err(lwis_dev->dev, "Failed to obtain reset gpio list (%ld)\n",
-				PTR_ERR(gpios));
-			return PTR_ERR(gpios);
-		}
-		/*
-		 * Setting reset_gpios to non-NULL to indicate that this lwis
-		 * device is holding onto the GPIO pins.
-		 */
-		lwis_dev->reset_gpios = gpios;
+/*
+ *  power_up_end: Bring up the PHY and the device once its power sequence ran.
+ */
+static int power_up_end(struct lwis_device *lwis_dev)
+{
+	int ret;
 
-		/* Set reset pin to 0 (i.e. deasserted) */
-		ret = lwis_gpio_list_set_output_value(gpios, 0);
+	if (lwis_dev->phys) {
+		/* Power on the PHY */
+		ret = lwis_phy_set_power_all(lwis_dev->phys,
+					     /* power_on = */ true);
 		if (ret) {
-			dev_err(lwis_dev->dev, "Failed to set reset GPIOs to ACTIVE (%d)\n", ret);
+			dev_err(lwis_dev->dev, "Error powering on PHY\n");
 			return ret;
 		}
+	}
 
-		usleep_range(1000, 1500);
-
-		/* Set reset pin to 1 (i.e. asserted) */
-		ret = lwis_gpio_list_set_output_value(gpios, 1);
+	if (lwis_dev->vops.device_enable) {
+		ret = lwis_dev->vops.device_enable(lwis_dev);
 		if (ret) {
-			dev_err(lwis_dev->dev, "Failed to set reset GPIOs to DE-ACTIVE (%d)\n",
-				ret);
+			dev_err(lwis_dev->dev, "Error executing device enable function\n");
 			return ret;
 		}
 	}
@@ -631,81 +930,381 @@ int lwis_dev_power_up_locked(struct lwis_device *lwis_dev)
 {
 	int ret;
 
-	if (lwis_dev->global_i2c_lock == NULL) {
-		dev_err(lwis_dev->dev, "global_i2c_lock is NULL. Abort power up.\n");
+	if (lwis_dev->type == DEVICE_TYPE_I2C && lwis_dev->i2c_bus_lock == NULL) {
+		dev_err(lwis_dev->dev, "i2c_bus_lock is NULL. Abort power up.\n");
 		return -EINVAL;
 	}
 
-	/* Let's do the platform-specific enable call */
-	ret = lwis_platform_device_enable(lwis_dev);
+	ret = power_up_begin(lwis_dev);
 	if (ret) {
-		dev_err(lwis_dev->dev, "Platform-specific device enable fail: %d\n", ret);
 		goto error_power_up;
 	}
 
-	if (lwis_dev->clocks) {
-		/* Enable clocks */
-		ret = lwis_clock_enable_all(lwis_dev->clocks);
-		if (ret) {
-			dev_err(lwis_dev->dev, "Error enabling clocks (%d)\n", ret);
-			goto error_power_up;
-		}
-	}
-
-	if (lwis_dev->type == DEVICE_TYPE_I2C) {
-		mutex_lock(lwis_dev->global_i2c_lock);
-	}
+	i2c_power_lock(lwis_dev);
 	if (lwis_dev->power_up_seqs_present) {
 		ret = lwis_dev_power_up_by_seqs(lwis_dev);
 		if (ret) {
 			dev_err(lwis_dev->dev, "Error lwis_dev_power_up_by_seqs (%d)\n", ret);
-			if (lwis_dev->type == DEVICE_TYPE_I2C) {
-				mutex_unlock(lwis_dev->global_i2c_lock);
-			}
+			i2c_power_unlock(lwis_dev);
 			goto error_power_up;
 		}
 	} else {
 		ret = lwis_dev_power_up_by_default(lwis_dev);
 		if (ret) {
 			dev_err(lwis_dev->dev, "Error lwis_dev_power_up_by_default (%d)\n", ret);
-			if (lwis_dev->type == DEVICE_TYPE_I2C) {
-				mutex_unlock(lwis_dev->global_i2c_lock);
-			}
+			i2c_power_unlock(lwis_dev);
 			goto error_power_up;
 		}
 	}
-	if (lwis_dev->type == DEVICE_TYPE_I2C) {
-		mutex_unlock(lwis_dev->global_i2c_lock);
+	i2c_power_unlock(lwis_dev);
+
+	ret = power_up_end(lwis_dev);
+	if (ret) {
+		goto error_power_up;
+	}
+
+	/* Sleeping to make sure all pins are ready to go */
+	usleep_range(POWER_UP_SETTLE_US, POWER_UP_SETTLE_US);
+	return 0;
+
+	/* Error handling */
+error_power_up:
+	lwis_dev_power_down_locked(lwis_dev);
+	return ret;
+}
+
+/*
+ *  struct power_group_dev
+ *  Progress of one entry of lwis_dev_power_up_group().
+ */
+struct power_group_dev {
+	struct lwis_power_group_entry *entry;
+	enum power_group_state state;
+	/* Next step of the power up sequence to run */
+	int next_step;
+	/* Time the delay of the last step or the final settle time elapses */
+	ktime_t ready_time;
+	/* Set while the i2c power locks of the device are held */
+	bool i2c_locked;
+	/* Set when a failed power up must be undone once the group finishes */
+	bool needs_power_down;
+};
+
+/*
+ *  power_group_start: Take the locks of an entry and begin its power up.
+ *  Returns -EBUSY when a lock is held elsewhere, the group never sleeps on a
+ *  lock since it may hold the locks of other devices.
+ */
+static int power_group_start(struct power_group_dev *pd)
+{
+	struct lwis_client *client = pd->entry->client;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+	int ret;
+
+	if (client->is_enabled) {
+		pd->state = POWER_GROUP_DONE;
+		return 0;
+	}
+	if (!mutex_trylock(&lwis_dev->client_lock)) {
+		return -EBUSY;
+	}
+	/* The client may be enabled by its own ioctls meanwhile, check again
+	 * with the lock held */
+	if (client->is_enabled) {
+		mutex_unlock(&lwis_dev->client_lock);
+		pd->state = POWER_GROUP_DONE;
+		return 0;
+	}
+	if (lwis_dev->enabled > 0 && lwis_dev->enabled < INT_MAX) {
+		lwis_dev->enabled++;
+		client->is_enabled = true;
+		mutex_unlock(&lwis_dev->client_lock);
+		pd->state = POWER_GROUP_DONE;
+		return 0;
+	} else if (lwis_dev->enabled == INT_MAX) {
+		dev_err(lwis_dev->dev, "Enable counter overflow\n");
+		mutex_unlock(&lwis_dev->client_lock);
+		return -EINVAL;
+	}
+	if (lwis_dev_power_down_cancel_locked(lwis_dev)) {
+		lwis_client_event_queue_clear(client);
+		lwis_dev->enabled++;
+		client->is_enabled = true;
+		mutex_unlock(&lwis_dev->client_lock);
+		dev_info(lwis_dev->dev, "Device enabled, power down canceled\n");
+		pd->state = POWER_GROUP_DONE;
+		return 0;
+	}
+	if (lwis_dev->type == DEVICE_TYPE_I2C && lwis_dev->i2c_bus_lock == NULL) {
+		dev_err(lwis_dev->dev, "i2c_bus_lock is NULL. Abort power up.\n");
+		mutex_unlock(&lwis_dev->client_lock);
+		return -EINVAL;
+	}
+	if (!i2c_power_trylock(lwis_dev)) {
+		mutex_unlock(&lwis_dev->client_lock);
+		return -EBUSY;
 	}
+	pd->i2c_locked = true;
 
-	if (lwis_dev->phys) {
-		/* Power on the PHY */
-		ret = lwis_phy_set_power_all(lwis_dev->phys,
-					     /* power_on = */ true);
-		if (ret) {
-			dev_err(lwis_dev->dev, "Error powering on PHY\n");
-			goto error_power_up;
-		}
+	/* Clear event queue to make sure there is no stale event from
+	 * previous session */
+	lwis_client_event_queue_clear(client);
+
+	ret = power_up_begin(lwis_dev);
+	if (ret) {
+		pd->needs_power_down = true;
+		return ret;
 	}
 
-	if (lwis_dev->vops.device_enable) {
-		ret = lwis_dev->vops.device_enable(lwis_dev);
+	pd->state = POWER_GROUP_SEQUENCING;
+	pd->next_step = 0;
+	pd->ready_time = ktime_get();
+	return 0;
+}
+
+/*
+ *  power_group_step: Run the next power up step of an entry whose previous
+ *  delay elapsed.
+ */
+static int power_group_step(struct power_group_dev *pd)
+{
+	struct lwis_device *lwis_dev = pd->entry->client->lwis_dev;
+	struct lwis_device_power_sequence_list *list = lwis_dev->power_up_sequence;
+	int ret;
+
+	if (lwis_dev->power_up_seqs_present) {
+		if (list == NULL || list->count == 0) {
+			dev_err(lwis_dev->dev, "No power_up_sequence defined\n");
+			return -EINVAL;
+		}
+		if (pd->next_step < list->count) {
+			ret = power_up_seq_step(lwis_dev, pd->next_step);
+			if (ret) {
+				dev_err(lwis_dev->dev, "Error lwis_dev_power_up_by_seqs (%d)\n",
+					ret);
+				return ret;
+			}
+			pd->ready_time =
+				ktime_add_us(ktime_get(), list->seq_info[pd->next_step].delay_us);
+			pd->next_step++;
+			return 0;
+		}
+	} else {
+		ret = lwis_dev_power_up_by_default(lwis_dev);
 		if (ret) {
-			dev_err(lwis_dev->dev, "Error executing device enable function\n");
-			goto error_power_up;
+			dev_err(lwis_dev->dev, "Error lwis_dev_power_up_by_default (%d)\n", ret);
+			return ret;
 		}
 	}
 
-	/* Sleeping to make sure all pins are ready to go */
-	usleep_range(2000, 2000);
+	i2c_power_unlock(lwis_dev);
+	pd->i2c_locked = false;
+
+	ret = power_up_end(lwis_dev);
+	if (ret) {
+		return ret;
+	}
+	pd->state = POWER_GROUP_SETTLING;
+	pd->ready_time = ktime_add_us(ktime_get(), POWER_UP_SETTLE_US);
+	return 0;
+}
+
+static void power_group_fail(struct power_group_dev *pd, int error)
+{
+	struct lwis_device *lwis_dev = pd->entry->client->lwis_dev;
+
+	if (pd->i2c_locked) {
+		i2c_power_unlock(lwis_dev);
+		pd->i2c_locked = false;
+	}
+	if (pd->state != POWER_GROUP_PENDING) {
+		pd->needs_power_down = true;
+	}
+	pd->entry->error = error;
+	pd->state = POWER_GROUP_FAILED;
+}
+
+int lwis_dev_power_down_deferred_locked(struct lwis_device *lwis_dev)
+{
+	if (lwis_dev->power_down_delay_ms == 0) {
+		return lwis_dev_power_down_locked(lwis_dev);
+	}
+
+	lwis_dev->power_down_pending = true;
+	schedule_delayed_work(&lwis_dev->power_down_work,
+			      msecs_to_jiffies(lwis_dev->power_down_delay_ms));
+	dev_info(lwis_dev->dev, "Power down deferred by %u ms\n", lwis_dev->power_down_delay_ms);
 	return 0;
+}
 
-	/* Error handling */
-error_power_up:
-	lwis_dev_power_down_locked(lwis_dev);
+bool lwis_dev_power_down_cancel_locked(struct lwis_device *lwis_dev)
+{
+	if (!lwis_dev->power_down_pending) {
+		return false;
+	}
+
+	/* The work may already be running and waiting for client_lock, it
+	   skips the power down once it sees power_down_pending cleared */
+	lwis_dev->power_down_pending = false;
+	cancel_delayed_work(&lwis_dev->power_down_work);
+	return true;
+}
+
+int lwis_dev_power_down_flush_locked(struct lwis_device *lwis_dev)
+{
+	if (!lwis_dev_power_down_cancel_locked(lwis_dev)) {
+		return 0;
+	}
+	return lwis_dev_power_down_locked(lwis_dev);
+}
+
+static void power_down_work_func(struct work_struct *work)
+{
+	struct lwis_device *lwis_dev =
+		container_of(to_delayed_work(work), struct lwis_device, power_down_work);
+	int ret;
+
+	mutex_lock(&lwis_dev->client_lock);
+	if (lwis_dev->power_down_pending && lwis_dev->enabled == 0) {
+		lwis_dev->power_down_pending = false;
+		ret = lwis_dev_power_down_locked(lwis_dev);
+		if (ret < 0) {
+			dev_err(lwis_dev->dev, "Failed to power down device\n");
+		}
+	}
+	mutex_unlock(&lwis_dev->client_lock);
+}
+
+int lwis_dev_power_up_group(struct lwis_power_group_entry *entries, int num_entries)
+{
+	struct power_group_dev *pds;
+	struct power_group_dev *pd;
+	struct lwis_device *lwis_dev;
+	ktime_t now;
+	ktime_t wake;
+	s64 sleep_us;
+	bool progress;
+	int active;
+	int ret = 0;
+	int i;
+
+	pds = kcalloc(num_entries, sizeof(struct power_group_dev), GFP_KERNEL);
+	if (!pds) {
+		return -ENOMEM;
+	}
+	for (i = 0; i < num_entries; ++i) {
+		pds[i].entry = &entries[i];
+		pds[i].state = POWER_GROUP_PENDING;
+		entries[i].error = 0;
+	}
+
+	do {
+		now = ktime_get();
+		wake = KTIME_MAX;
+		progress = false;
+		active = 0;
+
+		for (i = 0; i < num_entries; ++i) {
+			pd = &pds[i];
+			lwis_dev = pd->entry->client->lwis_dev;
+
+			if (pd->state == POWER_GROUP_PENDING) {
+				if (pd->entry->depends_on >= 0) {
+					enum power_group_state dep_state =
+						pds[pd->entry->depends_on].state;
+
+					if (dep_state == POWER_GROUP_FAILED) {
+						power_group_fail(pd, -ECANCELED);
+						continue;
+					}
+					if (dep_state != POWER_GROUP_DONE) {
+						active++;
+						continue;
+					}
+				}
+				ret = power_group_start(pd);
+				if (ret == -EBUSY) {
+					wake = min(wake, ktime_add_us(now, POWER_GROUP_RETRY_US));
+				} else if (ret) {
+					power_group_fail(pd, ret);
+					continue;
+				} else {
+					progress = true;
+				}
+			} else if (pd->state == POWER_GROUP_SEQUENCING) {
+				if (ktime_before(now, pd->ready_time)) {
+					wake = min(wake, pd->ready_time);
+				} else {
+					ret = power_group_step(pd);
+					if (ret) {
+						power_group_fail(pd, ret);
+						continue;
+					}
+					progress = true;
+				}
+			} else if (pd->state == POWER_GROUP_SETTLING) {
+				if (ktime_before(now, pd->ready_time)) {
+					wake = min(wake, pd->ready_time);
+				} else {
+					lwis_dev->enabled++;
+					pd->entry->client->is_enabled = true;
+					mutex_unlock(&lwis_dev->client_lock);
+					dev_info(lwis_dev->dev, "Device enabled\n");
+					pd->state = POWER_GROUP_DONE;
+					progress = true;
+				}
+			}
+			if (pd->state != POWER_GROUP_DONE && pd->state != POWER_GROUP_FAILED) {
+				active++;
+			}
+		}
+
+		/* Sleep until the earliest delay elapses, overlapping the delays of
+		   every device in the group */
+		if (active > 0 && !progress) {
+			if (wake == KTIME_MAX) {
+				wake = ktime_add_us(now, POWER_GROUP_RETRY_US);
+			}
+			sleep_us = ktime_us_delta(wake, ktime_get());
+			if (sleep_us > 0) {
+				usleep_range(sleep_us, sleep_us);
+			}
+		}
+	} while (active > 0);
+
+	/* Undo failed power ups now that no other lock of the group is held */
+	ret = 0;
+	for (i = 0; i < num_entries; ++i) {
+		pd = &pds[i];
+		if (pd->needs_power_down) {
+			lwis_dev = pd->entry->client->lwis_dev;
+			lwis_dev_power_down_locked(lwis_dev);
+			mutex_unlock(&lwis_dev->client_lock);
+		}
+		if (pd->entry->error && !ret) {
+			ret = pd->entry->error;
+		}
+	}
+
+	kfree(pds);
 	return ret;
 }
 
+struct file *lwis_client_fget(int fd)
+{
+	struct file *fp;
+
+	fp = fget(fd);
+	if (!fp) {
+		return ERR_PTR(-EBADF);
+	}
+	if (fp->f_op != &lwis_fops) {
+		fput(fp);
+		return ERR_PTR(-EINVAL);
+	}
+	return fp;
+}
+
 static int lwis_dev_power_down_by_seqs(struct lwis_device *lwis_dev)
 {
 	struct lwis_device_power_sequence_list *list;
@@ -790,7 +1389,7 @@ static int lwis_dev_power_down_by_seqs(struct lwis_device *lwis_dev)
 					if ((lwis_dev->id != lwis_dev_it->id) &&
 					    (lwis_dev_it->shared_pinctrl ==
 					     lwis_dev->shared_pinctrl) &&
-					    lwis_dev_it->enabled) {
+					    dev_is_powered(lwis_dev_it)) {
 						/*
 						 * Move mclk owner to the device who
 						 * still using it
@@ -847,7 +1446,7 @@ static int lwis_dev_power_down_by_default(struct lwis_device *lwis_dev)
 			list_for_each_entry (lwis_dev_it, &core.lwis_dev_list, dev_list) {
 				if ((lwis_dev->id != lwis_dev_it->id) &&
 				    (lwis_dev_it->shared_pinctrl == lwis_dev->shared_pinctrl) &&
-				    lwis_dev_it->enabled) {
+				    dev_is_powered(lwis_dev_it)) {
 					/*
 					 * Move mclk owner to the device who
 					 * still using it
@@ -946,6 +1545,11 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 		}
 	}
 
+	/* Registers are back to their reset values on the next power up */
+	if (lwis_dev->vops.register_cache_invalidate) {
+		lwis_dev->vops.register_cache_invalidate(lwis_dev);
+	}
+
 	if (lwis_dev->phys) {
 		/* Power on the PHY */
 		ret = lwis_phy_set_power_all(lwis_dev->phys,
@@ -956,9 +1560,7 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 		}
 	}
 
-	if (lwis_dev->type == DEVICE_TYPE_I2C && lwis_dev->global_i2c_lock != NULL) {
-		mutex_lock(lwis_dev->global_i2c_lock);
-	}
+	i2c_power_lock(lwis_dev);
 	if (lwis_dev->power_down_seqs_present) {
 		ret = lwis_dev_power_down_by_seqs(lwis_dev);
 		if (ret) {
@@ -972,9 +1574,7 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 			last_error = ret;
 		}
 	}
-	if (lwis_dev->type == DEVICE_TYPE_I2C && lwis_dev->global_i2c_lock != NULL) {
-		mutex_unlock(lwis_dev->global_i2c_lock);
-	}
+	i2c_power_unlock(lwis_dev);
 
 	if (lwis_dev->clocks) {
 		/* Disable all clocks */
@@ -983,6 +1583,8 @@ int lwis_dev_power_down_locked(struct lwis_device *lwis_dev)
 
 	/* Let's do the platform-specific disable call */
 	ret = lwis_platform_device_disable(lwis_dev);
+	/* The platform dropped the votes of the device */
+	lwis_dpm_votes_invalidate(lwis_dev);
 	if (ret) {
 		dev_err(lwis_dev->dev, "Platform-specific device disable fail: %d\n", ret);
 		last_error = ret;
@@ -1117,7 +1719,7 @@ bool lwis_i2c_dev_is_in_use(struct lwis_device *lwis_dev)
 			struct lwis_i2c_device *i2c_dev_it = (struct lwis_i2c_device *)lwis_dev_it;
 			/* Look up if i2c bus are still in use by other device*/
 			if ((i2c_dev_it->state_pinctrl == i2c_dev->state_pinctrl) &&
-			    (i2c_dev_it != i2c_dev) && lwis_dev_it->enabled) {
+			    (i2c_dev_it != i2c_dev) && dev_is_powered(lwis_dev_it)) {
 				mutex_unlock(&core.lock);
 				return true;
 			}
@@ -1127,6 +1729,50 @@ bool lwis_i2c_dev_is_in_use(struct lwis_device *lwis_dev)
 	return false;
 }
 
+/*
+ *  i2c_lock_find_or_create_locked: Return the power lock matching the adapter
+ *  and group, allocating it on first use. core.lock should be held.
+ */
+static struct mutex *i2c_lock_find_or_create_locked(struct i2c_adapter *adapter, uint32_t group)
+{
+	struct lwis_i2c_lock *i2c_lock;
+
+	list_for_each_entry (i2c_lock, &core.i2c_lock_list, node) {
+		if (i2c_lock->adapter == adapter && i2c_lock->group == group) {
+			return &i2c_lock->lock;
+		}
+	}
+
+	i2c_lock = kzalloc(sizeof(struct lwis_i2c_lock), GFP_KERNEL);
+	if (!i2c_lock) {
+		return NULL;
+	}
+	i2c_lock->adapter = adapter;
+	i2c_lock->group = group;
+	mutex_init(&i2c_lock->lock);
+	list_add_tail(&i2c_lock->node, &core.i2c_lock_list);
+	return &i2c_lock->lock;
+}
+
+int lwis_i2c_dev_locks_get(struct lwis_device *lwis_dev, struct i2c_adapter *adapter,
+			   uint32_t group)
+{
+	int ret = 0;
+
+	mutex_lock(&core.lock);
+	lwis_dev->i2c_bus_lock = i2c_lock_find_or_create_locked(adapter, 0);
+	lwis_dev->i2c_group_lock = NULL;
+	if (lwis_dev->i2c_bus_lock && group != 0) {
+		lwis_dev->i2c_group_lock = i2c_lock_find_or_create_locked(NULL, group);
+	}
+	if (!lwis_dev->i2c_bus_lock || (group != 0 && !lwis_dev->i2c_group_lock)) {
+		lwis_dev->i2c_bus_lock = NULL;
+		ret = -ENOMEM;
+	}
+	mutex_unlock(&core.lock);
+	return ret;
+}
+
 /*
  *  lwis_base_probe: Create a device instance for each of the LWIS device.
  */
@@ -1152,7 +1798,8 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
 	/* Initialize client mutex */
 	mutex_init(&lwis_dev->client_lock);
 
-	lwis_dev->global_i2c_lock = &core.global_i2c_lock;
+	INIT_DELAYED_WORK(&lwis_dev->power_down_work, power_down_work_func);
+	INIT_LIST_HEAD(&lwis_dev->bw_node);
 
 	/* Initialize register access mutex */
 	mutex_init(&lwis_dev->reg_rw_lock);
@@ -1165,6 +1812,7 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
 
 	/* Initialize the spinlock */
 	spin_lock_init(&lwis_dev->lock);
+	init_waitqueue_head(&lwis_dev->event_wait_queue);
 
 	if (lwis_dev->type == DEVICE_TYPE_TOP) {
 		lwis_dev->top_dev = lwis_dev;
@@ -1181,6 +1829,12 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
 	list_add(&lwis_dev->dev_list, &core.lwis_dev_list);
 	mutex_unlock(&core.lock);
 
+	ret = lwis_stats_init(lwis_dev);
+	if (ret) {
+		goto error_init;
+	}
+	lwis_ioctl_trace_init(&lwis_dev->ioctl_trace);
+
 	lwis_dev->plat_dev = plat_dev;
 	ret = lwis_base_setup(lwis_dev);
 	if (ret) {
@@ -1188,6 +1842,23 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
 		goto error_init;
 	}
 
+	ret = lwis_rt_worker_create(lwis_dev);
+	if (ret) {
+		goto error_init;
+	}
+
+	ret = lwis_buffer_pool_create(lwis_dev);
+	if (ret) {
+		goto error_init;
+	}
+
+	ret = lwis_event_history_init(&lwis_dev->debug_info.event_hist,
+				      lwis_dev->event_history_depth);
+	if (ret) {
+		pr_err("Failed to allocate the event history\n");
+		goto error_init;
+	}
+
 	/* Upon success initialization, create device for this instance */
 	lwis_dev->dev = device_create(core.dev_class, NULL, MKDEV(core.device_major, lwis_dev->id),
 				      lwis_dev, LWIS_DEVICE_NAME "-%s", lwis_dev->name);
@@ -1203,7 +1874,6 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
 	lwis_platform_probe(lwis_dev);
 
 	lwis_device_debugfs_setup(lwis_dev, core.dbg_root);
-	memset(&lwis_dev->debug_info, 0, sizeof(lwis_dev->debug_info));
 
 	dev_info(lwis_dev->dev, "Base Probe: Success\n");
 
@@ -1225,6 +1895,9 @@ void lwis_base_unprobe(struct lwis_device *unprobe_lwis_dev)
 {
 	struct lwis_device *lwis_dev, *temp;
 
+	/* Run a deferred power down before the device goes away */
+	flush_delayed_work(&unprobe_lwis_dev->power_down_work);
+
 	mutex_lock(&core.lock);
 	list_for_each_entry_safe (lwis_dev, temp, &core.lwis_dev_list, dev_list) {
 		if (lwis_dev == unprobe_lwis_dev) {
@@ -1264,6 +1937,18 @@ void lwis_base_unprobe(struct lwis_device *unprobe_lwis_dev)
 				lwis_gpios_list_free(lwis_dev->gpios_list);
 				lwis_dev->gpios_list = NULL;
 			}
+			/* Stop the real-time worker */
+			if (lwis_dev->rt_worker) {
+				kthread_destroy_worker(lwis_dev->rt_worker);
+				lwis_dev->rt_worker = NULL;
+			}
+			/* Release the pooled buffers */
+			lwis_buffer_pool_destroy(lwis_dev);
+			/* Release the statistics and event history, after the
+			 * interrupts */
+			lwis_stats_free(lwis_dev);
+			lwis_event_history_free(&lwis_dev->debug_info.event_hist);
+			lwis_ioctl_trace_free(&lwis_dev->ioctl_trace);
 			/* Destroy device */
 			if (!IS_ERR(lwis_dev->dev)) {
 				device_destroy(core.dev_class,
@@ -1396,12 +2081,18 @@ static int __init lwis_base_device_init(void)
 	/* Initialize the core struct */
 	memset(&core, 0, sizeof(struct lwis_core));
 	mutex_init(&core.lock);
-	mutex_init(&core.global_i2c_lock);
+	INIT_LIST_HEAD(&core.i2c_lock_list);
+
+	ret = lwis_transaction_module_init();
+	if (ret) {
+		pr_err("Failed to lwis_transaction_module_init (%d)\n", ret);
+		return ret;
+	}
 
 	ret = lwis_register_base_device();
 	if (ret) {
 		pr_err("Failed to register LWIS base (%d)\n", ret);
-		return ret;
+		goto base_failure;
 	}
 
 	ret = lwis_top_device_init();
@@ -1446,6 +2137,8 @@ ioreg_failure:
 	lwis_top_device_deinit();
 top_failure:
 	lwis_unregister_base_device();
+base_failure:
+	lwis_transaction_module_deinit();
 	return ret;
 }
 
@@ -1457,11 +2150,14 @@ static void __exit lwis_driver_exit(void)
 	struct lwis_device *lwis_dev, *temp;
 	struct lwis_client *client, *client_temp;
 	struct lwis_i2c_device *i2c_dev;
+	struct lwis_i2c_lock *i2c_lock, *i2c_lock_temp;
 
 	pr_info("%s Clean up LWIS devices.\n", __func__);
 	list_for_each_entry_safe (lwis_dev, temp, &core.lwis_dev_list, dev_list) {
 		pr_info("Destroy device %s id %d", lwis_dev->name, lwis_dev->id);
 		lwis_device_debugfs_cleanup(lwis_dev);
+		/* Run a deferred power down */
+		flush_delayed_work(&lwis_dev->power_down_work);
 		/* Disable lwis device events */
 		lwis_device_event_enable(lwis_dev, LWIS_EVENT_ID_HEARTBEAT, false);
 		if (lwis_dev->type == DEVICE_TYPE_I2C) {
@@ -1473,6 +2169,16 @@ static void __exit lwis_driver_exit(void)
 			if (lwis_release_client(client))
 				pr_info("Failed to release client.");
 		}
+		/* Once the clients, whose cleanup transactions still transfer, are gone */
+		if (lwis_dev->type == DEVICE_TYPE_I2C)
+			lwis_i2c_transfer_deinit((struct lwis_i2c_device *)lwis_dev);
+		/* Stop the real-time worker */
+		if (lwis_dev->rt_worker) {
+			kthread_destroy_worker(lwis_dev->rt_worker);
+			lwis_dev->rt_worker = NULL;
+		}
+		/* Release the pooled buffers */
+		lwis_buffer_pool_destroy(lwis_dev);
 		pm_runtime_disable(&lwis_dev->plat_dev->dev);
 		/* Release device clock list */
 		if (lwis_dev->clocks)
@@ -1501,12 +2207,22 @@ static void __exit lwis_driver_exit(void)
 		/* Release event subscription components */
 		if (lwis_dev->type == DEVICE_TYPE_TOP)
 			lwis_dev->top_dev->subscribe_ops.release(lwis_dev);
+		/* Release the statistics and event history, after the interrupts */
+		lwis_stats_free(lwis_dev);
+		lwis_event_history_free(&lwis_dev->debug_info.event_hist);
+		lwis_ioctl_trace_free(&lwis_dev->ioctl_trace);
 		/* Destroy device */
 		device_destroy(core.dev_class, MKDEV(core.device_major, lwis_dev->id));
 		list_del(&lwis_dev->dev_list);
 		kfree(lwis_dev);
 	}
 
+	/* Release I2C power locks */
+	list_for_each_entry_safe (i2c_lock, i2c_lock_temp, &core.i2c_lock_list, node) {
+		list_del(&i2c_lock->node);
+		kfree(i2c_lock);
+	}
+
 	/* Deinit device classes */
 	lwis_dpm_device_deinit();
 	lwis_slc_device_deinit();
@@ -1516,6 +2232,9 @@ static void __exit lwis_driver_exit(void)
 
 	/* Unregister base lwis device */
 	lwis_unregister_base_device();
+
+	/* Release the read buffers of the transactions freed with the clients */
+	lwis_transaction_module_deinit();
 }
 
 subsys_initcall(lwis_base_device_init);
@@ -17,21 +17,31 @@
 #include <linux/hashtable.h>
 #include <linux/idr.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/mutex.h>
 #include <linux/platform_device.h>
 #include <linux/poll.h>
+#include <linux/rbtree.h>
+#include <linux/shrinker.h>
 #include <linux/workqueue.h>
+#include <linux/xarray.h>
 
 #include "lwis_clock.h"
 #include "lwis_commands.h"
 #include "lwis_event.h"
+#include "lwis_event_history.h"
 #include "lwis_gpio.h"
 #include "lwis_interrupt.h"
+#include "lwis_ioctl_trace.h"
+#include "lwis_latency.h"
 #include "lwis_phy.h"
 #include "lwis_regulator.h"
+#include "lwis_stats.h"
 #include "lwis_transaction.h"
 
+struct i2c_adapter;
+
 #define LWIS_TOP_DEVICE_COMPAT "google,lwis-top-device"
 #define LWIS_I2C_DEVICE_COMPAT "google,lwis-i2c-device"
 #define LWIS_IOREG_DEVICE_COMPAT "google,lwis-ioreg-device"
@@ -39,10 +49,16 @@
 #define LWIS_DPM_DEVICE_COMPAT "google,lwis-dpm-device"
 
 #define EVENT_HASH_BITS 8
-#define BUFFER_HASH_BITS 8
-#define TRANSACTION_HASH_BITS 8
-#define PERIODIC_IO_HASH_BITS 8
+/* Clients only use a few events, trigger events, DMA addresses and periods
+ * each, and their tables are cleared on every open */
+#define CLIENT_EVENT_HASH_BITS 5
+#define BUFFER_HASH_BITS 6
+#define TRANSACTION_HASH_BITS 5
+#define PERIODIC_IO_HASH_BITS 3
+#define UPLOADED_IO_HASH_BITS 4
 #define BTS_UNSUPPORTED -1
+/* Clients beyond this get no listener slot, see lwis_device_event_state */
+#define LWIS_MAX_CLIENT_SLOTS BITS_PER_LONG
 
 /* Forward declaration for lwis_device. This is needed for the declaration for
    lwis_device_subclass_operations data struct. */
@@ -51,6 +67,12 @@ struct lwis_device;
 /* Forward declaration of a platform specific struct used by platform funcs */
 struct lwis_platform;
 
+/* Forward declaration of the subclass specific compiled form of io entries */
+struct lwis_io_program;
+
+/* Forward declaration of the pool of freed allocated buffers */
+struct lwis_buffer_pool;
+
 /*
  *  struct lwis_core
  *  This struct applies to all LWIS devices that are defined in the
@@ -61,7 +83,8 @@ struct lwis_core {
 	struct idr *idr;
 	struct cdev *chr_dev;
 	struct mutex lock;
-	struct mutex global_i2c_lock;
+	/* Power locks shared by I2C devices, guarded by lock */
+	struct list_head i2c_lock_list;
 	dev_t lwis_devt;
 	int device_major;
 	struct list_head lwis_dev_list;
@@ -80,6 +103,39 @@ struct lwis_device_subclass_operations {
 	/* Called by lwis_device when a read/write memory barrier needs to be inserted */
 	int (*register_io_barrier)(struct lwis_device *lwis_dev, bool use_read_barrier,
 				   bool use_write_barrier);
+	/* Called by lwis_device when entries[0] is a LWIS_IO_ENTRY_WRITE, to let the
+	 * device send it together with the consecutive writes following it as one
+	 * burst. Returns the number of entries written, or a negative error code */
+	int (*register_write_burst)(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				    int num_entries);
+	/* Called by lwis_device to execute a run of READ, READ_BATCH, WRITE and
+	 * WRITE_BATCH entries with as few bus operations as possible. The number
+	 * of entries fully executed is stored in num_completed, also on error */
+	int (*register_io_group)(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				 int num_entries, int *num_completed);
+	/* Called by lwis_device when io entries are submitted for repeated
+	 * execution, to resolve and validate their register accesses once. The
+	 * program is released with kfree. Returns NULL if the entries cannot be
+	 * compiled, in which case they are executed through register_io */
+	struct lwis_io_program *(*register_io_compile)(struct lwis_device *lwis_dev,
+						       struct lwis_io_entry *entries,
+						       int num_entries);
+	/* Called by lwis_device to execute the READ, READ_BATCH, WRITE and
+	 * WRITE_BATCH entries [first, first + num_entries) of a compiled program.
+	 * The number of entries fully executed is stored in num_completed */
+	int (*register_io_program_run)(struct lwis_device *lwis_dev,
+				       struct lwis_io_program *program,
+				       struct lwis_io_entry *entries, int first, int num_entries,
+				       int *num_completed);
+	/* Called by lwis_device instead of locking reg_rw_lock around the
+	 * execution of io entries, for devices whose register blocks are
+	 * accessed independently. Returns the locks taken for register_unlock */
+	unsigned long (*register_lock)(struct lwis_device *lwis_dev,
+				       struct lwis_io_entry *entries, int num_entries);
+	void (*register_unlock)(struct lwis_device *lwis_dev, unsigned long locked);
+	/* Called by lwis_device when the device register state is lost, on
+	 * power down and reset, to drop any shadow of the register values */
+	void (*register_cache_invalidate)(struct lwis_device *lwis_dev);
 	/* called by lwis_device when enabling the device */
 	int (*device_enable)(struct lwis_device *lwis_dev);
 	/* called by lwis_device when disabling the device */
@@ -155,8 +211,18 @@ struct lwis_client_debug_info {
  */
 #define EVENT_DEBUG_HISTORY_SIZE 16
 struct lwis_device_debug_info {
-	struct lwis_device_event_state_history event_hist[EVENT_DEBUG_HISTORY_SIZE];
-	int cur_event_hist_idx;
+	/* Emitted events, of which dev_info shows the last
+	 * EVENT_DEBUG_HISTORY_SIZE and event_history streams all */
+	struct lwis_event_history event_hist;
+};
+
+/*
+ *  struct lwis_dma_address_reg
+ *  Register of a device that takes a DMA address.
+ */
+struct lwis_dma_address_reg {
+	int bid;
+	uint64_t offset;
 };
 
 /*
@@ -190,20 +256,34 @@ struct lwis_device {
 	int enabled;
 	/* Mutex used to synchronize access between clients */
 	struct mutex client_lock;
-	/* Mutex shared by all I2C devices */
-	struct mutex *global_i2c_lock;
+	/* Mutex shared by the I2C devices on the same adapter */
+	struct mutex *i2c_bus_lock;
+	/* Mutex shared by the I2C devices in the same lock group, may be NULL */
+	struct mutex *i2c_group_lock;
 	/* Spinlock used to synchronize access to the device struct */
 	spinlock_t lock;
 	/* List of clients opened for this device */
 	struct list_head clients;
+	/* Clients indexed by their event listener slot */
+	struct lwis_client __rcu *client_slots[LWIS_MAX_CLIENT_SLOTS];
+	unsigned long used_client_slots;
+	/* Clients without a slot, emitting visits every client while non-zero */
+	int num_unslotted_clients;
 	/* Hash table of device-specific per-event state/control data */
 	DECLARE_HASHTABLE(event_states, EVENT_HASH_BITS);
 	/* Virtual function table for sub classes */
 	struct lwis_device_subclass_operations vops;
 	/* Does the device have IOMMU. TODO: Move to platform */
 	bool has_iommu;
-	/* Mutex used to synchronize register access between clients */
+	/* Mutex used to synchronize register access between clients, unless
+	 * vops.register_lock is set */
 	struct mutex reg_rw_lock;
+	/* Set, under reg_rw_lock, while executing entries that skip writes of
+	 * unchanged values */
+	bool skip_unchanged_writes;
+	/* Woken up by the events of this device, for the poll entries waiting
+	 * on them */
+	wait_queue_head_t event_wait_queue;
 	/* Heartbeat timer structure */
 	struct timer_list heartbeat_timer;
 	/* Register-related properties */
@@ -219,14 +299,37 @@ struct lwis_device {
 	struct dentry *dbg_event_file;
 	struct dentry *dbg_transaction_file;
 	struct dentry *dbg_buffer_file;
+	struct dentry *dbg_latency_file;
+	struct dentry *dbg_stats_file;
+	struct dentry *dbg_event_history_file;
+	struct dentry *dbg_ioctl_trace_file;
 #endif
 	/* Structure to store info to help debugging device data */
 	struct lwis_device_debug_info debug_info;
+	/* Latency histograms of all the clients of the device */
+	struct lwis_latency_stats latency;
+	/* Cumulative I/O and error counters, per CPU */
+	struct lwis_stats __percpu *stats;
+	/* Recording of the ioctls of the clients, enabled through debugfs */
+	struct lwis_ioctl_trace ioctl_trace;
 
 	/* clock family this device belongs to */
 	int clock_family;
 	/* index to bandwidth traffic shaper */
 	int bts_index;
+	/* Last bandwidth voted to BTS as peak, read, write and rt, valid if
+	 * bts_vote_valid, guarded by the DPM vote lock */
+	bool bts_vote_valid;
+	unsigned int bts_vote[4];
+	/* Last QoS vote in KHz per clock family, valid for the families set in
+	 * qos_voted, guarded by the DPM vote lock */
+	unsigned long qos_voted;
+	int qos_vote_khz[NUM_CLOCK_FAMILY];
+	/* Bandwidth requested as peak, read, write and rt in the pipeline totals
+	 * of the top device, and node in its list of requesting devices,
+	 * guarded by the top device bw_lock */
+	unsigned int bw_request[4];
+	struct list_head bw_node;
 	/* BTS scenario name */
 	const char *bts_scenario_name;
 	/* BTS scenario index */
@@ -245,6 +348,40 @@ struct lwis_device {
 
 	/* Power management hibernation state of the device */
 	int pm_hibernation;
+	/* Time the device stays powered once disabled by its last client, in
+	 * case it is enabled again, 0 to power down right away */
+	uint32_t power_down_delay_ms;
+	/* Number of iterations of a repeating transaction that can be in
+	 * flight, at most BITS_PER_LONG */
+	uint32_t transaction_instance_pool_size;
+	/* Set while the device is disabled but its power down is deferred,
+	 * guarded by client_lock */
+	bool power_down_pending;
+	/* Work powering down the device once power_down_delay_ms elapses */
+	struct delayed_work power_down_work;
+	/* Real-time worker running the deferred periodic IO work and
+	 * run_at_real_time transactions, and the other transactions if
+	 * rt_worker_transactions is set, of all clients */
+	struct kthread_worker *rt_worker;
+	/* The device has rt_worker, which runs at the sched_set_fifo() priority */
+	bool rt_worker_enabled;
+	/* CPU rt_worker is bound to, negative if unbound */
+	int rt_worker_cpu;
+	bool rt_worker_transactions;
+	/* Cross-device events are emitted to this device straight from the
+	 * trigger device context instead of the top device tasklet. Only set
+	 * for devices whose register access does not sleep */
+	bool direct_event_dispatch;
+	/* Registers taking DMA addresses, the values transactions write to them
+	 * are checked against the client's enrolled buffers. None if NULL */
+	struct lwis_dma_address_reg *dma_address_regs;
+	int num_dma_address_regs;
+	/* Size in KB of the pool keeping freed allocated buffers for reuse, and
+	 * the pool itself, NULL if the size is 0 */
+	uint32_t buffer_pool_kb;
+	struct lwis_buffer_pool *buffer_pool;
+	/* Number of emitted events kept per CPU in the event history */
+	uint32_t event_history_depth;
 };
 
 /*
@@ -256,50 +393,88 @@ struct lwis_client {
 	struct mutex lock;
 	struct lwis_device *lwis_dev;
 	/* Hash table of events controlled by userspace in this client */
-	DECLARE_HASHTABLE(event_states, EVENT_HASH_BITS);
+	DECLARE_HASHTABLE(event_states, CLIENT_EVENT_HASH_BITS);
 	/* Queue of pending events to be consumed by userspace */
 	struct list_head event_queue;
 	size_t event_queue_size;
 	struct list_head error_event_queue;
 	size_t error_event_queue_size;
+	/* Optional event ring mapped by userspace, used instead of event_queue */
+	struct lwis_event_ring *event_ring;
 	/* Spinlock used to synchronize access to event states and queue */
 	spinlock_t event_lock;
 	/* Event wait queue for waking up userspace */
 	wait_queue_head_t event_wait_queue;
-	/* Hash table of allocated buffers keyed by file descriptor. */
-	DECLARE_HASHTABLE(allocated_buffers, BUFFER_HASH_BITS);
+	/* Allocated buffers indexed by file descriptor */
+	struct xarray allocated_buffers;
 	/* Hash table of enrolled buffers keyed by dvaddr */
 	DECLARE_HASHTABLE(enrolled_buffers, BUFFER_HASH_BITS);
+	/* Enrolled buffers indexed by the DMA address range they span */
+	struct rb_root_cached enrolled_buffer_ranges;
+	/* Mappings of disenrolled buffers kept for re-enrollment, least recently
+	 * disenrolled first, at most buffer_cache_max of them */
+	struct list_head buffer_cache;
+	uint32_t buffer_cache_size;
+	uint32_t buffer_cache_max;
+	/* Releases cached mappings under memory pressure, registered while
+	 * buffer_cache_max is set */
+	struct shrinker buffer_cache_shrinker;
+	bool buffer_cache_shrinker_registered;
 	/* Hash table of transactions keyed by trigger event ID */
 	DECLARE_HASHTABLE(transaction_list, TRANSACTION_HASH_BITS);
-	/* Transaction task-related variables */
-	struct tasklet_struct transaction_tasklet;
-	struct workqueue_struct *transaction_wq;
-	struct work_struct transaction_work;
+	/* Transactions in transaction_list and chained ones indexed by ID,
+	 * modified with transaction_lock held */
+	struct xarray transaction_ids;
+	/* Normal priority worker processing transaction_process_queue, unless
+	 * lwis_dev->rt_worker_transactions moves it to lwis_dev->rt_worker */
+	struct kthread_worker *transaction_worker;
+	struct kthread_work transaction_work;
+	/* Processes transaction_process_queue_rt on lwis_dev->rt_worker, or
+	 * on transaction_worker if the device has none */
+	struct kthread_work transaction_rt_work;
 	/* Spinlock used to synchronize access to transaction data structs */
 	spinlock_t transaction_lock;
 	/* List of transaction triggers */
-	struct list_head transaction_process_queue_tasklet;
+	struct list_head transaction_process_queue_rt;
 	struct list_head transaction_process_queue;
 	/* Transaction counter, which also provides transacton ID */
 	int64_t transaction_counter;
+	/* Hash table of uploaded io entries keyed by handle, guarded by lock */
+	DECLARE_HASHTABLE(uploaded_io, UPLOADED_IO_HASH_BITS);
+	/* Uploaded io entries counter, which also provides their handle */
+	int64_t uploaded_io_counter;
 	/* Hash table of hrtimer keyed by time out duration */
 	DECLARE_HASHTABLE(timer_list, PERIODIC_IO_HASH_BITS);
 	/* Workqueue variables for periodic io */
 	struct workqueue_struct *periodic_io_wq;
 	struct work_struct periodic_io_work;
+	/* Used instead of periodic_io_work on lwis_dev->rt_worker */
+	struct kthread_work periodic_io_rt_work;
 	/* Spinlock used to synchronize access to periodic io data structs */
 	spinlock_t periodic_io_lock;
 	/* Queue of all periodic_io pending processing */
 	struct list_head periodic_io_process_queue;
 	/* Periodic IO counter, which also provides periodic io ID */
 	int64_t periodic_io_counter;
+	/* Optional ring mapped by userspace receiving periodic io results */
+	struct lwis_periodic_io_ring *periodic_io_ring;
 	/* Structure to store info to help debugging client data */
 	struct lwis_client_debug_info debug_info;
+	/* Latency histograms of the transactions and events of the client */
+	struct lwis_latency_stats latency;
 	/* Each device has a linked list of clients */
 	struct list_head node;
+	/* Index in lwis_dev->client_slots, or -1 if no slot was free */
+	int slot;
+	/* ID of the client in the ioctl trace, 0 until it has a record */
+	uint32_t ioctl_trace_id;
 	/* Mark if the client called device enable */
 	bool is_enabled;
+	/* Work running the device enable of LWIS_DEVICE_ENABLE_ASYNC */
+	struct work_struct enable_work;
+	/* Set until the asynchronous device enable completes, immediate
+	 * transactions are held meanwhile. Written under lwis_dev->client_lock */
+	bool enable_pending;
 };
 
 /*
@@ -313,6 +488,20 @@ int lwis_base_probe(struct lwis_device *lwis_dev, struct platform_device *plat_d
  */
 void lwis_base_unprobe(struct lwis_device *unprobe_lwis_dev);
 
+/*
+ *  lwis_client_create: Creates a client of the device, as opening the device
+ *  file does.
+ *  Returns: the client, or an error pointer
+ */
+struct lwis_client *lwis_client_create(struct lwis_device *lwis_dev);
+
+/*
+ *  lwis_release_client: Releases the client and deletes it from the client
+ *  list of the device, which must still exist. Takes the device and client
+ *  locks.
+ */
+int lwis_release_client(struct lwis_client *lwis_client);
+
 /*
  * Find LWIS top device
  */
@@ -329,12 +518,67 @@ struct lwis_device *lwis_find_dev_by_id(int dev_id);
  */
 bool lwis_i2c_dev_is_in_use(struct lwis_device *lwis_dev);
 
+/*
+ * Look up the power locks of an i2c device:
+ * The bus lock is shared with every device on the same adapter, the group
+ * lock with every device of the same non-zero lock group.
+ */
+int lwis_i2c_dev_locks_get(struct lwis_device *lwis_dev, struct i2c_adapter *adapter,
+			   uint32_t group);
+
 /*
  * Power up a LWIS device, should be called when lwis_dev->enabled is 0
  * lwis_dev->client_lock should be held before this function.
  */
 int lwis_dev_power_up_locked(struct lwis_device *lwis_dev);
 
+/*
+ * Power down a LWIS device that its last client disabled, after
+ * lwis_dev->power_down_delay_ms if it is set.
+ * lwis_dev->client_lock should be held before this function.
+ */
+int lwis_dev_power_down_deferred_locked(struct lwis_device *lwis_dev);
+
+/*
+ * Cancel the deferred power down of a LWIS device being enabled again.
+ * Returns true if the device is still powered up and needs no power up.
+ * lwis_dev->client_lock should be held before this function.
+ */
+bool lwis_dev_power_down_cancel_locked(struct lwis_device *lwis_dev);
+
+/*
+ * Run the deferred power down of a LWIS device right away, if any.
+ * lwis_dev->client_lock should be held before this function.
+ */
+int lwis_dev_power_down_flush_locked(struct lwis_device *lwis_dev);
+
+/*
+ *  struct lwis_power_group_entry
+ *  Client enabled as part of a group by lwis_dev_power_up_group().
+ */
+struct lwis_power_group_entry {
+	struct lwis_client *client;
+	/* Index of an earlier entry whose device must be powered up first, or -1 */
+	int depends_on;
+	/* Result of enabling the client */
+	int error;
+};
+
+/*
+ * Enable the clients of a group, as LWIS_DEVICE_ENABLE would for each of
+ * them, overlapping the power sequence delays of their devices. Each device
+ * keeps the order of its own sequence and starts only once the device it
+ * depends on is powered up. Returns the first error of the group, with the
+ * result of each entry in its error field.
+ */
+int lwis_dev_power_up_group(struct lwis_power_group_entry *entries, int num_entries);
+
+/*
+ * Take a reference on the file of a LWIS client, or return an error pointer
+ * if fd is not a LWIS client.
+ */
+struct file *lwis_client_fget(int fd);
+
 /*
  * Power down a LWIS device, should be called when lwis_dev->enabled become 0
  * lwis_dev->client_lock should be held before this function.
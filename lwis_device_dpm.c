@@ -16,6 +16,7 @@
 #include <linux/slab.h>
 
 #include "lwis_commands.h"
+#include "lwis_device_top.h"
 #include "lwis_init.h"
 #include "lwis_platform.h"
 
@@ -38,16 +39,55 @@ static struct lwis_event_subscribe_operations dpm_subscribe_ops = {
 	.release = NULL,
 };
 
+/* Serializes the BTS and QoS votes with the last values cached per device */
+static DEFINE_MUTEX(vote_lock);
+
 /*
- *  lwis_dpm_update_qos: update qos requirement for lwis device.
+ *  struct dpm_vote
+ *  Vote resulting from a list of qos settings: a BTS bandwidth vote if
+ *  clock_family is CLOCK_FAMILY_INVALID, a QoS frequency vote otherwise.
  */
-int lwis_dpm_update_qos(struct lwis_device *lwis_dev, struct lwis_qos_setting *qos_setting)
+struct dpm_vote {
+	struct lwis_device *dev;
+	int32_t clock_family;
+	unsigned int bw_peak;
+	unsigned int bw_read;
+	unsigned int bw_write;
+	unsigned int bw_rt;
+	int frequency_khz;
+};
+
+/*
+ *  vote_find_or_add: Returns the vote of the device and clock family, a later
+ *  setting replacing what an earlier one of the same list voted.
+ */
+static struct dpm_vote *vote_find_or_add(struct dpm_vote *votes, int *num_votes,
+					 struct lwis_device *dev, int32_t clock_family)
+{
+	int i;
+
+	for (i = 0; i < *num_votes; ++i) {
+		if (votes[i].dev == dev && votes[i].clock_family == clock_family) {
+			return &votes[i];
+		}
+	}
+	votes[*num_votes].dev = dev;
+	votes[*num_votes].clock_family = clock_family;
+	return &votes[(*num_votes)++];
+}
+
+/*
+ *  qos_setting_to_votes: Turn a qos setting into the votes it stands for.
+ *  Needs room for two more votes.
+ */
+static int qos_setting_to_votes(struct lwis_device *lwis_dev, struct lwis_qos_setting *qos_setting,
+				struct dpm_vote *votes, int *num_votes)
 {
-	int ret = 0;
 	int64_t peak_bw = 0;
 	int64_t read_bw = 0;
 	int64_t write_bw = 0;
 	int64_t rt_bw = 0;
+	struct dpm_vote *vote;
 	struct lwis_device *target_dev = lwis_find_dev_by_id(qos_setting->device_id);
 	if (!target_dev) {
 		dev_err(lwis_dev->dev, "Can't find device by id: %d\n", qos_setting->device_id);
@@ -71,45 +111,170 @@ int lwis_dpm_update_qos(struct lwis_device *lwis_dev, struct lwis_qos_setting *q
 				  qos_setting->peak_bw :
 					((read_bw > write_bw) ? read_bw : write_bw) / 4;
 		rt_bw = (qos_setting->rt_bw > 0) ? qos_setting->rt_bw : 0;
-		ret = lwis_platform_update_bts(target_dev, peak_bw, read_bw, write_bw, rt_bw);
-		if (ret < 0) {
-			dev_err(lwis_dev->dev, "Failed to update bandwidth to bts, ret: %d\n", ret);
-			break;
-		}
+		vote = vote_find_or_add(votes, num_votes, target_dev, CLOCK_FAMILY_INVALID);
+		vote->bw_peak = peak_bw;
+		vote->bw_read = read_bw;
+		vote->bw_write = write_bw;
+		vote->bw_rt = rt_bw;
 		if (qos_setting->frequency_hz >= 0 && lwis_dev->id == target_dev->id) {
 			/* vote to qos if frequency is specified. The vote only available for dpm
 			 * device
 			 */
-			ret = lwis_platform_update_qos(lwis_dev,
-						       (int)(qos_setting->frequency_hz / 1000),
-						       qos_setting->clock_family);
-			if (ret) {
-				dev_err(lwis_dev->dev,
-					"Failed to vote to qos for clock family %d\n",
-					qos_setting->clock_family);
-			}
+			vote = vote_find_or_add(votes, num_votes, lwis_dev,
+						qos_setting->clock_family);
+			vote->frequency_khz = (int)(qos_setting->frequency_hz / 1000);
 		}
 		break;
 	case CLOCK_FAMILY_TNR:
 	case CLOCK_FAMILY_CAM:
 	case CLOCK_FAMILY_INTCAM:
 		/* convert value to KHz */
-		ret = lwis_platform_update_qos(target_dev, (int)(qos_setting->frequency_hz / 1000),
-					       qos_setting->clock_family);
-		if (ret) {
-			dev_err(lwis_dev->dev,
-				"Failed to apply core clock requirement for %s, ret: %d\n",
-				target_dev->name, ret);
-		}
+		vote = vote_find_or_add(votes, num_votes, target_dev, qos_setting->clock_family);
+		vote->frequency_khz = (int)(qos_setting->frequency_hz / 1000);
 		break;
 	default:
 		dev_err(lwis_dev->dev, "Invalid clock family %d\n", qos_setting->clock_family);
-		ret = -EINVAL;
+		return -EINVAL;
+	}
+
+	return 0;
+}
+
+/*
+ *  vote_apply_locked: Pass a vote on to the platform, unless it matches the
+ *  last vote of the device. vote_lock should be held.
+ */
+static int vote_apply_locked(struct lwis_device *lwis_dev, struct dpm_vote *vote)
+{
+	struct lwis_device *dev = vote->dev;
+	unsigned int bw[TOP_BW_NUM];
+	unsigned int prev_bw[TOP_BW_NUM];
+	int ret;
+
+	if (vote->clock_family == CLOCK_FAMILY_INVALID) {
+		if (dev->bts_vote_valid && dev->bts_vote[0] == vote->bw_peak &&
+		    dev->bts_vote[1] == vote->bw_read && dev->bts_vote[2] == vote->bw_write &&
+		    dev->bts_vote[3] == vote->bw_rt) {
+			return 0;
+		}
+		bw[TOP_BW_PEAK] = vote->bw_peak;
+		bw[TOP_BW_READ] = vote->bw_read;
+		bw[TOP_BW_WRITE] = vote->bw_write;
+		bw[TOP_BW_RT] = vote->bw_rt;
+		ret = lwis_top_bandwidth_request(dev, bw, prev_bw);
+		if (ret) {
+			dev_err(lwis_dev->dev, "%s bandwidth request over budget\n", dev->name);
+			return ret;
+		}
+		ret = lwis_platform_update_bts(dev, vote->bw_peak, vote->bw_read, vote->bw_write,
+					       vote->bw_rt);
+		if (ret < 0) {
+			dev_err(lwis_dev->dev, "Failed to update bandwidth to bts, ret: %d\n", ret);
+			lwis_top_bandwidth_restore(dev, prev_bw);
+			dev->bts_vote_valid = false;
+			return ret;
+		}
+		dev->bts_vote[0] = vote->bw_peak;
+		dev->bts_vote[1] = vote->bw_read;
+		dev->bts_vote[2] = vote->bw_write;
+		dev->bts_vote[3] = vote->bw_rt;
+		dev->bts_vote_valid = true;
+		return 0;
 	}
 
+	if (test_bit(vote->clock_family, &dev->qos_voted) &&
+	    dev->qos_vote_khz[vote->clock_family] == vote->frequency_khz) {
+		return 0;
+	}
+	ret = lwis_platform_update_qos(dev, vote->frequency_khz, vote->clock_family);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to apply clock requirement %d for %s, ret: %d\n",
+			vote->clock_family, dev->name, ret);
+		clear_bit(vote->clock_family, &dev->qos_voted);
+		return ret;
+	}
+	dev->qos_vote_khz[vote->clock_family] = vote->frequency_khz;
+	set_bit(vote->clock_family, &dev->qos_voted);
+	return 0;
+}
+
+/*
+ *  lwis_dpm_update_qos_list: update the qos requirements of a list as one
+ *  aggregated update.
+ */
+int lwis_dpm_update_qos_list(struct lwis_device *lwis_dev, struct lwis_qos_setting *qos_settings,
+			     size_t num_settings)
+{
+	struct dpm_vote *votes;
+	int num_votes = 0;
+	int ret = 0;
+	int err;
+	int i;
+
+	votes = kcalloc(num_settings * 2, sizeof(struct dpm_vote), GFP_KERNEL);
+	if (!votes) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num_settings; ++i) {
+		ret = qos_setting_to_votes(lwis_dev, &qos_settings[i], votes, &num_votes);
+		if (ret) {
+			goto out;
+		}
+	}
+
+	mutex_lock(&vote_lock);
+	for (i = 0; i < num_votes; ++i) {
+		err = vote_apply_locked(lwis_dev, &votes[i]);
+		if (err && !ret) {
+			ret = err;
+		}
+	}
+	mutex_unlock(&vote_lock);
+
+out:
+	kfree(votes);
 	return ret;
 }
 
+/*
+ *  lwis_dpm_update_qos: update qos requirement for lwis device.
+ */
+int lwis_dpm_update_qos(struct lwis_device *lwis_dev, struct lwis_qos_setting *qos_setting)
+{
+	return lwis_dpm_update_qos_list(lwis_dev, qos_setting, 1);
+}
+
+/*
+ *  lwis_dpm_remove_votes: drop the BTS and QoS votes of a lwis device.
+ */
+void lwis_dpm_remove_votes(struct lwis_device *lwis_dev)
+{
+	struct dpm_vote no_bw = { .dev = lwis_dev, .clock_family = CLOCK_FAMILY_INVALID };
+	const unsigned int no_request[TOP_BW_NUM] = {};
+
+	mutex_lock(&vote_lock);
+	if (lwis_dev->bts_index != BTS_UNSUPPORTED) {
+		vote_apply_locked(lwis_dev, &no_bw);
+	}
+	lwis_top_bandwidth_request(lwis_dev, no_request, NULL);
+	/* remove voted qos */
+	lwis_platform_remove_qos(lwis_dev);
+	lwis_dev->qos_voted = 0;
+	mutex_unlock(&vote_lock);
+}
+
+/*
+ *  lwis_dpm_votes_invalidate: forget the cached votes of a lwis device.
+ */
+void lwis_dpm_votes_invalidate(struct lwis_device *lwis_dev)
+{
+	mutex_lock(&vote_lock);
+	lwis_dev->bts_vote_valid = false;
+	lwis_dev->qos_voted = 0;
+	mutex_unlock(&vote_lock);
+}
+
 /*
  *  lwis_dpm_update_clock: update specific clock settings to lwis device.
  */
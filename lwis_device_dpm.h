@@ -34,6 +34,27 @@ int lwis_dpm_update_clock(struct lwis_device *lwis_dev, struct lwis_clk_setting
  */
 int lwis_dpm_update_qos(struct lwis_device *lwis_dev, struct lwis_qos_setting *qos_setting);
 
+/*
+ *  lwis_dpm_update_qos_list: update the qos requirements of a list from dpm
+ *  client. The votes of the whole list are aggregated, a later setting for the
+ *  same device and clock family replacing an earlier one, and only the votes
+ *  that differ from the last ones are passed on to the platform.
+ */
+int lwis_dpm_update_qos_list(struct lwis_device *lwis_dev, struct lwis_qos_setting *qos_settings,
+			     size_t num_settings);
+
+/*
+ *  lwis_dpm_remove_votes: drop the bandwidth and clock votes of lwis device.
+ */
+void lwis_dpm_remove_votes(struct lwis_device *lwis_dev);
+
+/*
+ *  lwis_dpm_votes_invalidate: forget the cached bandwidth and clock votes of
+ *  lwis device, such that the next votes reach the platform. Called when the
+ *  platform power up or down sets or drops the votes of the device itself.
+ */
+void lwis_dpm_votes_invalidate(struct lwis_device *lwis_dev);
+
 /*
  *  lwis_dpm_read_clock: read current IP core clock for given lwis device.
  *  The unit is hz.
@@ -24,6 +24,7 @@
 #include "lwis_i2c.h"
 #include "lwis_init.h"
 #include "lwis_periodic_io.h"
+#include "lwis_trace.h"
 
 #ifdef CONFIG_OF
 #include "lwis_dt.h"
@@ -39,10 +40,16 @@ static int lwis_i2c_device_enable(struct lwis_device *lwis_dev);
 static int lwis_i2c_device_disable(struct lwis_device *lwis_dev);
 static int lwis_i2c_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				int access_size);
+static int lwis_i2c_register_write_burst(struct lwis_device *lwis_dev,
+					 struct lwis_io_entry *entries, int num_entries);
+static int lwis_i2c_register_io_group(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				      int num_entries, int *num_completed);
+static void lwis_i2c_register_cache_invalidate(struct lwis_device *lwis_dev);
 
 static struct lwis_device_subclass_operations i2c_vops = {
 	.register_io = lwis_i2c_register_io,
 	.register_io_barrier = NULL,
+	.register_cache_invalidate = lwis_i2c_register_cache_invalidate,
 	.device_enable = lwis_i2c_device_enable,
 	.device_disable = lwis_i2c_device_disable,
 	.event_enable = NULL,
@@ -63,7 +70,7 @@ static int lwis_i2c_device_enable(struct lwis_device *lwis_dev)
 	struct lwis_i2c_device *i2c_dev = (struct lwis_i2c_device *)lwis_dev;
 
 	/* Enable the I2C bus */
-	mutex_lock(lwis_dev->global_i2c_lock);
+	mutex_lock(lwis_dev->i2c_bus_lock);
 
 #if IS_ENABLED(CONFIG_INPUT_STMVL53L1)
 	if (is_shared_i2c_with_stmvl53l1(i2c_dev->state_pinctrl))
@@ -76,7 +83,7 @@ static int lwis_i2c_device_enable(struct lwis_device *lwis_dev)
 	ret = lwis_i2c_set_state(i2c_dev, I2C_ON_STRING);
 #endif
 
-	mutex_unlock(lwis_dev->global_i2c_lock);
+	mutex_unlock(lwis_dev->i2c_bus_lock);
 	if (ret) {
 		dev_err(lwis_dev->dev, "Error enabling i2c bus (%d)\n", ret);
 		return ret;
@@ -93,11 +100,11 @@ static int lwis_i2c_device_disable(struct lwis_device *lwis_dev)
 #if IS_ENABLED(CONFIG_INPUT_STMVL53L1)
 	if (is_shared_i2c_with_stmvl53l1(i2c_dev->state_pinctrl)) {
 		/* Disable the shared i2c bus */
-		mutex_lock(lwis_dev->global_i2c_lock);
+		mutex_lock(lwis_dev->i2c_bus_lock);
 		ret = shared_i2c_set_state(&i2c_dev->client->dev,
 					   i2c_dev->state_pinctrl,
 					   I2C_OFF_STRING);
-		mutex_unlock(lwis_dev->global_i2c_lock);
+		mutex_unlock(lwis_dev->i2c_bus_lock);
 		if (ret) {
 			dev_err(lwis_dev->dev, "Error disabling i2c bus (%d)\n",
 				ret);
@@ -108,9 +115,9 @@ static int lwis_i2c_device_disable(struct lwis_device *lwis_dev)
 
 	if (!lwis_i2c_dev_is_in_use(lwis_dev)) {
 		/* Disable the I2C bus */
-		mutex_lock(lwis_dev->global_i2c_lock);
+		mutex_lock(lwis_dev->i2c_bus_lock);
 		ret = lwis_i2c_set_state(i2c_dev, I2C_OFF_STRING);
-		mutex_unlock(lwis_dev->global_i2c_lock);
+		mutex_unlock(lwis_dev->i2c_bus_lock);
 		if (ret) {
 			dev_err(lwis_dev->dev, "Error disabling i2c bus (%d)\n", ret);
 			return ret;
@@ -123,11 +130,54 @@ static int lwis_i2c_device_disable(struct lwis_device *lwis_dev)
 static int lwis_i2c_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				int access_size)
 {
+	int ret;
+
+	/* Running in interrupt context is not supported as i2c driver might sleep */
+	if (in_interrupt()) {
+		return -EAGAIN;
+	}
+	ret = lwis_i2c_io_entry_rw((struct lwis_i2c_device *)lwis_dev, entry);
+	trace_lwis_bus_io(lwis_dev, entry, 1, ret ? ret : 1);
+	lwis_stats_count_io(lwis_dev, entry, ret ? 0 : 1, ret);
+	return ret;
+}
+
+static int lwis_i2c_register_write_burst(struct lwis_device *lwis_dev,
+					 struct lwis_io_entry *entries, int num_entries)
+{
+	int ret;
+
+	/* Running in interrupt context is not supported as i2c driver might sleep */
+	if (in_interrupt()) {
+		return -EAGAIN;
+	}
+	ret = lwis_i2c_io_entry_write_burst((struct lwis_i2c_device *)lwis_dev, entries,
+					    num_entries);
+	trace_lwis_bus_io(lwis_dev, entries, ret > 0 ? ret : 1, ret);
+	lwis_stats_count_io(lwis_dev, entries, max(ret, 0), ret);
+	return ret;
+}
+
+static int lwis_i2c_register_io_group(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				      int num_entries, int *num_completed)
+{
+	int ret;
+
 	/* Running in interrupt context is not supported as i2c driver might sleep */
 	if (in_interrupt()) {
+		*num_completed = 0;
 		return -EAGAIN;
 	}
-	return lwis_i2c_io_entry_rw((struct lwis_i2c_device *)lwis_dev, entry);
+	ret = lwis_i2c_io_entries_rw((struct lwis_i2c_device *)lwis_dev, entries, num_entries,
+				     num_completed);
+	trace_lwis_bus_io(lwis_dev, entries, num_entries, ret ? ret : *num_completed);
+	lwis_stats_count_io(lwis_dev, entries, *num_completed, ret);
+	return ret;
+}
+
+static void lwis_i2c_register_cache_invalidate(struct lwis_device *lwis_dev)
+{
+	lwis_i2c_shadow_invalidate((struct lwis_i2c_device *)lwis_dev);
 }
 
 static int lwis_i2c_addr_matcher(struct device *dev, void *data)
@@ -164,6 +214,12 @@ static int lwis_i2c_device_setup(struct lwis_i2c_device *i2c_dev)
 	return -ENOSYS;
 #endif
 
+	ret = lwis_i2c_dev_locks_get(&i2c_dev->base_dev, i2c_dev->adapter, i2c_dev->lock_group);
+	if (ret) {
+		dev_err(i2c_dev->base_dev.dev, "Failed to get i2c power locks\n");
+		return ret;
+	}
+
 	info.addr = i2c_dev->address;
 
 	i2c_dev->client = i2c_new_client_device(i2c_dev->adapter, &info);
@@ -216,6 +272,24 @@ static int lwis_i2c_device_setup(struct lwis_i2c_device *i2c_dev)
 	}
 	i2c_dev->state_pinctrl = pinctrl;
 
+	ret = lwis_i2c_transfer_init(i2c_dev);
+	if (ret) {
+		dev_err(i2c_dev->base_dev.dev, "Failed to initialize i2c transfers (%d)\n", ret);
+		return ret;
+	}
+
+	/* Write coalescing is opt-in, as it relies on the device auto-incrementing
+	   the register offset within a burst */
+	if (i2c_dev->coalesce_writes) {
+		i2c_dev->base_dev.vops.register_write_burst = lwis_i2c_register_write_burst;
+	}
+
+	/* Combining transfers is opt-in, as messages are then separated by a
+	   repeated START instead of a STOP */
+	if (i2c_dev->combine_transfers) {
+		i2c_dev->base_dev.vops.register_io_group = lwis_i2c_register_io_group;
+	}
+
 	return 0;
 }
 
@@ -246,6 +320,8 @@ static int lwis_i2c_device_probe(struct platform_device *plat_dev)
 	ret = lwis_i2c_device_setup(i2c_dev);
 	if (ret) {
 		dev_err(i2c_dev->base_dev.dev, "Error in i2c device initialization\n");
+		/* Also frees the register shadow ranges parsed from the device tree */
+		lwis_i2c_transfer_deinit(i2c_dev);
 		lwis_base_unprobe((struct lwis_device *)i2c_dev);
 		goto error_probe;
 	}
@@ -264,9 +340,14 @@ static int lwis_i2c_device_suspend(struct device *dev)
 {
 	struct lwis_device *lwis_dev = dev_get_drvdata(dev);
 	struct lwis_client *lwis_client, *n;
+	unsigned long flags;
 	int ret = 0;
 
 	if (lwis_dev->enabled == 0) {
+		/* Do not keep the device powered through suspend */
+		mutex_lock(&lwis_dev->client_lock);
+		ret = lwis_dev_power_down_flush_locked(lwis_dev);
+		mutex_unlock(&lwis_dev->client_lock);
 		return ret;
 	}
 
@@ -312,7 +393,9 @@ static int lwis_i2c_device_suspend(struct device *dev)
 		dev_err(lwis_dev->dev, "Failed to power down device\n");
 	}
 
+	spin_lock_irqsave(&lwis_dev->lock, flags);
 	lwis_device_event_states_clear_locked(lwis_dev);
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 	lwis_dev->enabled = 0;
 	dev_warn(lwis_dev->dev, "Device disabled when system suspend\n");
 	mutex_unlock(&lwis_dev->client_lock);
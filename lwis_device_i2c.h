@@ -16,6 +16,30 @@
 
 #include "lwis_device.h"
 
+/* Default maximum number of value bytes sent in one batch write without
+ * allocating memory */
+#define I2C_DEFAULT_MAX_BURST_BYTES 256
+
+/* Maximum number of io entries combined into one i2c_transfer() */
+#define I2C_MAX_GROUP_ENTRIES 16
+
+/* Lock group of the devices sharing pins that do not name a group */
+#define I2C_LOCK_GROUP_SHARED U32_MAX
+
+/*
+ *  struct lwis_i2c_shadow_range
+ *  Range of cacheable registers, from start to end inclusive, whose last value
+ *  written to or read from the device is kept in a write-through shadow.
+ */
+struct lwis_i2c_shadow_range {
+	uint32_t start;
+	uint32_t end;
+	/* Shadow value of each register offset in the range */
+	uint32_t *values;
+	/* Set for the offsets whose shadow value matches the device */
+	unsigned long *valid;
+};
+
 /*
  *  struct lwis_i2c_device
  *  "Derived" lwis_device struct, with added i2c related elements.
@@ -27,6 +51,37 @@ struct lwis_i2c_device {
 	struct i2c_client *client;
 	struct pinctrl *state_pinctrl;
 	bool pinctrl_default_state_only;
+	/* Maximum number of value bytes in one preallocated batch write */
+	uint32_t max_burst_bytes;
+	/* Send consecutive register writes as a single burst transfer */
+	bool coalesce_writes;
+	/* Send the register accesses of a transaction in a single i2c_transfer() */
+	bool combine_transfers;
+	/* Preallocated DMA-safe buffer for register transfers */
+	uint8_t *xfer_buf;
+	size_t xfer_buf_size;
+	/* Offset of the read region in xfer_buf */
+	size_t xfer_rbuf_offset;
+	/* Largest number of value bytes sent in one message, batch writes
+	 * larger than it being split in chunks, 0 for no limit */
+	uint32_t write_chunk_bytes;
+	/* Time between two chunks, for devices committing each page written */
+	uint32_t write_chunk_delay_us;
+	/* Preallocated DMA-safe buffers of the chunks being sent and built,
+	 * each chunk_stride bytes apart, guarded by xfer_lock */
+	uint8_t *chunk_buf;
+	size_t chunk_stride;
+	/* Messages of a combined transfer, guarded by xfer_lock */
+	struct i2c_msg group_msgs[I2C_MAX_GROUP_ENTRIES * 2];
+	/* Mutex used to synchronize access to xfer_buf */
+	struct mutex xfer_lock;
+	/* Cacheable register ranges, shadow values are guarded by xfer_lock */
+	struct lwis_i2c_shadow_range *shadow_ranges;
+	int num_shadow_ranges;
+	/* Serve register reads of cacheable registers from the shadow */
+	bool shadow_reads;
+	/* Power lock group shared with other devices, 0 for none */
+	uint32_t lock_group;
 };
 
 int lwis_i2c_device_deinit(void);
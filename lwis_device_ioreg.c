@@ -23,6 +23,7 @@
 #include "lwis_interrupt.h"
 #include "lwis_ioreg.h"
 #include "lwis_periodic_io.h"
+#include "lwis_trace.h"
 
 #ifdef CONFIG_OF
 #include "lwis_dt.h"
@@ -35,10 +36,24 @@ static int lwis_ioreg_device_disable(struct lwis_device *lwis_dev);
 static int lwis_ioreg_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				  int access_size);
 static int lwis_ioreg_register_io_barrier(struct lwis_device *lwis_dev, bool read, bool write);
+static unsigned long lwis_ioreg_register_lock(struct lwis_device *lwis_dev,
+					      struct lwis_io_entry *entries, int num_entries);
+static void lwis_ioreg_register_unlock(struct lwis_device *lwis_dev, unsigned long locked);
+static struct lwis_io_program *lwis_ioreg_register_io_compile(struct lwis_device *lwis_dev,
+							      struct lwis_io_entry *entries,
+							      int num_entries);
+static int lwis_ioreg_register_io_program_run(struct lwis_device *lwis_dev,
+					      struct lwis_io_program *program,
+					      struct lwis_io_entry *entries, int first,
+					      int num_entries, int *num_completed);
 
 static struct lwis_device_subclass_operations ioreg_vops = {
 	.register_io = lwis_ioreg_register_io,
 	.register_io_barrier = lwis_ioreg_register_io_barrier,
+	.register_io_compile = lwis_ioreg_register_io_compile,
+	.register_io_program_run = lwis_ioreg_register_io_program_run,
+	.register_lock = lwis_ioreg_register_lock,
+	.register_unlock = lwis_ioreg_register_unlock,
 	.device_enable = lwis_ioreg_device_enable,
 	.device_disable = lwis_ioreg_device_disable,
 	.event_enable = NULL,
@@ -66,7 +81,11 @@ static int lwis_ioreg_device_disable(struct lwis_device *lwis_dev)
 static int lwis_ioreg_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
 				  int access_size)
 {
-	return lwis_ioreg_io_entry_rw((struct lwis_ioreg_device *)lwis_dev, entry, access_size);
+	int ret = lwis_ioreg_io_entry_rw((struct lwis_ioreg_device *)lwis_dev, entry, access_size);
+
+	trace_lwis_bus_io(lwis_dev, entry, 1, ret ? ret : 1);
+	lwis_stats_count_io(lwis_dev, entry, ret ? 0 : 1, ret);
+	return ret;
 }
 
 static int lwis_ioreg_register_io_barrier(struct lwis_device *lwis_dev, bool use_read_barrier,
@@ -76,6 +95,45 @@ static int lwis_ioreg_register_io_barrier(struct lwis_device *lwis_dev, bool use
 					 use_write_barrier);
 }
 
+static unsigned long lwis_ioreg_register_lock(struct lwis_device *lwis_dev,
+					      struct lwis_io_entry *entries, int num_entries)
+{
+	return lwis_ioreg_lock_blocks((struct lwis_ioreg_device *)lwis_dev, entries, num_entries);
+}
+
+static void lwis_ioreg_register_unlock(struct lwis_device *lwis_dev, unsigned long locked)
+{
+	lwis_ioreg_unlock_blocks((struct lwis_ioreg_device *)lwis_dev, locked);
+}
+
+static struct lwis_io_program *lwis_ioreg_register_io_compile(struct lwis_device *lwis_dev,
+							      struct lwis_io_entry *entries,
+							      int num_entries)
+{
+	return lwis_ioreg_io_program_compile((struct lwis_ioreg_device *)lwis_dev, entries,
+					     num_entries);
+}
+
+static int lwis_ioreg_register_io_program_run(struct lwis_device *lwis_dev,
+					      struct lwis_io_program *program,
+					      struct lwis_io_entry *entries, int first,
+					      int num_entries, int *num_completed)
+{
+	int ret = lwis_ioreg_io_program_run((struct lwis_ioreg_device *)lwis_dev, program,
+					    entries, first, num_entries, num_completed);
+
+	trace_lwis_bus_io(lwis_dev, entries, num_entries, ret ? ret : *num_completed);
+	lwis_stats_count_io(lwis_dev, entries, *num_completed, ret);
+	return ret;
+}
+
+void lwis_ioreg_device_ops_set(struct lwis_ioreg_device *ioreg_dev)
+{
+	ioreg_dev->base_dev.type = DEVICE_TYPE_IOREG;
+	ioreg_dev->base_dev.vops = ioreg_vops;
+	ioreg_dev->base_dev.subscribe_ops = ioreg_subscribe_ops;
+}
+
 static int lwis_ioreg_device_setup(struct lwis_ioreg_device *ioreg_dev)
 {
 	int ret = 0;
@@ -106,9 +164,7 @@ static int lwis_ioreg_device_probe(struct platform_device *plat_dev)
 		return -ENOMEM;
 	}
 
-	ioreg_dev->base_dev.type = DEVICE_TYPE_IOREG;
-	ioreg_dev->base_dev.vops = ioreg_vops;
-	ioreg_dev->base_dev.subscribe_ops = ioreg_subscribe_ops;
+	lwis_ioreg_device_ops_set(ioreg_dev);
 
 	/* Call the base device probe function */
 	ret = lwis_base_probe((struct lwis_device *)ioreg_dev, plat_dev);
@@ -139,9 +195,14 @@ static int lwis_ioreg_device_suspend(struct device *dev)
 {
 	struct lwis_device *lwis_dev = dev_get_drvdata(dev);
 	struct lwis_client *lwis_client, *n;
+	unsigned long flags;
 	int ret = 0;
 
 	if (lwis_dev->enabled == 0) {
+		/* Do not keep the device powered through suspend */
+		mutex_lock(&lwis_dev->client_lock);
+		ret = lwis_dev_power_down_flush_locked(lwis_dev);
+		mutex_unlock(&lwis_dev->client_lock);
 		return ret;
 	}
 
@@ -182,7 +243,9 @@ static int lwis_ioreg_device_suspend(struct device *dev)
 		dev_err(lwis_dev->dev, "Failed to power down device\n");
 	}
 
+	spin_lock_irqsave(&lwis_dev->lock, flags);
 	lwis_device_event_states_clear_locked(lwis_dev);
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 	lwis_dev->enabled = 0;
 	dev_warn(lwis_dev->dev, "Device disabled when system suspend\n");
 	mutex_unlock(&lwis_dev->client_lock);
@@ -11,6 +11,7 @@
 #ifndef LWIS_DEVICE_IOREG_H_
 #define LWIS_DEVICE_IOREG_H_
 
+#include <linux/mutex.h>
 #include <linux/types.h>
 
 #include "lwis_device.h"
@@ -20,6 +21,12 @@ struct lwis_ioreg {
 	int size;
 	void __iomem *base;
 	char *name;
+	/* Whether the block accepts 64-bit accesses regardless of the native
+	 * value bitwidth, which batch transfers use on 8-byte aligned spans */
+	bool wide_access;
+	/* Serializes the io entry executions accessing the block. Blocks from
+	 * index BITS_PER_LONG - 1 on share the lock of that block */
+	struct mutex lock;
 };
 
 struct lwis_ioreg_list {
@@ -36,5 +43,11 @@ struct lwis_ioreg_device {
 	struct lwis_ioreg_list reg_list;
 };
 
+/*
+ *  lwis_ioreg_device_ops_set: Sets the type and the operations of an ioreg
+ *  device, before it is probed.
+ */
+void lwis_ioreg_device_ops_set(struct lwis_ioreg_device *ioreg_dev);
+
 int lwis_ioreg_device_deinit(void);
 #endif /* LWIS_DEVICE_IOREG_H_ */
@@ -28,7 +28,7 @@
 
 #define LWIS_DRIVER_NAME "lwis-slc"
 
-#define SIZE_TO_KB(x) x / 1024
+#define SIZE_TO_KB(x) DIV_ROUND_UP(x, 1024)
 
 static const struct file_operations pt_file_ops = {
 	.owner = THIS_MODULE,
@@ -83,12 +83,7 @@ static int lwis_slc_enable(struct lwis_device *lwis_dev)
 	}
 
 	for (i = 0; i < num_pt_id; i++) {
-		/* Make sure pt_size are in ascending order, since it's required by the allocation logic. */
 		of_property_read_u32_index(node, "pt_size", i, (u32 *)&pt_size_kb[i]);
-		if (i > 0 && pt_size_kb[i] < pt_size_kb[i - 1]) {
-			dev_err(lwis_dev->dev, "SLC partition sizes are not in ascending order!");
-			return -EINVAL;
-		}
 	}
 
 	/* Initialize SLC partitions and get a handle */
@@ -99,20 +94,31 @@ static int lwis_slc_enable(struct lwis_device *lwis_dev)
 		slc_dev->partition_handle = NULL;
 		return ret;
 	}
+	mutex_lock(&slc_dev->lock);
 	slc_dev->num_pt = num_pt_id;
 	for (i = 0; i < slc_dev->num_pt; i++) {
+		memset(&slc_dev->pt[i], 0, sizeof(struct slc_partition));
 		slc_dev->pt[i].id = i;
 		slc_dev->pt[i].size_kb = pt_size_kb[i];
-		slc_dev->pt[i].fd = -1;
 		slc_dev->pt[i].partition_id = PT_PTID_INVALID;
 		slc_dev->pt[i].partition_handle = slc_dev->partition_handle;
 	}
+	mutex_unlock(&slc_dev->lock);
 	return 0;
 #else /* CONFIG_OF not defined */
 	return -ENOENT;
 #endif /* CONFIG_OF */
 }
 
+static void partition_disable(struct slc_partition *slc_pt)
+{
+	pt_client_disable(slc_pt->partition_handle, slc_pt->id);
+	slc_pt->enabled_ns += ktime_to_ns(ktime_sub(ktime_get(), slc_pt->enable_time));
+	slc_pt->partition_id = PT_PTID_INVALID;
+	slc_pt->num_buffers = 0;
+	slc_pt->shared = false;
+}
+
 static int lwis_slc_disable(struct lwis_device *lwis_dev)
 {
 	struct lwis_slc_device *slc_dev = (struct lwis_slc_device *)lwis_dev;
@@ -127,22 +133,62 @@ static int lwis_slc_disable(struct lwis_device *lwis_dev)
 		dev_err(slc_dev->base_dev.dev, "Partition handle is NULL\n");
 		return -ENODEV;
 	}
+	mutex_lock(&slc_dev->lock);
 	for (i = 0; i < slc_dev->num_pt; i++) {
 		if (slc_dev->pt[i].partition_id != PT_PTID_INVALID) {
 			dev_info(slc_dev->base_dev.dev,
 				 "Closing partition id %d at device shutdown", slc_dev->pt[i].id);
-			pt_client_disable(slc_dev->partition_handle, slc_dev->pt[i].id);
-			slc_dev->pt[i].partition_id = PT_PTID_INVALID;
-			slc_dev->pt[i].fd = -1;
+			partition_disable(&slc_dev->pt[i]);
 		}
 	}
+	mutex_unlock(&slc_dev->lock);
 	pt_client_unregister(slc_dev->partition_handle);
 	return 0;
 }
 
+/*
+ * find_partition_locked: Returns the smallest partition that fits size_kb,
+ * preferring an enabled partition with room for one more buffer for shared
+ * allocations over enabling another one.
+ */
+static struct slc_partition *find_partition_locked(struct lwis_slc_device *slc_dev,
+						   size_t size_kb, bool shared)
+{
+	struct slc_partition *best = NULL;
+	struct slc_partition *slc_pt;
+	int i;
+
+	if (shared) {
+		for (i = 0; i < slc_dev->num_pt; i++) {
+			slc_pt = &slc_dev->pt[i];
+			if (slc_pt->partition_id != PT_PTID_INVALID && slc_pt->shared &&
+			    slc_pt->num_buffers < MAX_NUM_PT_BUFFERS &&
+			    slc_pt->size_kb >= size_kb &&
+			    (!best || slc_pt->size_kb < best->size_kb)) {
+				best = slc_pt;
+			}
+		}
+		if (best) {
+			return best;
+		}
+	}
+
+	for (i = 0; i < slc_dev->num_pt; i++) {
+		slc_pt = &slc_dev->pt[i];
+		if (slc_pt->partition_id == PT_PTID_INVALID && slc_pt->size_kb >= size_kb &&
+		    (!best || slc_pt->size_kb < best->size_kb)) {
+			best = slc_pt;
+		}
+	}
+	return best;
+}
+
 int lwis_slc_buffer_alloc(struct lwis_device *lwis_dev, struct lwis_alloc_buffer_info *alloc_info)
 {
 	struct lwis_slc_device *slc_dev = (struct lwis_slc_device *)lwis_dev;
+	struct slc_partition *slc_pt;
+	bool shared;
+	size_t largest_kb = 0;
 	int i = 0, fd_or_err = -1;
 	ptid_t partition_id = PT_PTID_INVALID;
 
@@ -166,46 +212,60 @@ int lwis_slc_buffer_alloc(struct lwis_device *lwis_dev, struct lwis_alloc_buffer
 		return -EINVAL;
 	}
 
-	for (i = 0; i < slc_dev->num_pt; i++) {
-		if (slc_dev->pt[i].partition_id == PT_PTID_INVALID &&
-		    slc_dev->pt[i].size_kb >= SIZE_TO_KB(alloc_info->size)) {
-			partition_id =
-				pt_client_enable(slc_dev->partition_handle, slc_dev->pt[i].id);
-			if (partition_id != PT_PTID_INVALID) {
-				fd_or_err = anon_inode_getfd("slc_pt_file", &pt_file_ops,
-							     &slc_dev->pt[i], O_CLOEXEC);
-				if (fd_or_err < 0) {
-					dev_err(lwis_dev->dev,
-						"Failed to create a new file instance for the partition\n");
-					return fd_or_err;
-				}
-				slc_dev->pt[i].fd = fd_or_err;
-				slc_dev->pt[i].partition_id = partition_id;
-				alloc_info->dma_fd = fd_or_err;
-				alloc_info->partition_id = slc_dev->pt[i].partition_id;
-				return 0;
-			} else {
-				dev_err(lwis_dev->dev, "Failed to enable partition id %d\n",
-					slc_dev->pt[i].id);
-				return -EPROTO;
-			}
+	shared = alloc_info->flags & LWIS_DMA_SYSTEM_CACHE_SHARED;
+	mutex_lock(&slc_dev->lock);
+	slc_pt = find_partition_locked(slc_dev, SIZE_TO_KB(alloc_info->size), shared);
+	if (!slc_pt) {
+		for (i = 0; i < slc_dev->num_pt; i++) {
+			largest_kb = max(largest_kb, slc_dev->pt[i].size_kb);
+		}
+		dev_err(lwis_dev->dev,
+			"Failed to find valid partition, largest size supported is %zuKB, asking for %zuKB\n",
+			largest_kb, SIZE_TO_KB(alloc_info->size));
+		for (i = 0; i < slc_dev->num_pt; i++) {
+			dev_err(lwis_dev->dev, "Partition[%d]: size %zuKB has %d buffers%s\n", i,
+				slc_dev->pt[i].size_kb, slc_dev->pt[i].num_buffers,
+				slc_dev->pt[i].shared ? " (shared)" : "");
 		}
+		mutex_unlock(&slc_dev->lock);
+		return -EINVAL;
 	}
-	dev_err(lwis_dev->dev,
-		"Failed to find valid partition, largest size supported is %zuKB, asking for %zuKB\n",
-		slc_dev->pt[slc_dev->num_pt - 1].size_kb, SIZE_TO_KB(alloc_info->size));
-	for (i = 0; i < slc_dev->num_pt; i++) {
-		dev_err(lwis_dev->dev, "Partition[%d]: size %zuKB is %s\n", i,
-			slc_dev->pt[i].size_kb,
-			(slc_dev->pt[i].partition_id == PT_PTID_INVALID) ? "NOT in use" : "in use");
+
+	if (slc_pt->partition_id == PT_PTID_INVALID) {
+		partition_id = pt_client_enable(slc_dev->partition_handle, slc_pt->id);
+		if (partition_id == PT_PTID_INVALID) {
+			dev_err(lwis_dev->dev, "Failed to enable partition id %d\n", slc_pt->id);
+			mutex_unlock(&slc_dev->lock);
+			return -EPROTO;
+		}
+		slc_pt->partition_id = partition_id;
+		slc_pt->shared = shared;
+		slc_pt->enable_time = ktime_get();
+		slc_pt->enable_count++;
 	}
-	return -EINVAL;
+
+	fd_or_err = anon_inode_getfd("slc_pt_file", &pt_file_ops, slc_pt, O_CLOEXEC);
+	if (fd_or_err < 0) {
+		dev_err(lwis_dev->dev, "Failed to create a new file instance for the partition\n");
+		if (slc_pt->num_buffers == 0) {
+			partition_disable(slc_pt);
+		}
+		mutex_unlock(&slc_dev->lock);
+		return fd_or_err;
+	}
+	slc_pt->fd[slc_pt->num_buffers++] = fd_or_err;
+	alloc_info->dma_fd = fd_or_err;
+	alloc_info->partition_id = slc_pt->partition_id;
+	mutex_unlock(&slc_dev->lock);
+	return 0;
 }
 
 int lwis_slc_buffer_free(struct lwis_device *lwis_dev, int fd)
 {
+	struct lwis_slc_device *slc_dev = (struct lwis_slc_device *)lwis_dev;
 	struct file *fp;
 	struct slc_partition *slc_pt;
+	int i;
 
 	if (!lwis_dev) {
 		pr_err("LWIS device cannot be NULL\n");
@@ -216,25 +276,64 @@ int lwis_slc_buffer_free(struct lwis_device *lwis_dev, int fd)
 	if (fp == NULL) {
 		return -EBADF;
 	}
+	if (fp->f_op != &pt_file_ops) {
+		dev_warn(lwis_dev->dev, "SLC buffer free for fd %d of another file\n", fd);
+		fput(fp);
+		return -EINVAL;
+	}
 	slc_pt = fp->private_data;
 
-	if (slc_pt->fd != fd) {
+	mutex_lock(&slc_dev->lock);
+	for (i = 0; i < slc_pt->num_buffers; i++) {
+		if (slc_pt->fd[i] == fd) {
+			break;
+		}
+	}
+	if (i == slc_pt->num_buffers) {
 		dev_warn(lwis_dev->dev, "Stale SLC buffer free for fd %d with ptid %d\n", fd,
 			 slc_pt->partition_id);
+		mutex_unlock(&slc_dev->lock);
 		fput(fp);
 		return -EINVAL;
 	}
 
-	if (slc_pt->partition_id != PT_PTID_INVALID && slc_pt->partition_handle) {
-		pt_client_disable(slc_pt->partition_handle, slc_pt->id);
-		slc_pt->partition_id = PT_PTID_INVALID;
-		slc_pt->fd = -1;
+	slc_pt->fd[i] = slc_pt->fd[--slc_pt->num_buffers];
+	if (slc_pt->num_buffers == 0 && slc_pt->partition_id != PT_PTID_INVALID &&
+	    slc_pt->partition_handle) {
+		partition_disable(slc_pt);
 	}
+	mutex_unlock(&slc_dev->lock);
 	fput(fp);
 
 	return 0;
 }
 
+int lwis_slc_partition_query(struct lwis_device *lwis_dev, struct lwis_slc_partition_info *infos,
+			     size_t max_partitions, size_t *num_partitions)
+{
+	struct lwis_slc_device *slc_dev = (struct lwis_slc_device *)lwis_dev;
+	struct slc_partition *slc_pt;
+	int i;
+
+	mutex_lock(&slc_dev->lock);
+	*num_partitions = slc_dev->num_pt;
+	for (i = 0; i < slc_dev->num_pt && i < max_partitions; i++) {
+		slc_pt = &slc_dev->pt[i];
+		infos[i].size_kb = slc_pt->size_kb;
+		infos[i].partition_id = slc_pt->partition_id;
+		infos[i].num_buffers = slc_pt->num_buffers;
+		infos[i].shared = slc_pt->shared;
+		infos[i].enable_count = slc_pt->enable_count;
+		infos[i].enabled_ns = slc_pt->enabled_ns;
+		if (slc_pt->partition_id != PT_PTID_INVALID) {
+			infos[i].enabled_ns +=
+				ktime_to_ns(ktime_sub(ktime_get(), slc_pt->enable_time));
+		}
+	}
+	mutex_unlock(&slc_dev->lock);
+	return 0;
+}
+
 static int lwis_slc_device_probe(struct platform_device *plat_dev)
 {
 	int ret = 0;
@@ -247,6 +346,7 @@ static int lwis_slc_device_probe(struct platform_device *plat_dev)
 		return -ENOMEM;
 	}
 
+	mutex_init(&slc_dev->lock);
 	slc_dev->base_dev.type = DEVICE_TYPE_SLC;
 	slc_dev->base_dev.vops = slc_vops;
 	slc_dev->base_dev.subscribe_ops = slc_subscribe_ops;
@@ -14,13 +14,22 @@
 #include <soc/google/pt.h>
 
 #define MAX_NUM_PT 16
+#define MAX_NUM_PT_BUFFERS 8
 
 struct slc_partition {
 	int id;
 	size_t size_kb;
-	int fd;
+	/* Files of the buffers attached to the partition */
+	int fd[MAX_NUM_PT_BUFFERS];
+	int num_buffers;
+	/* Whether other shared buffers can attach to the partition */
+	bool shared;
 	ptid_t partition_id;
 	struct pt_handle *partition_handle;
+	/* Time of the last enable, number of enables and total time enabled */
+	ktime_t enable_time;
+	uint32_t enable_count;
+	uint64_t enabled_ns;
 };
 
 /*
@@ -29,6 +38,8 @@ struct slc_partition {
  */
 struct lwis_slc_device {
 	struct lwis_device base_dev;
+	/* Protects the partitions from concurrent clients */
+	struct mutex lock;
 	int num_pt;
 	struct slc_partition pt[MAX_NUM_PT];
 	struct pt_handle *partition_handle;
@@ -40,4 +51,12 @@ int lwis_slc_buffer_alloc(struct lwis_device *lwis_dev, struct lwis_alloc_buffer
 
 int lwis_slc_buffer_free(struct lwis_device *lwis_dev, int fd);
 
+/*
+ * lwis_slc_partition_query: Fills infos with the occupancy of up to
+ * max_partitions partitions, and returns the number of partitions of the
+ * device in num_partitions.
+ */
+int lwis_slc_partition_query(struct lwis_device *lwis_dev, struct lwis_slc_partition_info *infos,
+			     size_t max_partitions, size_t *num_partitions);
+
 #endif /* LWIS_DEVICE_SLC_H_ */
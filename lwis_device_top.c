@@ -13,12 +13,16 @@
 #include "lwis_device_top.h"
 #include "lwis_event.h"
 #include "lwis_init.h"
+#include "lwis_util.h"
 
 #include <linux/device.h>
 #include <linux/init.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/overflow.h>
+#include <linux/percpu.h>
 #include <linux/platform_device.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
 
 #ifdef CONFIG_OF
@@ -66,6 +70,22 @@ struct lwis_event_subscribe_info {
 	struct hlist_node node;
 };
 
+/*
+ *  struct lwis_top_event_receivers
+ *  Snapshot of the devices that subscribed to one trigger event, so that
+ *  dispatching does not walk the subscriber table.
+ */
+struct lwis_top_event_receivers {
+	int64_t event_id;
+	int num_receivers;
+	/* Some receivers are not dispatched directly and need the tasklet */
+	bool has_deferred;
+	/* Node in the lwis_top_device->event_receivers hash table */
+	struct hlist_node node;
+	struct rcu_head rcu;
+	struct lwis_device *receivers[];
+};
+
 struct lwis_trigger_event_info {
 	/* Store emitted event id from trigger device */
 	int64_t trigger_event_id;
@@ -73,35 +93,125 @@ struct lwis_trigger_event_info {
 	int64_t trigger_event_count;
 	/* Store emitted event timestamp from trigger device */
 	int64_t trigger_event_timestamp;
-	/* node of list head */
-	struct list_head node;
 };
 
-static void subscribe_tasklet_func(unsigned long data)
+/*
+ *  struct lwis_top_notify_ring
+ *  Single producer, single consumer ring of emitted events. The producer is
+ *  the CPU owning the ring, with local interrupts disabled, and the consumer
+ *  is the subscribe tasklet.
+ */
+struct lwis_top_notify_ring {
+	/* Only advanced by the owning CPU */
+	unsigned int head;
+	/* Only advanced by the subscribe tasklet */
+	unsigned int tail;
+	struct lwis_trigger_event_info slots[TOP_NOTIFY_RING_SIZE];
+};
+
+/* Calling this requires holding base_dev.lock or rcu_read_lock. */
+static struct lwis_top_event_receivers *
+event_receivers_find(struct lwis_top_device *lwis_top_dev, int64_t event_id)
 {
-	struct lwis_top_device *lwis_top_dev = (struct lwis_top_device *)data;
-	struct lwis_trigger_event_info *trigger_event;
+	struct lwis_top_event_receivers *p;
+
+	hash_for_each_possible_rcu (lwis_top_dev->event_receivers, p, node, event_id) {
+		if (p->event_id == event_id) {
+			return p;
+		}
+	}
+	return NULL;
+}
+
+/* Rebuilds the receivers of event_id from the subscriber table. Calling this
+ * requires holding base_dev.lock. */
+static int event_receivers_update_locked(struct lwis_top_device *lwis_top_dev, int64_t event_id)
+{
+	struct lwis_top_event_receivers *old_receivers, *new_receivers = NULL;
 	struct lwis_event_subscribe_info *p;
-	struct list_head *it_sub, *it_sub_tmp;
-	unsigned long flags;
+	int num_receivers = 0;
 
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	list_for_each_safe (it_sub, it_sub_tmp, &lwis_top_dev->emitted_event_list_tasklet) {
-		trigger_event = list_entry(it_sub, struct lwis_trigger_event_info, node);
-		list_del(&trigger_event->node);
-		hash_for_each_possible (lwis_top_dev->event_subscriber, p, node,
-					trigger_event->trigger_event_id) {
-			if (p->event_id == trigger_event->trigger_event_id) {
+	hash_for_each_possible (lwis_top_dev->event_subscriber, p, node, event_id) {
+		if (p->event_id == event_id) {
+			num_receivers++;
+		}
+	}
+
+	if (num_receivers > 0) {
+		new_receivers = kmalloc(struct_size(new_receivers, receivers, num_receivers),
+					GFP_ATOMIC);
+		if (!new_receivers) {
+			return -ENOMEM;
+		}
+		new_receivers->event_id = event_id;
+		new_receivers->num_receivers = 0;
+		new_receivers->has_deferred = false;
+		hash_for_each_possible (lwis_top_dev->event_subscriber, p, node, event_id) {
+			if (p->event_id == event_id) {
+				new_receivers->receivers[new_receivers->num_receivers++] =
+					p->receiver_dev;
+				if (!p->receiver_dev->direct_event_dispatch) {
+					new_receivers->has_deferred = true;
+				}
+			}
+		}
+	}
+
+	/* The tasklet may still be dispatching to the old receivers */
+	old_receivers = event_receivers_find(lwis_top_dev, event_id);
+	if (old_receivers && new_receivers) {
+		hlist_replace_rcu(&old_receivers->node, &new_receivers->node);
+	} else if (old_receivers) {
+		hash_del_rcu(&old_receivers->node);
+	} else if (new_receivers) {
+		hash_add_rcu(lwis_top_dev->event_receivers, &new_receivers->node, event_id);
+	}
+	if (old_receivers) {
+		kfree_rcu(old_receivers, rcu);
+	}
+	return 0;
+}
+
+static void subscribe_tasklet_func(unsigned long data)
+{
+	struct lwis_top_device *lwis_top_dev = (struct lwis_top_device *)data;
+	struct lwis_trigger_event_info trigger_event;
+	struct lwis_top_event_receivers *receivers;
+	struct lwis_top_notify_ring *ring;
+	unsigned int head, tail;
+	int cpu, i;
+
+	/* Receivers are only read under RCU, so emitting to other devices does
+	 * not hold the top device lock */
+	rcu_read_lock();
+	for_each_possible_cpu (cpu) {
+		ring = per_cpu_ptr(lwis_top_dev->notify_rings, cpu);
+		tail = ring->tail;
+		head = smp_load_acquire(&ring->head);
+		while (tail != head) {
+			trigger_event = ring->slots[tail & (TOP_NOTIFY_RING_SIZE - 1)];
+			/* Hand the slot back before emitting */
+			smp_store_release(&ring->tail, ++tail);
+
+			receivers = event_receivers_find(lwis_top_dev,
+							 trigger_event.trigger_event_id);
+			if (!receivers) {
+				continue;
+			}
+			for (i = 0; i < receivers->num_receivers; i++) {
+				/* Direct receivers were notified by lwis_top_event_notify */
+				if (receivers->receivers[i]->direct_event_dispatch) {
+					continue;
+				}
 				/* Notify subscriber an event is happening */
 				lwis_device_external_event_emit(
-					p->receiver_dev, trigger_event->trigger_event_id,
-					trigger_event->trigger_event_count,
-					trigger_event->trigger_event_timestamp, false);
+					receivers->receivers[i], trigger_event.trigger_event_id,
+					trigger_event.trigger_event_count,
+					trigger_event.trigger_event_timestamp, false);
 			}
 		}
-		kfree(trigger_event);
 	}
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
+	rcu_read_unlock();
 }
 
 static void lwis_top_event_notify(struct lwis_device *lwis_dev, int64_t trigger_event_id,
@@ -109,21 +219,54 @@ static void lwis_top_event_notify(struct lwis_device *lwis_dev, int64_t trigger_
 				  bool in_irq)
 {
 	struct lwis_top_device *lwis_top_dev = (struct lwis_top_device *)lwis_dev;
+	struct lwis_top_event_receivers *receivers;
+	struct lwis_top_notify_ring *ring;
+	struct lwis_trigger_event_info *trigger_event;
 	unsigned long flags;
+	unsigned int head;
+	bool has_deferred = false;
+	int i;
 
-	struct lwis_trigger_event_info *trigger_event =
-		kmalloc(sizeof(struct lwis_trigger_event_info), GFP_ATOMIC);
-	if (trigger_event == NULL) {
-		dev_err(lwis_top_dev->base_dev.dev, "Allocate trigger_event_info failed");
+	/* Receivers opted in to direct dispatch run their transactions in the
+	 * context of the trigger event, e.g. straight from its ISR */
+	rcu_read_lock();
+	receivers = event_receivers_find(lwis_top_dev, trigger_event_id);
+	if (receivers) {
+		for (i = 0; i < receivers->num_receivers; i++) {
+			if (receivers->receivers[i]->direct_event_dispatch) {
+				lwis_device_external_event_emit(receivers->receivers[i],
+								trigger_event_id,
+								trigger_event_count,
+								trigger_event_timestamp, in_irq);
+			}
+		}
+		has_deferred = receivers->has_deferred;
+	}
+	rcu_read_unlock();
+	if (!has_deferred) {
+		return;
+	}
+
+	/* Keep this CPU the only producer of its ring */
+	local_irq_save(flags);
+	ring = this_cpu_ptr(lwis_top_dev->notify_rings);
+	head = ring->head;
+	if (head - smp_load_acquire(&ring->tail) >= TOP_NOTIFY_RING_SIZE) {
+		local_irq_restore(flags);
+		dev_err_ratelimited(lwis_top_dev->base_dev.dev,
+				    "Notification ring full, dropping event %llx\n",
+				    trigger_event_id);
 		return;
 	}
 
+	trigger_event = &ring->slots[head & (TOP_NOTIFY_RING_SIZE - 1)];
 	trigger_event->trigger_event_id = trigger_event_id;
 	trigger_event->trigger_event_count = trigger_event_count;
 	trigger_event->trigger_event_timestamp = trigger_event_timestamp;
-	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
-	list_add_tail(&trigger_event->node, &lwis_top_dev->emitted_event_list_tasklet);
-	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
+	/* Publish the slot to the tasklet */
+	smp_store_release(&ring->head, head + 1);
+	local_irq_restore(flags);
+
 	/* Schedule deferred subscribed events */
 	tasklet_schedule(&lwis_top_dev->subscribe_tasklet);
 }
@@ -135,7 +278,6 @@ static int lwis_top_event_unsubscribe(struct lwis_device *lwis_dev, int64_t trig
 	struct lwis_device *trigger_dev;
 	struct lwis_event_subscribe_info *p;
 	struct hlist_node *tmp;
-	struct lwis_trigger_event_info *pending_event, *n;
 	unsigned long flags;
 	bool has_subscriber = false;
 
@@ -144,19 +286,6 @@ static int lwis_top_event_unsubscribe(struct lwis_device *lwis_dev, int64_t trig
 	/* Remove event from hash table */
 	hash_for_each_possible_safe (lwis_top_dev->event_subscriber, p, tmp, node,
 				     trigger_event_id) {
-		/* Clear pending events */
-		list_for_each_entry_safe (pending_event, n,
-					  &lwis_top_dev->emitted_event_list_tasklet, node) {
-			/* The condition indicates that clear pending events by subscriber
-			 * because there are possibly other subscribers have the same pending event.
-			 */
-			if (p->receiver_dev->id == receiver_device_id &&
-			    pending_event->trigger_event_id == trigger_event_id) {
-				list_del(&pending_event->node);
-				kfree(pending_event);
-			}
-		}
-
 		if (p->event_id == trigger_event_id && p->receiver_dev->id == receiver_device_id) {
 			dev_info(lwis_dev->dev,
 				 "unsubscribe event: %llx, trigger device: %s, target device: %s\n",
@@ -171,6 +300,11 @@ static int lwis_top_event_unsubscribe(struct lwis_device *lwis_dev, int64_t trig
 			has_subscriber = true;
 		}
 	}
+	/* Pending notifications are dispatched to the remaining receivers only */
+	if (event_receivers_update_locked(lwis_top_dev, trigger_event_id)) {
+		dev_err(lwis_dev->dev, "Failed to update receivers of event: %llx\n",
+			trigger_event_id);
+	}
 	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 	lwis_device_event_update_subscriber(trigger_dev, trigger_event_id, has_subscriber);
 	return 0;
@@ -219,6 +353,16 @@ static int lwis_top_event_subscribe(struct lwis_device *lwis_dev, int64_t trigge
 	new_subscription->trigger_dev = lwis_trigger_dev;
 	spin_lock_irqsave(&lwis_top_dev->base_dev.lock, flags);
 	hash_add(lwis_top_dev->event_subscriber, &new_subscription->node, trigger_event_id);
+	ret = event_receivers_update_locked(lwis_top_dev, trigger_event_id);
+	if (ret) {
+		hash_del(&new_subscription->node);
+		spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
+		dev_err(lwis_top_dev->base_dev.dev, "Failed to update receivers of event: %llx\n",
+			trigger_event_id);
+		kfree(new_subscription);
+		has_subscriber = false;
+		goto out;
+	}
 	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 	dev_info(lwis_dev->dev, "subscribe event: %llx, trigger device: %s, target device: %s",
 		 trigger_event_id, lwis_trigger_dev->name, lwis_receiver_dev->name);
@@ -233,20 +377,26 @@ out:
 	return ret;
 }
 
-static void lwis_top_event_subscribe_init(struct lwis_top_device *lwis_top_dev)
+static int lwis_top_event_subscribe_init(struct lwis_top_device *lwis_top_dev)
 {
 	hash_init(lwis_top_dev->event_subscriber);
-	INIT_LIST_HEAD(&lwis_top_dev->emitted_event_list_tasklet);
+	hash_init(lwis_top_dev->event_receivers);
+	lwis_top_dev->notify_rings = alloc_percpu(struct lwis_top_notify_ring);
+	if (!lwis_top_dev->notify_rings) {
+		dev_err(lwis_top_dev->base_dev.dev, "Failed to allocate notification rings\n");
+		return -ENOMEM;
+	}
 	tasklet_init(&lwis_top_dev->subscribe_tasklet, subscribe_tasklet_func,
 		     (unsigned long)lwis_top_dev);
+	return 0;
 }
 
 static void lwis_top_event_subscribe_clear(struct lwis_device *lwis_dev)
 {
 	struct lwis_top_device *lwis_top_dev = (struct lwis_top_device *)lwis_dev;
 	struct lwis_event_subscribe_info *subscribe_info;
+	struct lwis_top_event_receivers *receivers;
 	struct hlist_node *tmp;
-	struct lwis_trigger_event_info *pending_event, *n;
 	int i;
 	unsigned long flags;
 
@@ -257,11 +407,11 @@ static void lwis_top_event_subscribe_clear(struct lwis_device *lwis_dev)
 		kfree(subscribe_info);
 	}
 
-	/* Clean up emitted event list */
-	list_for_each_entry_safe (pending_event, n, &lwis_top_dev->emitted_event_list_tasklet,
-				  node) {
-		list_del(&pending_event->node);
-		kfree(pending_event);
+	/* Clean up receivers, pending notifications are dropped by the tasklet
+	 * once no receiver is left */
+	hash_for_each_safe (lwis_top_dev->event_receivers, i, tmp, receivers, node) {
+		hash_del_rcu(&receivers->node);
+		kfree_rcu(receivers, rcu);
 	}
 	spin_unlock_irqrestore(&lwis_top_dev->base_dev.lock, flags);
 }
@@ -272,6 +422,8 @@ static void lwis_top_event_subscribe_release(struct lwis_device *lwis_dev)
 	lwis_top_event_subscribe_clear(lwis_dev);
 	/* Clean up tasklet process */
 	tasklet_kill(&lwis_top_dev->subscribe_tasklet);
+	free_percpu(lwis_top_dev->notify_rings);
+	lwis_top_dev->notify_rings = NULL;
 }
 
 static int lwis_top_register_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entry,
@@ -279,8 +431,12 @@ static int lwis_top_register_io(struct lwis_device *lwis_dev, struct lwis_io_ent
 {
 	struct lwis_top_device *top_dev = (struct lwis_top_device *)lwis_dev;
 	struct lwis_io_entry_rw_batch *rw_batch;
+	struct lwis_io_entry_write_scatter *scatter;
 	int i;
 	uint64_t reg_value;
+	uint64_t offset;
+	const unsigned int addr_bytes = lwis_dev->native_addr_bitwidth / BITS_PER_BYTE;
+	const unsigned int value_bytes = lwis_dev->native_value_bitwidth / BITS_PER_BYTE;
 
 	BUG_ON(!entry);
 
@@ -320,6 +476,26 @@ static int lwis_top_register_io(struct lwis_device *lwis_dev, struct lwis_io_ent
 		for (i = 0; i < rw_batch->size_in_bytes; ++i) {
 			top_dev->scratch_mem[rw_batch->offset + i] = rw_batch->buf[i];
 		}
+	} else if (entry->type == LWIS_IO_ENTRY_WRITE_SCATTER) {
+		scatter = &entry->scatter;
+		if (!lwis_scatter_field_width_valid(addr_bytes) ||
+		    !lwis_scatter_field_width_valid(value_bytes) ||
+		    scatter->size_in_bytes % (addr_bytes + value_bytes)) {
+			dev_err(top_dev->base_dev.dev,
+				"Scatter write size (%zu) is not a multiple of the pair size (%u)\n",
+				scatter->size_in_bytes, addr_bytes + value_bytes);
+			return -EINVAL;
+		}
+		for (i = 0; i < scatter->size_in_bytes; i += addr_bytes + value_bytes) {
+			offset = lwis_scatter_field_get(scatter->buf + i, addr_bytes);
+			if (offset >= SCRATCH_MEMORY_SIZE) {
+				dev_err(top_dev->base_dev.dev, "Offset (%llu) must be < %d\n",
+					offset, SCRATCH_MEMORY_SIZE);
+				return -EINVAL;
+			}
+			top_dev->scratch_mem[offset] =
+				lwis_scatter_field_get(scatter->buf + i + addr_bytes, value_bytes);
+		}
 	} else if (entry->type == LWIS_IO_ENTRY_MODIFY) {
 		if (entry->mod.offset >= SCRATCH_MEMORY_SIZE) {
 			dev_err(top_dev->base_dev.dev, "Offset (%llu) must be < %d\n",
@@ -338,6 +514,172 @@ static int lwis_top_register_io(struct lwis_device *lwis_dev, struct lwis_io_ent
 	return 0;
 }
 
+static void bandwidth_over_budget(struct lwis_top_device *top_dev, struct lwis_device *lwis_dev,
+				  const uint64_t *total, bool rejected)
+{
+	struct lwis_bandwidth_over_budget_event_payload payload;
+	int i;
+
+	payload.device_id = lwis_dev->id;
+	payload.rejected = rejected;
+	for (i = 0; i < TOP_BW_NUM; ++i) {
+		payload.total[i] = total[i];
+		payload.budget[i] = top_dev->bw_budget[i];
+	}
+	dev_warn_ratelimited(top_dev->base_dev.dev,
+			     "%s over bandwidth budget%s: peak %llu read %llu write %llu rt %llu\n",
+			     lwis_dev->name, rejected ? ", rejected" : "", total[TOP_BW_PEAK],
+			     total[TOP_BW_READ], total[TOP_BW_WRITE], total[TOP_BW_RT]);
+	lwis_device_error_event_emit(&top_dev->base_dev, LWIS_ERROR_EVENT_ID_BANDWIDTH_OVER_BUDGET,
+				     &payload, sizeof(payload));
+}
+
+/* Calling this function requires holding the bw_lock of the top device */
+static void bandwidth_set_locked(struct lwis_top_device *top_dev, struct lwis_device *lwis_dev,
+				 const uint64_t *total, const unsigned int *bw)
+{
+	bool requested = false;
+	int i;
+
+	for (i = 0; i < TOP_BW_NUM; ++i) {
+		top_dev->bw_total[i] = total[i];
+		lwis_dev->bw_request[i] = bw[i];
+		requested |= bw[i] != 0;
+	}
+	if (requested && list_empty(&lwis_dev->bw_node)) {
+		list_add_tail(&lwis_dev->bw_node, &top_dev->bw_devices);
+	} else if (!requested) {
+		list_del_init(&lwis_dev->bw_node);
+	}
+}
+
+int lwis_top_bandwidth_request(struct lwis_device *lwis_dev, const unsigned int *bw,
+			       unsigned int *prev_bw)
+{
+	struct lwis_top_device *top_dev;
+	uint64_t total[TOP_BW_NUM];
+	bool over_budget = false;
+	int i;
+
+	/* Check if top device probe failed */
+	if (lwis_dev->top_dev == NULL) {
+		return 0;
+	}
+	top_dev = container_of(lwis_dev->top_dev, struct lwis_top_device, base_dev);
+
+	mutex_lock(&top_dev->bw_lock);
+	for (i = 0; i < TOP_BW_NUM; ++i) {
+		total[i] = top_dev->bw_total[i] - lwis_dev->bw_request[i] + bw[i];
+		/* Only a request that grows can break the budget, lowering one
+		 * is always allowed */
+		if (top_dev->bw_budget[i] && total[i] > top_dev->bw_budget[i] &&
+		    bw[i] > lwis_dev->bw_request[i]) {
+			over_budget = true;
+		}
+		if (prev_bw) {
+			prev_bw[i] = lwis_dev->bw_request[i];
+		}
+	}
+
+	if (over_budget) {
+		bandwidth_over_budget(top_dev, lwis_dev, total, top_dev->bw_budget_enforce);
+		if (top_dev->bw_budget_enforce) {
+			mutex_unlock(&top_dev->bw_lock);
+			return -EDQUOT;
+		}
+	}
+
+	bandwidth_set_locked(top_dev, lwis_dev, total, bw);
+	mutex_unlock(&top_dev->bw_lock);
+	return 0;
+}
+
+void lwis_top_bandwidth_restore(struct lwis_device *lwis_dev, const unsigned int *bw)
+{
+	struct lwis_top_device *top_dev;
+	uint64_t total[TOP_BW_NUM];
+	int i;
+
+	if (lwis_dev->top_dev == NULL) {
+		return;
+	}
+	top_dev = container_of(lwis_dev->top_dev, struct lwis_top_device, base_dev);
+
+	mutex_lock(&top_dev->bw_lock);
+	for (i = 0; i < TOP_BW_NUM; ++i) {
+		total[i] = top_dev->bw_total[i] - lwis_dev->bw_request[i] + bw[i];
+	}
+	bandwidth_set_locked(top_dev, lwis_dev, total, bw);
+	mutex_unlock(&top_dev->bw_lock);
+}
+
+#ifdef CONFIG_DEBUG_FS
+static ssize_t bandwidth_read(struct file *fp, char __user *user_buf, size_t count,
+			      loff_t *position)
+{
+	struct lwis_top_device *top_dev = fp->f_inode->i_private;
+	struct lwis_device *lwis_dev;
+	const size_t buffer_size = 4096;
+	char *buffer;
+	size_t len;
+	ssize_t ret;
+
+	buffer = kzalloc(buffer_size, GFP_KERNEL);
+	if (!buffer) {
+		return -ENOMEM;
+	}
+
+	mutex_lock(&top_dev->bw_lock);
+	len = scnprintf(buffer, buffer_size, "%-24s %12s %12s %12s %12s\n", "KB/s", "peak",
+			"read", "write", "rt");
+	len += scnprintf(buffer + len, buffer_size - len, "%-24s %12llu %12llu %12llu %12llu\n",
+			 "budget", top_dev->bw_budget[TOP_BW_PEAK],
+			 top_dev->bw_budget[TOP_BW_READ], top_dev->bw_budget[TOP_BW_WRITE],
+			 top_dev->bw_budget[TOP_BW_RT]);
+	len += scnprintf(buffer + len, buffer_size - len, "%-24s %12llu %12llu %12llu %12llu\n",
+			 "total", top_dev->bw_total[TOP_BW_PEAK], top_dev->bw_total[TOP_BW_READ],
+			 top_dev->bw_total[TOP_BW_WRITE], top_dev->bw_total[TOP_BW_RT]);
+	list_for_each_entry (lwis_dev, &top_dev->bw_devices, bw_node) {
+		len += scnprintf(buffer + len, buffer_size - len, "%-24s %12u %12u %12u %12u\n",
+				 lwis_dev->name, lwis_dev->bw_request[TOP_BW_PEAK],
+				 lwis_dev->bw_request[TOP_BW_READ],
+				 lwis_dev->bw_request[TOP_BW_WRITE],
+				 lwis_dev->bw_request[TOP_BW_RT]);
+	}
+	mutex_unlock(&top_dev->bw_lock);
+
+	ret = simple_read_from_buffer(user_buf, count, position, buffer, len);
+	kfree(buffer);
+	return ret;
+}
+
+static struct file_operations bandwidth_fops = {
+	.owner = THIS_MODULE,
+	.read = bandwidth_read,
+};
+
+static void lwis_top_bandwidth_debugfs_setup(struct lwis_top_device *top_dev)
+{
+	struct dentry *dbg_file;
+
+	/* DebugFS not present, just return */
+	if (top_dev->base_dev.dbg_dir == NULL) {
+		return;
+	}
+
+	dbg_file = debugfs_create_file("bandwidth", 0444, top_dev->base_dev.dbg_dir, top_dev,
+				       &bandwidth_fops);
+	if (IS_ERR_OR_NULL(dbg_file)) {
+		dev_warn(top_dev->base_dev.dev, "Failed to create DebugFS bandwidth - %ld",
+			 PTR_ERR(dbg_file));
+	}
+}
+#else /* CONFIG_DEBUG_FS */
+static void lwis_top_bandwidth_debugfs_setup(struct lwis_top_device *top_dev)
+{
+}
+#endif /* CONFIG_DEBUG_FS */
+
 static int lwis_top_close(struct lwis_device *lwis_dev)
 {
 	lwis_top_event_subscribe_clear(lwis_dev);
@@ -377,6 +719,8 @@ static int lwis_top_device_probe(struct platform_device *plat_dev)
 	top_dev->base_dev.type = DEVICE_TYPE_TOP;
 	top_dev->base_dev.vops = top_vops;
 	top_dev->base_dev.subscribe_ops = top_subscribe_ops;
+	mutex_init(&top_dev->bw_lock);
+	INIT_LIST_HEAD(&top_dev->bw_devices);
 
 	/* Call the base device probe function */
 	ret = lwis_base_probe((struct lwis_device *)top_dev, plat_dev);
@@ -393,7 +737,13 @@ static int lwis_top_device_probe(struct platform_device *plat_dev)
 		goto error_probe;
 	}
 
-	lwis_top_event_subscribe_init(top_dev);
+	ret = lwis_top_event_subscribe_init(top_dev);
+	if (ret) {
+		lwis_base_unprobe((struct lwis_device *)top_dev);
+		goto error_probe;
+	}
+
+	lwis_top_bandwidth_debugfs_setup(top_dev);
 
 	return 0;
 
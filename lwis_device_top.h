@@ -14,6 +14,14 @@
 #include "lwis_device.h"
 
 #define SCRATCH_MEMORY_SIZE 16
+/* Number of cross-device notifications each CPU can have in flight, must be
+ * a power of 2 */
+#define TOP_NOTIFY_RING_SIZE 64
+
+struct lwis_top_notify_ring;
+
+/* Bandwidth components, in the order of lwis_device bts_vote and bw_request */
+enum lwis_top_bw { TOP_BW_PEAK, TOP_BW_READ, TOP_BW_WRITE, TOP_BW_RT, TOP_BW_NUM };
 
 /*
  *  struct lwis_top_device
@@ -27,11 +35,44 @@ struct lwis_top_device {
 	uint8_t scratch_mem[SCRATCH_MEMORY_SIZE];
 	/* Hash table for event subscriber */
 	DECLARE_HASHTABLE(event_subscriber, EVENT_HASH_BITS);
+	/* Receiver devices of each subscribed event, rebuilt from
+	 * event_subscriber on every change and read under RCU */
+	DECLARE_HASHTABLE(event_receivers, EVENT_HASH_BITS);
 
 	/* Subscription tasklet */
 	struct tasklet_struct subscribe_tasklet;
-	struct list_head emitted_event_list_tasklet;
+	/* Per-CPU rings of emitted events waiting for the tasklet */
+	struct lwis_top_notify_ring __percpu *notify_rings;
+
+	/* Guards the bandwidth totals and the bw_request of the devices */
+	struct mutex bw_lock;
+	/* Devices with a nonzero bandwidth request */
+	struct list_head bw_devices;
+	/* Bandwidth requested by the whole pipeline, in KB/s */
+	uint64_t bw_total[TOP_BW_NUM];
+	/* Pipeline bandwidth budget in KB/s, 0 if unlimited */
+	uint64_t bw_budget[TOP_BW_NUM];
+	/* Reject the requests that exceed the budget instead of only reporting
+	 * them */
+	bool bw_budget_enforce;
 };
 
+/*
+ *  lwis_top_bandwidth_request: Replace the bandwidth lwis_dev requests in the
+ *  pipeline totals of its top device. If the totals then exceed the budget,
+ *  LWIS_ERROR_EVENT_ID_BANDWIDTH_OVER_BUDGET is emitted from the top device,
+ *  and if the budget is enforced, the request is left unchanged and -EDQUOT is
+ *  returned. The request it replaces is copied to prev_bw, unless NULL.
+ */
+int lwis_top_bandwidth_request(struct lwis_device *lwis_dev, const unsigned int *bw,
+			       unsigned int *prev_bw);
+
+/*
+ *  lwis_top_bandwidth_restore: Put back the bandwidth request replaced by
+ *  lwis_top_bandwidth_request() when the vote it accounts for failed, without
+ *  checking the budget.
+ */
+void lwis_top_bandwidth_restore(struct lwis_device *lwis_dev, const unsigned int *bw);
+
 int lwis_top_device_deinit(void);
 #endif /* LWIS_DEVICE_TOP_H_ */
@@ -12,6 +12,7 @@
 
 #include "lwis_dt.h"
 
+#include <linux/cpumask.h>
 #include <linux/kernel.h>
 #include <linux/of.h>
 #include <linux/of_address.h>
@@ -25,6 +26,7 @@
 #include "lwis_i2c.h"
 #include "lwis_ioreg.h"
 #include "lwis_regulator.h"
+#include "lwis_transaction.h"
 
 #define SHARED_STRING "shared-"
 #define PULSE_STRING "pulse-"
@@ -286,6 +288,149 @@ static int parse_critical_irq_events(struct device_node *event_info, u64** irq_e
 
 	return critical_irq_events_num;
 }
+/*
+ * parse_irq_events: Reads the irq-events and int-reg-bits pairs of an
+ * interrupt status register node. The arrays are allocated on success and
+ * must be freed by the caller.
+ */
+static int parse_irq_events(struct device_node *node, u64 **irq_events, u32 **int_reg_bits,
+			    bool optional)
+{
+	int irq_events_num;
+	int int_reg_bits_num;
+	int ret;
+
+	*irq_events = NULL;
+	*int_reg_bits = NULL;
+
+	irq_events_num = of_property_count_elems_of_size(node, "irq-events", 8);
+	if (irq_events_num <= 0) {
+		if (optional && !of_find_property(node, "int-reg-bits", NULL)) {
+			return 0;
+		}
+		pr_err("Error getting irq-events: %d\n", irq_events_num);
+		return -EINVAL;
+	}
+
+	int_reg_bits_num = of_property_count_elems_of_size(node, "int-reg-bits", 4);
+	if (irq_events_num != int_reg_bits_num || int_reg_bits_num <= 0) {
+		pr_err("Error getting int-reg-bits: %d\n", int_reg_bits_num);
+		return -EINVAL;
+	}
+
+	*irq_events = kmalloc(sizeof(u64) * irq_events_num, GFP_KERNEL);
+	if (!*irq_events) {
+		return -ENOMEM;
+	}
+
+	*int_reg_bits = kmalloc(sizeof(u32) * int_reg_bits_num, GFP_KERNEL);
+	if (!*int_reg_bits) {
+		ret = -ENOMEM;
+		goto error;
+	}
+
+	ret = of_property_read_variable_u64_array(node, "irq-events", *irq_events,
+						  irq_events_num, irq_events_num);
+	if (ret != irq_events_num) {
+		pr_err("Error getting irq-events: %d\n", ret);
+		ret = (ret < 0) ? ret : -EINVAL;
+		goto error;
+	}
+
+	ret = of_property_read_variable_u32_array(node, "int-reg-bits", *int_reg_bits,
+						  int_reg_bits_num, int_reg_bits_num);
+	if (ret != int_reg_bits_num) {
+		pr_err("Error getting int-reg-bits: %d\n", ret);
+		ret = (ret < 0) ? ret : -EINVAL;
+		goto error;
+	}
+
+	return irq_events_num;
+
+error:
+	kfree(*irq_events);
+	kfree(*int_reg_bits);
+	*irq_events = NULL;
+	*int_reg_bits = NULL;
+	return ret;
+}
+
+/*
+ * parse_interrupt_leaves: Adds the leaf status registers that are reported by
+ * the aggregator status register of interrupt index, if any.
+ */
+static int parse_interrupt_leaves(struct lwis_device *lwis_dev, struct device_node *event_info,
+				  int index)
+{
+	struct of_phandle_iterator it;
+	int ret;
+
+	of_for_each_phandle (&it, ret, event_info, "irq-leaves", 0, 0) {
+		/* The iterator holds a reference to the node until the next one */
+		struct device_node *leaf_info = it.node;
+		u32 aggregator_bit;
+		u64 irq_src_reg;
+		u64 irq_reset_reg;
+		u64 irq_mask_reg;
+		int irq_events_num;
+		int critical_events_num;
+		u64 *irq_events = NULL;
+		u32 *int_reg_bits = NULL;
+		u64 *critical_events = NULL;
+
+		critical_events_num = parse_critical_irq_events(leaf_info, &critical_events);
+
+		irq_events_num = parse_irq_events(leaf_info, &irq_events, &int_reg_bits,
+						  /*optional=*/false);
+		if (irq_events_num < 0) {
+			ret = irq_events_num;
+			goto error_leaf;
+		}
+
+		ret = of_property_read_u32(leaf_info, "irq-aggregator-bit", &aggregator_bit);
+		if (ret) {
+			pr_err("Error getting irq-aggregator-bit from dt: %d\n", ret);
+			goto error_leaf;
+		}
+
+		ret = of_property_read_u64(leaf_info, "irq-src-reg", &irq_src_reg);
+		if (ret) {
+			pr_err("Error getting leaf irq-src-reg from dt: %d\n", ret);
+			goto error_leaf;
+		}
+
+		ret = of_property_read_u64(leaf_info, "irq-reset-reg", &irq_reset_reg);
+		if (ret) {
+			pr_err("Error getting leaf irq-reset-reg from dt: %d\n", ret);
+			goto error_leaf;
+		}
+
+		ret = of_property_read_u64(leaf_info, "irq-mask-reg", &irq_mask_reg);
+		if (ret) {
+			pr_err("Error getting leaf irq-mask-reg from dt: %d\n", ret);
+			goto error_leaf;
+		}
+
+		ret = lwis_interrupt_add_leaf(lwis_dev->irqs, index, aggregator_bit,
+					      (int64_t *)irq_events, irq_events_num, int_reg_bits,
+					      irq_events_num, irq_src_reg, irq_reset_reg,
+					      irq_mask_reg, (int64_t *)critical_events,
+					      critical_events_num);
+
+error_leaf:
+		kfree(irq_events);
+		kfree(int_reg_bits);
+		kfree(critical_events);
+		if (ret) {
+			of_node_put(leaf_info);
+			return ret;
+		}
+	}
+
+	/* Iteration ends with -ENOENT, which is also returned without leaves */
+	return (ret == -ENOENT) ? 0 : ret;
+}
+
 static int parse_interrupts(struct lwis_device *lwis_dev)
 {
 	int i;
@@ -334,72 +479,34 @@ static int parse_interrupts(struct lwis_device *lwis_dev)
 	of_for_each_phandle (&it, ret, dev_node, "interrupt-event-infos", 0, 0) {
 		const char *irq_reg_space = NULL;
 		bool irq_mask_reg_toggle;
+		bool has_leaves;
 		u64 irq_src_reg;
 		u64 irq_reset_reg;
 		u64 irq_mask_reg;
 		int irq_events_num;
 		int int_reg_bits_num;
 		int critical_events_num = 0;
-		u64 *irq_events;
-		u32 *int_reg_bits;
+		u64 *irq_events = NULL;
+		u32 *int_reg_bits = NULL;
 		u64 *critical_events = NULL;
 		int irq_reg_bid = -1;
 		int irq_reg_bid_count;
 		/* To match default value of reg-addr/value-bitwidth. */
 		u32 irq_reg_bitwidth = 32;
 		int j;
-		struct device_node *event_info = of_node_get(it.node);
+		struct device_node *event_info = it.node;
 
 		critical_events_num = parse_critical_irq_events(event_info, &critical_events);
 
-		irq_events_num = of_property_count_elems_of_size(event_info, "irq-events", 8);
-		if (irq_events_num <= 0) {
-			pr_err("Error getting irq-events: %d\n", irq_events_num);
-			ret = -EINVAL;
-			goto error_event_infos;
-		}
-
-		int_reg_bits_num = of_property_count_elems_of_size(event_info, "int-reg-bits", 4);
-		if (irq_events_num != int_reg_bits_num || int_reg_bits_num <= 0) {
-			pr_err("Error getting int-reg-bits: %d\n", int_reg_bits_num);
-			ret = -EINVAL;
-			goto error_event_infos;
-		}
-
-		irq_events = kmalloc(sizeof(u64) * irq_events_num, GFP_KERNEL);
-		if (IS_ERR_OR_NULL(irq_events)) {
-			ret = -ENOMEM;
-			goto error_event_infos;
-		}
-
-		int_reg_bits = kmalloc(sizeof(u32) * int_reg_bits_num, GFP_KERNEL);
-		if (IS_ERR_OR_NULL(int_reg_bits)) {
-			ret = -ENOMEM;
-			kfree(irq_events);
-			goto error_event_infos;
-		}
-
-		irq_events_num = of_property_read_variable_u64_array(
-			event_info, "irq-events", irq_events, irq_events_num, irq_events_num);
-		if (irq_events_num != int_reg_bits_num) {
-			pr_err("Error getting irq-events: %d\n", irq_events_num);
+		/* Aggregators may only report leaves */
+		has_leaves = of_property_read_bool(event_info, "irq-leaves");
+		irq_events_num = parse_irq_events(event_info, &irq_events, &int_reg_bits,
+						  /*optional=*/has_leaves);
+		if (irq_events_num < 0) {
 			ret = irq_events_num;
-			kfree(irq_events);
-			kfree(int_reg_bits);
-			goto error_event_infos;
-		}
-
-		int_reg_bits_num =
-			of_property_read_variable_u32_array(event_info, "int-reg-bits",
-							    int_reg_bits, int_reg_bits_num,
-							    int_reg_bits_num);
-		if (irq_events_num != int_reg_bits_num) {
-			pr_err("Error getting int-reg-bits: %d\n", int_reg_bits_num);
-			ret = int_reg_bits_num;
-			kfree(irq_events);
-			kfree(int_reg_bits);
 			goto error_event_infos;
 		}
+		int_reg_bits_num = irq_events_num;
 
 		ret = of_property_read_string(event_info, "irq-reg-space", &irq_reg_space);
 		if (ret) {
@@ -476,7 +583,14 @@ static int parse_interrupts(struct lwis_device *lwis_dev)
 			goto error_event_infos;
 		}
 
-		of_node_put(event_info);
+		ret = parse_interrupt_leaves(lwis_dev, event_info, i);
+		if (ret) {
+			pr_err("Error setting leaves for interrupt %d %d\n", i, ret);
+			kfree(irq_events);
+			kfree(int_reg_bits);
+			goto error_event_infos;
+		}
+
 		i++;
 		kfree(irq_events);
 		kfree(int_reg_bits);
@@ -488,6 +602,8 @@ static int parse_interrupts(struct lwis_device *lwis_dev)
 
 	return 0;
 error_event_infos:
+	/* Release the node of the failed iteration */
+	of_node_put(it.node);
 	for (i = 0; i < count; ++i) {
 		// TODO(yromanenko): lwis_interrupt_put
 	}
@@ -786,6 +902,66 @@ static int parse_pm_hibernation(struct lwis_device *lwis_dev)
 	return 0;
 }
 
+static int parse_dma_address_regs(struct lwis_device *lwis_dev)
+{
+	struct device *dev = &lwis_dev->plat_dev->dev;
+	struct device_node *dev_node = dev->of_node;
+	struct lwis_dma_address_reg *regs;
+	u32 bid, offset;
+	int count;
+	int i;
+
+	lwis_dev->dma_address_regs = NULL;
+	lwis_dev->num_dma_address_regs = 0;
+
+	/* Listed as <bid offset> pairs, no validation without it */
+	count = of_property_count_elems_of_size(dev_node, "dma-address-regs", sizeof(u32));
+	if (count <= 0) {
+		return 0;
+	}
+	if (count % 2) {
+		pr_err("dma-address-regs should be <bid offset> pairs\n");
+		return -EINVAL;
+	}
+
+	regs = devm_kcalloc(dev, count / 2, sizeof(struct lwis_dma_address_reg), GFP_KERNEL);
+	if (!regs) {
+		return -ENOMEM;
+	}
+	for (i = 0; i < count / 2; ++i) {
+		of_property_read_u32_index(dev_node, "dma-address-regs", 2 * i, &bid);
+		of_property_read_u32_index(dev_node, "dma-address-regs", 2 * i + 1, &offset);
+		regs[i].bid = bid;
+		regs[i].offset = offset;
+	}
+	lwis_dev->dma_address_regs = regs;
+	lwis_dev->num_dma_address_regs = count / 2;
+
+	return 0;
+}
+
+static int parse_rt_worker(struct lwis_device *lwis_dev)
+{
+	struct device_node *dev_node = lwis_dev->plat_dev->dev.of_node;
+	u32 cpu;
+
+	lwis_dev->rt_worker_enabled = of_property_read_bool(dev_node, "rt-worker");
+	lwis_dev->rt_worker_cpu = -1;
+
+	if (!of_property_read_u32(dev_node, "rt-worker-cpu", &cpu)) {
+		if (cpu >= nr_cpu_ids) {
+			pr_err("Invalid rt-worker-cpu %u\n", cpu);
+			return -EINVAL;
+		}
+		lwis_dev->rt_worker_cpu = cpu;
+	}
+
+	lwis_dev->rt_worker_transactions =
+		of_property_read_bool(dev_node, "rt-worker-transactions");
+
+	return 0;
+}
+
 int lwis_base_parse_dt(struct lwis_device *lwis_dev)
 {
 	struct device *dev;
@@ -884,6 +1060,24 @@ int lwis_base_parse_dt(struct lwis_device *lwis_dev)
 		return ret;
 	}
 
+	ret = parse_rt_worker(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing rt worker\n");
+		return ret;
+	}
+
+	ret = parse_dma_address_regs(lwis_dev);
+	if (ret) {
+		pr_err("Error parsing dma-address-regs\n");
+		return ret;
+	}
+
+	lwis_dev->buffer_pool_kb = 0;
+	of_property_read_u32(dev_node, "buffer-pool-size-kb", &lwis_dev->buffer_pool_kb);
+
+	lwis_dev->event_history_depth = LWIS_EVENT_HISTORY_DEFAULT_DEPTH;
+	of_property_read_u32(dev_node, "event-history-depth", &lwis_dev->event_history_depth);
+
 	parse_bitwidths(lwis_dev);
 
 	iommus = of_find_property(dev_node, "iommus", &iommus_len);
@@ -892,6 +1086,19 @@ int lwis_base_parse_dt(struct lwis_device *lwis_dev)
 	lwis_dev->bts_scenario_name = NULL;
 	of_property_read_string(dev_node, "bts-scenario", &lwis_dev->bts_scenario_name);
 
+	lwis_dev->power_down_delay_ms = 0;
+	of_property_read_u32(dev_node, "power-down-delay-ms", &lwis_dev->power_down_delay_ms);
+
+	lwis_dev->transaction_instance_pool_size = LWIS_TRANSACTION_INSTANCE_POOL_SIZE;
+	of_property_read_u32(dev_node, "transaction-instance-pool-size",
+			     &lwis_dev->transaction_instance_pool_size);
+	if (lwis_dev->transaction_instance_pool_size == 0 ||
+	    lwis_dev->transaction_instance_pool_size > BITS_PER_LONG) {
+		pr_err("Invalid transaction-instance-pool-size %u\n",
+		       lwis_dev->transaction_instance_pool_size);
+		return -EINVAL;
+	}
+
 	dev_node->data = lwis_dev;
 
 	pr_debug("Device tree entry [%s] - end\n", lwis_dev->name);
@@ -899,6 +1106,69 @@ int lwis_base_parse_dt(struct lwis_device *lwis_dev)
 	return ret;
 }
 
+static bool i2c_uses_shared_pins(struct lwis_device *lwis_dev)
+{
+	int i;
+
+	if (lwis_dev->shared_pinctrl > 0 || lwis_dev->shared_enable_gpios_present) {
+		return true;
+	}
+	if (lwis_dev->gpios_list) {
+		for (i = 0; i < lwis_dev->gpios_list->count; ++i) {
+			if (lwis_dev->gpios_list->gpios_info[i].is_shared) {
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+static int parse_i2c_shadow_ranges(struct lwis_i2c_device *i2c_dev,
+				   struct device_node *dev_node)
+{
+	int i;
+	int count;
+	u32 start;
+	u32 end;
+
+	i2c_dev->shadow_ranges = NULL;
+	i2c_dev->num_shadow_ranges = 0;
+	i2c_dev->shadow_reads = of_property_read_bool(dev_node, "i2c-cache-reads");
+
+	/* Registers are volatile unless listed as <start end> pairs */
+	count = of_property_count_u32_elems(dev_node, "i2c-cacheable-ranges");
+	if (count <= 0) {
+		return 0;
+	}
+	if (count % 2) {
+		dev_err(i2c_dev->base_dev.dev, "i2c-cacheable-ranges must hold <start end> pairs\n");
+		return -EINVAL;
+	}
+
+	i2c_dev->shadow_ranges =
+		kcalloc(count / 2, sizeof(struct lwis_i2c_shadow_range), GFP_KERNEL);
+	if (!i2c_dev->shadow_ranges) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < count / 2; ++i) {
+		of_property_read_u32_index(dev_node, "i2c-cacheable-ranges", 2 * i, &start);
+		of_property_read_u32_index(dev_node, "i2c-cacheable-ranges", 2 * i + 1, &end);
+		if (end < start) {
+			dev_err(i2c_dev->base_dev.dev, "Invalid cacheable range 0x%x-0x%x\n", start,
+				end);
+			kfree(i2c_dev->shadow_ranges);
+			i2c_dev->shadow_ranges = NULL;
+			return -EINVAL;
+		}
+		i2c_dev->shadow_ranges[i].start = start;
+		i2c_dev->shadow_ranges[i].end = end;
+	}
+	i2c_dev->num_shadow_ranges = count / 2;
+
+	return 0;
+}
+
 int lwis_i2c_device_parse_dt(struct lwis_i2c_device *i2c_dev)
 {
 	struct device_node *dev_node;
@@ -925,6 +1195,35 @@ int lwis_i2c_device_parse_dt(struct lwis_i2c_device *i2c_dev)
 		return ret;
 	}
 
+	i2c_dev->max_burst_bytes = I2C_DEFAULT_MAX_BURST_BYTES;
+	of_property_read_u32(dev_node, "i2c-max-burst-bytes", &i2c_dev->max_burst_bytes);
+	i2c_dev->write_chunk_bytes = 0;
+	of_property_read_u32(dev_node, "i2c-write-chunk-bytes", &i2c_dev->write_chunk_bytes);
+	i2c_dev->write_chunk_delay_us = 0;
+	of_property_read_u32(dev_node, "i2c-write-chunk-delay-us", &i2c_dev->write_chunk_delay_us);
+	i2c_dev->coalesce_writes = of_property_read_bool(dev_node, "i2c-coalesce-writes");
+	i2c_dev->combine_transfers = of_property_read_bool(dev_node, "i2c-combine-transfers");
+	/* Combined transfers take over the register accesses of transactions,
+	   which would then silently skip the coalescing */
+	if (i2c_dev->coalesce_writes && i2c_dev->combine_transfers) {
+		dev_err(i2c_dev->base_dev.dev,
+			"i2c-coalesce-writes and i2c-combine-transfers are exclusive\n");
+		return -EINVAL;
+	}
+
+	ret = parse_i2c_shadow_ranges(i2c_dev, dev_node);
+	if (ret) {
+		dev_err(i2c_dev->base_dev.dev, "Failed to parse i2c-cacheable-ranges\n");
+		return ret;
+	}
+
+	/* Power sequences touching pins shared with other devices are serialized
+	   in one group, unless the device tree names a narrower group */
+	if (of_property_read_u32(dev_node, "i2c-lock-group", &i2c_dev->lock_group) &&
+	    i2c_uses_shared_pins(&i2c_dev->base_dev)) {
+		i2c_dev->lock_group = I2C_LOCK_GROUP_SHARED;
+	}
+
 	return 0;
 }
 
@@ -959,8 +1258,13 @@ int lwis_ioreg_device_parse_dt(struct lwis_ioreg_device *ioreg_dev)
 			dev_err(ioreg_dev->base_dev.dev, "Cannot set ioreg info for %s\n", name);
 			goto error_ioreg;
 		}
+		ioreg_dev->reg_list.block[i].wide_access =
+			of_property_match_string(dev_node, "reg-wide-access", name) >= 0;
 	}
 
+	ioreg_dev->base_dev.direct_event_dispatch =
+		of_property_read_bool(dev_node, "direct-event-dispatch");
+
 	return 0;
 
 error_ioreg:
@@ -973,6 +1277,23 @@ error_ioreg:
 
 int lwis_top_device_parse_dt(struct lwis_top_device *top_dev)
 {
-	/* To be implemented */
+	struct device_node *dev_node = top_dev->base_dev.plat_dev->dev.of_node;
+	u32 budget[TOP_BW_NUM];
+	int ret;
+	int i;
+
+	/* Pipeline bandwidth budget in KB/s as <peak read write rt>, 0 for no
+	 * limit. Optional, the bandwidth is unlimited without it */
+	ret = of_property_read_u32_array(dev_node, "bandwidth-budget-kbps", budget, TOP_BW_NUM);
+	if (ret == 0) {
+		for (i = 0; i < TOP_BW_NUM; ++i) {
+			top_dev->bw_budget[i] = budget[i];
+		}
+	} else if (ret != -EINVAL) {
+		pr_err("Error getting bandwidth-budget-kbps: %d\n", ret);
+		return ret;
+	}
+	top_dev->bw_budget_enforce = of_property_read_bool(dev_node, "bandwidth-budget-enforce");
+
 	return 0;
 }
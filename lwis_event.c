@@ -10,17 +10,28 @@
 
 #define pr_fmt(fmt) KBUILD_MODNAME "-event: " fmt
 
+#include <linux/eventfd.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 
 #include "lwis_device.h"
 #include "lwis_event.h"
+#include "lwis_trace.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
 
 /* Maximum number of pending events in the event queues */
 #define MAX_NUM_PENDING_EVENTS 2048
 
+/* Limits of the event ring that userspace can request */
+#define MAX_NUM_EVENT_RING_SLOTS 4096
+#define MAX_EVENT_RING_SLOT_PAYLOAD_SIZE 4096
+
 /*
  * lwis_client_event_state_find_locked: Looks through the provided client's
  * event state list and tries to find a lwis_client_event_state object with the
@@ -110,6 +121,12 @@ lwis_client_event_state_find_or_create(struct lwis_client *lwis_client, int64_t
 		 */
 		new_state->event_control.event_id = event_id;
 		new_state->event_control.flags = 0;
+		new_state->eventfd = NULL;
+		new_state->eventfd_notify_only = false;
+		memset(&new_state->filter, 0, sizeof(new_state->filter));
+		new_state->filter.event_id = event_id;
+		new_state->filter_skipped = 0;
+		new_state->latest_event = NULL;
 
 		/* Critical section for adding to the hash table */
 		spin_lock_irqsave(&lwis_client->event_lock, flags);
@@ -141,7 +158,7 @@ lwis_client_event_state_find_or_create(struct lwis_client *lwis_client, int64_t
  * event state list and tries to find a lwis_device_event_state object with the
  * matching event_id. If not found, returns NULL
  *
- * Assumes: lwis_dev->lock is locked
+ * Assumes: lwis_dev->lock is locked, or rcu_read_lock is held
  * Alloc: No
  * Returns: device event state object, if found, NULL otherwise
  */
@@ -152,7 +169,7 @@ lwis_device_event_state_find_locked(struct lwis_device *lwis_dev, int64_t event_
 	struct lwis_device_event_state *p;
 
 	/* Iterate through the hash bucket for this event_id */
-	hash_for_each_possible (lwis_dev->event_states, p, node, event_id) {
+	hash_for_each_possible_rcu (lwis_dev->event_states, p, node, event_id) {
 		/* If it's indeed the right one, return it */
 		if (p->event_id == event_id) {
 			return p;
@@ -162,27 +179,6 @@ lwis_device_event_state_find_locked(struct lwis_device *lwis_dev, int64_t event_
 	return NULL;
 }
 
-/*
- * save_device_event_state_to_history_locked: Saves the emitted events in a
- * history buffer for better debugability.
- *
- * Assumes: lwis_dev->lock is locked
- * Alloc : No
- * Returns: None
- */
-static void save_device_event_state_to_history_locked(struct lwis_device *lwis_dev,
-						      struct lwis_device_event_state *state,
-						      int64_t timestamp)
-{
-	lwis_dev->debug_info.event_hist[lwis_dev->debug_info.cur_event_hist_idx].state = *state;
-	lwis_dev->debug_info.event_hist[lwis_dev->debug_info.cur_event_hist_idx].timestamp =
-		timestamp;
-	lwis_dev->debug_info.cur_event_hist_idx++;
-	if (lwis_dev->debug_info.cur_event_hist_idx >= EVENT_DEBUG_HISTORY_SIZE) {
-		lwis_dev->debug_info.cur_event_hist_idx = 0;
-	}
-}
-
 /*
  * lwis_device_event_state_find: Looks through the provided device's
  * event state list and tries to find a lwis_device_event_state object with the
@@ -233,8 +229,10 @@ struct lwis_device_event_state *lwis_device_event_state_find_or_create(struct lw
 		 */
 		new_state->event_id = event_id;
 		new_state->enable_counter = 0;
-		new_state->event_counter = 0;
+		atomic64_set(&new_state->event_counter, 0);
 		new_state->has_subscriber = false;
+		new_state->listeners = 0;
+		new_state->pinned = false;
 
 		/* Critical section for adding to the hash table */
 		spin_lock_irqsave(&lwis_dev->lock, flags);
@@ -246,7 +244,7 @@ struct lwis_device_event_state *lwis_device_event_state_find_or_create(struct lw
 		/* Ok, it's not there */
 		if (state == NULL) {
 			/* Let's add the new state object */
-			hash_add(lwis_dev->event_states, &new_state->node, event_id);
+			hash_add_rcu(lwis_dev->event_states, &new_state->node, event_id);
 			state = new_state;
 		} else {
 			/* Ok, we now suddenly have a valid state so we need to
@@ -262,6 +260,94 @@ struct lwis_device_event_state *lwis_device_event_state_find_or_create(struct lw
 	return state;
 }
 
+struct lwis_device_event_state *lwis_device_event_state_pin(struct lwis_device *lwis_dev,
+							    int64_t event_id)
+{
+	struct lwis_device_event_state *state;
+	unsigned long flags;
+
+	state = lwis_device_event_state_find_or_create(lwis_dev, event_id);
+	if (IS_ERR_OR_NULL(state)) {
+		return state;
+	}
+
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	state->pinned = true;
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+
+	return state;
+}
+
+int lwis_device_event_listener_add(struct lwis_client *lwis_client, int64_t event_id)
+{
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	struct lwis_device_event_state *state;
+	unsigned long flags;
+
+	/* Clients without a slot are visited on every emit */
+	if (lwis_client->slot < 0) {
+		return 0;
+	}
+
+	/* Set the bit with the device lock held, so that the state cannot be
+	 * cleared in between and the bit is seen by
+	 * lwis_device_event_states_clear_locked */
+	spin_lock_irqsave(&lwis_dev->lock, flags);
+	state = lwis_device_event_state_find_locked(lwis_dev, event_id);
+	while (!state) {
+		spin_unlock_irqrestore(&lwis_dev->lock, flags);
+		state = lwis_device_event_state_find_or_create(lwis_dev, event_id);
+		if (IS_ERR_OR_NULL(state)) {
+			return -ENOMEM;
+		}
+		spin_lock_irqsave(&lwis_dev->lock, flags);
+		state = lwis_device_event_state_find_locked(lwis_dev, event_id);
+	}
+	set_bit(lwis_client->slot, &state->listeners);
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+	return 0;
+}
+
+int lwis_device_event_listener_update(struct lwis_client *lwis_client, int64_t event_id,
+				      bool queue_enabled)
+{
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	struct lwis_device_event_state *state;
+	unsigned long flags, dev_flags;
+	int ret = 0;
+
+	if (lwis_client->slot < 0) {
+		return 0;
+	}
+
+	/* Transactions add their listener bit with the transaction lock held,
+	 * so holding it here keeps a newly queued transaction from losing it */
+	spin_lock_irqsave(&lwis_client->transaction_lock, flags);
+	if (queue_enabled || lwis_transaction_event_pending_locked(lwis_client, event_id)) {
+		ret = lwis_device_event_listener_add(lwis_client, event_id);
+	} else {
+		spin_lock_irqsave(&lwis_dev->lock, dev_flags);
+		state = lwis_device_event_state_find_locked(lwis_dev, event_id);
+		if (state) {
+			clear_bit(lwis_client->slot, &state->listeners);
+		}
+		spin_unlock_irqrestore(&lwis_dev->lock, dev_flags);
+	}
+	spin_unlock_irqrestore(&lwis_client->transaction_lock, flags);
+
+	return ret;
+}
+
+void lwis_device_event_listeners_release_locked(struct lwis_client *lwis_client)
+{
+	struct lwis_device_event_state *state;
+	int i;
+
+	hash_for_each (lwis_client->lwis_dev->event_states, i, state, node) {
+		clear_bit(lwis_client->slot, &state->listeners);
+	}
+}
+
 static int lwis_client_event_get_trigger_device_id(int64_t event_id)
 {
 	return (event_id >> LWIS_EVENT_ID_EVENT_CODE_LEN) & 0xFFFF;
@@ -338,7 +424,7 @@ static int lwis_client_event_unsubscribe(struct lwis_client *lwis_client, int64_
 	event_state = lwis_device_event_state_find(lwis_dev, event_id);
 	if (event_state) {
 		spin_lock_irqsave(&lwis_dev->lock, flags);
-		event_state->event_counter = 0;
+		atomic64_set(&event_state->event_counter, 0);
 		spin_unlock_irqrestore(&lwis_dev->lock, flags);
 	}
 
@@ -363,6 +449,14 @@ int lwis_client_event_control_set(struct lwis_client *lwis_client,
 	new_flags = control->flags;
 	if (old_flags != new_flags) {
 		state->event_control.flags = new_flags;
+		ret = lwis_device_event_listener_update(
+			lwis_client, control->event_id,
+			/*queue_enabled=*/new_flags & LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE);
+		if (ret) {
+			dev_err(lwis_client->lwis_dev->dev, "Updating event listener failed: %d\n",
+				ret);
+			return ret;
+		}
 		ret = lwis_device_event_flags_updated(lwis_client->lwis_dev, control->event_id,
 						      old_flags, new_flags);
 		if (ret) {
@@ -401,6 +495,78 @@ int lwis_client_event_control_set(struct lwis_client *lwis_client,
 	return ret;
 }
 
+int lwis_client_event_eventfd_bind(struct lwis_client *lwis_client, int64_t event_id,
+				   struct eventfd_ctx *eventfd, bool notify_only)
+{
+	struct lwis_client_event_state *state;
+	struct eventfd_ctx *old_eventfd;
+	unsigned long flags;
+
+	state = lwis_client_event_state_find_or_create(lwis_client, event_id);
+	if (IS_ERR_OR_NULL(state)) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"Failed to find or create new client event state\n");
+		if (eventfd) {
+			eventfd_ctx_put(eventfd);
+		}
+		return -ENOMEM;
+	}
+
+	/* Emitters signal the eventfd with the event lock held, so the old one
+	 * can be released once it is replaced */
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	old_eventfd = state->eventfd;
+	state->eventfd = eventfd;
+	state->eventfd_notify_only = eventfd && notify_only;
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	if (old_eventfd) {
+		eventfd_ctx_put(old_eventfd);
+	}
+	return 0;
+}
+
+int lwis_client_event_filter_set(struct lwis_client *lwis_client,
+				 const struct lwis_event_filter *filter)
+{
+	struct lwis_client_event_state *state;
+	unsigned long flags;
+
+	switch (filter->mode) {
+	case LWIS_EVENT_FILTER_NONE:
+	case LWIS_EVENT_FILTER_LATEST:
+		break;
+	case LWIS_EVENT_FILTER_EVERY_NTH:
+		if (filter->divisor == 0) {
+			return -EINVAL;
+		}
+		break;
+	case LWIS_EVENT_FILTER_COUNTER_MODULO:
+		if (filter->remainder >= filter->divisor) {
+			return -EINVAL;
+		}
+		break;
+	default:
+		return -EINVAL;
+	}
+	if (filter->reserved != 0) {
+		return -EINVAL;
+	}
+
+	state = lwis_client_event_state_find_or_create(lwis_client, filter->event_id);
+	if (IS_ERR_OR_NULL(state)) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"Failed to find or create new client event state\n");
+		return -ENOMEM;
+	}
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	state->filter = *filter;
+	state->filter_skipped = 0;
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+	return 0;
+}
+
 int lwis_client_event_control_get(struct lwis_client *lwis_client, int64_t event_id,
 				  struct lwis_event_control *control)
 {
@@ -418,6 +584,27 @@ int lwis_client_event_control_get(struct lwis_client *lwis_client, int64_t event
 	return 0;
 }
 
+/*
+ * event_removed_locked: Forgets the entry of an event filtered with
+ * LWIS_EVENT_FILTER_LATEST once it leaves the event queue, so that the next
+ * occurrence is queued rather than replacing it.
+ *
+ * Assumes: lwis_client->event_lock is locked
+ */
+static void event_removed_locked(struct lwis_client *lwis_client, struct lwis_event_entry *event)
+{
+	struct lwis_client_event_state *state;
+
+	if (!event->coalesced) {
+		return;
+	}
+	event->coalesced = false;
+	state = lwis_client_event_state_find_locked(lwis_client, event->event_info.event_id);
+	if (state && state->latest_event == event) {
+		state->latest_event = NULL;
+	}
+}
+
 static int event_queue_get_front(struct lwis_client *lwis_client, struct list_head *event_queue,
 				 size_t *event_queue_size, bool should_remove_entry,
 				 struct lwis_event_entry **event_out)
@@ -439,6 +626,9 @@ static int event_queue_get_front(struct lwis_client *lwis_client, struct list_he
 		/* Delete from the queue */
 		list_del(&event->node);
 		(*event_queue_size)--;
+		event_removed_locked(lwis_client, event);
+		lwis_latency_record(lwis_client, LWIS_LATENCY_EMIT_TO_DEQUEUE,
+				    ktime_to_ns(lwis_get_time()) - event->event_info.timestamp_ns);
 	}
 	if (event_out) {
 		/* Copy it over */
@@ -447,7 +637,7 @@ static int event_queue_get_front(struct lwis_client *lwis_client, struct list_he
 		/* The caller did not request ownership of the event,
 		 * and this is a "pop" operation, we can just free the
 		 * event here. */
-		kfree(event);
+		lwis_event_entry_free(event);
 	}
 	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
 
@@ -465,7 +655,8 @@ static void event_queue_clear(struct lwis_client *lwis_client, struct list_head
 	list_for_each_safe (it_event, it_tmp, event_queue) {
 		event = list_entry(it_event, struct lwis_event_entry, node);
 		list_del(&event->node);
-		kfree(event);
+		event_removed_locked(lwis_client, event);
+		lwis_event_entry_free(event);
 	}
 	*event_queue_size = 0;
 	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
@@ -514,12 +705,272 @@ void lwis_client_error_event_queue_clear(struct lwis_client *lwis_client)
 			  &lwis_client->error_event_queue_size);
 }
 
+/*
+ * event_queue_pop_batch_locked: Moves events from the front of event_queue to
+ * out_list while they fit in the remaining count and payload budget.
+ *
+ * Assumes: lwis_client->event_lock is locked
+ * Returns: false once an event did not fit, true otherwise
+ */
+static bool event_queue_pop_batch_locked(struct lwis_client *lwis_client,
+					 struct list_head *event_queue, size_t *event_queue_size,
+					 struct list_head *out_list, size_t max_events,
+					 size_t *num_events, size_t payload_budget,
+					 size_t *payload_offset, size_t *next_payload_size)
+{
+	struct lwis_event_entry *event;
+	size_t offset;
+
+	while (!list_empty(event_queue)) {
+		if (*num_events >= max_events) {
+			return false;
+		}
+		event = list_first_entry(event_queue, struct lwis_event_entry, node);
+		offset = ALIGN(*payload_offset, sizeof(uint64_t));
+		if (event->event_info.payload_size > 0 &&
+		    offset + event->event_info.payload_size > payload_budget) {
+			*next_payload_size = event->event_info.payload_size;
+			return false;
+		}
+		if (event->event_info.payload_size > 0) {
+			*payload_offset = offset + event->event_info.payload_size;
+		}
+		list_move_tail(&event->node, out_list);
+		(*event_queue_size)--;
+		(*num_events)++;
+		event_removed_locked(lwis_client, event);
+	}
+	return true;
+}
+
+size_t lwis_client_event_pop_batch(struct lwis_client *lwis_client, size_t max_events,
+				   size_t payload_budget, struct list_head *error_events,
+				   struct list_head *events, size_t *next_payload_size)
+{
+	size_t num_events = 0;
+	size_t payload_offset = 0;
+	struct lwis_event_entry *event;
+	int64_t now;
+	unsigned long flags;
+
+	*next_payload_size = 0;
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	/* Error events have priority over the normal events */
+	if (event_queue_pop_batch_locked(lwis_client, &lwis_client->error_event_queue,
+					 &lwis_client->error_event_queue_size, error_events,
+					 max_events, &num_events, payload_budget, &payload_offset,
+					 next_payload_size)) {
+		event_queue_pop_batch_locked(lwis_client, &lwis_client->event_queue,
+					     &lwis_client->event_queue_size, events, max_events,
+					     &num_events, payload_budget, &payload_offset,
+					     next_payload_size);
+	}
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	now = ktime_to_ns(lwis_get_time());
+	list_for_each_entry (event, error_events, node) {
+		lwis_latency_record(lwis_client, LWIS_LATENCY_EMIT_TO_DEQUEUE,
+				    now - event->event_info.timestamp_ns);
+	}
+	list_for_each_entry (event, events, node) {
+		lwis_latency_record(lwis_client, LWIS_LATENCY_EMIT_TO_DEQUEUE,
+				    now - event->event_info.timestamp_ns);
+	}
+
+	return num_events;
+}
+
+void lwis_client_event_unpop_batch(struct lwis_client *lwis_client, struct list_head *error_events,
+				   struct list_head *events)
+{
+	struct list_head *it_event;
+	struct lwis_event_entry *event;
+	struct lwis_client_event_state *state;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	list_for_each (it_event, error_events) {
+		lwis_client->error_event_queue_size++;
+	}
+	list_for_each (it_event, events) {
+		lwis_client->event_queue_size++;
+	}
+	/* The last occurrence put back is again the one the next occurrence
+	 * replaces, unless another one was queued meanwhile */
+	list_for_each_entry_reverse (event, events, node) {
+		state = lwis_client_event_state_find_locked(lwis_client,
+							    event->event_info.event_id);
+		if (state && state->filter.mode == LWIS_EVENT_FILTER_LATEST &&
+		    !state->latest_event) {
+			event->coalesced = true;
+			state->latest_event = event;
+		}
+	}
+	list_splice_init(error_events, &lwis_client->error_event_queue);
+	list_splice_init(events, &lwis_client->event_queue);
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+}
+
+int lwis_client_event_ring_setup(struct lwis_client *lwis_client,
+				 struct lwis_event_ring_info *info)
+{
+	struct lwis_event_ring *ring;
+	size_t slots_offset, slot_size, mmap_size;
+	unsigned long flags;
+
+	if (lwis_client->event_ring) {
+		dev_err(lwis_client->lwis_dev->dev, "Event ring is already set up\n");
+		return -EBUSY;
+	}
+
+	if (info->num_slots == 0 || info->num_slots > MAX_NUM_EVENT_RING_SLOTS ||
+	    !is_power_of_2(info->num_slots) ||
+	    info->slot_payload_size > MAX_EVENT_RING_SLOT_PAYLOAD_SIZE) {
+		dev_err(lwis_client->lwis_dev->dev,
+			"Invalid event ring size: %u slots of %u payload bytes\n", info->num_slots,
+			info->slot_payload_size);
+		return -EINVAL;
+	}
+
+	slots_offset = ALIGN(sizeof(struct lwis_event_ring_header), SMP_CACHE_BYTES);
+	slot_size = ALIGN(sizeof(struct lwis_event_ring_slot) + info->slot_payload_size,
+			  sizeof(uint64_t));
+	mmap_size = PAGE_ALIGN(slots_offset + info->num_slots * slot_size);
+
+	ring = kzalloc(sizeof(struct lwis_event_ring), GFP_KERNEL);
+	if (!ring) {
+		dev_err(lwis_client->lwis_dev->dev, "Failed to allocate event ring\n");
+		return -ENOMEM;
+	}
+
+	/* vmalloc_user returns zeroed memory that can be mapped to userspace */
+	ring->header = vmalloc_user(mmap_size);
+	if (!ring->header) {
+		dev_err(lwis_client->lwis_dev->dev, "Failed to allocate event ring buffer\n");
+		kfree(ring);
+		return -ENOMEM;
+	}
+	ring->header->num_slots = info->num_slots;
+	ring->header->slot_size = slot_size;
+	ring->header->slots_offset = slots_offset;
+	ring->slots = (uint8_t *)ring->header + slots_offset;
+	ring->mmap_size = mmap_size;
+	ring->num_slots = info->num_slots;
+	ring->slot_size = slot_size;
+	ring->slot_payload_size = info->slot_payload_size;
+	ring->write_index = 0;
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	lwis_client->event_ring = ring;
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	info->mmap_size = mmap_size;
+	return 0;
+}
+
+void lwis_client_event_ring_free(struct lwis_client *lwis_client)
+{
+	struct lwis_event_ring *ring;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	ring = lwis_client->event_ring;
+	lwis_client->event_ring = NULL;
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	if (!ring) {
+		return;
+	}
+	vfree(ring->header);
+	kfree(ring);
+}
+
+int lwis_client_event_ring_mmap(struct lwis_client *lwis_client, struct vm_area_struct *vma)
+{
+	struct lwis_event_ring *ring = lwis_client->event_ring;
+
+	if (!ring) {
+		dev_err(lwis_client->lwis_dev->dev, "Event ring is not set up\n");
+		return -ENODEV;
+	}
+
+	if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start > ring->mmap_size) {
+		dev_err(lwis_client->lwis_dev->dev, "Invalid event ring mapping range\n");
+		return -EINVAL;
+	}
+
+	/* Userspace writes read_index, the driver never reads anything else
+	 * back from the mapping */
+	return remap_vmalloc_range(vma, ring->header, 0);
+}
+
+bool lwis_client_event_ring_poll(struct lwis_client *lwis_client)
+{
+	struct lwis_event_ring *ring;
+	bool has_events = false;
+	unsigned long flags;
+
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	ring = lwis_client->event_ring;
+	if (ring) {
+		has_events = ring->write_index != smp_load_acquire(&ring->header->read_index);
+	}
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+
+	return has_events;
+}
+
+/*
+ * event_ring_push_locked: Writes an event into the next slot of the event
+ * ring, overwriting the oldest event if the ring is full.
+ *
+ * Assumes: lwis_client->event_lock is locked
+ * Alloc: No
+ * Returns: true if the whole event, including payload, fits in the ring
+ */
+static bool event_ring_push_locked(struct lwis_event_ring *ring, int64_t event_id,
+				   int64_t event_counter, int64_t timestamp, void *payload,
+				   size_t payload_size)
+{
+	uint64_t index = ring->write_index;
+	struct lwis_event_ring_slot *slot =
+		(struct lwis_event_ring_slot *)(ring->slots +
+						(index & (ring->num_slots - 1)) * ring->slot_size);
+	bool payload_fits = payload_size <= ring->slot_payload_size;
+
+	/* Invalidate the slot before overwriting it so that a reader racing
+	 * with us discards what it copied */
+	WRITE_ONCE(slot->sequence, 0);
+	smp_wmb();
+
+	slot->event_id = event_id;
+	slot->event_counter = event_counter;
+	slot->timestamp_ns = timestamp;
+	slot->payload_size = payload_size;
+	slot->flags = payload_fits ? 0 : LWIS_EVENT_RING_SLOT_FLAG_PAYLOAD_QUEUED;
+	if (payload_fits && payload_size > 0) {
+		memcpy(slot->payload, payload, payload_size);
+	}
+
+	smp_wmb();
+	WRITE_ONCE(slot->sequence, index + 1);
+	ring->write_index = index + 1;
+	smp_store_release(&ring->header->write_index, index + 1);
+
+	return payload_fits;
+}
+
 /*
  * lwis_client_event_push_back: Inserts new event into the client event queue
  * to be later consumed by userspace. Takes ownership of *event (does not copy,
  * will be freed on the other side)
  *
- * Also wakes up any readers for this client (select() callers, etc.)
+ * Also wakes up any readers for this client (select() callers, etc.) if wake
+ * is set
+ *
+ * If coalesce is set, the event replaces the entry of the previous occurrence
+ * still queued, if any, following LWIS_EVENT_FILTER_LATEST
  *
  * Locks: lwis_client->event_lock
  *
@@ -527,8 +978,10 @@ void lwis_client_error_event_queue_clear(struct lwis_client *lwis_client)
  * Returns: 0 on success
  */
 static int lwis_client_event_push_back(struct lwis_client *lwis_client,
-				       struct lwis_event_entry *event)
+				       struct lwis_event_entry *event, bool wake, bool coalesce)
 {
+	struct lwis_client_event_state *state = NULL;
+	struct lwis_event_entry *replaced = NULL;
 	unsigned long flags;
 
 	if (!event) {
@@ -538,8 +991,21 @@ static int lwis_client_event_push_back(struct lwis_client *lwis_client,
 
 	spin_lock_irqsave(&lwis_client->event_lock, flags);
 
+	/* The state is looked up again as it may have been cleared since the
+	 * event was filtered */
+	if (coalesce) {
+		state = lwis_client_event_state_find_locked(lwis_client,
+							    event->event_info.event_id);
+	}
+	if (state && state->latest_event) {
+		replaced = state->latest_event;
+		list_del(&replaced->node);
+		lwis_client->event_queue_size--;
+	}
+
 	if (lwis_client->event_queue_size >= MAX_NUM_PENDING_EVENTS) {
 		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+		lwis_stats_add(lwis_client->lwis_dev, LWIS_STAT_EVENT_QUEUE_OVERFLOWS, 1);
 		/* Send an error event to userspace to handle the overflow */
 		lwis_device_error_event_emit(lwis_client->lwis_dev,
 					     LWIS_ERROR_EVENT_ID_EVENT_QUEUE_OVERFLOW,
@@ -549,10 +1015,19 @@ static int lwis_client_event_push_back(struct lwis_client *lwis_client,
 
 	list_add_tail(&event->node, &lwis_client->event_queue);
 	lwis_client->event_queue_size++;
+	if (state) {
+		event->coalesced = true;
+		state->latest_event = event;
+	}
 
 	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
 
-	wake_up_interruptible(&lwis_client->event_wait_queue);
+	if (replaced) {
+		lwis_event_entry_free(replaced);
+	}
+	if (wake) {
+		wake_up_interruptible(&lwis_client->event_wait_queue);
+	}
 
 	return 0;
 }
@@ -622,6 +1097,9 @@ int lwis_client_event_states_clear(struct lwis_client *lwis_client)
 		lwis_device_event_flags_updated(lwis_client->lwis_dev,
 						state->event_control.event_id,
 						state->event_control.flags, 0);
+		if (state->eventfd) {
+			eventfd_ctx_put(state->eventfd);
+		}
 		/* Free the object */
 		kfree(state);
 	}
@@ -636,8 +1114,19 @@ int lwis_device_event_states_clear_locked(struct lwis_device *lwis_dev)
 	int i;
 
 	hash_for_each_safe (lwis_dev->event_states, i, n, state, node) {
-		hash_del(&state->node);
-		kfree(state);
+		/* Pinned states are only reset, as interrupts keep a reference
+		 * to them. States with listeners are kept as well, their clients
+		 * still wait on the event through queued transactions or an
+		 * enabled event queue */
+		if (state->pinned || state->listeners) {
+			state->enable_counter = 0;
+			atomic64_set(&state->event_counter, 0);
+			state->has_subscriber = false;
+			continue;
+		}
+		/* Emitters may still be reading the state */
+		hash_del_rcu(&state->node);
+		kfree_rcu(state, rcu);
 	}
 
 	return 0;
@@ -687,7 +1176,7 @@ int lwis_device_event_flags_updated(struct lwis_device *lwis_dev, int64_t event_
 
 		/* Reset hw event counter if hw event has been disabled */
 		if (!event_enabled) {
-			state->event_counter = 0;
+			atomic64_set(&state->event_counter, 0);
 		}
 	}
 
@@ -695,7 +1184,7 @@ int lwis_device_event_flags_updated(struct lwis_device *lwis_dev, int64_t event_
 	if ((event_id & LWIS_TRANSACTION_EVENT_FLAG ||
 	     event_id & LWIS_TRANSACTION_FAILURE_EVENT_FLAG) &&
 	    new_flags == 0)
-		state->event_counter = 0;
+		atomic64_set(&state->event_counter, 0);
 
 	/* Check if our specialization cares about flags updates */
 	if (lwis_dev->vops.event_flags_updated) {
@@ -775,46 +1264,222 @@ int lwis_device_event_enable(struct lwis_device *lwis_dev, int64_t event_id, boo
 	return err ? err : ret;
 }
 
-static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t event_id,
-				       void *payload, size_t payload_size,
-				       struct list_head *pending_events, bool in_irq)
+/*
+ * client_event_filter_pass_locked: Applies the filter of the client event
+ * state to an occurrence of the event.
+ *
+ * Assumes: lwis_client->event_lock is locked
+ * Returns: true if the occurrence is delivered to the client
+ */
+static bool client_event_filter_pass_locked(struct lwis_client_event_state *state,
+					    int64_t event_counter)
+{
+	uint32_t remainder;
+
+	switch (state->filter.mode) {
+	case LWIS_EVENT_FILTER_EVERY_NTH:
+		if (++state->filter_skipped < state->filter.divisor) {
+			return false;
+		}
+		state->filter_skipped = 0;
+		return true;
+	case LWIS_EVENT_FILTER_COUNTER_MODULO:
+		div_u64_rem((uint64_t)event_counter, state->filter.divisor, &remainder);
+		return remainder == state->filter.remainder;
+	default:
+		return true;
+	}
+}
+
+/*
+ * client_event_emit: Hands the event to the client, through the event ring or
+ * queue if the client has the event queue enabled, and triggers the client
+ * transactions that match the event ID and counter. The queued entry
+ * references shared_payload, if any, instead of copying the payload. The
+ * client event filter only applies to the delivery, transactions are
+ * triggered by every occurrence.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: May allocate (GFP_ATOMIC only)
+ * Returns: 0 on success
+ */
+static int client_event_emit(struct lwis_client *lwis_client, int64_t event_id,
+			     int64_t event_counter, int64_t timestamp, void *payload,
+			     size_t payload_size, struct lwis_event_payload *shared_payload,
+			     struct list_head *pending_events, bool in_irq)
 {
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
 	struct lwis_client_event_state *client_event_state;
-	struct lwis_device_event_state *device_event_state;
 	struct lwis_event_entry *event;
-	/* Our iterators */
-	struct lwis_client *lwis_client;
-	struct list_head *p, *n;
-	int64_t timestamp;
-	int64_t event_counter;
+	size_t entry_size;
 	/* Flags for IRQ disable */
 	unsigned long flags;
-	bool has_subscriber;
+	bool emit = false;
+	bool ring_updated = false;
+	bool signaled = false;
+	bool coalesce = false;
 	int ret;
 
-	/* Lock and disable to prevent event_states from changing */
-	spin_lock_irqsave(&lwis_dev->lock, flags);
+	/* Lock the event lock instead */
+	spin_lock_irqsave(&lwis_client->event_lock, flags);
+	client_event_state = lwis_client_event_state_find_locked(lwis_client, event_id);
+
+	if (!IS_ERR_OR_NULL(client_event_state)) {
+		if (client_event_state->event_control.flags &
+		    LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE) {
+			emit = client_event_filter_pass_locked(client_event_state, event_counter);
+			coalesce = client_event_state->filter.mode == LWIS_EVENT_FILTER_LATEST;
+			/* Bound events wake up their eventfd waiter only */
+			if (emit && client_event_state->eventfd) {
+				eventfd_signal(client_event_state->eventfd, 1);
+				signaled = true;
+				emit = !client_event_state->eventfd_notify_only;
+			}
+		}
+	}
 
-	device_event_state = lwis_device_event_state_find_locked(lwis_dev, event_id);
-	if (IS_ERR_OR_NULL(device_event_state)) {
-		dev_err(lwis_dev->dev, "Device event state not found %llx\n", event_id);
-		spin_unlock_irqrestore(&lwis_dev->lock, flags);
-		return -EINVAL;
+	/* Events that fit in the event ring do not need to be queued, unless
+	 * they are coalesced in the queue */
+	if (emit && !coalesce && lwis_client->event_ring) {
+		emit = !event_ring_push_locked(lwis_client->event_ring, event_id, event_counter,
+					       timestamp, payload, payload_size);
+		ring_updated = true;
 	}
 
-	/* Increment the event counter */
-	device_event_state->event_counter++;
-	/* Save event counter to local variable */
-	event_counter = device_event_state->event_counter;
-	/* Latch timestamp */
-	timestamp = ktime_to_ns(lwis_get_time());
-	/* Saves this event to history buffer */
-	save_device_event_state_to_history_locked(lwis_dev, device_event_state, timestamp);
+	/* Restore the event lock */
+	spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+	if (ring_updated && !signaled) {
+		wake_up_interruptible(&lwis_client->event_wait_queue);
+	}
+	if (emit) {
+		if (payload_size == 0) {
+			shared_payload = NULL;
+		}
+		entry_size = sizeof(struct lwis_event_entry);
+		if (!shared_payload) {
+			entry_size += payload_size;
+		}
+		event = kmalloc(entry_size, GFP_ATOMIC);
+		if (!event) {
+			dev_err(lwis_dev->dev, "Failed to allocate event entry\n");
+			return -ENOMEM;
+		}
 
-	has_subscriber = device_event_state->has_subscriber;
+		event->event_info.event_id = event_id;
+		event->event_info.event_counter = event_counter;
+		event->event_info.timestamp_ns = timestamp;
+		event->event_info.payload_size = payload_size;
+		event->shared_payload = shared_payload;
+		event->coalesced = false;
+		if (shared_payload) {
+			refcount_inc(&shared_payload->refcount);
+			event->event_info.payload_buffer = shared_payload->data;
+		} else if (payload_size > 0) {
+			event->event_info.payload_buffer =
+				(void *)((uint8_t *)event + sizeof(struct lwis_event_entry));
+			memcpy(event->event_info.payload_buffer, payload, payload_size);
+		} else {
+			event->event_info.payload_buffer = NULL;
+		}
+		ret = lwis_client_event_push_back(lwis_client, event, /*wake=*/!signaled,
+						  coalesce);
+		if (ret) {
+			dev_err_ratelimited(lwis_dev->dev,
+					    "Failed to push event to queue: ID 0x%llx Counter %lld\n",
+					    event_id, event_counter);
+			lwis_event_entry_free(event);
+			return ret;
+		}
+	}
 
-	/* Unlock and restore device lock */
-	spin_unlock_irqrestore(&lwis_dev->lock, flags);
+	/* Trigger transactions, if there's any that matches this event
+	   ID and counter */
+	if (lwis_transaction_event_trigger(lwis_client, event_id, event_counter, pending_events,
+					   in_irq)) {
+		dev_warn(lwis_dev->dev,
+			 "Failed to process transactions: Event ID: 0x%llx Counter: %lld\n",
+			 event_id, event_counter);
+	}
+
+	return 0;
+}
+
+/*
+ * notify_listeners: Emits the event to the clients in the listeners mask of
+ * its device event state. Falls back to every client of the device while
+ * some client has no slot in the mask.
+ *
+ * Locks: rcu_read_lock, lwis_client->event_lock
+ * Alloc: May allocate (GFP_ATOMIC only)
+ * Returns: 0 on success
+ */
+static int notify_listeners(struct lwis_device *lwis_dev, unsigned long listeners,
+			    int64_t event_id, int64_t event_counter, int64_t timestamp,
+			    void *payload, size_t payload_size,
+			    struct lwis_event_payload *shared_payload,
+			    struct list_head *pending_events, bool in_irq)
+{
+	struct lwis_client *lwis_client;
+	struct list_head *p, *n;
+	unsigned long slot;
+	int ret;
+
+	if (READ_ONCE(lwis_dev->num_unslotted_clients) > 0) {
+		list_for_each_safe (p, n, &lwis_dev->clients) {
+			lwis_client = list_entry(p, struct lwis_client, node);
+			ret = client_event_emit(lwis_client, event_id, event_counter, timestamp,
+						payload, payload_size, shared_payload,
+						pending_events, in_irq);
+			if (ret) {
+				return ret;
+			}
+		}
+		return 0;
+	}
+
+	/* The client stays allocated while its slot is read under RCU */
+	ret = 0;
+	rcu_read_lock();
+	for_each_set_bit (slot, &listeners, LWIS_MAX_CLIENT_SLOTS) {
+		lwis_client = rcu_dereference(lwis_dev->client_slots[slot]);
+		if (!lwis_client) {
+			continue;
+		}
+		ret = client_event_emit(lwis_client, event_id, event_counter, timestamp, payload,
+					payload_size, shared_payload, pending_events, in_irq);
+		if (ret) {
+			break;
+		}
+	}
+	rcu_read_unlock();
+	return ret;
+}
+
+/*
+ * device_event_emitted: Records the emitted event in the history, forwards it
+ * to the subscriber via the top device, and runs the device specific handler,
+ * which may replace the payload.
+ *
+ * Locks: lwis_dev->debug_info.event_hist_lock
+ * Alloc: No
+ * Returns: None
+ */
+static void device_event_emitted(struct lwis_device *lwis_dev, int64_t event_id,
+				 int64_t event_counter, int64_t timestamp, bool has_subscriber,
+				 void **payload, size_t *payload_size, bool in_irq)
+{
+	int ret;
+
+	/* Saves this event to history buffer */
+	lwis_event_history_record(&lwis_dev->debug_info.event_hist, event_id, event_counter,
+				  timestamp);
+
+	/* Wake up the poll entries waiting on an event. The counter was just
+	 * incremented with a fully ordered atomic, which pairs with the barrier
+	 * in prepare_to_wait() */
+	if (waitqueue_active(&lwis_dev->event_wait_queue)) {
+		wake_up_all(&lwis_dev->event_wait_queue);
+	}
 
 	/* Emit event to subscriber via top device */
 	if (has_subscriber) {
@@ -824,71 +1489,56 @@ static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t eve
 
 	/* Run internal handler if any */
 	if (lwis_dev->vops.event_emitted) {
-		ret = lwis_dev->vops.event_emitted(lwis_dev, event_id, &payload, &payload_size);
+		ret = lwis_dev->vops.event_emitted(lwis_dev, event_id, payload, payload_size);
 		if (ret) {
 			dev_warn(lwis_dev->dev, "Warning: vops.event_emitted returned %d\n", ret);
 		}
 	}
 
-	/* Notify clients */
-	list_for_each_safe (p, n, &lwis_dev->clients) {
-		bool emit = false;
-		lwis_client = list_entry(p, struct lwis_client, node);
+	trace_lwis_event_emit(lwis_dev, event_id, event_counter, *payload_size);
+}
 
-		/* Lock the event lock instead */
-		spin_lock_irqsave(&lwis_client->event_lock, flags);
-		client_event_state = lwis_client_event_state_find_locked(lwis_client, event_id);
+static int lwis_device_event_emit_impl(struct lwis_device *lwis_dev, int64_t event_id,
+				       struct lwis_device_event_state *device_event_state,
+				       void *payload, size_t payload_size,
+				       struct lwis_event_payload *shared_payload,
+				       struct list_head *pending_events, bool in_irq)
+{
+	int64_t timestamp;
+	int64_t event_counter;
+	unsigned long listeners;
+	bool has_subscriber;
 
-		if (!IS_ERR_OR_NULL(client_event_state)) {
-			if (client_event_state->event_control.flags &
-			    LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE) {
-				emit = true;
-			}
+	/* Device event states are freed after an RCU grace period, so emitting
+	 * only needs the device lock if the state is not pinned */
+	rcu_read_lock();
+	if (!device_event_state) {
+		device_event_state = lwis_device_event_state_find_locked(lwis_dev, event_id);
+		if (IS_ERR_OR_NULL(device_event_state)) {
+			rcu_read_unlock();
+			dev_err(lwis_dev->dev, "Device event state not found %llx\n", event_id);
+			return -EINVAL;
 		}
+	}
 
-		/* Restore the event lock */
-		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
-		if (emit) {
-			event = kmalloc(sizeof(struct lwis_event_entry) + payload_size, GFP_ATOMIC);
-			if (!event) {
-				dev_err(lwis_dev->dev, "Failed to allocate event entry\n");
-				return -ENOMEM;
-			}
-
-			event->event_info.event_id = event_id;
-			event->event_info.event_counter = event_counter;
-			event->event_info.timestamp_ns = timestamp;
-			event->event_info.payload_size = payload_size;
-			if (payload_size > 0) {
-				event->event_info.payload_buffer =
-					(void *)((uint8_t *)event +
-						 sizeof(struct lwis_event_entry));
-				memcpy(event->event_info.payload_buffer, payload, payload_size);
-			} else {
-				event->event_info.payload_buffer = NULL;
-			}
-			ret = lwis_client_event_push_back(lwis_client, event);
-			if (ret) {
-				dev_err_ratelimited(
-					lwis_dev->dev,
-					"Failed to push event to queue: ID 0x%llx Counter %lld\n",
-					event_id, event_counter);
-				kfree(event);
-				return ret;
-			}
-		}
+	/* Increment the event counter and save it to local variable */
+	event_counter = atomic64_inc_return(&device_event_state->event_counter);
+	has_subscriber = READ_ONCE(device_event_state->has_subscriber);
+	listeners = READ_ONCE(device_event_state->listeners);
+	rcu_read_unlock();
 
-		/* Trigger transactions, if there's any that matches this event
-		   ID and counter */
-		if (lwis_transaction_event_trigger(lwis_client, event_id, event_counter,
-						   pending_events, in_irq)) {
-			dev_warn(lwis_dev->dev,
-				 "Failed to process transactions: Event ID: 0x%llx Counter: %lld\n",
-				 event_id, event_counter);
-		}
+	/* Latch timestamp */
+	timestamp = ktime_to_ns(lwis_get_time());
+	device_event_emitted(lwis_dev, event_id, event_counter, timestamp, has_subscriber,
+			     &payload, &payload_size, in_irq);
+	/* The payload can no longer be shared if the handler replaced it */
+	if (shared_payload && payload != shared_payload->data) {
+		shared_payload = NULL;
 	}
 
-	return 0;
+	/* Notify the clients listening to this event */
+	return notify_listeners(lwis_dev, listeners, event_id, event_counter, timestamp, payload,
+				payload_size, shared_payload, pending_events, in_irq);
 }
 
 int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void *payload,
@@ -902,8 +1552,9 @@ int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void
 	INIT_LIST_HEAD(&pending_events);
 
 	/* Emit the original event */
-	ret = lwis_device_event_emit_impl(lwis_dev, event_id, payload, payload_size,
-					  &pending_events, in_irq);
+	ret = lwis_device_event_emit_impl(lwis_dev, event_id, /*device_event_state=*/NULL, payload,
+					  payload_size, /*shared_payload=*/NULL, &pending_events,
+					  in_irq);
 	if (ret) {
 		dev_err_ratelimited(lwis_dev->dev,
 				    "lwis_device_event_emit_impl failed: event ID 0x%llx\n",
@@ -915,22 +1566,165 @@ int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void
 	return lwis_pending_events_emit(lwis_dev, &pending_events, in_irq);
 }
 
+int lwis_device_event_emit_state(struct lwis_device *lwis_dev,
+				 struct lwis_device_event_state *state, void *payload,
+				 size_t payload_size, bool in_irq)
+{
+	int ret;
+	struct list_head pending_events;
+
+	/* Container to store events that are triggered as a result of this
+	   event. */
+	INIT_LIST_HEAD(&pending_events);
+
+	/* Emit the original event */
+	ret = lwis_device_event_emit_impl(lwis_dev, state->event_id, state, payload, payload_size,
+					  /*shared_payload=*/NULL, &pending_events, in_irq);
+	if (ret) {
+		dev_err_ratelimited(lwis_dev->dev,
+				    "lwis_device_event_emit_impl failed: event ID 0x%llx\n",
+				    state->event_id);
+		return ret;
+	}
+
+	/* Emit pending events */
+	return lwis_pending_events_emit(lwis_dev, &pending_events, in_irq);
+}
+
+int lwis_device_event_emit_batch(struct lwis_device *lwis_dev,
+				 struct lwis_event_batch_entry *entries, int num_entries,
+				 bool in_irq)
+{
+	struct lwis_device_event_state *state;
+	struct lwis_client *lwis_client;
+	struct list_head *p, *n;
+	struct list_head pending_events;
+	unsigned long listeners = 0;
+	unsigned long slot;
+	int64_t timestamp;
+	bool all_clients;
+	int i, ret, return_val = 0;
+
+	if (num_entries <= 0) {
+		return 0;
+	}
+
+	/* Container to store events that are triggered as a result of these
+	   events. */
+	INIT_LIST_HEAD(&pending_events);
+
+	/* All the events of the batch share one timestamp */
+	timestamp = ktime_to_ns(lwis_get_time());
+	for (i = 0; i < num_entries; i++) {
+		state = entries[i].state;
+		entries[i].event_counter = atomic64_inc_return(&state->event_counter);
+		entries[i].listeners = READ_ONCE(state->listeners);
+		listeners |= entries[i].listeners;
+		entries[i].payload = NULL;
+		entries[i].payload_size = 0;
+		device_event_emitted(lwis_dev, state->event_id, entries[i].event_counter, timestamp,
+				     READ_ONCE(state->has_subscriber), &entries[i].payload,
+				     &entries[i].payload_size, in_irq);
+	}
+
+	/* Visit each listening client once for all of its events. A failed
+	 * event does not keep the rest of the batch from being delivered */
+	all_clients = READ_ONCE(lwis_dev->num_unslotted_clients) > 0;
+	if (all_clients) {
+		list_for_each_safe (p, n, &lwis_dev->clients) {
+			lwis_client = list_entry(p, struct lwis_client, node);
+			for (i = 0; i < num_entries; i++) {
+				ret = client_event_emit(lwis_client, entries[i].state->event_id,
+							entries[i].event_counter, timestamp,
+							entries[i].payload, entries[i].payload_size,
+							/*shared_payload=*/NULL, &pending_events,
+							in_irq);
+				if (ret) {
+					return_val = ret;
+				}
+			}
+		}
+	} else {
+		rcu_read_lock();
+		for_each_set_bit (slot, &listeners, LWIS_MAX_CLIENT_SLOTS) {
+			lwis_client = rcu_dereference(lwis_dev->client_slots[slot]);
+			if (!lwis_client) {
+				continue;
+			}
+			for (i = 0; i < num_entries; i++) {
+				if (!test_bit(slot, &entries[i].listeners)) {
+					continue;
+				}
+				ret = client_event_emit(lwis_client, entries[i].state->event_id,
+							entries[i].event_counter, timestamp,
+							entries[i].payload, entries[i].payload_size,
+							/*shared_payload=*/NULL, &pending_events,
+							in_irq);
+				if (ret) {
+					return_val = ret;
+				}
+			}
+		}
+		rcu_read_unlock();
+	}
+
+	/* Emit pending events */
+	ret = lwis_pending_events_emit(lwis_dev, &pending_events, in_irq);
+	return return_val ? return_val : ret;
+}
+
+int lwis_device_event_counter_get(struct lwis_device *lwis_dev, int64_t event_id,
+				  int64_t *event_counter)
+{
+	struct lwis_device_event_state *state;
+	int ret = 0;
+
+	rcu_read_lock();
+	state = lwis_device_event_state_find_locked(lwis_dev, event_id);
+	if (IS_ERR_OR_NULL(state)) {
+		ret = -ENOENT;
+	} else {
+		*event_counter = atomic64_read(&state->event_counter);
+	}
+	rcu_read_unlock();
+	return ret;
+}
+
+void lwis_event_entry_free(struct lwis_event_entry *event)
+{
+	if (event->shared_payload && refcount_dec_and_test(&event->shared_payload->refcount)) {
+		kfree(event->shared_payload);
+	}
+	kfree(event);
+}
+
 int lwis_pending_event_push(struct list_head *pending_events, int64_t event_id, void *payload,
 			    size_t payload_size)
 {
 	struct lwis_event_entry *event;
+	struct lwis_event_payload *shared_payload;
 
-	event = kzalloc(sizeof(struct lwis_event_entry) + payload_size, GFP_ATOMIC);
+	event = kzalloc(sizeof(struct lwis_event_entry), GFP_ATOMIC);
 	if (!event) {
 		pr_err("Failed to allocate event entry\n");
 		return -ENOMEM;
 	}
 	event->event_info.event_id = event_id;
 	event->event_info.payload_size = payload_size;
+	/* The payload is shared with the entries of the clients it is emitted
+	 * to, this entry holds the initial reference */
 	if (payload_size > 0) {
-		event->event_info.payload_buffer =
-			(void *)((uint8_t *)event + sizeof(struct lwis_event_entry));
-		memcpy(event->event_info.payload_buffer, payload, payload_size);
+		shared_payload =
+			kmalloc(struct_size(shared_payload, data, payload_size), GFP_ATOMIC);
+		if (!shared_payload) {
+			pr_err("Failed to allocate event payload\n");
+			kfree(event);
+			return -ENOMEM;
+		}
+		refcount_set(&shared_payload->refcount, 1);
+		memcpy(shared_payload->data, payload, payload_size);
+		event->shared_payload = shared_payload;
+		event->event_info.payload_buffer = shared_payload->data;
 	} else {
 		event->event_info.payload_buffer = NULL;
 	}
@@ -949,9 +1743,11 @@ int lwis_pending_events_emit(struct lwis_device *lwis_dev, struct list_head *pen
 	while (!list_empty(pending_events)) {
 		event = list_first_entry(pending_events, struct lwis_event_entry, node);
 		emit_result = lwis_device_event_emit_impl(lwis_dev, event->event_info.event_id,
+							  /*device_event_state=*/NULL,
 							  event->event_info.payload_buffer,
 							  event->event_info.payload_size,
-							  pending_events, in_irq);
+							  event->shared_payload, pending_events,
+							  in_irq);
 		if (emit_result) {
 			return_val = emit_result;
 			dev_warn(lwis_dev->dev,
@@ -959,7 +1755,7 @@ int lwis_pending_events_emit(struct lwis_device *lwis_dev, struct list_head *pen
 				 event->event_info.event_id);
 		}
 		list_del(&event->node);
-		kfree(event);
+		lwis_event_entry_free(event);
 	}
 	return return_val;
 }
@@ -991,16 +1787,11 @@ out:
 void lwis_device_external_event_emit(struct lwis_device *lwis_dev, int64_t event_id,
 				     int64_t event_counter, int64_t timestamp, bool in_irq)
 {
-	struct lwis_client_event_state *client_event_state;
 	struct lwis_device_event_state *device_event_state;
-	struct lwis_event_entry *event;
-	/* Our iterators */
-	struct lwis_client *lwis_client;
-	struct list_head *p, *n;
 	struct list_head pending_events;
 	/* Flags for IRQ disable */
 	unsigned long flags;
-	bool emit = false;
+	unsigned long listeners;
 
 	INIT_LIST_HEAD(&pending_events);
 
@@ -1013,60 +1804,53 @@ void lwis_device_external_event_emit(struct lwis_device *lwis_dev, int64_t event
 	spin_lock_irqsave(&lwis_dev->lock, flags);
 
 	/* Update event counter */
-	device_event_state->event_counter = event_counter;
+	atomic64_set(&device_event_state->event_counter, event_counter);
+	listeners = device_event_state->listeners;
 
 	/* Unlock and restore device lock */
 	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 
-	/* Notify clients */
-	list_for_each_safe (p, n, &lwis_dev->clients) {
-		emit = false;
-		lwis_client = list_entry(p, struct lwis_client, node);
-
-		/* Lock the event lock instead */
-		spin_lock_irqsave(&lwis_client->event_lock, flags);
-		client_event_state = lwis_client_event_state_find_locked(lwis_client, event_id);
-
-		if (!IS_ERR_OR_NULL(client_event_state)) {
-			if (client_event_state->event_control.flags &
-			    LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE) {
-				emit = true;
-			}
-		}
-		/* Restore the event lock */
-		spin_unlock_irqrestore(&lwis_client->event_lock, flags);
+	/* Notify the clients listening to this event, external events carry
+	 * no payload */
+	if (notify_listeners(lwis_dev, listeners, event_id, event_counter, timestamp,
+			     /*payload=*/NULL, /*payload_size=*/0, /*shared_payload=*/NULL,
+			     &pending_events, in_irq)) {
+		return;
+	}
 
-		if (emit) {
-			event = kmalloc(sizeof(struct lwis_event_entry), GFP_ATOMIC);
-			if (!event) {
-				dev_err(lwis_dev->dev, "Failed to allocate event entry\n");
-				return;
-			}
+	lwis_pending_events_emit(lwis_dev, &pending_events, in_irq);
+}
 
-			event->event_info.event_id = event_id;
-			event->event_info.event_counter = event_counter;
-			event->event_info.timestamp_ns = timestamp;
-			event->event_info.payload_size = 0;
-			event->event_info.payload_buffer = NULL;
-			if (lwis_client_event_push_back(lwis_client, event)) {
-				dev_err_ratelimited(
-					lwis_dev->dev,
-					"Failed to push event to queue: ID 0x%llx Counter %lld\n",
-					event_id, event_counter);
-				kfree(event);
-				return;
-			}
-		}
+int lwis_client_event_emit(struct lwis_client *lwis_client, int64_t event_id, void *payload,
+			   size_t payload_size)
+{
+	struct lwis_event_entry *event;
 
-		if (lwis_transaction_event_trigger(lwis_client, event_id, event_counter,
-						   &pending_events, in_irq))
-			dev_warn(
-				lwis_dev->dev,
-				"Failed to process transactions: external event ID: 0x%llx counter: %lld\n",
-				event_id, event_counter);
+	event = kmalloc(sizeof(struct lwis_event_entry) + payload_size, GFP_KERNEL);
+	if (!event) {
+		dev_err(lwis_client->lwis_dev->dev, "Failed to allocate event entry\n");
+		return -ENOMEM;
 	}
-
-	lwis_pending_events_emit(lwis_dev, &pending_events, in_irq);
+	event->event_info.event_id = event_id;
+	event->event_info.event_counter = 0;
+	event->event_info.timestamp_ns = ktime_to_ns(lwis_get_time());
+	event->event_info.payload_size = payload_size;
+	event->shared_payload = NULL;
+	event->coalesced = false;
+	if (payload_size > 0) {
+		event->event_info.payload_buffer =
+			(void *)((uint8_t *)event + sizeof(struct lwis_event_entry));
+		memcpy(event->event_info.payload_buffer, payload, payload_size);
+	} else {
+		event->event_info.payload_buffer = NULL;
+	}
+	if (lwis_client_event_push_back(lwis_client, event, /*wake=*/true, /*coalesce=*/false)) {
+		dev_err_ratelimited(lwis_client->lwis_dev->dev,
+				    "Failed to push event to queue: ID 0x%llx\n", event_id);
+		kfree(event);
+		return -EOVERFLOW;
+	}
+	return 0;
 }
 
 void lwis_device_error_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void *payload,
@@ -1100,6 +1884,8 @@ void lwis_device_error_event_emit(struct lwis_device *lwis_dev, int64_t event_id
 		event->event_info.event_counter = 0;
 		event->event_info.timestamp_ns = timestamp;
 		event->event_info.payload_size = payload_size;
+		event->shared_payload = NULL;
+		event->coalesced = false;
 		if (payload_size > 0) {
 			event->event_info.payload_buffer =
 				(void *)((uint8_t *)event + sizeof(struct lwis_event_entry));
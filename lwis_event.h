@@ -11,7 +11,9 @@
 #ifndef LWIS_EVENT_H_
 #define LWIS_EVENT_H_
 
+#include <linux/atomic.h>
 #include <linux/list.h>
+#include <linux/refcount.h>
 
 #include "lwis_commands.h"
 
@@ -24,6 +26,8 @@
  */
 struct lwis_client;
 struct lwis_device;
+struct vm_area_struct;
+struct eventfd_ctx;
 
 /*
  *  LWIS Event Structures
@@ -35,20 +39,18 @@ struct lwis_device;
 struct lwis_device_event_state {
 	int64_t event_id;
 	int64_t enable_counter;
-	int64_t event_counter;
+	/* Incremented on emit without holding lwis_dev->lock */
+	atomic64_t event_counter;
 	bool has_subscriber;
+	/* Bitmask of the client slots that asked to be notified of this event,
+	 * either with the event queue enabled or with transactions waiting on
+	 * it. Bits may be stale, but a listening client always has its bit set */
+	unsigned long listeners;
+	/* Pinned states are resolved at setup and are kept until the device
+	 * is removed, so their users can hold on to the state pointer */
+	bool pinned;
 	struct hlist_node node;
-};
-
-/*
- * struct lwis_device_event_state_history
- * For debugging purposes, keeps track of event states and the time an event
- * triggered.
- */
-
-struct lwis_device_event_state_history {
-	struct lwis_device_event_state state;
-	int64_t timestamp;
+	struct rcu_head rcu;
 };
 
 /*
@@ -57,10 +59,34 @@ struct lwis_device_event_state_history {
  */
 struct lwis_client_event_state {
 	struct lwis_event_control event_control;
+	/* Signaled instead of the client event_wait_queue when the event is
+	 * emitted, NULL if the event is not bound to an eventfd */
+	struct eventfd_ctx *eventfd;
+	/* The event is only signaled on eventfd, not queued */
+	bool eventfd_notify_only;
+	/* Filter of the delivered occurrences, LWIS_EVENT_FILTER_NONE by
+	 * default */
+	struct lwis_event_filter filter;
+	/* Occurrences skipped by LWIS_EVENT_FILTER_EVERY_NTH */
+	uint32_t filter_skipped;
+	/* Queued entry that the next occurrence replaces, with
+	 * LWIS_EVENT_FILTER_LATEST */
+	struct lwis_event_entry *latest_event;
 	struct hlist_node node;
 	struct list_head clearance_node;
 };
 
+/*
+ *  struct lwis_event_payload
+ *  Payload of a pending event, shared by the event entries of all the clients
+ *  it is emitted to instead of being copied for each of them. Freed along with
+ *  the last entry referencing it.
+ */
+struct lwis_event_payload {
+	refcount_t refcount;
+	uint8_t data[];
+};
+
 /*
  *  struct lwis_event_entry
  *  This struct can be used to keep track of events inside the client event
@@ -70,9 +96,44 @@ struct lwis_client_event_state {
  */
 struct lwis_event_entry {
 	struct lwis_event_info event_info;
+	/* Shared payload event_info.payload_buffer points to, NULL if the
+	 * payload is stored right after the entry */
+	struct lwis_event_payload *shared_payload;
+	/* Set if the entry is the latest_event of its client event state */
+	bool coalesced;
 	struct list_head node;
 };
 
+/*
+ *  struct lwis_event_ring
+ *  Kernel side bookkeeping of the client event ring that is mapped by
+ *  userspace. The mapped memory starts with struct lwis_event_ring_header.
+ */
+struct lwis_event_ring {
+	struct lwis_event_ring_header *header;
+	uint8_t *slots;
+	size_t mmap_size;
+	uint32_t num_slots;
+	uint32_t slot_size;
+	uint32_t slot_payload_size;
+	/* Private copy of the write index, userspace cannot modify it */
+	uint64_t write_index;
+};
+
+/*
+ *  struct lwis_event_batch_entry
+ *  One of the events emitted together by lwis_device_event_emit_batch.
+ */
+struct lwis_event_batch_entry {
+	/* Pinned state of the event */
+	struct lwis_device_event_state *state;
+	/* Filled in on emit */
+	int64_t event_counter;
+	unsigned long listeners;
+	void *payload;
+	size_t payload_size;
+};
+
 /*
  *  LWIS Event Typedefs and Enums
  */
@@ -93,6 +154,28 @@ struct lwis_event_entry {
 int lwis_client_event_control_set(struct lwis_client *lwisclient,
 				  const struct lwis_event_control *control);
 
+/*
+ * lwis_client_event_eventfd_bind: Binds the event to eventfd, or unbinds it
+ * if eventfd is NULL, taking over the reference to eventfd.
+ *
+ * Locks: lwisclient->event_lock
+ * Alloc: Maybe
+ * Returns: 0 on success
+ */
+int lwis_client_event_eventfd_bind(struct lwis_client *lwisclient, int64_t event_id,
+				   struct eventfd_ctx *eventfd, bool notify_only);
+
+/*
+ * lwis_client_event_filter_set: Sets the filter of the occurrences of the
+ * event delivered to the client.
+ *
+ * Locks: lwisclient->event_lock
+ * Alloc: Maybe
+ * Returns: 0 on success, -EINVAL if the filter is invalid
+ */
+int lwis_client_event_filter_set(struct lwis_client *lwisclient,
+				 const struct lwis_event_filter *filter);
+
 /*
  * lwis_client_event_control_get: Finds and returns the current event state
  * for a particular event id
@@ -178,6 +261,79 @@ int lwis_client_error_event_peek_front(struct lwis_client *lwis_client,
  */
 void lwis_client_error_event_queue_clear(struct lwis_client *lwis_client);
 
+/*
+ * lwis_client_event_pop_batch: Removes events from the front of the client
+ * event queues, error events first, until max_events are removed or the
+ * next payload does not fit in payload_budget bytes. Payloads are expected
+ * to be packed at 8-byte aligned offsets. The removed events are moved to
+ * the error_events and events lists, in order, and the caller takes
+ * ownership of them.
+ *
+ * next_payload_size is set to the payload size of the event that did not fit,
+ * 0 otherwise.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: No
+ * Returns: number of events removed
+ */
+size_t lwis_client_event_pop_batch(struct lwis_client *lwis_client, size_t max_events,
+				   size_t payload_budget, struct list_head *error_events,
+				   struct list_head *events, size_t *next_payload_size);
+
+/*
+ * lwis_client_event_unpop_batch: Puts events removed by
+ * lwis_client_event_pop_batch back to the front of the client event queues.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: No
+ * Returns: void
+ */
+void lwis_client_event_unpop_batch(struct lwis_client *lwis_client, struct list_head *error_events,
+				   struct list_head *events);
+
+/*
+ * lwis_client_event_ring_setup: Allocates the event ring of the client, the
+ * mapping size is returned through info->mmap_size.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: Yes
+ * Assumes: lwis_client->lock is locked
+ * Returns: 0 on success, -EBUSY if the ring is already set up
+ */
+int lwis_client_event_ring_setup(struct lwis_client *lwis_client,
+				 struct lwis_event_ring_info *info);
+
+/*
+ * lwis_client_event_ring_free: Frees the event ring of the client, if any.
+ * Must only be called once the client can no longer be mapped.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: Free only
+ * Returns: void
+ */
+void lwis_client_event_ring_free(struct lwis_client *lwis_client);
+
+/*
+ * lwis_client_event_ring_mmap: Maps the event ring of the client into
+ * userspace.
+ *
+ * Assumes: lwis_client->lock is locked
+ * Alloc: No
+ * Returns: 0 on success, -ENODEV if the ring is not set up
+ */
+int lwis_client_event_ring_mmap(struct lwis_client *lwis_client, struct vm_area_struct *vma);
+
+/*
+ * lwis_client_event_ring_poll: Checks whether the event ring holds events
+ * that userspace did not consume yet, according to the read_index it writes
+ * into the ring header.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: No
+ * Returns: true if there are unconsumed events in the ring
+ */
+bool lwis_client_event_ring_poll(struct lwis_client *lwis_client);
+
 /*
  * lwis_client_event_states_clear: Frees all items in lwisclient->event_states
  * and clears the hash table. Used for client shutdown only.
@@ -227,13 +383,40 @@ int lwis_device_event_enable(struct lwis_device *lwis_dev, int64_t event_id, boo
  * lwis_device_event_emit: Emits an event to all the relevant clients of the
  * device
  *
- * Locks: lwis_dev->lock and then lwis_client->event_lock
+ * Locks: lwis_client->event_lock
  * Alloc: May allocate (GFP_ATOMIC or GFP_NOWAIT only)
  * Returns: 0 on success
  */
 int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void *payload,
 			   size_t payload_size, bool in_irq);
 
+/*
+ * lwis_device_event_emit_state: Same as lwis_device_event_emit, for an event
+ * whose state was pinned with lwis_device_event_state_pin. Skips looking up
+ * the event state.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: May allocate (GFP_ATOMIC or GFP_NOWAIT only)
+ * Returns: 0 on success
+ */
+int lwis_device_event_emit_state(struct lwis_device *lwis_dev,
+				 struct lwis_device_event_state *state, void *payload,
+				 size_t payload_size, bool in_irq);
+
+/*
+ * lwis_device_event_emit_batch: Emits a set of events with pinned states,
+ * such as the events of one interrupt, in a single pass. The events share one
+ * timestamp, each listening client is visited once, and the events triggered
+ * by them are emitted together afterwards.
+ *
+ * Locks: lwis_client->event_lock
+ * Alloc: May allocate (GFP_ATOMIC or GFP_NOWAIT only)
+ * Returns: 0 on success, or the last error if some event failed to be emitted
+ */
+int lwis_device_event_emit_batch(struct lwis_device *lwis_dev,
+				 struct lwis_event_batch_entry *entries, int num_entries,
+				 bool in_irq);
+
 /*
  * lwis_device_external_event_emit: Emits an subscribed event to device.
  * The difference to lwis_device_event_emit is
@@ -245,6 +428,17 @@ int lwis_device_event_emit(struct lwis_device *lwis_dev, int64_t event_id, void
 void lwis_device_external_event_emit(struct lwis_device *lwis_dev, int64_t event_id,
 				     int64_t event_counter, int64_t timestamp, bool in_irq);
 
+/*
+ * lwis_client_event_emit: Emits an event to a single client, whether or not
+ * the client enabled the event. Used for events that answer a request of the
+ * client.
+ *
+ * Alloc: Yes
+ * Returns: 0 on success
+ */
+int lwis_client_event_emit(struct lwis_client *lwis_client, int64_t event_id, void *payload,
+			   size_t payload_size);
+
 /*
  * lwis_device_error_event_emit: Emits an error event for all clients.
  * The difference to lwis_device_event_emit is that this directly sends the
@@ -282,6 +476,51 @@ struct lwis_device_event_state *lwis_device_event_state_find(struct lwis_device
 struct lwis_device_event_state *lwis_device_event_state_find_or_create(struct lwis_device *lwis_dev,
 								       int64_t event_id);
 
+/*
+ * lwis_device_event_state_pin: Finds or creates the device event state of the
+ * event_id and pins it, such that the state stays valid until the device is
+ * removed. Used for events emitted from interrupts, to resolve their state
+ * once at setup.
+ *
+ * Locks: lwis_dev->lock
+ * Alloc: Maybe
+ * Returns: device event state object on success, errno on error
+ */
+struct lwis_device_event_state *lwis_device_event_state_pin(struct lwis_device *lwis_dev,
+							    int64_t event_id);
+
+/*
+ * lwis_device_event_listener_add: Marks the client as a listener of the
+ * event_id on its device, such that emitting the event visits the client.
+ *
+ * Locks: lwis_dev->lock
+ * Alloc: Maybe
+ * Returns: 0 on success
+ */
+int lwis_device_event_listener_add(struct lwis_client *lwis_client, int64_t event_id);
+
+/*
+ * lwis_device_event_listener_update: Adds the client as a listener of the
+ * event_id if it has the event queue enabled or transactions waiting on the
+ * event, and removes it otherwise.
+ *
+ * Locks: lwis_client->transaction_lock, lwis_dev->lock
+ * Alloc: Maybe
+ * Returns: 0 on success
+ */
+int lwis_device_event_listener_update(struct lwis_client *lwis_client, int64_t event_id,
+				      bool queue_enabled);
+
+/*
+ * lwis_device_event_listeners_release_locked: Removes the client from the
+ * listeners of every event state of its device, before its slot is reused.
+ *
+ * Assumes: lwis_dev->lock is locked
+ * Alloc: No
+ * Returns: None
+ */
+void lwis_device_event_listeners_release_locked(struct lwis_client *lwis_client);
+
 /*
  * lwis_client_event_state_find_or_create: Looks through the provided client's
  * event state list and tries to find a lwis_client_event_state object with the
@@ -295,6 +534,24 @@ struct lwis_device_event_state *lwis_device_event_state_find_or_create(struct lw
 struct lwis_client_event_state *
 lwis_client_event_state_find_or_create(struct lwis_client *lwis_client, int64_t event_id);
 
+/*
+ * lwis_device_event_counter_get: Reads the current counter of a device event.
+ *
+ * Alloc: No
+ * Returns: 0 on success, -ENOENT if the event state does not exist
+ */
+int lwis_device_event_counter_get(struct lwis_device *lwis_dev, int64_t event_id,
+				  int64_t *event_counter);
+
+/*
+ * lwis_event_entry_free: Frees an event entry, and its payload if the entry
+ * held the last reference to it.
+ *
+ * Alloc: Free only
+ * Returns: None
+ */
+void lwis_event_entry_free(struct lwis_event_entry *event);
+
 /*
  * lwis_pending_event_push: Push triggered event into a local pending queue to
  * defer processing until all the current event is done
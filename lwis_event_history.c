@@ -0,0 +1,178 @@
+/*
+ * Google LWIS Event History
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-event-history: " fmt
+
+#include <linux/cpumask.h>
+#include <linux/irqflags.h>
+#include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/slab.h>
+#include <linux/topology.h>
+
+#include "lwis_event_history.h"
+
+int lwis_event_history_init(struct lwis_event_history *hist, u32 depth)
+{
+	struct lwis_event_history_cpu *cpu_hist;
+	int cpu;
+
+	init_waitqueue_head(&hist->wait_queue);
+	hist->depth = roundup_pow_of_two(max_t(u32, depth, 1));
+	hist->cpus = alloc_percpu(struct lwis_event_history_cpu);
+	if (!hist->cpus) {
+		return -ENOMEM;
+	}
+
+	for_each_possible_cpu (cpu) {
+		cpu_hist = per_cpu_ptr(hist->cpus, cpu);
+		cpu_hist->slots = kcalloc_node(hist->depth, sizeof(struct lwis_event_history_slot),
+					       GFP_KERNEL, cpu_to_node(cpu));
+		if (!cpu_hist->slots) {
+			lwis_event_history_free(hist);
+			return -ENOMEM;
+		}
+	}
+	return 0;
+}
+
+void lwis_event_history_free(struct lwis_event_history *hist)
+{
+	int cpu;
+
+	if (!hist->cpus) {
+		return;
+	}
+	for_each_possible_cpu (cpu) {
+		kfree(per_cpu_ptr(hist->cpus, cpu)->slots);
+	}
+	free_percpu(hist->cpus);
+	hist->cpus = NULL;
+}
+
+void lwis_event_history_record(struct lwis_event_history *hist, int64_t event_id,
+			       int64_t event_counter, int64_t timestamp)
+{
+	struct lwis_event_history_cpu *cpu_hist;
+	struct lwis_event_history_slot *slot;
+	unsigned long flags;
+	u64 pos;
+
+	/* Events can be emitted before the device is fully probed */
+	if (!hist->cpus) {
+		return;
+	}
+
+	local_irq_save(flags);
+	cpu_hist = this_cpu_ptr(hist->cpus);
+	pos = cpu_hist->head;
+	slot = &cpu_hist->slots[pos & (hist->depth - 1)];
+	/* Readers copying the previous record of the slot see the sequence
+	 * change and drop it */
+	WRITE_ONCE(slot->seq, 0);
+	smp_wmb();
+	slot->record.event_id = event_id;
+	slot->record.event_counter = event_counter;
+	slot->record.timestamp_ns = timestamp;
+	smp_wmb();
+	WRITE_ONCE(slot->seq, pos + 1);
+	smp_store_release(&cpu_hist->head, pos + 1);
+	local_irq_restore(flags);
+
+	if (wq_has_sleeper(&hist->wait_queue)) {
+		wake_up_interruptible(&hist->wait_queue);
+	}
+}
+
+int lwis_event_history_reader_init(struct lwis_event_history *hist,
+				   struct lwis_event_history_reader *reader, u32 backlog)
+{
+	u64 head;
+	int cpu;
+
+	if (!hist->cpus) {
+		return -ENODEV;
+	}
+	reader->cpus = kcalloc(nr_cpu_ids, sizeof(struct lwis_event_history_reader_cpu),
+			       GFP_KERNEL);
+	if (!reader->cpus) {
+		return -ENOMEM;
+	}
+
+	backlog = min(backlog, hist->depth);
+	for_each_possible_cpu (cpu) {
+		head = smp_load_acquire(&per_cpu_ptr(hist->cpus, cpu)->head);
+		reader->cpus[cpu].pos = head > backlog ? head - backlog : 0;
+	}
+	return 0;
+}
+
+void lwis_event_history_reader_free(struct lwis_event_history_reader *reader)
+{
+	kfree(reader->cpus);
+	reader->cpus = NULL;
+}
+
+size_t lwis_event_history_read(struct lwis_event_history *hist,
+			       struct lwis_event_history_reader *reader,
+			       struct lwis_event_history_record *records, size_t max_records)
+{
+	struct lwis_event_history_cpu *cpu_hist;
+	struct lwis_event_history_slot *slot;
+	struct lwis_event_history_record record;
+	struct lwis_event_history_reader_cpu *reader_cpu;
+	size_t num_records = 0;
+	u64 head, pos, seq;
+	int cpu;
+
+	for_each_possible_cpu (cpu) {
+		cpu_hist = per_cpu_ptr(hist->cpus, cpu);
+		reader_cpu = &reader->cpus[cpu];
+		head = smp_load_acquire(&cpu_hist->head);
+		pos = reader_cpu->pos;
+		if (head - pos > hist->depth) {
+			reader_cpu->num_dropped += head - hist->depth - pos;
+			pos = head - hist->depth;
+		}
+
+		for (; pos < head && num_records < max_records; ++pos) {
+			slot = &cpu_hist->slots[pos & (hist->depth - 1)];
+			seq = READ_ONCE(slot->seq);
+			smp_rmb();
+			record = slot->record;
+			smp_rmb();
+			if (seq != pos + 1 || READ_ONCE(slot->seq) != seq) {
+				/* Overwritten by a later record */
+				reader_cpu->num_dropped++;
+				continue;
+			}
+			record.cpu = cpu;
+			record.num_dropped = reader_cpu->num_dropped;
+			records[num_records++] = record;
+			reader_cpu->num_dropped = 0;
+		}
+		reader_cpu->pos = pos;
+	}
+	return num_records;
+}
+
+bool lwis_event_history_pending(struct lwis_event_history *hist,
+				struct lwis_event_history_reader *reader)
+{
+	int cpu;
+
+	for_each_possible_cpu (cpu) {
+		if (smp_load_acquire(&per_cpu_ptr(hist->cpus, cpu)->head) !=
+		    reader->cpus[cpu].pos) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,108 @@
+/*
+ * Google LWIS Event History
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_EVENT_HISTORY_H_
+#define LWIS_EVENT_HISTORY_H_
+
+#include <linux/percpu.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+#include "lwis_commands.h"
+
+/* Default number of records kept per CPU */
+#define LWIS_EVENT_HISTORY_DEFAULT_DEPTH 16
+
+struct lwis_event_history_slot {
+	/* Position + 1 of the record in the slot, 0 while it is written */
+	u64 seq;
+	struct lwis_event_history_record record;
+};
+
+/* Ring of the events emitted on one CPU, only written from that CPU with
+ * interrupts disabled */
+struct lwis_event_history_cpu {
+	/* Number of records written, the next one goes to
+	 * slots[head & (depth - 1)] */
+	u64 head;
+	struct lwis_event_history_slot *slots;
+};
+
+/*
+ * struct lwis_event_history
+ * Per-CPU rings of the events emitted by a device. Recording an event takes
+ * no lock, readers detect the records overwritten while they copy them.
+ */
+struct lwis_event_history {
+	struct lwis_event_history_cpu __percpu *cpus;
+	/* Number of records per CPU, a power of 2 */
+	u32 depth;
+	/* Woken up when records are added, for the streaming readers */
+	wait_queue_head_t wait_queue;
+};
+
+/* Read position of a reader in a CPU ring, and the number of records
+ * dropped since its last record */
+struct lwis_event_history_reader_cpu {
+	u64 pos;
+	u32 num_dropped;
+};
+
+struct lwis_event_history_reader {
+	struct lwis_event_history_reader_cpu *cpus;
+};
+
+/*
+ * lwis_event_history_init: Allocates rings of depth records, rounded up to
+ * a power of 2, for every possible CPU.
+ */
+int lwis_event_history_init(struct lwis_event_history *hist, u32 depth);
+
+/*
+ * lwis_event_history_free: Frees the rings.
+ */
+void lwis_event_history_free(struct lwis_event_history *hist);
+
+/*
+ * lwis_event_history_record: Records an emitted event, from any context.
+ */
+void lwis_event_history_record(struct lwis_event_history *hist, int64_t event_id,
+			       int64_t event_counter, int64_t timestamp);
+
+/*
+ * lwis_event_history_reader_init: Positions the reader at most backlog
+ * records before the latest one of each CPU.
+ */
+int lwis_event_history_reader_init(struct lwis_event_history *hist,
+				   struct lwis_event_history_reader *reader, u32 backlog);
+
+/*
+ * lwis_event_history_reader_free: Frees the reader positions.
+ */
+void lwis_event_history_reader_free(struct lwis_event_history_reader *reader);
+
+/*
+ * lwis_event_history_read: Copies up to max_records records past the reader
+ * positions into records and advances them.
+ *
+ * Returns: the number of records copied
+ */
+size_t lwis_event_history_read(struct lwis_event_history *hist,
+			       struct lwis_event_history_reader *reader,
+			       struct lwis_event_history_record *records, size_t max_records);
+
+/*
+ * lwis_event_history_pending: Returns true if records were added past the
+ * reader positions.
+ */
+bool lwis_event_history_pending(struct lwis_event_history *hist,
+				struct lwis_event_history_reader *reader);
+
+#endif /* LWIS_EVENT_HISTORY_H_ */
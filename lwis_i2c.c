@@ -12,13 +12,20 @@
 
 #include "lwis_i2c.h"
 
+#include <linux/bitmap.h>
 #include <linux/bits.h>
+#include <linux/cache.h>
+#include <linux/delay.h>
 #include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
 #include <linux/module.h>
 #include <linux/mutex.h>
 #include <linux/slab.h>
 #include <linux/string.h>
 
+#include "lwis_util.h"
+
 #define I2C_DEVICE_NAME "LWIS_I2C"
 
 /* Max bit width for register and data that is supported by this
@@ -33,6 +40,13 @@ static inline bool check_bitwidth(const int bitwidth, const int min, const int m
 	return (bitwidth >= min) && (bitwidth <= max) && ((bitwidth % 8) == 0);
 }
 
+/* Number of chunk buffers, two to build a chunk while waiting to send it, or
+ * one per message of a transfer of chunks */
+static inline int write_chunk_slots(struct lwis_i2c_device *i2c)
+{
+	return i2c->write_chunk_delay_us ? 2 : I2C_MAX_GROUP_ENTRIES;
+}
+
 static void value_to_buf(uint64_t value, uint8_t *buf, int buf_size)
 {
 	if (buf_size == 1) {
@@ -136,25 +150,18 @@ int lwis_i2c_set_state(struct lwis_i2c_device *i2c, const char *state_str)
 	return 0;
 }
 
-static int i2c_read(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *value)
+int lwis_i2c_transfer_init(struct lwis_i2c_device *i2c)
 {
-	int ret = 0;
-	u8 *wbuf;
-	u8 *rbuf;
-	struct i2c_client *client;
-	struct i2c_msg msg[2];
-
+	int i;
+	size_t num_regs;
+	struct lwis_i2c_shadow_range *range;
 	const unsigned int offset_bits = i2c->base_dev.native_addr_bitwidth;
 	const unsigned int value_bits = i2c->base_dev.native_value_bitwidth;
 	const unsigned int offset_bytes = offset_bits / BITS_PER_BYTE;
 	const unsigned int value_bytes = value_bits / BITS_PER_BYTE;
 
-	if (!i2c || !i2c->client) {
-		pr_err("Cannot find i2c instance\n");
-		return -ENODEV;
-	}
-	client = i2c->client;
-
+	/* Bitwidths are fixed once the device tree is parsed, validate them
+	   here instead of on every register access */
 	if (!check_bitwidth(offset_bits, MIN_OFFSET_BITS, MAX_OFFSET_BITS)) {
 		dev_err(i2c->base_dev.dev, "Invalid offset bitwidth %d\n", offset_bits);
 		return -EINVAL;
@@ -165,19 +172,219 @@ static int i2c_read(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *valu
 		return -EINVAL;
 	}
 
-	wbuf = kmalloc(offset_bytes, GFP_KERNEL);
-	if (!wbuf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c write buffer\n");
+	/* Adapters limiting the message length need chunks as well, and
+	   chunks hold whole values */
+	if (i2c->adapter && i2c->adapter->quirks && i2c->adapter->quirks->max_write_len &&
+	    (!i2c->write_chunk_bytes ||
+	     i2c->write_chunk_bytes > i2c->adapter->quirks->max_write_len - offset_bytes)) {
+		i2c->write_chunk_bytes = i2c->adapter->quirks->max_write_len - offset_bytes;
+	}
+	if (i2c->write_chunk_bytes) {
+		i2c->write_chunk_bytes = max(rounddown(i2c->write_chunk_bytes, value_bytes),
+					     value_bytes);
+		/* Batches that fit in the preallocated buffer are not split */
+		i2c->max_burst_bytes = min(i2c->max_burst_bytes, i2c->write_chunk_bytes);
+	}
+
+	if (i2c->max_burst_bytes < value_bytes) {
+		i2c->max_burst_bytes = value_bytes;
+	}
+
+	/* The write region holds the offset followed by up to max_burst_bytes
+	   of values, and the read region starts on its own cache line so that
+	   the two messages of a read never share one. The read region has one
+	   value slot per entry of a combined transfer */
+	i2c->xfer_rbuf_offset = L1_CACHE_ALIGN(offset_bytes + i2c->max_burst_bytes);
+	i2c->xfer_buf_size = i2c->xfer_rbuf_offset + I2C_MAX_GROUP_ENTRIES * value_bytes;
+
+	/* kmalloc'ed memory is DMA-safe */
+	i2c->xfer_buf = kmalloc(i2c->xfer_buf_size, GFP_KERNEL);
+	if (!i2c->xfer_buf) {
+		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c transfer buffer\n");
 		return -ENOMEM;
 	}
+	mutex_init(&i2c->xfer_lock);
+
+	if (i2c->write_chunk_bytes) {
+		i2c->chunk_stride = L1_CACHE_ALIGN(offset_bytes + i2c->write_chunk_bytes);
+		i2c->chunk_buf =
+			kmalloc_array(write_chunk_slots(i2c), i2c->chunk_stride, GFP_KERNEL);
+		if (!i2c->chunk_buf) {
+			dev_err(i2c->base_dev.dev, "Failed to allocate i2c write chunk buffers\n");
+			lwis_i2c_transfer_deinit(i2c);
+			return -ENOMEM;
+		}
+	}
+
+	for (i = 0; i < i2c->num_shadow_ranges; ++i) {
+		range = &i2c->shadow_ranges[i];
+		num_regs = range->end - range->start + 1;
+		range->values = kvcalloc(num_regs, sizeof(uint32_t), GFP_KERNEL);
+		range->valid = bitmap_zalloc(num_regs, GFP_KERNEL);
+		if (!range->values || !range->valid) {
+			dev_err(i2c->base_dev.dev, "Failed to allocate register shadow\n");
+			lwis_i2c_transfer_deinit(i2c);
+			return -ENOMEM;
+		}
+	}
+
+	return 0;
+}
+
+void lwis_i2c_transfer_deinit(struct lwis_i2c_device *i2c)
+{
+	int i;
+
+	for (i = 0; i < i2c->num_shadow_ranges; ++i) {
+		kvfree(i2c->shadow_ranges[i].values);
+		bitmap_free(i2c->shadow_ranges[i].valid);
+	}
+	kfree(i2c->shadow_ranges);
+	i2c->shadow_ranges = NULL;
+	i2c->num_shadow_ranges = 0;
+
+	kfree(i2c->xfer_buf);
+	i2c->xfer_buf = NULL;
+	i2c->xfer_buf_size = 0;
+	kfree(i2c->chunk_buf);
+	i2c->chunk_buf = NULL;
+}
+
+static struct lwis_i2c_shadow_range *shadow_range_find(struct lwis_i2c_device *i2c,
+						       uint64_t offset)
+{
+	int i;
+
+	for (i = 0; i < i2c->num_shadow_ranges; ++i) {
+		if (offset >= i2c->shadow_ranges[i].start && offset <= i2c->shadow_ranges[i].end) {
+			return &i2c->shadow_ranges[i];
+		}
+	}
+	return NULL;
+}
+
+/* Calling this function requires holding the xfer_lock. */
+static bool shadow_get(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *value)
+{
+	struct lwis_i2c_shadow_range *range = shadow_range_find(i2c, offset);
+
+	if (!range || !test_bit(offset - range->start, range->valid)) {
+		return false;
+	}
+	*value = range->values[offset - range->start];
+	return true;
+}
+
+/* Calling this function requires holding the xfer_lock. */
+static void shadow_set(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t value)
+{
+	struct lwis_i2c_shadow_range *range = shadow_range_find(i2c, offset);
+
+	if (range) {
+		range->values[offset - range->start] = value;
+		__set_bit(offset - range->start, range->valid);
+	}
+}
+
+/* Calling this function requires holding the xfer_lock. */
+static void shadow_drop(struct lwis_i2c_device *i2c, uint64_t offset)
+{
+	struct lwis_i2c_shadow_range *range = shadow_range_find(i2c, offset);
+
+	if (range) {
+		__clear_bit(offset - range->start, range->valid);
+	}
+}
+
+/*
+ * Update the shadow of the registers written by a batch of wire format values
+ * starting at start_offset, or drop them if the write failed or the batch
+ * does not hold whole values. Calling this function requires holding the
+ * xfer_lock.
+ */
+static void shadow_update_batch(struct lwis_i2c_device *i2c, uint64_t start_offset,
+				const uint8_t *buf, size_t size_in_bytes, bool written)
+{
+	size_t i;
+	const unsigned int value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
 
-	rbuf = kmalloc(value_bytes, GFP_KERNEL);
-	if (!rbuf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c read buffer\n");
-		ret = -ENOMEM;
-		goto error_rbuf_alloc;
+	if (i2c->num_shadow_ranges == 0) {
+		return;
 	}
 
+	written = written && (size_in_bytes % value_bytes == 0);
+	for (i = 0; i < size_in_bytes; i += value_bytes) {
+		if (written) {
+			shadow_set(i2c, start_offset + i, buf_to_value((uint8_t *)buf + i, value_bytes));
+		} else {
+			shadow_drop(i2c, start_offset + i);
+		}
+	}
+}
+
+/*
+ * Whether writing value to the register at offset can be skipped, as the
+ * device is known to hold it already and the entries being executed skip
+ * unchanged writes. Calling this function requires holding the xfer_lock.
+ */
+static bool shadow_write_unchanged(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t value)
+{
+	uint64_t shadow_value;
+
+	return i2c->base_dev.skip_unchanged_writes && shadow_get(i2c, offset, &shadow_value) &&
+	       shadow_value == value;
+}
+
+/* Same as shadow_write_unchanged, for a batch of wire format values. */
+static bool shadow_write_batch_unchanged(struct lwis_i2c_device *i2c, uint64_t start_offset,
+					 const uint8_t *buf, size_t size_in_bytes)
+{
+	size_t i;
+	const unsigned int value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
+
+	if (!i2c->base_dev.skip_unchanged_writes || size_in_bytes % value_bytes) {
+		return false;
+	}
+	for (i = 0; i < size_in_bytes; i += value_bytes) {
+		if (!shadow_write_unchanged(i2c, start_offset + i,
+					    buf_to_value((uint8_t *)buf + i, value_bytes))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+void lwis_i2c_shadow_invalidate(struct lwis_i2c_device *i2c)
+{
+	int i;
+
+	if (i2c->num_shadow_ranges == 0) {
+		return;
+	}
+
+	mutex_lock(&i2c->xfer_lock);
+	for (i = 0; i < i2c->num_shadow_ranges; ++i) {
+		bitmap_zero(i2c->shadow_ranges[i].valid,
+			    i2c->shadow_ranges[i].end - i2c->shadow_ranges[i].start + 1);
+	}
+	mutex_unlock(&i2c->xfer_lock);
+}
+
+/* Calling this function requires holding the xfer_lock. */
+static int i2c_read_locked(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *value)
+{
+	int ret = 0;
+	u8 *wbuf;
+	u8 *rbuf;
+	struct i2c_client *client = i2c->client;
+	struct i2c_msg msg[2];
+
+	const unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
+	const unsigned int value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
+
+	wbuf = i2c->xfer_buf;
+	rbuf = i2c->xfer_buf + i2c->xfer_rbuf_offset;
+
 	msg[0].addr = client->addr;
 	msg[0].flags = 0;
 	msg[0].len = offset_bytes;
@@ -192,57 +399,33 @@ static int i2c_read(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t *valu
 
 	if (ret) {
 		dev_err(i2c->base_dev.dev, "I2C Read failed: Offset 0x%llx (%d)\n", offset, ret);
-		goto error_transfer;
+		return ret;
 	}
 
 	*value = buf_to_value(rbuf, value_bytes);
+	shadow_set(i2c, offset, *value);
 
-error_transfer:
-	kfree(rbuf);
-error_rbuf_alloc:
-	kfree(wbuf);
-
-	return ret;
+	return 0;
 }
 
-static int i2c_write(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t value)
+/* Calling this function requires holding the xfer_lock. */
+static int i2c_write_locked(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t value)
 {
 	int ret;
-	u8 *buf;
-	struct i2c_client *client;
+	struct i2c_client *client = i2c->client;
 	struct i2c_msg msg;
 
-	const unsigned int offset_bits = i2c->base_dev.native_addr_bitwidth;
-	const unsigned int value_bits = i2c->base_dev.native_value_bitwidth;
-	const unsigned int offset_bytes = offset_bits / BITS_PER_BYTE;
-	const unsigned int value_bytes = value_bits / BITS_PER_BYTE;
+	const unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
+	const unsigned int value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
 	const int msg_bytes = offset_bytes + value_bytes;
 
-	if (!i2c || !i2c->client) {
-		pr_err("Cannot find i2c instance\n");
-		return -ENODEV;
-	}
-	client = i2c->client;
-
-	if (!check_bitwidth(offset_bits, MIN_OFFSET_BITS, MAX_OFFSET_BITS)) {
-		dev_err(i2c->base_dev.dev, "Invalid offset bitwidth %d\n", offset_bits);
-		return -EINVAL;
-	}
-
-	if (!check_bitwidth(value_bits, MIN_DATA_BITS, MAX_DATA_BITS)) {
-		dev_err(i2c->base_dev.dev, "Invalid value bitwidth %d\n", value_bits);
-		return -EINVAL;
-	}
-
-	buf = kmalloc(msg_bytes, GFP_KERNEL);
-	if (!buf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c buffer\n");
-		return -ENOMEM;
+	if (shadow_write_unchanged(i2c, offset, value)) {
+		return 0;
 	}
 
 	msg.addr = client->addr;
 	msg.flags = 0;
-	msg.buf = buf;
+	msg.buf = i2c->xfer_buf;
 	msg.len = msg_bytes;
 
 	ret = perform_write_transfer(client, &msg, offset, offset_bytes, value_bytes, value);
@@ -250,45 +433,28 @@ static int i2c_write(struct lwis_i2c_device *i2c, uint64_t offset, uint64_t valu
 	if (ret) {
 		dev_err(i2c->base_dev.dev, "I2C Write failed: Offset 0x%llx Value 0x%llx (%d)\n",
 			offset, value, ret);
+		shadow_drop(i2c, offset);
+	} else {
+		shadow_set(i2c, offset, value);
 	}
 
-	kfree(buf);
-
 	return ret;
 }
 
-static int i2c_read_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, uint8_t *read_buf,
-			  int read_buf_size)
+/* Calling this function requires holding the xfer_lock. */
+static int i2c_read_batch_locked(struct lwis_i2c_device *i2c, uint64_t start_offset,
+				 uint8_t *read_buf, int read_buf_size)
 {
 	int ret = 0;
-	uint8_t *wbuf;
-	struct i2c_client *client;
+	struct i2c_client *client = i2c->client;
 	struct i2c_msg msg[2];
 
-	const unsigned int offset_bits = i2c->base_dev.native_addr_bitwidth;
-	const unsigned int offset_bytes = offset_bits / BITS_PER_BYTE;
-
-	if (!i2c || !i2c->client) {
-		pr_err("Cannot find i2c instance\n");
-		return -ENODEV;
-	}
-	client = i2c->client;
-
-	if (!check_bitwidth(offset_bits, MIN_OFFSET_BITS, MAX_OFFSET_BITS)) {
-		dev_err(i2c->base_dev.dev, "Invalid offset bitwidth %d\n", offset_bits);
-		return -EINVAL;
-	}
-
-	wbuf = kmalloc(offset_bytes, GFP_KERNEL);
-	if (!wbuf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c write buffer\n");
-		return -ENOMEM;
-	}
+	const unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
 
 	msg[0].addr = client->addr;
 	msg[0].flags = 0;
 	msg[0].len = offset_bytes;
-	msg[0].buf = wbuf;
+	msg[0].buf = i2c->xfer_buf;
 
 	msg[1].addr = client->addr;
 	msg[1].flags = I2C_M_RD;
@@ -302,41 +468,126 @@ static int i2c_read_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, ui
 			start_offset, ret);
 	}
 
-	kfree(wbuf);
 	return ret;
 }
 
-static int i2c_write_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, uint8_t *write_buf,
-			   int write_buf_size)
+/* Builds the messages of the chunks of write_buf from *pos on, up to
+ * num_slots of them, in the chunk buffers from slot on. */
+static int write_chunks_build(struct lwis_i2c_device *i2c, struct i2c_msg *msgs, int slot,
+			      int num_slots, uint64_t start_offset, uint8_t *write_buf,
+			      int write_buf_size, int *pos)
+{
+	int num_msgs;
+	int chunk_size;
+	uint8_t *buf;
+
+	const unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
+
+	for (num_msgs = 0; num_msgs < num_slots && *pos < write_buf_size; ++num_msgs) {
+		chunk_size = min_t(int, i2c->write_chunk_bytes, write_buf_size - *pos);
+		buf = i2c->chunk_buf + (slot + num_msgs) * i2c->chunk_stride;
+		value_to_buf(start_offset + *pos, buf, offset_bytes);
+		memcpy(buf + offset_bytes, write_buf + *pos, chunk_size);
+
+		msgs[num_msgs].addr = i2c->client->addr;
+		msgs[num_msgs].flags = I2C_M_DMA_SAFE;
+		msgs[num_msgs].len = offset_bytes + chunk_size;
+		msgs[num_msgs].buf = buf;
+		*pos += chunk_size;
+	}
+	return num_msgs;
+}
+
+/*
+ * Sends a batch larger than write_chunk_bytes in chunks, each with the offset
+ * of its first register. Without a delay between chunks, up to
+ * I2C_MAX_GROUP_ENTRIES of them are sent in one i2c_transfer(), so that the
+ * adapter moves from one to the next on its own. With a delay, the next chunk
+ * is built while it runs. Calling this function requires holding the
+ * xfer_lock.
+ */
+static int i2c_write_chunks_locked(struct lwis_i2c_device *i2c, uint64_t start_offset,
+				   uint8_t *write_buf, int write_buf_size)
+{
+	int ret = 0;
+	int pos = 0;
+	int slot = 0;
+	int num_msgs;
+	s64 wait_us;
+	ktime_t sent_time;
+	struct i2c_client *client = i2c->client;
+	struct i2c_msg *msgs = i2c->group_msgs;
+
+	const u32 delay_us = i2c->write_chunk_delay_us;
+	const int num_slots = delay_us ? 1 : write_chunk_slots(i2c);
+
+	num_msgs = write_chunks_build(i2c, msgs + slot, slot, num_slots, start_offset, write_buf,
+				      write_buf_size, &pos);
+	while (num_msgs > 0) {
+		ret = i2c_transfer(client->adapter, msgs + slot, num_msgs);
+		if (ret != num_msgs) {
+			ret = ret < 0 ? ret : -EIO;
+			break;
+		}
+		ret = 0;
+		sent_time = ktime_get();
+
+		/* The other chunk buffer is free once a chunk is sent */
+		if (delay_us) {
+			slot = 1 - slot;
+		}
+		num_msgs = write_chunks_build(i2c, msgs + slot, slot, num_slots, start_offset,
+					      write_buf, write_buf_size, &pos);
+		if (num_msgs > 0 && delay_us) {
+			wait_us = delay_us - ktime_us_delta(ktime_get(), sent_time);
+			if (wait_us > 0) {
+				usleep_range(wait_us, wait_us);
+			}
+		}
+	}
+
+	if (ret) {
+		dev_err(i2c->base_dev.dev, "I2C Write Chunks failed: Start Offset 0x%llx (%d)\n",
+			start_offset, ret);
+	}
+	shadow_update_batch(i2c, start_offset, write_buf, write_buf_size, ret == 0);
+	return ret;
+}
+
+/* Calling this function requires holding the xfer_lock. */
+static int i2c_write_batch_locked(struct lwis_i2c_device *i2c, uint64_t start_offset,
+				  uint8_t *write_buf, int write_buf_size)
 {
 	int ret;
 	uint8_t *buf;
-	struct i2c_client *client;
+	struct i2c_client *client = i2c->client;
 	struct i2c_msg msg;
 
-	const unsigned int offset_bits = i2c->base_dev.native_addr_bitwidth;
-	const unsigned int offset_bytes = offset_bits / BITS_PER_BYTE;
+	const unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
 	const int msg_bytes = offset_bytes + write_buf_size;
 
-	if (!i2c || !i2c->client) {
-		pr_err("Cannot find i2c instance\n");
-		return -ENODEV;
+	if (shadow_write_batch_unchanged(i2c, start_offset, write_buf, write_buf_size)) {
+		return 0;
 	}
-	client = i2c->client;
 
-	if (!check_bitwidth(offset_bits, MIN_OFFSET_BITS, MAX_OFFSET_BITS)) {
-		dev_err(i2c->base_dev.dev, "Invalid offset bitwidth %d\n", offset_bits);
-		return -EINVAL;
+	if (i2c->write_chunk_bytes && write_buf_size > i2c->write_chunk_bytes) {
+		return i2c_write_chunks_locked(i2c, start_offset, write_buf, write_buf_size);
 	}
 
-	buf = kmalloc(msg_bytes, GFP_KERNEL);
-	if (!buf) {
-		dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c buffer\n");
-		return -ENOMEM;
+	/* Only batches larger than the preallocated buffer need allocation */
+	if (write_buf_size <= i2c->max_burst_bytes) {
+		buf = i2c->xfer_buf;
+	} else {
+		buf = kmalloc(msg_bytes, GFP_KERNEL);
+		if (!buf) {
+			dev_err(i2c->base_dev.dev, "Failed to allocate memory for i2c buffer\n");
+			return -ENOMEM;
+		}
 	}
 
+	/* Both buffers are kmalloc'ed, so the adapter needs no bounce buffer */
 	msg.addr = client->addr;
-	msg.flags = 0;
+	msg.flags = I2C_M_DMA_SAFE;
 	msg.buf = buf;
 	msg.len = msg_bytes;
 
@@ -347,41 +598,501 @@ static int i2c_write_batch(struct lwis_i2c_device *i2c, uint64_t start_offset, u
 		dev_err(i2c->base_dev.dev, "I2C Write Batch failed: Start Offset 0x%llx (%d)\n",
 			start_offset, ret);
 	}
+	shadow_update_batch(i2c, start_offset, write_buf, write_buf_size, ret == 0);
 
-	kfree(buf);
+	if (buf != i2c->xfer_buf) {
+		kfree(buf);
+	}
 
 	return ret;
 }
 
-int lwis_i2c_io_entry_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entry)
+/* Calling this function requires holding the xfer_lock. */
+static int i2c_write_burst_locked(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+				  int num_entries)
+{
+	int ret;
+	int i;
+	uint8_t *buf = i2c->xfer_buf;
+	struct i2c_client *client = i2c->client;
+	struct i2c_msg msg;
+
+	const unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
+	const unsigned int value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
+
+	/* Unchanged values within the burst are cheaper to resend than to split
+	   the burst around, only skip it as a whole */
+	for (i = 0; i < num_entries; ++i) {
+		if (!shadow_write_unchanged(i2c, entries[i].rw.offset, entries[i].rw.val)) {
+			break;
+		}
+	}
+	if (i == num_entries) {
+		return 0;
+	}
+
+	value_to_buf(entries[0].rw.offset, buf, offset_bytes);
+	buf += offset_bytes;
+	for (i = 0; i < num_entries; ++i) {
+		value_to_buf(entries[i].rw.val, buf, value_bytes);
+		buf += value_bytes;
+	}
+
+	msg.addr = client->addr;
+	msg.flags = 0;
+	msg.buf = i2c->xfer_buf;
+	msg.len = offset_bytes + num_entries * value_bytes;
+
+	ret = i2c_transfer(client->adapter, &msg, 1);
+	if (ret != 1) {
+		dev_err(i2c->base_dev.dev, "I2C Write Burst failed: Start Offset 0x%llx (%d)\n",
+			entries[0].rw.offset, ret);
+		for (i = 0; i < num_entries; ++i) {
+			shadow_drop(i2c, entries[i].rw.offset);
+		}
+		return ret < 0 ? ret : -EIO;
+	}
+
+	for (i = 0; i < num_entries; ++i) {
+		shadow_set(i2c, entries[i].rw.offset, entries[i].rw.val);
+	}
+	return 0;
+}
+
+/* Calling this function requires holding the xfer_lock. */
+static void shadow_update_scatter(struct lwis_i2c_device *i2c, const uint8_t *pairs,
+				  int num_pairs, bool written)
+{
+	int i;
+	uint64_t offset;
+	const unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
+	const unsigned int value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
+
+	for (i = 0; i < num_pairs; ++i, pairs += offset_bytes + value_bytes) {
+		offset = lwis_scatter_field_get(pairs, offset_bytes);
+		if (written) {
+			shadow_set(i2c, offset,
+				   lwis_scatter_field_get(pairs + offset_bytes, value_bytes));
+		} else {
+			shadow_drop(i2c, offset);
+		}
+	}
+}
+
+/*
+ * Whether one of the write messages already queued in a scatter chunk targets
+ * offset. The shadow only learns about them once the chunk is transferred.
+ */
+static bool scatter_msgs_write_offset(struct i2c_msg *msgs, int num_msgs, int offset_bytes,
+				      uint64_t offset)
+{
+	int i;
+
+	for (i = 0; i < num_msgs; ++i) {
+		if (buf_to_value(msgs[i].buf, offset_bytes) == offset) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Calling this function requires holding the xfer_lock. */
+static int i2c_write_scatter_locked(struct lwis_i2c_device *i2c,
+				    struct lwis_io_entry_write_scatter *scatter)
+{
+	int ret;
+	int num_msgs;
+	int max_msgs;
+	size_t num_pairs;
+	size_t num_chunk_pairs;
+	size_t pair;
+	uint64_t offset;
+	uint64_t value;
+	const uint8_t *src;
+	const uint8_t *chunk;
+	struct i2c_client *client = i2c->client;
+	struct i2c_msg *msgs = i2c->group_msgs;
+
+	const unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
+	const unsigned int value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
+	const unsigned int pair_bytes = offset_bytes + value_bytes;
+
+	if (!lwis_scatter_field_width_valid(offset_bytes) ||
+	    !lwis_scatter_field_width_valid(value_bytes)) {
+		dev_err(i2c->base_dev.dev, "Scatter write of %u byte offsets and %u byte values\n",
+			offset_bytes, value_bytes);
+		return -EINVAL;
+	}
+	if (scatter->size_in_bytes % pair_bytes) {
+		dev_err(i2c->base_dev.dev,
+			"Scatter write size %zu is not a multiple of the pair size %u\n",
+			scatter->size_in_bytes, pair_bytes);
+		return -EINVAL;
+	}
+
+	/* Nothing is read back, so every pair can take its own write message
+	   anywhere in the transfer buffer */
+	max_msgs = min_t(size_t, ARRAY_SIZE(i2c->group_msgs), i2c->xfer_buf_size / pair_bytes);
+	if (max_msgs == 0) {
+		dev_err(i2c->base_dev.dev,
+			"Transfer buffer of %zu bytes is below the pair size %u\n",
+			i2c->xfer_buf_size, pair_bytes);
+		return -EINVAL;
+	}
+	num_pairs = scatter->size_in_bytes / pair_bytes;
+	src = scatter->buf;
+	for (pair = 0; pair < num_pairs; pair += num_chunk_pairs) {
+		chunk = src;
+		num_msgs = 0;
+		for (num_chunk_pairs = 0; num_msgs < max_msgs && pair + num_chunk_pairs < num_pairs;
+		     ++num_chunk_pairs, src += pair_bytes) {
+			offset = lwis_scatter_field_get(src, offset_bytes);
+			value = lwis_scatter_field_get(src + offset_bytes, value_bytes);
+			if (shadow_write_unchanged(i2c, offset, value)) {
+				/* An earlier pair of this chunk may be changing the
+				   register, so decide once the chunk has landed */
+				if (scatter_msgs_write_offset(msgs, num_msgs, offset_bytes,
+							      offset)) {
+					break;
+				}
+				continue;
+			}
+			msgs[num_msgs].addr = client->addr;
+			msgs[num_msgs].flags = 0;
+			msgs[num_msgs].len = pair_bytes;
+			msgs[num_msgs].buf = i2c->xfer_buf + num_msgs * pair_bytes;
+			value_to_buf(offset, msgs[num_msgs].buf, offset_bytes);
+			value_to_buf(value, msgs[num_msgs].buf + offset_bytes, value_bytes);
+			num_msgs++;
+		}
+		if (num_msgs == 0) {
+			continue;
+		}
+
+		ret = i2c_transfer(client->adapter, msgs, num_msgs);
+		if (ret == num_msgs) {
+			ret = 0;
+		} else if (ret >= 0) {
+			ret = -EIO;
+		}
+		if (i2c->num_shadow_ranges > 0) {
+			shadow_update_scatter(i2c, chunk, num_chunk_pairs, ret == 0);
+		}
+		if (ret) {
+			dev_err(i2c->base_dev.dev, "I2C Scatter Write failed: Pair %zu (%d)\n",
+				pair, ret);
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
+/* Calling this function requires holding the xfer_lock. */
+static int i2c_io_entry_rw_locked(struct lwis_i2c_device *i2c, struct lwis_io_entry *entry)
 {
 	int ret;
 	uint64_t reg_value;
-	BUG_ON(!entry);
 
 	if (entry->type == LWIS_IO_ENTRY_READ) {
-		return i2c_read(i2c, entry->rw.offset, &entry->rw.val);
+		if (i2c->shadow_reads && shadow_get(i2c, entry->rw.offset, &entry->rw.val)) {
+			return 0;
+		}
+		return i2c_read_locked(i2c, entry->rw.offset, &entry->rw.val);
 	}
 	if (entry->type == LWIS_IO_ENTRY_WRITE) {
-		return i2c_write(i2c, entry->rw.offset, entry->rw.val);
+		return i2c_write_locked(i2c, entry->rw.offset, entry->rw.val);
 	}
 	if (entry->type == LWIS_IO_ENTRY_MODIFY) {
-		ret = i2c_read(i2c, entry->mod.offset, &reg_value);
-		if (ret) {
-			return ret;
+		/* A cacheable register is only read back if its value is unknown */
+		if (!shadow_get(i2c, entry->mod.offset, &reg_value)) {
+			ret = i2c_read_locked(i2c, entry->mod.offset, &reg_value);
+			if (ret) {
+				return ret;
+			}
 		}
 		reg_value &= ~entry->mod.val_mask;
 		reg_value |= entry->mod.val_mask & entry->mod.val;
-		return i2c_write(i2c, entry->mod.offset, reg_value);
+		return i2c_write_locked(i2c, entry->mod.offset, reg_value);
 	}
 	if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
-		return i2c_read_batch(i2c, entry->rw_batch.offset, entry->rw_batch.buf,
-				      entry->rw_batch.size_in_bytes);
+		return i2c_read_batch_locked(i2c, entry->rw_batch.offset, entry->rw_batch.buf,
+					     entry->rw_batch.size_in_bytes);
 	}
 	if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
-		return i2c_write_batch(i2c, entry->rw_batch.offset, entry->rw_batch.buf,
-				       entry->rw_batch.size_in_bytes);
+		return i2c_write_batch_locked(i2c, entry->rw_batch.offset, entry->rw_batch.buf,
+					      entry->rw_batch.size_in_bytes);
+	}
+	if (entry->type == LWIS_IO_ENTRY_WRITE_SCATTER) {
+		return i2c_write_scatter_locked(i2c, &entry->scatter);
 	}
 	dev_err(i2c->base_dev.dev, "Invalid IO entry type: %d\n", entry->type);
 	return -EINVAL;
 }
+
+/*
+ * Whether one of the first num_group entries of a group, not counting the
+ * skipped ones, writes the register at offset. The shadow only learns about
+ * them once the group is transferred.
+ */
+static bool group_writes_offset(struct lwis_io_entry *entries, int num_group,
+				unsigned long skipped, uint64_t offset)
+{
+	int i;
+
+	for (i = 0; i < num_group; ++i) {
+		if (skipped & BIT(i)) {
+			continue;
+		}
+		if (entries[i].type == LWIS_IO_ENTRY_WRITE && entries[i].rw.offset == offset) {
+			return true;
+		}
+		if (entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH &&
+		    offset >= entries[i].rw_batch.offset &&
+		    offset - entries[i].rw_batch.offset < entries[i].rw_batch.size_in_bytes) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Calling this function requires holding the xfer_lock. */
+static int i2c_io_entries_transfer_locked(struct lwis_i2c_device *i2c,
+					  struct lwis_io_entry *entries, int num_entries,
+					  int *num_completed)
+{
+	int ret;
+	int i;
+	int num_group;
+	int num_msgs = 0;
+	unsigned long skipped = 0;
+	size_t wbuf_used = 0;
+	size_t wbuf_needed;
+	struct lwis_io_entry *entry;
+	struct i2c_client *client = i2c->client;
+	struct i2c_msg *msgs = i2c->group_msgs;
+	uint8_t *rbuf = i2c->xfer_buf + i2c->xfer_rbuf_offset;
+
+	const unsigned int offset_bytes = i2c->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
+	const unsigned int value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
+	const size_t wbuf_size = offset_bytes + i2c->max_burst_bytes;
+
+	*num_completed = 0;
+
+	/* Build the messages of as many entries as fit in the transfer buffer */
+	for (num_group = 0; num_group < num_entries && num_group < I2C_MAX_GROUP_ENTRIES;
+	     ++num_group) {
+		entry = &entries[num_group];
+		if (entry->type == LWIS_IO_ENTRY_WRITE &&
+		    shadow_write_unchanged(i2c, entry->rw.offset, entry->rw.val)) {
+			/* The shadow is stale while an earlier entry of the group
+			   writes the same register, so end the group before it */
+			if (group_writes_offset(entries, num_group, skipped, entry->rw.offset)) {
+				break;
+			}
+			/* Completes with the transfer without sending anything */
+			skipped |= BIT(num_group);
+			continue;
+		}
+		if (entry->type == LWIS_IO_ENTRY_WRITE) {
+			wbuf_needed = offset_bytes + value_bytes;
+		} else if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			wbuf_needed = offset_bytes + entry->rw_batch.size_in_bytes;
+		} else if (entry->type == LWIS_IO_ENTRY_READ ||
+			   entry->type == LWIS_IO_ENTRY_READ_BATCH) {
+			wbuf_needed = offset_bytes;
+		} else {
+			/* Let the entries before it execute first */
+			if (num_group > 0) {
+				break;
+			}
+			dev_err(i2c->base_dev.dev, "Invalid IO entry type for group: %d\n",
+				entry->type);
+			return -EINVAL;
+		}
+		if (wbuf_used + wbuf_needed > wbuf_size) {
+			break;
+		}
+
+		msgs[num_msgs].addr = client->addr;
+		msgs[num_msgs].flags = 0;
+		msgs[num_msgs].len = wbuf_needed;
+		msgs[num_msgs].buf = i2c->xfer_buf + wbuf_used;
+		wbuf_used += wbuf_needed;
+
+		if (entry->type == LWIS_IO_ENTRY_WRITE) {
+			value_to_buf(entry->rw.offset, msgs[num_msgs].buf, offset_bytes);
+			value_to_buf(entry->rw.val, msgs[num_msgs].buf + offset_bytes, value_bytes);
+			num_msgs++;
+		} else if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			value_to_buf(entry->rw_batch.offset, msgs[num_msgs].buf, offset_bytes);
+			memcpy(msgs[num_msgs].buf + offset_bytes, entry->rw_batch.buf,
+			       entry->rw_batch.size_in_bytes);
+			num_msgs++;
+		} else if (entry->type == LWIS_IO_ENTRY_READ) {
+			value_to_buf(entry->rw.offset, msgs[num_msgs].buf, offset_bytes);
+			num_msgs++;
+			msgs[num_msgs].addr = client->addr;
+			msgs[num_msgs].flags = I2C_M_RD;
+			msgs[num_msgs].len = value_bytes;
+			msgs[num_msgs].buf = rbuf + num_group * value_bytes;
+			num_msgs++;
+		} else {
+			value_to_buf(entry->rw_batch.offset, msgs[num_msgs].buf, offset_bytes);
+			num_msgs++;
+			msgs[num_msgs].addr = client->addr;
+			msgs[num_msgs].flags = I2C_M_RD;
+			msgs[num_msgs].len = entry->rw_batch.size_in_bytes;
+			msgs[num_msgs].buf = entry->rw_batch.buf;
+			num_msgs++;
+		}
+	}
+
+	/* A write batch larger than the transfer buffer is sent on its own */
+	if (num_group == 0) {
+		ret = i2c_io_entry_rw_locked(i2c, &entries[0]);
+		if (!ret) {
+			*num_completed = 1;
+		}
+		return ret;
+	}
+
+	if (num_msgs == 0) {
+		*num_completed = num_group;
+		return 0;
+	}
+
+	ret = i2c_transfer(client->adapter, msgs, num_msgs);
+	if (ret == num_msgs) {
+		*num_completed = num_group;
+		ret = 0;
+	} else if (ret >= 0) {
+		/* Map the number of messages transferred back to the entries */
+		for (i = 0; i < num_group; ++i) {
+			if (!(skipped & BIT(i))) {
+				ret -= (entries[i].type == LWIS_IO_ENTRY_READ ||
+					entries[i].type == LWIS_IO_ENTRY_READ_BATCH) ?
+					       2 :
+					       1;
+			}
+			if (ret < 0) {
+				break;
+			}
+			*num_completed = i + 1;
+		}
+		ret = -EIO;
+	}
+
+	for (i = 0; i < *num_completed; ++i) {
+		if (entries[i].type == LWIS_IO_ENTRY_READ) {
+			entries[i].rw.val = buf_to_value(rbuf + i * value_bytes, value_bytes);
+			shadow_set(i2c, entries[i].rw.offset, entries[i].rw.val);
+		} else if (entries[i].type == LWIS_IO_ENTRY_WRITE) {
+			shadow_set(i2c, entries[i].rw.offset, entries[i].rw.val);
+		} else if (entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			shadow_update_batch(i2c, entries[i].rw_batch.offset, entries[i].rw_batch.buf,
+					    entries[i].rw_batch.size_in_bytes, true);
+		}
+	}
+	/* The device state is unknown for the writes that may not have landed */
+	for (i = *num_completed; i < num_group; ++i) {
+		if (entries[i].type == LWIS_IO_ENTRY_WRITE) {
+			shadow_drop(i2c, entries[i].rw.offset);
+		} else if (entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			shadow_update_batch(i2c, entries[i].rw_batch.offset, entries[i].rw_batch.buf,
+					    entries[i].rw_batch.size_in_bytes, false);
+		}
+	}
+
+	if (ret) {
+		dev_err(i2c->base_dev.dev, "I2C Combined Transfer failed: Offset 0x%llx (%d)\n",
+			entries[*num_completed].rw.offset, ret);
+	}
+
+	return ret;
+}
+
+int lwis_i2c_io_entry_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entry)
+{
+	int ret;
+	BUG_ON(!entry);
+
+	if (!i2c || !i2c->client || !i2c->xfer_buf) {
+		pr_err("Cannot find i2c instance\n");
+		return -ENODEV;
+	}
+
+	mutex_lock(&i2c->xfer_lock);
+	ret = i2c_io_entry_rw_locked(i2c, entry);
+	mutex_unlock(&i2c->xfer_lock);
+
+	return ret;
+}
+
+int lwis_i2c_io_entries_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+			   int num_entries, int *num_completed)
+{
+	int ret = 0;
+	int num_transferred;
+	BUG_ON(!entries || !num_completed);
+
+	*num_completed = 0;
+	if (!i2c || !i2c->client || !i2c->xfer_buf) {
+		pr_err("Cannot find i2c instance\n");
+		return -ENODEV;
+	}
+
+	mutex_lock(&i2c->xfer_lock);
+	while (*num_completed < num_entries) {
+		ret = i2c_io_entries_transfer_locked(i2c, entries + *num_completed,
+						     num_entries - *num_completed,
+						     &num_transferred);
+		*num_completed += num_transferred;
+		if (ret) {
+			break;
+		}
+	}
+	mutex_unlock(&i2c->xfer_lock);
+
+	return ret;
+}
+
+int lwis_i2c_io_entry_write_burst(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+				  int num_entries)
+{
+	int ret;
+	int num_burst = 1;
+	unsigned int max_burst_entries;
+	unsigned int value_bytes;
+	BUG_ON(!entries || num_entries < 1);
+
+	if (!i2c || !i2c->client || !i2c->xfer_buf) {
+		pr_err("Cannot find i2c instance\n");
+		return -ENODEV;
+	}
+
+	if (entries[0].type != LWIS_IO_ENTRY_WRITE) {
+		dev_err(i2c->base_dev.dev, "Invalid IO entry type for burst: %d\n", entries[0].type);
+		return -EINVAL;
+	}
+
+	/* Find the run of writes to consecutive registers that fits in the
+	   preallocated transfer buffer */
+	value_bytes = i2c->base_dev.native_value_bitwidth / BITS_PER_BYTE;
+	max_burst_entries = i2c->max_burst_bytes / value_bytes;
+	while (num_burst < num_entries && num_burst < max_burst_entries &&
+	       entries[num_burst].type == LWIS_IO_ENTRY_WRITE &&
+	       entries[num_burst].rw.offset == entries[num_burst - 1].rw.offset + value_bytes) {
+		num_burst++;
+	}
+
+	mutex_lock(&i2c->xfer_lock);
+	if (num_burst == 1) {
+		ret = i2c_write_locked(i2c, entries[0].rw.offset, entries[0].rw.val);
+	} else {
+		ret = i2c_write_burst_locked(i2c, entries, num_burst);
+	}
+	mutex_unlock(&i2c->xfer_lock);
+
+	return ret ? ret : num_burst;
+}
@@ -29,10 +29,46 @@
  */
 int lwis_i2c_set_state(struct lwis_i2c_device *i2c, const char *state_str);
 
+/*
+ *  lwis_i2c_transfer_init: Validate the register bitwidths of the device and
+ *  allocate the buffer used for register transfers. Called once at probe, after
+ *  the device tree is parsed.
+ */
+int lwis_i2c_transfer_init(struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_transfer_deinit: Free the buffer used for register transfers.
+ */
+void lwis_i2c_transfer_deinit(struct lwis_i2c_device *i2c);
+
+/*
+ *  lwis_i2c_shadow_invalidate: Forget the shadow values of all cacheable
+ *  registers, e.g. once the device lost its register state on power down.
+ */
+void lwis_i2c_shadow_invalidate(struct lwis_i2c_device *i2c);
+
 /*
  *  lwis_i2c_io_entry_rw: Read/Write from i2c bus via io_entry request.
  *  The readback values will be stored in the entry.
  */
 int lwis_i2c_io_entry_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entry);
 
+/*
+ *  lwis_i2c_io_entry_write_burst: Write entries[0], which must be a
+ *  LWIS_IO_ENTRY_WRITE, together with the following writes to consecutive
+ *  registers as one burst transfer.
+ *  Returns: number of entries written, or negative error code.
+ */
+int lwis_i2c_io_entry_write_burst(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+				  int num_entries);
+
+/*
+ *  lwis_i2c_io_entries_rw: Execute a list of READ, READ_BATCH, WRITE and
+ *  WRITE_BATCH entries, combining up to I2C_MAX_GROUP_ENTRIES of them into each
+ *  i2c_transfer() call. The number of entries fully executed is stored in
+ *  num_completed, also on error.
+ */
+int lwis_i2c_io_entries_rw(struct lwis_i2c_device *i2c, struct lwis_io_entry *entries,
+			   int num_entries, int *num_completed);
+
 #endif /* LWIS_I2C_H_ */
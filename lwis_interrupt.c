@@ -18,6 +18,7 @@
 #include "lwis_device.h"
 #include "lwis_event.h"
 #include "lwis_platform.h"
+#include "lwis_trace.h"
 #include "lwis_transaction.h"
 #include "lwis_util.h"
 
@@ -30,10 +31,13 @@ struct lwis_single_event_info {
 	bool is_critical;
 	/* Reference to the device event state */
 	struct lwis_device_event_state *state;
+	/* Leaf whose status register holds int_reg_bit, NULL for the top level
+	 * status register */
+	struct lwis_interrupt_leaf *leaf;
 	/* Node in the lwis_interrupt->event_infos hash table */
 	struct hlist_node node;
-	/* Node in the lwis_interrupt->enabled_event_infos list */
-	struct list_head node_enabled;
+	/* Next enabled event on the same bit of lwis_interrupt->enabled_event_infos */
+	struct lwis_single_event_info *next_enabled;
 };
 
 static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data);
@@ -53,7 +57,7 @@ struct lwis_interrupt_list *lwis_interrupt_list_alloc(struct lwis_device *lwis_d
 		return ERR_PTR(-ENOMEM);
 	}
 
-	list->irq = kmalloc(count * sizeof(struct lwis_interrupt), GFP_KERNEL);
+	list->irq = kcalloc(count, sizeof(struct lwis_interrupt), GFP_KERNEL);
 	if (!list->irq) {
 		pr_err("Failed to allocate IRQs\n");
 		kfree(list);
@@ -68,7 +72,7 @@ struct lwis_interrupt_list *lwis_interrupt_list_alloc(struct lwis_device *lwis_d
 
 void lwis_interrupt_list_free(struct lwis_interrupt_list *list)
 {
-	int i;
+	int i, bit;
 	if (!list) {
 		return;
 	}
@@ -80,6 +84,9 @@ void lwis_interrupt_list_free(struct lwis_interrupt_list *list)
 
 	for (i = 0; i < list->count; ++i) {
 		free_irq(list->irq[i].irq, &list->irq[i]);
+		for (bit = 0; bit < IRQ_MAX_REG_BITS; bit++) {
+			kfree(list->irq[i].leaves[bit]);
+		}
 	}
 	kfree(list->irq);
 }
@@ -137,13 +144,41 @@ lwis_interrupt_get_single_event_info_locked(struct lwis_interrupt *irq, int64_t
 	return NULL;
 }
 
+/*
+ * queue_bit_events_locked: Adds the enabled events of a fired status bit to
+ * the emit batch of the interrupt, flushing the batch when it is full.
+ *
+ * Assumes: irq->lock is locked
+ */
+static void queue_bit_events_locked(struct lwis_interrupt *irq,
+				    struct lwis_single_event_info *event, int *num_events)
+{
+	for (; event; event = event->next_enabled) {
+		/* Bits with several events may overflow the batch */
+		if (*num_events == IRQ_MAX_REG_BITS) {
+			lwis_device_event_emit_batch(irq->lwis_dev, irq->emit_batch, *num_events,
+						     /*in_irq=*/true);
+			*num_events = 0;
+		}
+		/* Queue the event, all the fired events are emitted together */
+		irq->emit_batch[(*num_events)++].state = event->state;
+
+		/* If considered critical, print the event */
+		if (event->is_critical) {
+			dev_err_ratelimited(irq->lwis_dev->dev,
+					    "Caught critical IRQ(%s) event(0x%llx)\n", irq->name,
+					    event->event_id);
+		}
+	}
+}
+
 static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
 {
 	int ret;
 	struct lwis_interrupt *irq = (struct lwis_interrupt *)data;
-	struct lwis_single_event_info *event;
-	struct list_head *p;
-	uint64_t source_value, reset_value = 0;
+	struct lwis_interrupt_leaf *leaf;
+	uint64_t source_value, pending, leaf_pending, reset_value = 0;
+	int bit, leaf_bit, num_events = 0;
 #ifdef LWIS_INTERRUPT_DEBUG
 	uint64_t mask_value;
 #endif
@@ -157,6 +192,37 @@ static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
 			irq->name, ret);
 		goto error;
 	}
+	trace_lwis_interrupt(irq->lwis_dev, irq_number, source_value);
+	WRITE_ONCE(irq->count, irq->count + 1);
+	lwis_stats_add(irq->lwis_dev, LWIS_STAT_IRQS, 1);
+
+	/* Read and clear only the pending leaves, before the aggregator bits
+	 * that report them are cleared */
+	pending = source_value & irq->leaf_mask;
+	while (pending) {
+		bit = __ffs64(pending);
+		pending &= pending - 1;
+
+		leaf = irq->leaves[bit];
+		ret = lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid,
+						       leaf->irq_src_reg, &leaf->source_value,
+						       irq->irq_reg_access_size);
+		if (ret) {
+			dev_err(irq->lwis_dev->dev,
+				"%s: Failed to read IRQ leaf %d status register: %d\n", irq->name,
+				bit, ret);
+			leaf->source_value = 0;
+			continue;
+		}
+		ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid,
+							leaf->irq_reset_reg, leaf->source_value,
+							irq->irq_reg_access_size);
+		if (ret) {
+			dev_err(irq->lwis_dev->dev,
+				"%s: Failed to write IRQ leaf %d reset register: %d\n", irq->name,
+				bit, ret);
+		}
+	}
 
 	/* Write back to the reset register */
 	ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid, irq->irq_reset_reg,
@@ -173,30 +239,35 @@ static irqreturn_t lwis_interrupt_event_isr(int irq_number, void *data)
 	}
 
 	spin_lock_irqsave(&irq->lock, flags);
-	list_for_each (p, &irq->enabled_event_infos) {
-		event = list_entry(p, struct lwis_single_event_info, node_enabled);
-
-		/* Check if this event needs to be emitted */
-		if ((source_value >> event->int_reg_bit) & 0x1) {
-			/* Emit the event */
-			lwis_device_event_emit(irq->lwis_dev, event->event_id, NULL, 0,
-					       /*in_irq=*/true);
-			/* Clear this interrupt */
-			reset_value |= (1ULL << event->int_reg_bit);
-
-			/* If considered critical, print the event */
-			if (event->is_critical) {
-				dev_err_ratelimited(irq->lwis_dev->dev,
-						    "Caught critical IRQ(%s) event(0x%llx)\n",
-						    irq->name, event->event_id);
-			}
-		}
+	/* Only visit the bits that fired and have enabled events */
+	pending = source_value & irq->enabled_mask;
+	while (pending) {
+		bit = __ffs64(pending);
+		pending &= pending - 1;
+
+		queue_bit_events_locked(irq, irq->enabled_event_infos[bit], &num_events);
+		/* Clear this interrupt */
+		reset_value |= (1ULL << bit);
+	}
 
-		/* All enabled and triggered interrupts are handled */
-		if (source_value == reset_value) {
-			break;
+	/* Same for the leaves that were pending */
+	pending = source_value & irq->leaf_mask;
+	while (pending) {
+		bit = __ffs64(pending);
+		pending &= pending - 1;
+
+		leaf = irq->leaves[bit];
+		leaf_pending = leaf->source_value & leaf->enabled_mask;
+		while (leaf_pending) {
+			leaf_bit = __ffs64(leaf_pending);
+			leaf_pending &= leaf_pending - 1;
+
+			queue_bit_events_locked(irq, leaf->enabled_event_infos[leaf_bit],
+						&num_events);
 		}
+		reset_value |= (1ULL << bit);
 	}
+	lwis_device_event_emit_batch(irq->lwis_dev, irq->emit_batch, num_events, /*in_irq=*/true);
 	spin_unlock_irqrestore(&irq->lock, flags);
 
 #ifdef LWIS_INTERRUPT_DEBUG
@@ -225,33 +296,18 @@ error:
 	return IRQ_HANDLED;
 }
 
-int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
-				  const char *irq_reg_space, int irq_reg_bid, int64_t *irq_events,
-				  size_t irq_events_num, uint32_t *int_reg_bits,
-				  size_t int_reg_bits_num, int64_t irq_src_reg,
-				  int64_t irq_reset_reg, int64_t irq_mask_reg, bool mask_toggled,
-				  int irq_reg_access_size, int64_t *critical_events,
-				  size_t critical_events_num)
+/*
+ * add_event_infos: Builds the infos of the events that the interrupt at index
+ * can emit, from the bits of the top level or the leaf status register.
+ */
+static int add_event_infos(struct lwis_interrupt_list *list, int index,
+			   struct lwis_interrupt_leaf *leaf, int64_t *irq_events,
+			   size_t irq_events_num, uint32_t *int_reg_bits,
+			   int64_t *critical_events, size_t critical_events_num)
 {
 	int i, j;
 	unsigned long flags;
 	bool is_critical = false;
-	BUG_ON(int_reg_bits_num != irq_events_num);
-
-	/* Protect the structure */
-	spin_lock_irqsave(&list->irq[index].lock, flags);
-	/* Set the fields */
-	list->irq[index].irq_reg_bid = irq_reg_bid;
-	list->irq[index].irq_src_reg = irq_src_reg;
-	list->irq[index].irq_reset_reg = irq_reset_reg;
-	list->irq[index].irq_mask_reg = irq_mask_reg;
-	list->irq[index].mask_toggled = mask_toggled;
-	list->irq[index].irq_reg_access_size = irq_reg_access_size;
-	/* Empty hash table for event infos */
-	hash_init(list->irq[index].event_infos);
-	/* Initialize an empty list for enabled events */
-	INIT_LIST_HEAD(&list->irq[index].enabled_event_infos);
-	spin_unlock_irqrestore(&list->irq[index].lock, flags);
 
 	/* Build the hash table of events we can emit */
 	for (i = 0; i < irq_events_num; i++) {
@@ -270,14 +326,26 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 			}
 		}
 
+		if (int_reg_bits[i] >= IRQ_MAX_REG_BITS) {
+			pr_err("Invalid int_reg_bit: %u for IRQ: %s\n", int_reg_bits[i],
+			       list->irq[index].name);
+			kfree(new_event);
+			return -EINVAL;
+		}
+
 		/* Fill the device id info in event id bit[47..32] */
 		irq_events[i] |= (int64_t)(list->lwis_dev->id & 0xFFFF) << 32;
-		/* Grab the device state outside of the spinlock */
-		new_event->state =
-			lwis_device_event_state_find_or_create(list->lwis_dev, irq_events[i]);
+		/* Grab the device state outside of the spinlock, pinned so that
+		 * the ISR can emit without looking it up */
+		new_event->state = lwis_device_event_state_pin(list->lwis_dev, irq_events[i]);
+		if (IS_ERR_OR_NULL(new_event->state)) {
+			kfree(new_event);
+			return -ENOMEM;
+		}
 		new_event->event_id = irq_events[i];
 		new_event->int_reg_bit = int_reg_bits[i];
 		new_event->is_critical = is_critical;
+		new_event->leaf = leaf;
 
 		spin_lock_irqsave(&list->irq[index].lock, flags);
 		/* Check for duplicate events */
@@ -286,6 +354,7 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 			spin_unlock_irqrestore(&list->irq[index].lock, flags);
 			pr_err("Duplicate event_id: %lld for IRQ: %s\n", new_event->event_id,
 			       list->irq[index].name);
+			kfree(new_event);
 			return -EINVAL;
 		}
 		/* Let's add the new state object */
@@ -293,6 +362,45 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 
 		spin_unlock_irqrestore(&list->irq[index].lock, flags);
 	}
+
+	return 0;
+}
+
+int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
+				  const char *irq_reg_space, int irq_reg_bid, int64_t *irq_events,
+				  size_t irq_events_num, uint32_t *int_reg_bits,
+				  size_t int_reg_bits_num, int64_t irq_src_reg,
+				  int64_t irq_reset_reg, int64_t irq_mask_reg, bool mask_toggled,
+				  int irq_reg_access_size, int64_t *critical_events,
+				  size_t critical_events_num)
+{
+	int ret;
+	unsigned long flags;
+	BUG_ON(int_reg_bits_num != irq_events_num);
+
+	/* Protect the structure */
+	spin_lock_irqsave(&list->irq[index].lock, flags);
+	/* Set the fields */
+	list->irq[index].irq_reg_bid = irq_reg_bid;
+	list->irq[index].irq_src_reg = irq_src_reg;
+	list->irq[index].irq_reset_reg = irq_reset_reg;
+	list->irq[index].irq_mask_reg = irq_mask_reg;
+	list->irq[index].mask_toggled = mask_toggled;
+	list->irq[index].irq_reg_access_size = irq_reg_access_size;
+	/* Empty hash table for event infos */
+	hash_init(list->irq[index].event_infos);
+	/* No events are enabled yet */
+	list->irq[index].enabled_mask = 0;
+	memset(list->irq[index].enabled_event_infos, 0,
+	       sizeof(list->irq[index].enabled_event_infos));
+	spin_unlock_irqrestore(&list->irq[index].lock, flags);
+
+	ret = add_event_infos(list, index, /*leaf=*/NULL, irq_events, irq_events_num,
+			      int_reg_bits, critical_events, critical_events_num);
+	if (ret) {
+		return ret;
+	}
+
 	/* It might make more sense to make has_events atomic_t instead of
 	 * locking a spinlock to write a boolean, but then we might have to deal
 	 * with barriers, etc. */
@@ -304,14 +412,55 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 	return 0;
 }
 
-static int lwis_interrupt_set_mask(struct lwis_interrupt *irq, int int_reg_bit, bool is_set)
+int lwis_interrupt_add_leaf(struct lwis_interrupt_list *list, int index, int aggregator_bit,
+			    int64_t *irq_events, size_t irq_events_num, uint32_t *int_reg_bits,
+			    size_t int_reg_bits_num, int64_t irq_src_reg, int64_t irq_reset_reg,
+			    int64_t irq_mask_reg, int64_t *critical_events,
+			    size_t critical_events_num)
+{
+	struct lwis_interrupt *irq = &list->irq[index];
+	struct lwis_interrupt_leaf *leaf;
+	unsigned long flags;
+	BUG_ON(int_reg_bits_num != irq_events_num);
+
+	if (aggregator_bit < 0 || aggregator_bit >= IRQ_MAX_REG_BITS) {
+		pr_err("Invalid aggregator bit: %d for IRQ: %s\n", aggregator_bit, irq->name);
+		return -EINVAL;
+	}
+
+	leaf = kzalloc(sizeof(struct lwis_interrupt_leaf), GFP_KERNEL);
+	if (!leaf) {
+		return -ENOMEM;
+	}
+	leaf->aggregator_bit = aggregator_bit;
+	leaf->irq_src_reg = irq_src_reg;
+	leaf->irq_reset_reg = irq_reset_reg;
+	leaf->irq_mask_reg = irq_mask_reg;
+
+	spin_lock_irqsave(&irq->lock, flags);
+	if (irq->leaves[aggregator_bit]) {
+		spin_unlock_irqrestore(&irq->lock, flags);
+		pr_err("Duplicate aggregator bit: %d for IRQ: %s\n", aggregator_bit, irq->name);
+		kfree(leaf);
+		return -EINVAL;
+	}
+	irq->leaves[aggregator_bit] = leaf;
+	irq->leaf_mask |= (1ULL << aggregator_bit);
+	spin_unlock_irqrestore(&irq->lock, flags);
+
+	return add_event_infos(list, index, leaf, irq_events, irq_events_num, int_reg_bits,
+			       critical_events, critical_events_num);
+}
+
+static int lwis_interrupt_set_mask(struct lwis_interrupt *irq, int64_t irq_mask_reg,
+				   int int_reg_bit, bool is_set)
 {
 	int ret = 0;
 	uint64_t mask_value = 0;
 	BUG_ON(!irq);
 
 	/* Read the mask register */
-	ret = lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid, irq->irq_mask_reg,
+	ret = lwis_device_single_register_read(irq->lwis_dev, irq->irq_reg_bid, irq_mask_reg,
 					       &mask_value, irq->irq_reg_access_size);
 	if (ret) {
 		pr_err("Failed to read IRQ mask register: %d\n", ret);
@@ -327,7 +476,7 @@ static int lwis_interrupt_set_mask(struct lwis_interrupt *irq, int int_reg_bit,
 	}
 
 	/* Write the mask register */
-	ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid, irq->irq_mask_reg,
+	ret = lwis_device_single_register_write(irq->lwis_dev, irq->irq_reg_bid, irq_mask_reg,
 						mask_value, irq->irq_reg_access_size);
 	if (ret) {
 		pr_err("Failed to write IRQ mask register: %d\n", ret);
@@ -341,19 +490,55 @@ static int lwis_interrupt_single_event_enable_locked(struct lwis_interrupt *irq,
 						     bool enabled)
 {
 	int ret = 0;
-	bool is_set;
+	bool is_set, leaf_was_enabled;
+	struct lwis_interrupt_leaf *leaf;
+	struct lwis_single_event_info **enabled_event_infos, **it;
+	uint64_t *enabled_mask;
+	int64_t irq_mask_reg;
 	BUG_ON(!irq);
 	BUG_ON(!event);
 
+	leaf = event->leaf;
+	if (leaf) {
+		enabled_event_infos = leaf->enabled_event_infos;
+		enabled_mask = &leaf->enabled_mask;
+		irq_mask_reg = leaf->irq_mask_reg;
+	} else {
+		enabled_event_infos = irq->enabled_event_infos;
+		enabled_mask = &irq->enabled_mask;
+		irq_mask_reg = irq->irq_mask_reg;
+	}
+	leaf_was_enabled = (*enabled_mask != 0);
+
 	if (enabled) {
-		list_add_tail(&event->node_enabled, &irq->enabled_event_infos);
+		event->next_enabled = enabled_event_infos[event->int_reg_bit];
+		enabled_event_infos[event->int_reg_bit] = event;
 	} else {
-		list_del(&event->node_enabled);
+		for (it = &enabled_event_infos[event->int_reg_bit]; *it; it = &(*it)->next_enabled) {
+			if (*it == event) {
+				*it = event->next_enabled;
+				break;
+			}
+		}
+		event->next_enabled = NULL;
+	}
+	if (enabled_event_infos[event->int_reg_bit]) {
+		*enabled_mask |= (1ULL << event->int_reg_bit);
+	} else {
+		*enabled_mask &= ~(1ULL << event->int_reg_bit);
 	}
 
 	/* If mask_toggled is set, reverse the enable/disable logic. */
 	is_set = (!irq->mask_toggled) ? enabled : !enabled;
-	ret = lwis_interrupt_set_mask(irq, event->int_reg_bit, is_set);
+	ret = lwis_interrupt_set_mask(irq, irq_mask_reg, event->int_reg_bit, is_set);
+	if (ret || !leaf || leaf_was_enabled == (*enabled_mask != 0)) {
+		return ret;
+	}
+
+	/* The aggregator bit of a leaf is unmasked while any of the leaf
+	 * events is enabled */
+	is_set = (!irq->mask_toggled) ? (*enabled_mask != 0) : (*enabled_mask == 0);
+	ret = lwis_interrupt_set_mask(irq, irq->irq_mask_reg, leaf->aggregator_bit, is_set);
 
 	return ret;
 }
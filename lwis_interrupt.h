@@ -16,8 +16,37 @@
 #include <linux/list.h>
 #include <linux/platform_device.h>
 
+#include "lwis_event.h"
+
 #define EVENT_INFO_HASH_BITS 8
 #define IRQ_FULL_NAME_LENGTH 32
+/* Status/reset/mask registers are accessed as up to 64-bit values */
+#define IRQ_MAX_REG_BITS 64
+
+struct lwis_single_event_info;
+
+/*
+ *  struct lwis_interrupt_leaf
+ *  Status/reset/mask registers of a sub-block, which are only pending when
+ *  their bit in the aggregator status register of the interrupt is set
+ */
+struct lwis_interrupt_leaf {
+	/* Bit of this leaf in the aggregator status/mask registers */
+	int aggregator_bit;
+	/* Offsets of the leaf registers, in the register space of the
+	 * interrupt */
+	int64_t irq_src_reg;
+	int64_t irq_reset_reg;
+	int64_t irq_mask_reg;
+	/* Status read by the ISR */
+	uint64_t source_value;
+	/* Bitmask of the status bits that have enabled events */
+	/* GUARDED_BY(lwis_interrupt->lock) */
+	uint64_t enabled_mask;
+	/* Enabled events of each status bit */
+	/* GUARDED_BY(lwis_interrupt->lock) */
+	struct lwis_single_event_info *enabled_event_infos[IRQ_MAX_REG_BITS];
+};
 
 struct lwis_interrupt {
 	int irq;
@@ -48,9 +77,22 @@ struct lwis_interrupt {
 	/* Hash table of event info */
 	/* GUARDED_BY(lock) */
 	DECLARE_HASHTABLE(event_infos, EVENT_INFO_HASH_BITS);
-	/* List of enabled events */
+	/* Bitmask of the status bits that have enabled events */
+	/* GUARDED_BY(lock) */
+	uint64_t enabled_mask;
+	/* Enabled events of each status bit, so the ISR only visits the bits
+	 * that fired */
 	/* GUARDED_BY(lock) */
-	struct list_head enabled_event_infos;
+	struct lwis_single_event_info *enabled_event_infos[IRQ_MAX_REG_BITS];
+	/* Leaves aggregated by the source register, indexed by their bit */
+	struct lwis_interrupt_leaf *leaves[IRQ_MAX_REG_BITS];
+	uint64_t leaf_mask;
+	/* Events fired by one interrupt, emitted together */
+	/* GUARDED_BY(lock) */
+	struct lwis_event_batch_entry emit_batch[IRQ_MAX_REG_BITS];
+	/* Number of times the interrupt was handled, only written by the ISR,
+	 * which does not run concurrently with itself */
+	u64 count;
 };
 
 /*
@@ -99,6 +141,21 @@ int lwis_interrupt_set_event_info(struct lwis_interrupt_list *list, int index,
 				  int irq_reg_access_size, int64_t *critical_events,
 				  size_t critical_events_num);
 
+/*
+ * lwis_interrupt_add_leaf: Adds a leaf status register to the interrupt at
+ * index, read and cleared by the ISR only when aggregator_bit is set in the
+ * interrupt source register. Must be called after
+ * lwis_interrupt_set_event_info.
+ *
+ * Does not take ownership of irq_events and int_reg_bits
+ * Returns: 0 on success
+ */
+int lwis_interrupt_add_leaf(struct lwis_interrupt_list *list, int index, int aggregator_bit,
+			    int64_t *irq_events, size_t irq_events_num, uint32_t *int_reg_bits,
+			    size_t int_reg_bits_num, int64_t irq_src_reg, int64_t irq_reset_reg,
+			    int64_t irq_mask_reg, int64_t *critical_events,
+			    size_t critical_events_num);
+
 /*
  * lwis_interrupt_event_enable: Handles masking and unmasking interrupts when
  * an event is enabled or disabled
@@ -12,6 +12,8 @@
 
 #include "lwis_ioctl.h"
 
+#include <linux/eventfd.h>
+#include <linux/file.h>
 #include <linux/kernel.h>
 #include <linux/mm.h>
 #include <linux/slab.h>
@@ -23,6 +25,7 @@
 #include "lwis_device_dpm.h"
 #include "lwis_device_i2c.h"
 #include "lwis_device_ioreg.h"
+#include "lwis_device_slc.h"
 #include "lwis_event.h"
 #include "lwis_i2c.h"
 #include "lwis_ioreg.h"
@@ -30,12 +33,24 @@
 #include "lwis_platform.h"
 #include "lwis_regulator.h"
 #include "lwis_transaction.h"
+#include "lwis_uploaded_io.h"
 #include "lwis_util.h"
 
 #define IOCTL_TO_ENUM(x) _IOC_NR(x)
 #define IOCTL_ARG_SIZE(x) _IOC_SIZE(x)
 #define STRINGIFY(x) #x
 
+/* Maximum number of events returned by one LWIS_EVENT_DEQUEUE_BATCH */
+#define EVENT_DEQUEUE_BATCH_MAX_EVENTS 256
+/* Maximum number of transactions submitted by one LWIS_TRANSACTION_SUBMIT_BATCH,
+ * all queued with interrupts disabled */
+#define TRANSACTION_SUBMIT_BATCH_MAX 64
+#define DEVICE_ENABLE_GROUP_MAX 64
+#define BUFFER_BATCH_MAX 256
+/* Maximum number of events bound by one LWIS_EVENT_EVENTFD_BIND, or filtered by
+ * one LWIS_EVENT_FILTER_SET */
+#define EVENT_BATCH_MAX 256
+
 void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_type, int errno)
 {
 	unsigned int type = IOCTL_TO_ENUM(ioctl_type);
@@ -55,6 +70,18 @@ void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_type, in
 		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_FREE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_FREE);
 		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_POOL_PREWARM):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_POOL_PREWARM), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_POOL_PREWARM);
+		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_SYNC):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_SYNC), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_SYNC);
+		break;
+	case IOCTL_TO_ENUM(LWIS_SLC_PARTITION_QUERY):
+		strlcpy(type_name, STRINGIFY(LWIS_SLC_PARTITION_QUERY), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_SLC_PARTITION_QUERY);
+		break;
 	case IOCTL_TO_ENUM(LWIS_BUFFER_ENROLL):
 		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_ENROLL), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_ENROLL);
@@ -63,10 +90,26 @@ void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_type, in
 		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_DISENROLL), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_DISENROLL);
 		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_ENROLL_CACHE):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_ENROLL_CACHE), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_ENROLL_CACHE);
+		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_ENROLL_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_ENROLL_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_ENROLL_BATCH);
+		break;
+	case IOCTL_TO_ENUM(LWIS_BUFFER_DISENROLL_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_BUFFER_DISENROLL_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_BUFFER_DISENROLL_BATCH);
+		break;
 	case IOCTL_TO_ENUM(LWIS_REG_IO):
 		strlcpy(type_name, STRINGIFY(LWIS_REG_IO), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_REG_IO);
 		break;
+	case IOCTL_TO_ENUM(LWIS_REG_IO_V1):
+		strlcpy(type_name, STRINGIFY(LWIS_REG_IO_V1), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_REG_IO_V1);
+		break;
 	case IOCTL_TO_ENUM(LWIS_DEVICE_ENABLE):
 		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_ENABLE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_ENABLE);
@@ -76,10 +119,26 @@ void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_type, in
 		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_DISABLE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_DISABLE);
 		break;
+	case IOCTL_TO_ENUM(LWIS_DEVICE_ENABLE_GROUP):
+		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_ENABLE_GROUP), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_ENABLE_GROUP);
+		break;
+	case IOCTL_TO_ENUM(LWIS_DEVICE_ENABLE_ASYNC):
+		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_ENABLE_ASYNC), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_ENABLE_ASYNC);
+		break;
+	case IOCTL_TO_ENUM(LWIS_DEVICE_POWER_DOWN_DELAY):
+		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_POWER_DOWN_DELAY), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_POWER_DOWN_DELAY);
+		break;
 	case IOCTL_TO_ENUM(LWIS_DEVICE_RESET):
 		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_RESET), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_RESET);
 		break;
+	case IOCTL_TO_ENUM(LWIS_DEVICE_RESET_V1):
+		strlcpy(type_name, STRINGIFY(LWIS_DEVICE_RESET_V1), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_DEVICE_RESET_V1);
+		break;
 	case IOCTL_TO_ENUM(LWIS_EVENT_CONTROL_GET):
 		strlcpy(type_name, STRINGIFY(LWIS_EVENT_CONTROL_GET), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_CONTROL_GET);
@@ -92,6 +151,26 @@ void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_type, in
 		strlcpy(type_name, STRINGIFY(LWIS_EVENT_DEQUEUE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_DEQUEUE);
 		break;
+	case IOCTL_TO_ENUM(LWIS_EVENT_DEQUEUE_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_EVENT_DEQUEUE_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_DEQUEUE_BATCH);
+		break;
+	case IOCTL_TO_ENUM(LWIS_EVENT_RING_SETUP):
+		strlcpy(type_name, STRINGIFY(LWIS_EVENT_RING_SETUP), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_RING_SETUP);
+		break;
+	case IOCTL_TO_ENUM(LWIS_EVENT_EVENTFD_BIND):
+		strlcpy(type_name, STRINGIFY(LWIS_EVENT_EVENTFD_BIND), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_EVENTFD_BIND);
+		break;
+	case IOCTL_TO_ENUM(LWIS_EVENT_FILTER_SET):
+		strlcpy(type_name, STRINGIFY(LWIS_EVENT_FILTER_SET), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_EVENT_FILTER_SET);
+		break;
+	case IOCTL_TO_ENUM(LWIS_PERIODIC_IO_RING_SETUP):
+		strlcpy(type_name, STRINGIFY(LWIS_PERIODIC_IO_RING_SETUP), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_PERIODIC_IO_RING_SETUP);
+		break;
 	case IOCTL_TO_ENUM(LWIS_TIME_QUERY):
 		strlcpy(type_name, STRINGIFY(LWIS_TIME_QUERY), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_TIME_QUERY);
@@ -108,6 +187,30 @@ void lwis_ioctl_pr_err(struct lwis_device *lwis_dev, unsigned int ioctl_type, in
 		strlcpy(type_name, STRINGIFY(LWIS_TRANSACTION_REPLACE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_TRANSACTION_REPLACE);
 		break;
+	case IOCTL_TO_ENUM(LWIS_TRANSACTION_SUBMIT_V1):
+		strlcpy(type_name, STRINGIFY(LWIS_TRANSACTION_SUBMIT_V1), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_TRANSACTION_SUBMIT_V1);
+		break;
+	case IOCTL_TO_ENUM(LWIS_TRANSACTION_REPLACE_V1):
+		strlcpy(type_name, STRINGIFY(LWIS_TRANSACTION_REPLACE_V1), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_TRANSACTION_REPLACE_V1);
+		break;
+	case IOCTL_TO_ENUM(LWIS_TRANSACTION_SUBMIT_BATCH):
+		strlcpy(type_name, STRINGIFY(LWIS_TRANSACTION_SUBMIT_BATCH), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_TRANSACTION_SUBMIT_BATCH);
+		break;
+	case IOCTL_TO_ENUM(LWIS_TRANSACTION_GROUP_SUBMIT):
+		strlcpy(type_name, STRINGIFY(LWIS_TRANSACTION_GROUP_SUBMIT), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_TRANSACTION_GROUP_SUBMIT);
+		break;
+	case IOCTL_TO_ENUM(LWIS_IO_ENTRIES_UPLOAD):
+		strlcpy(type_name, STRINGIFY(LWIS_IO_ENTRIES_UPLOAD), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_IO_ENTRIES_UPLOAD);
+		break;
+	case IOCTL_TO_ENUM(LWIS_IO_ENTRIES_RELEASE):
+		strlcpy(type_name, STRINGIFY(LWIS_IO_ENTRIES_RELEASE), sizeof(type_name));
+		exp_size = IOCTL_ARG_SIZE(LWIS_IO_ENTRIES_RELEASE);
+		break;
 	case IOCTL_TO_ENUM(LWIS_DPM_CLK_UPDATE):
 		strlcpy(type_name, STRINGIFY(LWIS_DPM_CLK_UPDATE), sizeof(type_name));
 		exp_size = IOCTL_ARG_SIZE(LWIS_DPM_CLK_UPDATE);
@@ -168,7 +271,7 @@ static int ioctl_get_device_info(struct lwis_device *lwis_dev, struct lwis_devic
 }
 
 static int register_read(struct lwis_device *lwis_dev, struct lwis_io_entry *read_entry,
-			 struct lwis_io_entry *user_msg)
+			 void *user_msg, size_t user_entry_size)
 {
 	int ret = 0;
 	uint8_t *user_buf;
@@ -207,7 +310,8 @@ static int register_read(struct lwis_device *lwis_dev, struct lwis_io_entry *rea
 				"Failed to copy register read buffer back to userspace\n");
 		}
 	} else {
-		if (copy_to_user((void __user *)user_msg, read_entry, sizeof(*read_entry))) {
+		/* The first version entries share the layout of their types */
+		if (copy_to_user((void __user *)user_msg, read_entry, user_entry_size)) {
 			ret = -EFAULT;
 			dev_err_ratelimited(
 				lwis_dev->dev,
@@ -226,30 +330,29 @@ static int register_write(struct lwis_device *lwis_dev, struct lwis_io_entry *wr
 {
 	int ret = 0;
 	uint8_t *user_buf;
-	bool batch_mode = false;
+	uint8_t **buf;
+	size_t size_in_bytes;
 
-	if (write_entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
-		batch_mode = true;
+	buf = lwis_io_entry_write_buf(write_entry, &size_in_bytes);
+	if (buf) {
 		/* Save the userspace buffer address */
-		user_buf = write_entry->rw_batch.buf;
+		user_buf = *buf;
 		/* Allocate write buffer and copy contents from userspace */
-		write_entry->rw_batch.buf =
-			kvmalloc(write_entry->rw_batch.size_in_bytes, GFP_KERNEL);
-		if (!write_entry->rw_batch.buf) {
+		*buf = kvmalloc(size_in_bytes, GFP_KERNEL);
+		if (!*buf) {
 			dev_err_ratelimited(lwis_dev->dev,
 					    "Failed to allocate register write buffer\n");
 			return -ENOMEM;
 		}
 
-		if (copy_from_user(write_entry->rw_batch.buf, (void __user *)user_buf,
-				   write_entry->rw_batch.size_in_bytes)) {
+		if (copy_from_user(*buf, (void __user *)user_buf, size_in_bytes)) {
 			ret = -EFAULT;
 			dev_err_ratelimited(lwis_dev->dev,
 					    "Failed to copy write buffer from userspace\n");
 			goto reg_write_exit;
 		}
 	} else if (write_entry->type != LWIS_IO_ENTRY_WRITE) {
-		/* Type must be either WRITE or WRITE_BATCH */
+		/* Type must be either WRITE, WRITE_BATCH or WRITE_SCATTER */
 		dev_err(lwis_dev->dev, "Invalid io_entry type for REGISTER_WRITE\n");
 		return -EINVAL;
 	}
@@ -260,8 +363,8 @@ static int register_write(struct lwis_device *lwis_dev, struct lwis_io_entry *wr
 	}
 
 reg_write_exit:
-	if (batch_mode) {
-		kvfree(write_entry->rw_batch.buf);
+	if (buf) {
+		kvfree(*buf);
 	}
 	return ret;
 }
@@ -278,11 +381,50 @@ static int register_modify(struct lwis_device *lwis_dev, struct lwis_io_entry *m
 	return ret;
 }
 
+/*
+ * Copies num_io_entries io entries from userspace, laid out as struct
+ * lwis_io_entry_v1 if v1 is set.
+ */
+static int io_entries_copy_from_user(struct lwis_device *lwis_dev, struct lwis_io_entry *k_entries,
+				     void *user_entries, size_t num_io_entries, bool v1)
+{
+	size_t i;
+	struct lwis_io_entry_v1 entry_v1;
+	struct lwis_io_entry_v1 *user_entries_v1 = user_entries;
+
+	if (!v1) {
+		if (copy_from_user((void *)k_entries, (void __user *)user_entries,
+				   num_io_entries * sizeof(struct lwis_io_entry))) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+
+	BUILD_BUG_ON(offsetof(struct lwis_io_entry_v1, rw) != offsetof(struct lwis_io_entry, rw));
+	for (i = 0; i < num_io_entries; ++i) {
+		if (copy_from_user((void *)&entry_v1, (void __user *)&user_entries_v1[i],
+				   sizeof(entry_v1))) {
+			return -EFAULT;
+		}
+		if (entry_v1.type > LWIS_IO_ENTRY_READ_ASSERT) {
+			dev_err(lwis_dev->dev, "Invalid io_entry type for the first version: %d\n",
+				entry_v1.type);
+			return -EINVAL;
+		}
+		memset(&k_entries[i], 0, sizeof(k_entries[i]));
+		k_entries[i].type = entry_v1.type;
+		memcpy(&k_entries[i].rw, &entry_v1.rw,
+		       sizeof(entry_v1) - offsetof(struct lwis_io_entry_v1, rw));
+	}
+	return 0;
+}
+
 static int copy_io_entries(struct lwis_device *lwis_dev, struct lwis_io_entries *user_msg,
-			   struct lwis_io_entries *k_msg, struct lwis_io_entry **k_entries)
+			   bool v1, struct lwis_io_entries *k_msg, struct lwis_io_entry **k_entries)
 {
 	int ret = 0;
 	struct lwis_io_entry *io_entries;
+	struct lwis_io_entries_v1 k_msg_v1;
 	uint32_t buf_size;
 
 	/* Register io is not supported for the lwis device, return */
@@ -292,19 +434,32 @@ static int copy_io_entries(struct lwis_device *lwis_dev, struct lwis_io_entries
 	}
 
 	/* Copy io_entries from userspace */
-	if (copy_from_user(k_msg, (void __user *)user_msg, sizeof(*k_msg))) {
+	if (v1) {
+		if (copy_from_user(&k_msg_v1, (void __user *)user_msg, sizeof(k_msg_v1))) {
+			dev_err(lwis_dev->dev, "Failed to copy io_entries header from userspace.");
+			return -EFAULT;
+		}
+		k_msg->num_io_entries = k_msg_v1.num_io_entries;
+		k_msg->flags = 0;
+		k_msg->io_entries = (struct lwis_io_entry *)k_msg_v1.io_entries;
+	} else if (copy_from_user(k_msg, (void __user *)user_msg, sizeof(*k_msg))) {
 		ret = -EFAULT;
 		dev_err(lwis_dev->dev, "Failed to copy io_entries header from userspace.");
 		return ret;
 	}
+	if (k_msg->flags & ~LWIS_IO_ENTRIES_FLAG_SKIP_UNCHANGED_WRITES) {
+		dev_err(lwis_dev->dev, "Invalid io_entries flags 0x%x\n", k_msg->flags);
+		return -EINVAL;
+	}
 	buf_size = sizeof(struct lwis_io_entry) * k_msg->num_io_entries;
 	io_entries = kvmalloc(buf_size, GFP_KERNEL);
 	if (!io_entries) {
 		dev_err(lwis_dev->dev, "Failed to allocate io_entries buffer\n");
 		return -ENOMEM;
 	}
-	if (copy_from_user(io_entries, (void __user *)k_msg->io_entries, buf_size)) {
-		ret = -EFAULT;
+	ret = io_entries_copy_from_user(lwis_dev, io_entries, k_msg->io_entries,
+					k_msg->num_io_entries, v1);
+	if (ret) {
 		kvfree(io_entries);
 		dev_err(lwis_dev->dev, "Failed to copy io_entries from userspace.");
 		return ret;
@@ -315,10 +470,11 @@ static int copy_io_entries(struct lwis_device *lwis_dev, struct lwis_io_entries
 }
 
 static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_io_entries,
-					  struct lwis_io_entry *io_entries,
-					  struct lwis_io_entry *user_msg)
+					  struct lwis_io_entry *io_entries, void *user_msg,
+					  size_t user_entry_size, uint32_t flags)
 {
 	int ret = 0, i = 0;
+	unsigned long locked;
 
 	/* Use write memory barrier at the beginning of I/O entries if the access protocol
 	 * allows it */
@@ -327,7 +483,8 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 						   /*use_read_barrier=*/false,
 						   /*use_write_barrier=*/true);
 	}
-	mutex_lock(&lwis_dev->reg_rw_lock);
+	locked = lwis_device_register_lock(lwis_dev, io_entries, num_io_entries,
+					   flags & LWIS_IO_ENTRIES_FLAG_SKIP_UNCHANGED_WRITES);
 	for (i = 0; i < num_io_entries; i++) {
 		switch (io_entries[i].type) {
 		case LWIS_IO_ENTRY_MODIFY:
@@ -335,13 +492,29 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 			break;
 		case LWIS_IO_ENTRY_READ:
 		case LWIS_IO_ENTRY_READ_BATCH:
-			ret = register_read(lwis_dev, &io_entries[i], user_msg + i);
+			ret = register_read(lwis_dev, &io_entries[i],
+					    (uint8_t *)user_msg + i * user_entry_size,
+					    user_entry_size);
 			break;
 		case LWIS_IO_ENTRY_WRITE:
+			if (lwis_dev->vops.register_write_burst) {
+				ret = lwis_dev->vops.register_write_burst(lwis_dev, &io_entries[i],
+									  num_io_entries - i);
+				if (ret > 0) {
+					/* Skip over the entries written as part of the burst */
+					i += ret - 1;
+					ret = 0;
+				}
+				break;
+			}
+			ret = register_write(lwis_dev, &io_entries[i]);
+			break;
 		case LWIS_IO_ENTRY_WRITE_BATCH:
+		case LWIS_IO_ENTRY_WRITE_SCATTER:
 			ret = register_write(lwis_dev, &io_entries[i]);
 			break;
 		case LWIS_IO_ENTRY_POLL:
+		case LWIS_IO_ENTRY_POLL_US:
 			ret = lwis_entry_poll(lwis_dev, &io_entries[i], /*non_blocking=*/false);
 			break;
 		case LWIS_IO_ENTRY_READ_ASSERT:
@@ -357,7 +530,7 @@ static int synchronous_process_io_entries(struct lwis_device *lwis_dev, int num_
 		}
 	}
 exit:
-	mutex_unlock(&lwis_dev->reg_rw_lock);
+	lwis_device_register_unlock(lwis_dev, locked);
 	/* Use read memory barrier at the end of I/O entries if the access protocol
 	 * allows it */
 	if (lwis_dev->vops.register_io_barrier != NULL) {
@@ -368,20 +541,21 @@ exit:
 	return ret;
 }
 
-static int ioctl_reg_io(struct lwis_device *lwis_dev, struct lwis_io_entries *user_msg)
+static int ioctl_reg_io(struct lwis_device *lwis_dev, struct lwis_io_entries *user_msg, bool v1)
 {
 	int ret = 0;
 	struct lwis_io_entries k_msg;
 	struct lwis_io_entry *k_entries = NULL;
 
-	ret = copy_io_entries(lwis_dev, user_msg, &k_msg, &k_entries);
+	ret = copy_io_entries(lwis_dev, user_msg, v1, &k_msg, &k_entries);
 	if (ret) {
 		goto reg_io_exit;
 	}
 
 	/* Walk through and execute the entries */
-	ret = synchronous_process_io_entries(lwis_dev, k_msg.num_io_entries, k_entries,
-					     k_msg.io_entries);
+	ret = synchronous_process_io_entries(
+		lwis_dev, k_msg.num_io_entries, k_entries, k_msg.io_entries,
+		v1 ? sizeof(struct lwis_io_entry_v1) : sizeof(struct lwis_io_entry), k_msg.flags);
 
 reg_io_exit:
 	if (k_entries) {
@@ -459,6 +633,116 @@ static int ioctl_buffer_free(struct lwis_client *lwis_client, int __user *msg)
 	return 0;
 }
 
+static int ioctl_buffer_pool_prewarm(struct lwis_device *lwis_dev,
+				     struct lwis_buffer_pool_prewarm __user *msg)
+{
+	struct lwis_buffer_pool_prewarm k_msg;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(k_msg));
+		return -EFAULT;
+	}
+
+	return lwis_buffer_pool_prewarm(lwis_dev, k_msg.size, k_msg.flags, k_msg.count);
+}
+
+static int ioctl_buffer_sync(struct lwis_client *lwis_client, struct lwis_buffer_sync __user *msg)
+{
+	int ret = 0;
+	size_t i;
+	struct lwis_buffer_sync k_msg;
+	struct lwis_buffer_sync_range *k_ranges;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(k_msg));
+		return -EFAULT;
+	}
+
+	if (k_msg.num_ranges == 0 || k_msg.num_ranges > BUFFER_BATCH_MAX || k_msg.ranges == NULL) {
+		dev_err(lwis_dev->dev, "Invalid sync of %zu ranges\n", k_msg.num_ranges);
+		return -EINVAL;
+	}
+
+	k_ranges = kmalloc_array(k_msg.num_ranges, sizeof(struct lwis_buffer_sync_range),
+				 GFP_KERNEL);
+	if (!k_ranges) {
+		dev_err(lwis_dev->dev, "Failed to allocate sync ranges\n");
+		return -ENOMEM;
+	}
+
+	if (copy_from_user((void *)k_ranges, (void __user *)k_msg.ranges,
+			   k_msg.num_ranges * sizeof(struct lwis_buffer_sync_range))) {
+		dev_err(lwis_dev->dev, "Failed to copy sync ranges from user\n");
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	for (i = 0; i < k_msg.num_ranges; ++i) {
+		ret = lwis_buffer_cpu_access(lwis_client, k_ranges[i].fd, k_ranges[i].flags,
+					     k_ranges[i].offset, k_ranges[i].length);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to sync range %zu of fd %d (%d)\n", i,
+				k_ranges[i].fd, ret);
+			break;
+		}
+	}
+
+	k_msg.num_synced = i;
+	if (copy_to_user((void __user *)&msg->num_synced, &k_msg.num_synced,
+			 sizeof(k_msg.num_synced))) {
+		dev_err(lwis_dev->dev, "Failed to copy sync results to user\n");
+		ret = -EFAULT;
+	}
+
+out_free:
+	kfree(k_ranges);
+	return ret;
+}
+
+static int ioctl_slc_partition_query(struct lwis_device *lwis_dev,
+				     struct lwis_slc_partition_query __user *msg)
+{
+	int ret = 0;
+	struct lwis_slc_partition_query k_msg;
+	struct lwis_slc_partition_info *k_infos;
+
+	if (lwis_dev->type != DEVICE_TYPE_SLC) {
+		dev_err(lwis_dev->dev, "not supported device type: %d\n", lwis_dev->type);
+		return -EINVAL;
+	}
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(k_msg));
+		return -EFAULT;
+	}
+
+	k_msg.max_partitions = min_t(size_t, k_msg.max_partitions, MAX_NUM_PT);
+	if (k_msg.max_partitions > 0 && !k_msg.partitions) {
+		dev_err(lwis_dev->dev, "Partition query without an output array\n");
+		return -EINVAL;
+	}
+
+	k_infos = kcalloc(MAX_NUM_PT, sizeof(struct lwis_slc_partition_info), GFP_KERNEL);
+	if (!k_infos) {
+		return -ENOMEM;
+	}
+
+	lwis_slc_partition_query(lwis_dev, k_infos, k_msg.max_partitions, &k_msg.num_partitions);
+
+	if (copy_to_user((void __user *)k_msg.partitions, k_infos,
+			 min(k_msg.max_partitions, k_msg.num_partitions) *
+				 sizeof(struct lwis_slc_partition_info)) ||
+	    copy_to_user((void __user *)&msg->num_partitions, &k_msg.num_partitions,
+			 sizeof(k_msg.num_partitions))) {
+		dev_err(lwis_dev->dev, "Failed to copy partition query to user\n");
+		ret = -EFAULT;
+	}
+
+	kfree(k_infos);
+	return ret;
+}
+
 static int ioctl_buffer_enroll(struct lwis_client *lwis_client, struct lwis_buffer_info __user *msg)
 {
 	unsigned long ret;
@@ -531,6 +815,170 @@ static int ioctl_buffer_disenroll(struct lwis_client *lwis_client,
 	return 0;
 }
 
+static int ioctl_buffer_enroll_batch(struct lwis_client *lwis_client,
+				     struct lwis_buffer_enroll_batch __user *msg)
+{
+	int ret = 0;
+	size_t i;
+	struct lwis_buffer_enroll_batch k_msg;
+	struct lwis_enrolled_buffer **buffers;
+	struct lwis_buffer_info *k_infos;
+	int32_t *k_errors;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(k_msg));
+		return -EFAULT;
+	}
+
+	if (k_msg.num_buffers == 0 || k_msg.num_buffers > BUFFER_BATCH_MAX ||
+	    k_msg.buffers == NULL) {
+		dev_err(lwis_dev->dev, "Invalid enroll batch of %zu buffers\n", k_msg.num_buffers);
+		return -EINVAL;
+	}
+
+	buffers = kcalloc(k_msg.num_buffers, sizeof(struct lwis_enrolled_buffer *), GFP_KERNEL);
+	k_infos = kmalloc_array(k_msg.num_buffers, sizeof(struct lwis_buffer_info), GFP_KERNEL);
+	k_errors = kmalloc_array(k_msg.num_buffers, sizeof(int32_t), GFP_KERNEL);
+	if (!buffers || !k_infos || !k_errors) {
+		dev_err(lwis_dev->dev, "Failed to allocate enroll batch\n");
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	if (copy_from_user((void *)k_infos, (void __user *)k_msg.buffers,
+			   k_msg.num_buffers * sizeof(struct lwis_buffer_info))) {
+		dev_err(lwis_dev->dev, "Failed to copy enroll batch from user\n");
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	k_msg.num_enrolled = 0;
+	for (i = 0; i < k_msg.num_buffers; ++i) {
+		buffers[i] = kmalloc(sizeof(struct lwis_enrolled_buffer), GFP_KERNEL);
+		if (!buffers[i]) {
+			k_errors[i] = -ENOMEM;
+			continue;
+		}
+		buffers[i]->info = k_infos[i];
+		k_errors[i] = lwis_buffer_enroll(lwis_client, buffers[i]);
+		if (k_errors[i]) {
+			kfree(buffers[i]);
+			buffers[i] = NULL;
+			continue;
+		}
+		k_infos[i] = buffers[i]->info;
+		k_msg.num_enrolled++;
+	}
+
+	if (copy_to_user((void __user *)k_msg.buffers, k_infos,
+			 k_msg.num_buffers * sizeof(struct lwis_buffer_info)) ||
+	    (k_msg.errors && copy_to_user((void __user *)k_msg.errors, k_errors,
+					  k_msg.num_buffers * sizeof(int32_t))) ||
+	    copy_to_user((void __user *)&msg->num_enrolled, &k_msg.num_enrolled,
+			 sizeof(k_msg.num_enrolled))) {
+		dev_err(lwis_dev->dev, "Failed to copy enroll batch results to user\n");
+		/* Userspace does not know the addresses, undo the whole batch */
+		for (i = 0; i < k_msg.num_buffers; ++i) {
+			if (buffers[i]) {
+				lwis_buffer_disenroll(lwis_client, buffers[i]);
+				kfree(buffers[i]);
+			}
+		}
+		ret = -EFAULT;
+	}
+
+out_free:
+	kfree(k_errors);
+	kfree(k_infos);
+	kfree(buffers);
+	return ret;
+}
+
+static int ioctl_buffer_disenroll_batch(struct lwis_client *lwis_client,
+					struct lwis_buffer_disenroll_batch __user *msg)
+{
+	int ret = 0;
+	size_t i;
+	struct lwis_buffer_disenroll_batch k_msg;
+	struct lwis_enrolled_buffer_info *k_infos;
+	struct lwis_enrolled_buffer *buffer;
+	int32_t *k_errors;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(k_msg));
+		return -EFAULT;
+	}
+
+	if (k_msg.num_buffers == 0 || k_msg.num_buffers > BUFFER_BATCH_MAX ||
+	    k_msg.buffers == NULL) {
+		dev_err(lwis_dev->dev, "Invalid disenroll batch of %zu buffers\n",
+			k_msg.num_buffers);
+		return -EINVAL;
+	}
+
+	k_infos = kmalloc_array(k_msg.num_buffers, sizeof(struct lwis_enrolled_buffer_info),
+				GFP_KERNEL);
+	k_errors = kmalloc_array(k_msg.num_buffers, sizeof(int32_t), GFP_KERNEL);
+	if (!k_infos || !k_errors) {
+		dev_err(lwis_dev->dev, "Failed to allocate disenroll batch\n");
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	if (copy_from_user((void *)k_infos, (void __user *)k_msg.buffers,
+			   k_msg.num_buffers * sizeof(struct lwis_enrolled_buffer_info))) {
+		dev_err(lwis_dev->dev, "Failed to copy disenroll batch from user\n");
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	k_msg.num_disenrolled = 0;
+	for (i = 0; i < k_msg.num_buffers; ++i) {
+		buffer = lwis_client_enrolled_buffer_find(lwis_client, k_infos[i].fd,
+							  k_infos[i].dma_vaddr);
+		if (!buffer) {
+			dev_err_ratelimited(lwis_dev->dev,
+					    "Failed to find dma buffer for fd %d vaddr %pad\n",
+					    k_infos[i].fd, &k_infos[i].dma_vaddr);
+			k_errors[i] = -ENOENT;
+			continue;
+		}
+		k_errors[i] = lwis_buffer_disenroll(lwis_client, buffer);
+		if (k_errors[i]) {
+			continue;
+		}
+		kfree(buffer);
+		k_msg.num_disenrolled++;
+	}
+
+	if ((k_msg.errors && copy_to_user((void __user *)k_msg.errors, k_errors,
+					  k_msg.num_buffers * sizeof(int32_t))) ||
+	    copy_to_user((void __user *)&msg->num_disenrolled, &k_msg.num_disenrolled,
+			 sizeof(k_msg.num_disenrolled))) {
+		dev_err(lwis_dev->dev, "Failed to copy disenroll batch results to user\n");
+		ret = -EFAULT;
+	}
+
+out_free:
+	kfree(k_errors);
+	kfree(k_infos);
+	return ret;
+}
+
+static int ioctl_buffer_enroll_cache(struct lwis_client *lwis_client, uint32_t __user *msg)
+{
+	uint32_t max_mappings;
+
+	if (copy_from_user((void *)&max_mappings, (void __user *)msg, sizeof(max_mappings))) {
+		dev_err(lwis_client->lwis_dev->dev, "Failed to copy buffer cache size from user\n");
+		return -EFAULT;
+	}
+
+	return lwis_client_buffer_cache_set(lwis_client, max_mappings);
+}
+
 static int ioctl_device_enable(struct lwis_client *lwis_client)
 {
 	int ret = 0;
@@ -555,6 +1003,14 @@ static int ioctl_device_enable(struct lwis_client *lwis_client)
 	 * previous session */
 	lwis_client_event_queue_clear(lwis_client);
 
+	if (lwis_dev_power_down_cancel_locked(lwis_dev)) {
+		lwis_dev->enabled++;
+		lwis_client->is_enabled = true;
+		mutex_unlock(&lwis_dev->client_lock);
+		dev_info(lwis_dev->dev, "Device enabled, power down canceled\n");
+		return 0;
+	}
+
 	ret = lwis_dev_power_up_locked(lwis_dev);
 	if (ret < 0) {
 		dev_err(lwis_dev->dev, "Failed to power up device\n");
@@ -569,11 +1025,162 @@ error_locked:
 	return ret;
 }
 
+void lwis_ioctl_device_enable_work(struct work_struct *work)
+{
+	struct lwis_client *lwis_client = container_of(work, struct lwis_client, enable_work);
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	int64_t event_id = LWIS_EVENT_ID_DEVICE_ENABLED | (int64_t)lwis_dev->id
+								  << LWIS_EVENT_ID_EVENT_CODE_LEN;
+	int32_t error;
+
+	/* Serialize with the ioctls of the client, a synchronous enable
+	 * included */
+	mutex_lock(&lwis_client->lock);
+	error = ioctl_device_enable(lwis_client);
+
+	mutex_lock(&lwis_dev->client_lock);
+	WRITE_ONCE(lwis_client->enable_pending, false);
+	mutex_unlock(&lwis_dev->client_lock);
+
+	/* Run the transactions submitted meanwhile, or cancel them with the
+	 * enable error */
+	lwis_transaction_client_resume(lwis_client, error);
+	mutex_unlock(&lwis_client->lock);
+
+	lwis_client_event_emit(lwis_client, event_id, &error, sizeof(error));
+}
+
+static int ioctl_device_enable_async(struct lwis_client *lwis_client)
+{
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	mutex_lock(&lwis_dev->client_lock);
+	if (lwis_client->enable_pending) {
+		mutex_unlock(&lwis_dev->client_lock);
+		return -EBUSY;
+	}
+	WRITE_ONCE(lwis_client->enable_pending, true);
+	mutex_unlock(&lwis_dev->client_lock);
+
+	queue_work(system_highpri_wq, &lwis_client->enable_work);
+	return 0;
+}
+
+static int ioctl_device_power_down_delay(struct lwis_client *lwis_client, uint32_t __user *msg)
+{
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	uint32_t delay_ms;
+
+	if (copy_from_user((void *)&delay_ms, (void __user *)msg, sizeof(delay_ms))) {
+		dev_err(lwis_dev->dev, "Failed to copy power down delay from user\n");
+		return -EFAULT;
+	}
+
+	mutex_lock(&lwis_dev->client_lock);
+	lwis_dev->power_down_delay_ms = delay_ms;
+	mutex_unlock(&lwis_dev->client_lock);
+	return 0;
+}
+
+static int ioctl_device_enable_group(struct lwis_client *lwis_client,
+				     struct lwis_device_enable_group __user *msg)
+{
+	int ret = 0;
+	int i;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	struct lwis_device_enable_group k_msg;
+	struct lwis_device_enable_group_entry *k_entries = NULL;
+	struct lwis_power_group_entry *group = NULL;
+	struct file **files = NULL;
+	int32_t *k_errors = NULL;
+
+	if (lwis_dev->type != DEVICE_TYPE_TOP) {
+		dev_err(lwis_dev->dev, "Group enable is only supported on the top device\n");
+		return -EINVAL;
+	}
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy enable group from user\n");
+		return -EFAULT;
+	}
+
+	if (k_msg.num_entries == 0 || k_msg.num_entries > DEVICE_ENABLE_GROUP_MAX) {
+		dev_err(lwis_dev->dev, "Invalid number of group entries %zu\n", k_msg.num_entries);
+		return -EINVAL;
+	}
+
+	k_entries = kmalloc_array(k_msg.num_entries, sizeof(*k_entries), GFP_KERNEL);
+	group = kcalloc(k_msg.num_entries, sizeof(*group), GFP_KERNEL);
+	files = kcalloc(k_msg.num_entries, sizeof(*files), GFP_KERNEL);
+	k_errors = kcalloc(k_msg.num_entries, sizeof(*k_errors), GFP_KERNEL);
+	if (!k_entries || !group || !files || !k_errors) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	if (copy_from_user((void *)k_entries, (void __user *)k_msg.entries,
+			   k_msg.num_entries * sizeof(*k_entries))) {
+		dev_err(lwis_dev->dev, "Failed to copy enable group entries from user\n");
+		ret = -EFAULT;
+		goto out_free;
+	}
+
+	for (i = 0; i < k_msg.num_entries; ++i) {
+		if (k_entries[i].depends_on < -1 || k_entries[i].depends_on >= i) {
+			dev_err(lwis_dev->dev, "Entry %d depends on invalid entry %d\n", i,
+				k_entries[i].depends_on);
+			ret = -EINVAL;
+			goto out_put;
+		}
+		files[i] = lwis_client_fget(k_entries[i].fd);
+		if (IS_ERR(files[i])) {
+			dev_err(lwis_dev->dev, "Entry %d fd %d is not a LWIS client\n", i,
+				k_entries[i].fd);
+			ret = PTR_ERR(files[i]);
+			files[i] = NULL;
+			goto out_put;
+		}
+		group[i].client = files[i]->private_data;
+		group[i].depends_on = k_entries[i].depends_on;
+	}
+
+	ret = lwis_dev_power_up_group(group, k_msg.num_entries);
+
+	for (i = 0; i < k_msg.num_entries; ++i) {
+		k_errors[i] = group[i].error;
+	}
+	if (k_msg.errors && copy_to_user((void __user *)k_msg.errors, k_errors,
+					 k_msg.num_entries * sizeof(int32_t))) {
+		dev_err(lwis_dev->dev, "Failed to copy enable group results to userspace\n");
+		ret = -EFAULT;
+	}
+
+out_put:
+	for (i = 0; i < k_msg.num_entries; ++i) {
+		if (files[i]) {
+			fput(files[i]);
+		}
+	}
+out_free:
+	kfree(k_errors);
+	kfree(files);
+	kfree(group);
+	kfree(k_entries);
+	return ret;
+}
+
 static int ioctl_device_disable(struct lwis_client *lwis_client)
 {
 	int ret = 0;
+	unsigned long flags;
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
 
+	/* The asynchronous enable waits for the client lock held here, and
+	 * lwis_ioctl flushes it before disabling */
+	if (READ_ONCE(lwis_client->enable_pending)) {
+		return -EBUSY;
+	}
+
 	if (!lwis_client->is_enabled) {
 		return ret;
 	}
@@ -610,12 +1217,16 @@ static int ioctl_device_disable(struct lwis_client *lwis_client)
 		goto error_locked;
 	}
 
-	ret = lwis_dev_power_down_locked(lwis_dev);
+	/* Deferred, so that enabling the device again within
+	 * power_down_delay_ms skips both power sequences */
+	ret = lwis_dev_power_down_deferred_locked(lwis_dev);
 	if (ret < 0) {
 		dev_err(lwis_dev->dev, "Failed to power down device\n");
 		goto error_locked;
 	}
+	spin_lock_irqsave(&lwis_dev->lock, flags);
 	lwis_device_event_states_clear_locked(lwis_dev);
+	spin_unlock_irqrestore(&lwis_dev->lock, flags);
 
 	lwis_dev->enabled--;
 	lwis_client->is_enabled = false;
@@ -657,7 +1268,8 @@ static int ioctl_echo(struct lwis_device *lwis_dev, struct lwis_echo __user *msg
 	return 0;
 }
 
-static int ioctl_device_reset(struct lwis_client *lwis_client, struct lwis_io_entries *user_msg)
+static int ioctl_device_reset(struct lwis_client *lwis_client, struct lwis_io_entries *user_msg,
+			      bool v1)
 {
 	int ret = 0;
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
@@ -665,7 +1277,7 @@ static int ioctl_device_reset(struct lwis_client *lwis_client, struct lwis_io_en
 	struct lwis_io_entry *k_entries = NULL;
 	unsigned long flags;
 
-	ret = copy_io_entries(lwis_dev, user_msg, &k_msg, &k_entries);
+	ret = copy_io_entries(lwis_dev, user_msg, v1, &k_msg, &k_entries);
 	if (ret) {
 		goto soft_reset_exit;
 	}
@@ -688,9 +1300,15 @@ static int ioctl_device_reset(struct lwis_client *lwis_client, struct lwis_io_en
 		dev_err(lwis_dev->dev, "Failed to flush all pending transactions\n");
 	}
 
+	/* The reset leaves no shadowed register value valid */
+	if (lwis_dev->vops.register_cache_invalidate) {
+		lwis_dev->vops.register_cache_invalidate(lwis_dev);
+	}
+
 	/* Perform reset routine defined by the io_entries */
-	ret = synchronous_process_io_entries(lwis_dev, k_msg.num_io_entries, k_entries,
-					     k_msg.io_entries);
+	ret = synchronous_process_io_entries(
+		lwis_dev, k_msg.num_io_entries, k_entries, k_msg.io_entries,
+		v1 ? sizeof(struct lwis_io_entry_v1) : sizeof(struct lwis_io_entry), k_msg.flags);
 
 	spin_lock_irqsave(&lwis_dev->lock, flags);
 	lwis_device_event_states_clear_locked(lwis_dev);
@@ -772,20 +1390,132 @@ out:
 	return ret;
 }
 
-static int ioctl_event_dequeue(struct lwis_client *lwis_client, struct lwis_event_info __user *msg)
+static int ioctl_event_eventfd_bind(struct lwis_client *lwis_client,
+				    struct lwis_event_eventfd_binding __user *msg)
 {
-	unsigned long ret, err = 0;
-	struct lwis_event_entry *event;
-	struct lwis_event_info info_user;
+	struct lwis_event_eventfd_binding k_msg;
+	struct eventfd_ctx *eventfd = NULL;
 	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
-	bool is_error_event = false;
+	int64_t *k_event_ids;
+	int ret = 0;
+	size_t i;
 
-	if (copy_from_user((void *)&info_user, (void __user *)msg, sizeof(info_user))) {
-		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(info_user));
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
 		return -EFAULT;
 	}
-
-	/* Peek at the front element of error event queue first */
+	if (k_msg.flags & ~LWIS_EVENT_EVENTFD_FLAG_NOTIFY_ONLY) {
+		dev_err(lwis_dev->dev, "Invalid eventfd binding flags 0x%x\n", k_msg.flags);
+		return -EINVAL;
+	}
+	if (k_msg.num_event_ids == 0 || k_msg.num_event_ids > EVENT_BATCH_MAX ||
+	    k_msg.event_ids == NULL) {
+		dev_err(lwis_dev->dev, "Invalid eventfd binding of %zu events\n",
+			k_msg.num_event_ids);
+		return -EINVAL;
+	}
+
+	k_event_ids = kmalloc_array(k_msg.num_event_ids, sizeof(*k_event_ids), GFP_KERNEL);
+	if (!k_event_ids) {
+		dev_err(lwis_dev->dev, "Failed to allocate event IDs\n");
+		return -ENOMEM;
+	}
+	if (copy_from_user(k_event_ids, (void __user *)k_msg.event_ids,
+			   k_msg.num_event_ids * sizeof(*k_event_ids))) {
+		dev_err(lwis_dev->dev, "Failed to copy event IDs from user\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < k_msg.num_event_ids; ++i) {
+		/* Every bound event holds a reference to the eventfd */
+		if (k_msg.fd >= 0) {
+			eventfd = eventfd_ctx_fdget(k_msg.fd);
+			if (IS_ERR(eventfd)) {
+				dev_err(lwis_dev->dev, "Invalid eventfd %d\n", k_msg.fd);
+				ret = PTR_ERR(eventfd);
+				break;
+			}
+		}
+		ret = lwis_client_event_eventfd_bind(
+			lwis_client, k_event_ids[i], eventfd,
+			k_msg.flags & LWIS_EVENT_EVENTFD_FLAG_NOTIFY_ONLY);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to bind event 0x%llx\n", k_event_ids[i]);
+			break;
+		}
+	}
+	/* Bind all the events or none */
+	if (ret && k_msg.fd >= 0) {
+		while (i-- > 0) {
+			lwis_client_event_eventfd_bind(lwis_client, k_event_ids[i], NULL, false);
+		}
+	}
+out:
+	kfree(k_event_ids);
+	return ret;
+}
+
+static int ioctl_event_filter_set(struct lwis_client *lwis_client,
+				  struct lwis_event_filter_list __user *msg)
+{
+	struct lwis_event_filter_list k_msg;
+	struct lwis_event_filter *k_event_filters;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	int ret = 0;
+	size_t i;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy ioctl message from user\n");
+		return -EFAULT;
+	}
+	if (k_msg.num_event_filters == 0 || k_msg.num_event_filters > EVENT_BATCH_MAX ||
+	    k_msg.event_filters == NULL) {
+		dev_err(lwis_dev->dev, "Invalid list of %zu event filters\n",
+			k_msg.num_event_filters);
+		return -EINVAL;
+	}
+
+	k_event_filters =
+		kmalloc_array(k_msg.num_event_filters, sizeof(*k_event_filters), GFP_KERNEL);
+	if (!k_event_filters) {
+		dev_err(lwis_dev->dev, "Failed to allocate event filters\n");
+		return -ENOMEM;
+	}
+	if (copy_from_user(k_event_filters, (void __user *)k_msg.event_filters,
+			   k_msg.num_event_filters * sizeof(*k_event_filters))) {
+		dev_err(lwis_dev->dev, "Failed to copy event filters from user\n");
+		ret = -EFAULT;
+		goto out;
+	}
+
+	for (i = 0; i < k_msg.num_event_filters; ++i) {
+		ret = lwis_client_event_filter_set(lwis_client, &k_event_filters[i]);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Failed to apply event filter 0x%llx\n",
+				k_event_filters[i].event_id);
+			goto out;
+		}
+	}
+out:
+	kfree(k_event_filters);
+	return ret;
+}
+
+static int ioctl_event_dequeue(struct lwis_client *lwis_client, struct lwis_event_info __user *msg)
+{
+	unsigned long ret, err = 0;
+	struct lwis_event_entry *event;
+	struct lwis_event_info info_user;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+	bool is_error_event = false;
+
+	if (copy_from_user((void *)&info_user, (void __user *)msg, sizeof(info_user))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(info_user));
+		return -EFAULT;
+	}
+
+	/* Peek at the front element of error event queue first */
 	ret = lwis_client_error_event_peek_front(lwis_client, &event);
 	if (ret == 0) {
 		is_error_event = true;
@@ -859,6 +1589,145 @@ static int ioctl_event_dequeue(struct lwis_client *lwis_client, struct lwis_even
 	return err;
 }
 
+static int copy_event_batch_to_user(struct lwis_device *lwis_dev, struct list_head *events,
+				    struct lwis_event_info *k_infos, size_t *num_copied,
+				    uint8_t __user *payload_buffer, size_t *payload_offset)
+{
+	struct lwis_event_entry *event;
+	struct lwis_event_info *info;
+
+	list_for_each_entry (event, events, node) {
+		info = &k_infos[*num_copied];
+		memcpy(info, &event->event_info, sizeof(struct lwis_event_info));
+		info->payload_buffer_size = event->event_info.payload_size;
+		info->payload_buffer = NULL;
+		if (event->event_info.payload_size > 0) {
+			*payload_offset = ALIGN(*payload_offset, sizeof(uint64_t));
+			info->payload_buffer = payload_buffer + *payload_offset;
+			if (copy_to_user((void __user *)info->payload_buffer,
+					 (void *)event->event_info.payload_buffer,
+					 event->event_info.payload_size)) {
+				dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n",
+					event->event_info.payload_size);
+				return -EFAULT;
+			}
+			*payload_offset += event->event_info.payload_size;
+		}
+		(*num_copied)++;
+	}
+	return 0;
+}
+
+static void free_event_batch(struct list_head *events)
+{
+	struct list_head *it_event, *it_tmp;
+	struct lwis_event_entry *event;
+
+	list_for_each_safe (it_event, it_tmp, events) {
+		event = list_entry(it_event, struct lwis_event_entry, node);
+		list_del(&event->node);
+		lwis_event_entry_free(event);
+	}
+}
+
+static int ioctl_event_dequeue_batch(struct lwis_client *lwis_client,
+				     struct lwis_event_dequeue_batch __user *msg)
+{
+	int ret = 0;
+	struct lwis_event_dequeue_batch k_msg;
+	struct lwis_event_info *k_infos;
+	struct list_head error_events, events;
+	size_t max_events, num_events, num_copied = 0, payload_offset = 0;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(k_msg));
+		return -EFAULT;
+	}
+
+	if (k_msg.max_events == 0 || k_msg.event_infos == NULL) {
+		dev_err(lwis_dev->dev, "Invalid event batch\n");
+		return -EINVAL;
+	}
+	max_events = min_t(size_t, k_msg.max_events, EVENT_DEQUEUE_BATCH_MAX_EVENTS);
+	if (k_msg.payload_buffer == NULL) {
+		k_msg.payload_buffer_size = 0;
+	}
+
+	k_infos = kmalloc_array(max_events, sizeof(struct lwis_event_info), GFP_KERNEL);
+	if (!k_infos) {
+		dev_err(lwis_dev->dev, "Failed to allocate event infos\n");
+		return -ENOMEM;
+	}
+
+	INIT_LIST_HEAD(&error_events);
+	INIT_LIST_HEAD(&events);
+	num_events = lwis_client_event_pop_batch(lwis_client, max_events,
+						 k_msg.payload_buffer_size, &error_events,
+						 &events, &k_msg.next_payload_size);
+	k_msg.num_events = num_events;
+	if (num_events == 0) {
+		/* Same as LWIS_EVENT_DEQUEUE, inform the user if the payload
+		 * buffer is too small for the next event */
+		ret = k_msg.next_payload_size > 0 ? -EAGAIN : -ENOENT;
+		goto out;
+	}
+
+	ret = copy_event_batch_to_user(lwis_dev, &error_events, k_infos, &num_copied,
+				       k_msg.payload_buffer, &payload_offset);
+	if (!ret) {
+		ret = copy_event_batch_to_user(lwis_dev, &events, k_infos, &num_copied,
+					       k_msg.payload_buffer, &payload_offset);
+	}
+	if (!ret && copy_to_user((void __user *)k_msg.event_infos, (void *)k_infos,
+				 num_events * sizeof(struct lwis_event_info))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu event infos to user\n", num_events);
+		ret = -EFAULT;
+	}
+	if (ret) {
+		/* Keep the events for the next attempt */
+		lwis_client_event_unpop_batch(lwis_client, &error_events, &events);
+		goto out_free;
+	}
+
+	free_event_batch(&error_events);
+	free_event_batch(&events);
+
+out:
+	if (copy_to_user((void __user *)msg, (void *)&k_msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(k_msg));
+		ret = -EFAULT;
+	}
+out_free:
+	kfree(k_infos);
+	return ret;
+}
+
+static int ioctl_event_ring_setup(struct lwis_client *lwis_client,
+				  struct lwis_event_ring_info __user *msg)
+{
+	int ret;
+	struct lwis_event_ring_info info;
+	struct lwis_device *lwis_dev = lwis_client->lwis_dev;
+
+	if (copy_from_user((void *)&info, (void __user *)msg, sizeof(info))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(info));
+		return -EFAULT;
+	}
+
+	ret = lwis_client_event_ring_setup(lwis_client, &info);
+	if (ret) {
+		return ret;
+	}
+
+	if (copy_to_user((void __user *)msg, (void *)&info, sizeof(info))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(info));
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 static int ioctl_time_query(struct lwis_client *client, int64_t __user *msg)
 {
 	int ret = 0;
@@ -872,8 +1741,101 @@ static int ioctl_time_query(struct lwis_client *client, int64_t __user *msg)
 	return ret;
 }
 
+/*
+ * Look up the uploaded io entries of handle and apply the patches copied from
+ * userspace, for a submission referencing them instead of passing io entries.
+ */
+static int instantiate_uploaded_io(struct lwis_client *client, int64_t handle,
+				   struct lwis_io_entry_patch *user_patches, size_t num_patches,
+				   struct lwis_uploaded_io **uploaded,
+				   struct lwis_io_entry **io_entries)
+{
+	int ret;
+	struct lwis_io_entry_patch *k_patches = NULL;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (num_patches > 0) {
+		k_patches = kvmalloc_array(num_patches, sizeof(struct lwis_io_entry_patch),
+					   GFP_KERNEL);
+		if (!k_patches) {
+			dev_err(lwis_dev->dev, "Failed to allocate io entry patches\n");
+			return -ENOMEM;
+		}
+		if (copy_from_user(k_patches, (void __user *)user_patches,
+				   num_patches * sizeof(struct lwis_io_entry_patch))) {
+			dev_err(lwis_dev->dev, "Failed to copy io entry patches from user\n");
+			kvfree(k_patches);
+			return -EFAULT;
+		}
+	}
+
+	ret = lwis_uploaded_io_instantiate(client, handle, k_patches, num_patches, uploaded,
+					   io_entries);
+	kvfree(k_patches);
+	return ret;
+}
+
+/*
+ * Copies the transaction info from userspace, laid out as struct
+ * lwis_transaction_info_v1 if v1 is set.
+ */
+static int transaction_info_copy_from_user(struct lwis_transaction_info *info, void *msg, bool v1)
+{
+	struct lwis_transaction_info_v1 info_v1;
+
+	if (!v1) {
+		if (copy_from_user((void *)info, (void __user *)msg, sizeof(*info))) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+
+	if (copy_from_user((void *)&info_v1, (void __user *)msg, sizeof(info_v1))) {
+		return -EFAULT;
+	}
+	/* The fields added since then default to 0, which is
+	 * LWIS_IO_ENTRIES_HANDLE_NONE and LWIS_TRANSACTION_CHAIN_NONE */
+	memset(info, 0, sizeof(*info));
+	info->trigger_event_id = info_v1.trigger_event_id;
+	info->trigger_event_counter = info_v1.trigger_event_counter;
+	info->num_io_entries = info_v1.num_io_entries;
+	info->io_entries = (struct lwis_io_entry *)info_v1.io_entries;
+	info->run_in_event_context = info_v1.run_in_event_context;
+	info->run_at_real_time = info_v1.run_at_real_time;
+	info->emit_success_event_id = info_v1.emit_success_event_id;
+	info->emit_error_event_id = info_v1.emit_error_event_id;
+	info->allow_counter_eq = info_v1.allow_counter_eq;
+	info->id = info_v1.id;
+	info->current_trigger_event_counter = info_v1.current_trigger_event_counter;
+	info->submission_timestamp_ns = info_v1.submission_timestamp_ns;
+	return 0;
+}
+
+static int transaction_info_copy_to_user(void *msg, const struct lwis_transaction_info *info,
+					 bool v1)
+{
+	struct lwis_transaction_info_v1 __user *user_info_v1 = msg;
+
+	if (!v1) {
+		if (copy_to_user((void __user *)msg, (void *)info, sizeof(*info))) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+
+	/* Only the outputs are written back, io_entries points to the kernel
+	 * copy by now */
+	if (put_user(info->id, &user_info_v1->id) ||
+	    put_user(info->current_trigger_event_counter,
+		     &user_info_v1->current_trigger_event_counter) ||
+	    put_user(info->submission_timestamp_ns, &user_info_v1->submission_timestamp_ns)) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
 static int construct_transaction(struct lwis_client *client,
-				 struct lwis_transaction_info __user *msg,
+				 struct lwis_transaction_info __user *msg, bool v1,
 				 struct lwis_transaction **transaction)
 {
 	int i;
@@ -886,6 +1848,8 @@ static int construct_transaction(struct lwis_client *client,
 	struct lwis_io_entry *user_entries;
 	uint8_t *user_buf;
 	uint8_t *k_buf;
+	uint8_t **write_buf;
+	size_t write_size;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 
 	k_transaction = kmalloc(sizeof(struct lwis_transaction), GFP_KERNEL);
@@ -895,12 +1859,31 @@ static int construct_transaction(struct lwis_client *client,
 	}
 
 	user_transaction = (struct lwis_transaction_info *)msg;
-	if (copy_from_user((void *)&k_transaction->info, (void __user *)user_transaction,
-			   sizeof(struct lwis_transaction_info))) {
+	if (transaction_info_copy_from_user(&k_transaction->info, user_transaction, v1)) {
 		ret = -EFAULT;
 		dev_err(lwis_dev->dev, "Failed to copy transaction info from user\n");
 		goto error_free_transaction;
 	}
+	k_transaction->parent = NULL;
+	k_transaction->instance_pool = NULL;
+	k_transaction->program = NULL;
+	k_transaction->uploaded = NULL;
+
+	/* Uploaded entries come with their write buffers and compiled program */
+	if (k_transaction->info.io_entries_handle != LWIS_IO_ENTRIES_HANDLE_NONE) {
+		ret = instantiate_uploaded_io(client, k_transaction->info.io_entries_handle,
+					      k_transaction->info.patches,
+					      k_transaction->info.num_patches,
+					      &k_transaction->uploaded,
+					      &k_transaction->info.io_entries);
+		if (ret) {
+			goto error_free_transaction;
+		}
+		k_transaction->info.num_io_entries = k_transaction->uploaded->num_io_entries;
+		k_transaction->program = k_transaction->uploaded->program;
+		*transaction = k_transaction;
+		return 0;
+	}
 
 	user_entries = k_transaction->info.io_entries;
 	entry_size = k_transaction->info.num_io_entries * sizeof(struct lwis_io_entry);
@@ -912,8 +1895,9 @@ static int construct_transaction(struct lwis_client *client,
 	}
 	k_transaction->info.io_entries = k_entries;
 
-	if (copy_from_user((void *)k_entries, (void __user *)user_entries, entry_size)) {
-		ret = -EFAULT;
+	ret = io_entries_copy_from_user(lwis_dev, k_entries, user_entries,
+					k_transaction->info.num_io_entries, v1);
+	if (ret) {
 		dev_err(lwis_dev->dev, "Failed to copy transaction entries from user\n");
 		goto error_free_entries;
 	}
@@ -924,9 +1908,10 @@ static int construct_transaction(struct lwis_client *client,
 	 * processing.
 	 */
 	for (i = 0; i < k_transaction->info.num_io_entries; ++i) {
-		if (k_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
-			user_buf = k_entries[i].rw_batch.buf;
-			k_buf = kvmalloc(k_entries[i].rw_batch.size_in_bytes, GFP_KERNEL);
+		write_buf = lwis_io_entry_write_buf(&k_entries[i], &write_size);
+		if (write_buf) {
+			user_buf = *write_buf;
+			k_buf = kvmalloc(write_size, GFP_KERNEL);
 			if (!k_buf) {
 				dev_err_ratelimited(lwis_dev->dev,
 						    "Failed to allocate tx write buffer\n");
@@ -934,9 +1919,8 @@ static int construct_transaction(struct lwis_client *client,
 				goto error_free_buf;
 			}
 			last_buf_alloc_idx = i;
-			k_entries[i].rw_batch.buf = k_buf;
-			if (copy_from_user(k_buf, (void __user *)user_buf,
-					   k_entries[i].rw_batch.size_in_bytes)) {
+			*write_buf = k_buf;
+			if (copy_from_user(k_buf, (void __user *)user_buf, write_size)) {
 				ret = -EFAULT;
 				dev_err_ratelimited(
 					lwis_dev->dev,
@@ -945,13 +1929,24 @@ static int construct_transaction(struct lwis_client *client,
 			}
 		}
 	}
+
+	/* Repeating transactions run the same entries on every trigger, resolve
+	 * and validate their register accesses once here */
+	if (k_transaction->info.trigger_event_id != LWIS_EVENT_ID_NONE &&
+	    k_transaction->info.trigger_event_counter == LWIS_EVENT_COUNTER_EVERY_TIME &&
+	    lwis_dev->vops.register_io_compile) {
+		k_transaction->program = lwis_dev->vops.register_io_compile(
+			lwis_dev, k_entries, k_transaction->info.num_io_entries);
+	}
+
 	*transaction = k_transaction;
 	return 0;
 
 error_free_buf:
 	for (i = 0; i <= last_buf_alloc_idx; ++i) {
-		if (k_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
-			kvfree(k_entries[i].rw_batch.buf);
+		write_buf = lwis_io_entry_write_buf(&k_entries[i], &write_size);
+		if (write_buf) {
+			kvfree(*write_buf);
 		}
 	}
 error_free_entries:
@@ -964,10 +1959,21 @@ error_free_transaction:
 static void free_transaction(struct lwis_transaction *transaction)
 {
 	int i;
+	uint8_t **write_buf;
+	size_t write_size;
+
+	if (transaction->uploaded) {
+		/* The program belongs to the uploaded entries */
+		lwis_uploaded_io_entries_free(transaction->uploaded, transaction->info.io_entries);
+		kfree(transaction);
+		return;
+	}
 
+	kfree(transaction->program);
 	for (i = 0; i < transaction->info.num_io_entries; ++i) {
-		if (transaction->info.io_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
-			kvfree(transaction->info.io_entries[i].rw_batch.buf);
+		write_buf = lwis_io_entry_write_buf(&transaction->info.io_entries[i], &write_size);
+		if (write_buf) {
+			kvfree(*write_buf);
 		}
 	}
 	kvfree(transaction->info.io_entries);
@@ -975,75 +1981,288 @@ static void free_transaction(struct lwis_transaction *transaction)
 }
 
 static int ioctl_transaction_submit(struct lwis_client *client,
-				    struct lwis_transaction_info __user *msg)
+				    struct lwis_transaction_info __user *msg, bool v1)
 {
 	int ret;
 	unsigned long flags;
 	struct lwis_transaction *k_transaction = NULL;
+	struct lwis_transaction_info k_transaction_info;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 
-	ret = construct_transaction(client, msg, &k_transaction);
+	ret = construct_transaction(client, msg, v1, &k_transaction);
 	if (ret)
 		return ret;
 
-	spin_lock_irqsave(&client->transaction_lock, flags);
-	ret = lwis_transaction_submit_locked(client, k_transaction);
+	/* Allocate and validate without the lock, which is shared with the
+	 * trigger path */
+	ret = lwis_transaction_prepare(client, k_transaction);
+	if (!ret) {
+		spin_lock_irqsave(&client->transaction_lock, flags);
+		ret = lwis_transaction_submit_locked(client, k_transaction);
+		/* The transaction may complete as soon as the lock is released */
+		k_transaction_info = k_transaction->info;
+		spin_unlock_irqrestore(&client->transaction_lock, flags);
+	}
 	if (ret) {
 		k_transaction->info.id = LWIS_ID_INVALID;
-		spin_unlock_irqrestore(&client->transaction_lock, flags);
-		if (copy_to_user((void __user *)msg, &k_transaction->info,
-				 sizeof(struct lwis_transaction_info))) {
+		if (transaction_info_copy_to_user(msg, &k_transaction->info, v1)) {
 			dev_err_ratelimited(lwis_dev->dev, "Failed to return info to userspace\n");
 		}
 		free_transaction(k_transaction);
 		return ret;
 	}
 
-	if (copy_to_user((void __user *)msg, &k_transaction->info,
-			 sizeof(struct lwis_transaction_info))) {
+	if (transaction_info_copy_to_user(msg, &k_transaction_info, v1)) {
 		ret = -EFAULT;
 		dev_err_ratelimited(lwis_dev->dev,
 				    "Failed to copy transaction results to userspace\n");
 	}
 
-	spin_unlock_irqrestore(&client->transaction_lock, flags);
 	return ret;
 }
 
 static int ioctl_transaction_replace(struct lwis_client *client,
-				     struct lwis_transaction_info __user *msg)
+				     struct lwis_transaction_info __user *msg, bool v1)
 {
 	int ret;
 	unsigned long flags;
 	struct lwis_transaction *k_transaction;
+	struct lwis_transaction_info k_transaction_info;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 
-	ret = construct_transaction(client, msg, &k_transaction);
+	ret = construct_transaction(client, msg, v1, &k_transaction);
 	if (ret) {
 		return ret;
 	}
 
-	spin_lock_irqsave(&client->transaction_lock, flags);
-	ret = lwis_transaction_replace_locked(client, k_transaction);
+	ret = lwis_transaction_prepare(client, k_transaction);
+	if (!ret) {
+		spin_lock_irqsave(&client->transaction_lock, flags);
+		ret = lwis_transaction_replace_locked(client, k_transaction);
+		k_transaction_info = k_transaction->info;
+		spin_unlock_irqrestore(&client->transaction_lock, flags);
+	}
 	if (ret) {
 		k_transaction->info.id = LWIS_ID_INVALID;
-		spin_unlock_irqrestore(&client->transaction_lock, flags);
-		if (copy_to_user((void __user *)msg, &k_transaction->info,
-				 sizeof(struct lwis_transaction_info))) {
+		if (transaction_info_copy_to_user(msg, &k_transaction->info, v1)) {
 			dev_err_ratelimited(lwis_dev->dev, "Failed to return info to userspace\n");
 		}
 		free_transaction(k_transaction);
 		return ret;
 	}
 
-	if (copy_to_user((void __user *)msg, &k_transaction->info,
-			 sizeof(struct lwis_transaction_info))) {
+	if (transaction_info_copy_to_user(msg, &k_transaction_info, v1)) {
 		ret = -EFAULT;
 		dev_err_ratelimited(lwis_dev->dev,
 				    "Failed to copy transaction results to userspace\n");
 	}
 
-	spin_unlock_irqrestore(&client->transaction_lock, flags);
+	return ret;
+}
+
+static int ioctl_transaction_submit_batch(struct lwis_client *client,
+					  struct lwis_transaction_submit_batch __user *msg)
+{
+	int ret = 0;
+	size_t i;
+	unsigned long copy_ret;
+	bool copy_failed = false;
+	struct lwis_transaction_submit_batch k_msg;
+	struct lwis_transaction **k_transactions;
+	struct lwis_transaction_info *k_infos;
+	int32_t *k_errors;
+	const int64_t invalid_id = LWIS_ID_INVALID;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(k_msg));
+		return -EFAULT;
+	}
+
+	if (k_msg.num_transactions == 0 || k_msg.num_transactions > TRANSACTION_SUBMIT_BATCH_MAX ||
+	    k_msg.transaction_infos == NULL) {
+		dev_err(lwis_dev->dev, "Invalid transaction batch of %zu transactions\n",
+			k_msg.num_transactions);
+		return -EINVAL;
+	}
+
+	k_transactions =
+		kcalloc(k_msg.num_transactions, sizeof(struct lwis_transaction *), GFP_KERNEL);
+	k_infos = kmalloc_array(k_msg.num_transactions, sizeof(struct lwis_transaction_info),
+				GFP_KERNEL);
+	k_errors = kmalloc_array(k_msg.num_transactions, sizeof(int32_t), GFP_KERNEL);
+	if (!k_transactions || !k_infos || !k_errors) {
+		dev_err(lwis_dev->dev, "Failed to allocate transaction batch\n");
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	/* The batch is only submitted if every transaction is valid */
+	for (i = 0; i < k_msg.num_transactions; ++i) {
+		k_errors[i] = -ECANCELED;
+	}
+	for (i = 0; i < k_msg.num_transactions; ++i) {
+		ret = construct_transaction(client, &k_msg.transaction_infos[i], /*v1=*/false,
+					    &k_transactions[i]);
+		if (ret) {
+			k_errors[i] = ret;
+			break;
+		}
+	}
+	if (!ret) {
+		ret = lwis_transaction_submit_batch(client, k_transactions, k_infos, k_errors,
+						    k_msg.num_transactions);
+	}
+	k_msg.num_submitted = ret ? 0 : k_msg.num_transactions;
+
+	for (i = 0; i < k_msg.num_transactions; ++i) {
+		if (k_transactions[i]) {
+			/* Not submitted */
+			free_transaction(k_transactions[i]);
+		}
+		if (k_msg.num_submitted) {
+			copy_ret = copy_to_user((void __user *)&k_msg.transaction_infos[i],
+						&k_infos[i], sizeof(struct lwis_transaction_info));
+		} else {
+			copy_ret = copy_to_user((void __user *)&k_msg.transaction_infos[i].id,
+						&invalid_id, sizeof(invalid_id));
+		}
+		if (copy_ret) {
+			copy_failed = true;
+		}
+	}
+	if (k_msg.errors && copy_to_user((void __user *)k_msg.errors, k_errors,
+					 k_msg.num_transactions * sizeof(int32_t))) {
+		copy_failed = true;
+	}
+	if (copy_to_user((void __user *)&msg->num_submitted, &k_msg.num_submitted,
+			 sizeof(k_msg.num_submitted))) {
+		copy_failed = true;
+	}
+	if (copy_failed) {
+		dev_err_ratelimited(lwis_dev->dev,
+				    "Failed to copy transaction batch results to userspace\n");
+		ret = -EFAULT;
+	}
+
+out_free:
+	kfree(k_errors);
+	kfree(k_infos);
+	kfree(k_transactions);
+	return ret;
+}
+
+static int ioctl_transaction_group_submit(struct lwis_client *client,
+					  struct lwis_transaction_group_submit __user *msg)
+{
+	int ret = 0;
+	int i;
+	int32_t fd;
+	bool enabled;
+	struct lwis_transaction_group_submit k_msg;
+	struct lwis_client *clients[LWIS_TRANSACTION_GROUP_MAX_MEMBERS];
+	struct lwis_client *locked[LWIS_TRANSACTION_GROUP_MAX_MEMBERS];
+	int num_locked;
+	struct lwis_transaction *k_transactions[LWIS_TRANSACTION_GROUP_MAX_MEMBERS] = {};
+	struct file *files[LWIS_TRANSACTION_GROUP_MAX_MEMBERS] = {};
+	struct lwis_transaction_info *k_infos = NULL;
+	struct lwis_device *member_dev;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (lwis_dev->type != DEVICE_TYPE_TOP) {
+		dev_err(lwis_dev->dev, "Transaction groups are only supported on the top device\n");
+		return -EINVAL;
+	}
+
+	if (copy_from_user((void *)&k_msg, (void __user *)msg, sizeof(k_msg))) {
+		dev_err(lwis_dev->dev, "Failed to copy transaction group from user\n");
+		return -EFAULT;
+	}
+
+	if (k_msg.num_members == 0 || k_msg.num_members > LWIS_TRANSACTION_GROUP_MAX_MEMBERS ||
+	    k_msg.members == NULL) {
+		dev_err(lwis_dev->dev, "Invalid transaction group of %zu members\n",
+			k_msg.num_members);
+		return -EINVAL;
+	}
+
+	k_infos = kmalloc_array(k_msg.num_members, sizeof(*k_infos), GFP_KERNEL);
+	if (!k_infos) {
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < k_msg.num_members; ++i) {
+		if (copy_from_user(&fd, (void __user *)&k_msg.members[i].fd, sizeof(fd))) {
+			ret = -EFAULT;
+			goto out_put;
+		}
+		files[i] = lwis_client_fget(fd);
+		if (IS_ERR(files[i])) {
+			dev_err(lwis_dev->dev, "Member %d fd %d is not a LWIS client\n", i, fd);
+			ret = PTR_ERR(files[i]);
+			files[i] = NULL;
+			goto out_put;
+		}
+		clients[i] = files[i]->private_data;
+
+		member_dev = clients[i]->lwis_dev;
+		mutex_lock(&member_dev->client_lock);
+		enabled = member_dev->enabled > 0 || clients[i]->enable_pending;
+		mutex_unlock(&member_dev->client_lock);
+		if (!enabled) {
+			dev_err(lwis_dev->dev, "Member %d device %s is disabled\n", i,
+				member_dev->name);
+			ret = -EBADFD;
+			goto out_put;
+		}
+	}
+
+	/* The members are constructed and prepared against the uploaded io
+	 * entries, enrolled buffers and workers of their clients */
+	num_locked = lwis_transaction_group_clients_lock(client, clients, k_msg.num_members,
+							 locked);
+	for (i = 0; i < k_msg.num_members; ++i) {
+		ret = construct_transaction(clients[i], &k_msg.members[i].info, /*v1=*/false,
+					    &k_transactions[i]);
+		if (ret) {
+			lwis_transaction_group_clients_unlock(client, locked, num_locked);
+			goto out_put;
+		}
+		k_transactions[i]->info.trigger_event_id = k_msg.trigger_event_id;
+		k_transactions[i]->info.trigger_event_counter = k_msg.trigger_event_counter;
+	}
+	ret = lwis_transaction_group_prepare(lwis_dev, clients, k_transactions, k_infos,
+					     k_msg.num_members);
+	lwis_transaction_group_clients_unlock(client, locked, num_locked);
+
+	if (!ret) {
+		ret = lwis_transaction_group_submit(lwis_dev, k_msg.emit_event_id, clients,
+						    k_transactions, k_infos, k_msg.num_members);
+	}
+
+	for (i = 0; i < k_msg.num_members; ++i) {
+		if (copy_to_user((void __user *)&k_msg.members[i].info, &k_infos[i],
+				 sizeof(struct lwis_transaction_info))) {
+			dev_err_ratelimited(lwis_dev->dev,
+					    "Failed to copy group results to userspace\n");
+			if (!ret) {
+				ret = -EFAULT;
+			}
+			break;
+		}
+	}
+
+out_put:
+	for (i = 0; i < k_msg.num_members; ++i) {
+		if (k_transactions[i]) {
+			/* Not queued */
+			free_transaction(k_transactions[i]);
+		}
+		if (files[i]) {
+			fput(files[i]);
+		}
+	}
+	kfree(k_infos);
 	return ret;
 }
 
@@ -1069,7 +2288,7 @@ static int ioctl_transaction_cancel(struct lwis_client *client, int64_t __user *
 }
 
 static int prepare_io_entry(struct lwis_client *client, struct lwis_io_entry *user_entries,
-			    size_t num_io_entries, struct lwis_io_entry **io_entries)
+			    size_t num_io_entries, bool v1, struct lwis_io_entry **io_entries)
 {
 	int i, ret;
 	int last_buf_alloc_idx = 0;
@@ -1077,6 +2296,8 @@ static int prepare_io_entry(struct lwis_client *client, struct lwis_io_entry *us
 	struct lwis_io_entry *k_entries;
 	uint8_t *user_buf;
 	uint8_t *k_buf;
+	uint8_t **write_buf;
+	size_t write_size;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 
 	entry_size = num_io_entries * sizeof(struct lwis_io_entry);
@@ -1087,8 +2308,8 @@ static int prepare_io_entry(struct lwis_client *client, struct lwis_io_entry *us
 	}
 	*io_entries = k_entries;
 
-	if (copy_from_user((void *)k_entries, (void __user *)user_entries, entry_size)) {
-		ret = -EFAULT;
+	ret = io_entries_copy_from_user(lwis_dev, k_entries, user_entries, num_io_entries, v1);
+	if (ret) {
 		dev_err(lwis_dev->dev, "Failed to copy periodic io entries from user\n");
 		goto error_free_entries;
 	}
@@ -1098,9 +2319,10 @@ static int prepare_io_entry(struct lwis_client *client, struct lwis_io_entry *us
 	 * will be allocated in the form of lwis_io_result in io processing.
 	 */
 	for (i = 0; i < num_io_entries; ++i) {
-		if (k_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
-			user_buf = k_entries[i].rw_batch.buf;
-			k_buf = kvmalloc(k_entries[i].rw_batch.size_in_bytes, GFP_KERNEL);
+		write_buf = lwis_io_entry_write_buf(&k_entries[i], &write_size);
+		if (write_buf) {
+			user_buf = *write_buf;
+			k_buf = kvmalloc(write_size, GFP_KERNEL);
 			if (!k_buf) {
 				dev_err_ratelimited(
 					lwis_dev->dev,
@@ -1109,9 +2331,8 @@ static int prepare_io_entry(struct lwis_client *client, struct lwis_io_entry *us
 				goto error_free_buf;
 			}
 			last_buf_alloc_idx = i;
-			k_entries[i].rw_batch.buf = k_buf;
-			if (copy_from_user(k_buf, (void __user *)user_buf,
-					   k_entries[i].rw_batch.size_in_bytes)) {
+			*write_buf = k_buf;
+			if (copy_from_user(k_buf, (void __user *)user_buf, write_size)) {
 				ret = -EFAULT;
 				dev_err_ratelimited(
 					lwis_dev->dev,
@@ -1124,8 +2345,9 @@ static int prepare_io_entry(struct lwis_client *client, struct lwis_io_entry *us
 
 error_free_buf:
 	for (i = 0; i <= last_buf_alloc_idx; ++i) {
-		if (k_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
-			kvfree(k_entries[i].rw_batch.buf);
+		write_buf = lwis_io_entry_write_buf(&k_entries[i], &write_size);
+		if (write_buf) {
+			kvfree(*write_buf);
 		}
 	}
 error_free_entries:
@@ -1133,8 +2355,118 @@ error_free_entries:
 	return ret;
 }
 
+static int ioctl_io_entries_upload(struct lwis_client *client,
+				   struct lwis_io_entries_upload __user *msg)
+{
+	int ret;
+	struct lwis_io_entries_upload k_upload;
+	struct lwis_io_entry *k_entries;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (copy_from_user((void *)&k_upload, (void __user *)msg, sizeof(k_upload))) {
+		dev_err(lwis_dev->dev, "Failed to copy io entries upload from user\n");
+		return -EFAULT;
+	}
+
+	ret = prepare_io_entry(client, k_upload.io_entries, k_upload.num_io_entries, /*v1=*/false,
+			       &k_entries);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to prepare lwis io entries for upload\n");
+		return ret;
+	}
+
+	ret = lwis_uploaded_io_add(client, k_entries, k_upload.num_io_entries, &k_upload.handle);
+	if (ret) {
+		return ret;
+	}
+
+	if (copy_to_user((void __user *)&msg->handle, &k_upload.handle,
+			 sizeof(k_upload.handle))) {
+		dev_err(lwis_dev->dev, "Failed to copy io entries handle to userspace\n");
+		lwis_uploaded_io_release(client, k_upload.handle);
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
+static int ioctl_io_entries_release(struct lwis_client *client, int64_t __user *msg)
+{
+	int ret;
+	int64_t handle;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (copy_from_user((void *)&handle, (void __user *)msg, sizeof(handle))) {
+		dev_err(lwis_dev->dev, "Failed to copy io entries handle from user\n");
+		return -EFAULT;
+	}
+
+	ret = lwis_uploaded_io_release(client, handle);
+	if (ret) {
+		dev_err_ratelimited(lwis_dev->dev, "Unknown io entries handle %lld\n", handle);
+	}
+
+	return ret;
+}
+
+/*
+ * Copies the periodic io info from userspace, laid out as struct
+ * lwis_periodic_io_info_v1 if v1 is set.
+ */
+static int periodic_io_info_copy_from_user(struct lwis_periodic_io_info *info, void *msg, bool v1)
+{
+	struct lwis_periodic_io_info_v1 info_v1;
+
+	if (!v1) {
+		if (copy_from_user((void *)info, (void __user *)msg, sizeof(*info))) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+
+	if (copy_from_user((void *)&info_v1, (void __user *)msg, sizeof(info_v1))) {
+		return -EFAULT;
+	}
+	/* The fields added since then default to 0 */
+	memset(info, 0, sizeof(*info));
+	info->batch_size = info_v1.batch_size;
+	info->period_ns = info_v1.period_ns;
+	info->num_io_entries = info_v1.num_io_entries;
+	info->io_entries = (struct lwis_io_entry *)info_v1.io_entries;
+	info->emit_success_event_id = info_v1.emit_success_event_id;
+	info->emit_error_event_id = info_v1.emit_error_event_id;
+	info->id = info_v1.id;
+	return 0;
+}
+
+static int periodic_io_info_copy_to_user(void *msg, const struct lwis_periodic_io_info *info,
+					 bool v1)
+{
+	struct lwis_periodic_io_info_v1 info_v1;
+
+	if (!v1) {
+		if (copy_to_user((void __user *)msg, (void *)info, sizeof(*info))) {
+			return -EFAULT;
+		}
+		return 0;
+	}
+
+	memset(&info_v1, 0, sizeof(info_v1));
+	info_v1.batch_size = info->batch_size;
+	info_v1.period_ns = info->period_ns;
+	info_v1.num_io_entries = info->num_io_entries;
+	info_v1.io_entries = (struct lwis_io_entry_v1 *)info->io_entries;
+	info_v1.emit_success_event_id = info->emit_success_event_id;
+	info_v1.emit_error_event_id = info->emit_error_event_id;
+	info_v1.id = info->id;
+	if (copy_to_user((void __user *)msg, (void *)&info_v1, sizeof(info_v1))) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
 static int prepare_periodic_io(struct lwis_client *client, struct lwis_periodic_io_info __user *msg,
-			       struct lwis_periodic_io **periodic_io)
+			       bool v1, struct lwis_periodic_io **periodic_io)
 {
 	int ret;
 	struct lwis_periodic_io *k_periodic_io;
@@ -1148,15 +2480,33 @@ static int prepare_periodic_io(struct lwis_client *client, struct lwis_periodic_
 	}
 
 	user_periodic_io = (struct lwis_periodic_io_info *)msg;
-	if (copy_from_user((void *)&k_periodic_io->info, (void __user *)user_periodic_io,
-			   sizeof(struct lwis_periodic_io_info))) {
+	if (periodic_io_info_copy_from_user(&k_periodic_io->info, user_periodic_io, v1)) {
 		ret = -EFAULT;
 		dev_err(lwis_dev->dev, "Failed to copy periodic io info from user\n");
 		goto error_free_periodic_io;
 	}
+	k_periodic_io->resp = NULL;
+	k_periodic_io->resp_v1 = v1;
+	k_periodic_io->program = NULL;
+	k_periodic_io->uploaded = NULL;
+
+	if (k_periodic_io->info.io_entries_handle != LWIS_IO_ENTRIES_HANDLE_NONE) {
+		ret = instantiate_uploaded_io(client, k_periodic_io->info.io_entries_handle,
+					      k_periodic_io->info.patches,
+					      k_periodic_io->info.num_patches,
+					      &k_periodic_io->uploaded,
+					      &k_periodic_io->info.io_entries);
+		if (ret) {
+			goto error_free_periodic_io;
+		}
+		k_periodic_io->info.num_io_entries = k_periodic_io->uploaded->num_io_entries;
+		*periodic_io = k_periodic_io;
+		return 0;
+	}
 
 	ret = prepare_io_entry(client, k_periodic_io->info.io_entries,
-			       k_periodic_io->info.num_io_entries, &k_periodic_io->info.io_entries);
+			       k_periodic_io->info.num_io_entries, v1,
+			       &k_periodic_io->info.io_entries);
 	if (ret) {
 		dev_err(lwis_dev->dev, "Failed to prepare lwis io entries for periodic io\n");
 		goto error_free_periodic_io;
@@ -1170,29 +2520,27 @@ error_free_periodic_io:
 }
 
 static int ioctl_periodic_io_submit(struct lwis_client *client,
-				    struct lwis_periodic_io_info __user *msg)
+				    struct lwis_periodic_io_info __user *msg, bool v1)
 {
 	int ret;
 	struct lwis_periodic_io *k_periodic_io = NULL;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 
-	ret = prepare_periodic_io(client, msg, &k_periodic_io);
+	ret = prepare_periodic_io(client, msg, v1, &k_periodic_io);
 	if (ret)
 		return ret;
 
 	ret = lwis_periodic_io_submit(client, k_periodic_io);
 	if (ret) {
 		k_periodic_io->info.id = LWIS_ID_INVALID;
-		if (copy_to_user((void __user *)msg, &k_periodic_io->info,
-				 sizeof(struct lwis_periodic_io_info))) {
+		if (periodic_io_info_copy_to_user(msg, &k_periodic_io->info, v1)) {
 			dev_err_ratelimited(lwis_dev->dev, "Failed to return info to userspace\n");
 		}
 		lwis_periodic_io_clean(k_periodic_io);
 		return ret;
 	}
 
-	if (copy_to_user((void __user *)msg, &k_periodic_io->info,
-			 sizeof(struct lwis_periodic_io_info))) {
+	if (periodic_io_info_copy_to_user(msg, &k_periodic_io->info, v1)) {
 		dev_err_ratelimited(lwis_dev->dev,
 				    "Failed to copy periodic io results to userspace\n");
 		return -EFAULT;
@@ -1220,6 +2568,31 @@ static int ioctl_periodic_io_cancel(struct lwis_client *client, int64_t __user *
 
 	return 0;
 }
+static int ioctl_periodic_io_ring_setup(struct lwis_client *client,
+					struct lwis_periodic_io_ring_info __user *msg)
+{
+	int ret;
+	struct lwis_periodic_io_ring_info info;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (copy_from_user((void *)&info, (void __user *)msg, sizeof(info))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes from user\n", sizeof(info));
+		return -EFAULT;
+	}
+
+	ret = lwis_periodic_io_ring_setup(client, &info);
+	if (ret) {
+		return ret;
+	}
+
+	if (copy_to_user((void __user *)msg, (void *)&info, sizeof(info))) {
+		dev_err(lwis_dev->dev, "Failed to copy %zu bytes to user\n", sizeof(info));
+		return -EFAULT;
+	}
+
+	return 0;
+}
+
 static int ioctl_dpm_clk_update(struct lwis_device *lwis_dev,
 				struct lwis_dpm_clk_settings __user *msg)
 {
@@ -1254,7 +2627,7 @@ static int ioctl_dpm_qos_update(struct lwis_device *lwis_dev,
 {
 	struct lwis_dpm_qos_requirements k_msg;
 	struct lwis_qos_setting *k_qos_settings;
-	int ret, i;
+	int ret;
 	size_t buf_size;
 
 	if (lwis_dev->type != DEVICE_TYPE_DPM) {
@@ -1281,12 +2654,9 @@ static int ioctl_dpm_qos_update(struct lwis_device *lwis_dev,
 		goto out;
 	}
 
-	for (i = 0; i < k_msg.num_settings; i++) {
-		ret = lwis_dpm_update_qos(lwis_dev, &k_qos_settings[i]);
-		if (ret) {
-			dev_err(lwis_dev->dev, "Failed to apply qos setting, ret: %d\n", ret);
-			goto out;
-		}
+	ret = lwis_dpm_update_qos_list(lwis_dev, k_qos_settings, k_msg.num_settings);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to apply qos settings, ret: %d\n", ret);
 	}
 out:
 	kfree(k_qos_settings);
@@ -1338,14 +2708,29 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 
 	mutex_lock(&lwis_dev->client_lock);
 	device_disabled = (lwis_dev->enabled == 0);
+	/* Transactions submitted while an asynchronous enable runs are held */
+	if (device_disabled && lwis_client->enable_pending &&
+	    (type == LWIS_TRANSACTION_SUBMIT || type == LWIS_TRANSACTION_REPLACE ||
+	     type == LWIS_TRANSACTION_SUBMIT_V1 || type == LWIS_TRANSACTION_REPLACE_V1 ||
+	     type == LWIS_TRANSACTION_SUBMIT_BATCH)) {
+		device_disabled = false;
+	}
 	mutex_unlock(&lwis_dev->client_lock);
 	/* Buffer dis/enroll is added here temporarily. Will need a proper
 	   fix to ensure buffer enrollment when device is enabled. */
 	if (lwis_dev->type != DEVICE_TYPE_TOP && device_disabled && type != LWIS_GET_DEVICE_INFO &&
 	    type != LWIS_DEVICE_ENABLE && type != LWIS_DEVICE_RESET &&
+	    type != LWIS_DEVICE_ENABLE_ASYNC &&
+	    type != LWIS_DEVICE_POWER_DOWN_DELAY &&
+	    type != LWIS_DEVICE_RESET_V1 &&
 	    type != LWIS_EVENT_CONTROL_GET && type != LWIS_TIME_QUERY &&
-	    type != LWIS_EVENT_DEQUEUE && type != LWIS_BUFFER_ENROLL &&
-	    type != LWIS_BUFFER_DISENROLL && type != LWIS_BUFFER_FREE &&
+	    type != LWIS_EVENT_DEQUEUE && type != LWIS_EVENT_DEQUEUE_BATCH &&
+	    type != LWIS_EVENT_RING_SETUP && type != LWIS_PERIODIC_IO_RING_SETUP &&
+	    type != LWIS_IO_ENTRIES_UPLOAD && type != LWIS_IO_ENTRIES_RELEASE &&
+	    type != LWIS_BUFFER_ENROLL &&
+	    type != LWIS_BUFFER_DISENROLL && type != LWIS_BUFFER_ENROLL_CACHE &&
+	    type != LWIS_BUFFER_ENROLL_BATCH && type != LWIS_BUFFER_DISENROLL_BATCH &&
+	    type != LWIS_BUFFER_FREE && type != LWIS_BUFFER_SYNC &&
 	    type != LWIS_DPM_QOS_UPDATE && type != LWIS_DPM_GET_CLOCK) {
 		ret = -EBADFD;
 		dev_err_ratelimited(lwis_dev->dev, "Unsupported IOCTL on disabled device.\n");
@@ -1362,6 +2747,15 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 	case LWIS_BUFFER_FREE:
 		ret = ioctl_buffer_free(lwis_client, (int *)param);
 		break;
+	case LWIS_BUFFER_SYNC:
+		ret = ioctl_buffer_sync(lwis_client, (struct lwis_buffer_sync *)param);
+		break;
+	case LWIS_SLC_PARTITION_QUERY:
+		ret = ioctl_slc_partition_query(lwis_dev, (struct lwis_slc_partition_query *)param);
+		break;
+	case LWIS_BUFFER_POOL_PREWARM:
+		ret = ioctl_buffer_pool_prewarm(lwis_dev, (struct lwis_buffer_pool_prewarm *)param);
+		break;
 	case LWIS_BUFFER_ENROLL:
 		ret = ioctl_buffer_enroll(lwis_client, (struct lwis_buffer_info *)param);
 		break;
@@ -1369,12 +2763,36 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 		ret = ioctl_buffer_disenroll(lwis_client,
 					     (struct lwis_enrolled_buffer_info *)param);
 		break;
+	case LWIS_BUFFER_ENROLL_CACHE:
+		ret = ioctl_buffer_enroll_cache(lwis_client, (uint32_t *)param);
+		break;
+	case LWIS_BUFFER_ENROLL_BATCH:
+		ret = ioctl_buffer_enroll_batch(lwis_client,
+						(struct lwis_buffer_enroll_batch *)param);
+		break;
+	case LWIS_BUFFER_DISENROLL_BATCH:
+		ret = ioctl_buffer_disenroll_batch(lwis_client,
+						   (struct lwis_buffer_disenroll_batch *)param);
+		break;
 	case LWIS_REG_IO:
-		ret = ioctl_reg_io(lwis_dev, (struct lwis_io_entries *)param);
+		ret = ioctl_reg_io(lwis_dev, (struct lwis_io_entries *)param, /*v1=*/false);
+		break;
+	case LWIS_REG_IO_V1:
+		ret = ioctl_reg_io(lwis_dev, (struct lwis_io_entries *)param, /*v1=*/true);
 		break;
 	case LWIS_DEVICE_ENABLE:
 		ret = ioctl_device_enable(lwis_client);
 		break;
+	case LWIS_DEVICE_ENABLE_GROUP:
+		ret = ioctl_device_enable_group(lwis_client,
+						(struct lwis_device_enable_group *)param);
+		break;
+	case LWIS_DEVICE_ENABLE_ASYNC:
+		ret = ioctl_device_enable_async(lwis_client);
+		break;
+	case LWIS_DEVICE_POWER_DOWN_DELAY:
+		ret = ioctl_device_power_down_delay(lwis_client, (uint32_t *)param);
+		break;
 	case LWIS_DEVICE_DISABLE:
 		ret = ioctl_device_disable(lwis_client);
 		break;
@@ -1382,7 +2800,12 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 		ret = ioctl_echo(lwis_dev, (struct lwis_echo *)param);
 		break;
 	case LWIS_DEVICE_RESET:
-		ret = ioctl_device_reset(lwis_client, (struct lwis_io_entries *)param);
+		ret = ioctl_device_reset(lwis_client, (struct lwis_io_entries *)param,
+					 /*v1=*/false);
+		break;
+	case LWIS_DEVICE_RESET_V1:
+		ret = ioctl_device_reset(lwis_client, (struct lwis_io_entries *)param,
+					 /*v1=*/true);
 		break;
 	case LWIS_EVENT_CONTROL_GET:
 		ret = ioctl_event_control_get(lwis_client, (struct lwis_event_control *)param);
@@ -1390,27 +2813,74 @@ int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsig
 	case LWIS_EVENT_CONTROL_SET:
 		ret = ioctl_event_control_set(lwis_client, (struct lwis_event_control_list *)param);
 		break;
+	case LWIS_EVENT_EVENTFD_BIND:
+		ret = ioctl_event_eventfd_bind(lwis_client,
+					       (struct lwis_event_eventfd_binding *)param);
+		break;
+	case LWIS_EVENT_FILTER_SET:
+		ret = ioctl_event_filter_set(lwis_client, (struct lwis_event_filter_list *)param);
+		break;
 	case LWIS_EVENT_DEQUEUE:
 		ret = ioctl_event_dequeue(lwis_client, (struct lwis_event_info *)param);
 		break;
+	case LWIS_EVENT_DEQUEUE_BATCH:
+		ret = ioctl_event_dequeue_batch(lwis_client,
+						(struct lwis_event_dequeue_batch *)param);
+		break;
+	case LWIS_EVENT_RING_SETUP:
+		ret = ioctl_event_ring_setup(lwis_client, (struct lwis_event_ring_info *)param);
+		break;
 	case LWIS_TIME_QUERY:
 		ret = ioctl_time_query(lwis_client, (int64_t *)param);
 		break;
 	case LWIS_TRANSACTION_SUBMIT:
-		ret = ioctl_transaction_submit(lwis_client, (struct lwis_transaction_info *)param);
+		ret = ioctl_transaction_submit(lwis_client, (struct lwis_transaction_info *)param,
+					       /*v1=*/false);
+		break;
+	case LWIS_TRANSACTION_SUBMIT_V1:
+		ret = ioctl_transaction_submit(lwis_client, (struct lwis_transaction_info *)param,
+					       /*v1=*/true);
+		break;
+	case LWIS_TRANSACTION_SUBMIT_BATCH:
+		ret = ioctl_transaction_submit_batch(lwis_client,
+						     (struct lwis_transaction_submit_batch *)param);
+		break;
+	case LWIS_TRANSACTION_GROUP_SUBMIT:
+		ret = ioctl_transaction_group_submit(lwis_client,
+						     (struct lwis_transaction_group_submit *)param);
 		break;
 	case LWIS_TRANSACTION_CANCEL:
 		ret = ioctl_transaction_cancel(lwis_client, (int64_t *)param);
 		break;
 	case LWIS_TRANSACTION_REPLACE:
-		ret = ioctl_transaction_replace(lwis_client, (struct lwis_transaction_info *)param);
+		ret = ioctl_transaction_replace(lwis_client, (struct lwis_transaction_info *)param,
+						/*v1=*/false);
+		break;
+	case LWIS_TRANSACTION_REPLACE_V1:
+		ret = ioctl_transaction_replace(lwis_client, (struct lwis_transaction_info *)param,
+						/*v1=*/true);
+		break;
+	case LWIS_IO_ENTRIES_UPLOAD:
+		ret = ioctl_io_entries_upload(lwis_client, (struct lwis_io_entries_upload *)param);
+		break;
+	case LWIS_IO_ENTRIES_RELEASE:
+		ret = ioctl_io_entries_release(lwis_client, (int64_t *)param);
 		break;
 	case LWIS_PERIODIC_IO_SUBMIT:
-		ret = ioctl_periodic_io_submit(lwis_client, (struct lwis_periodic_io_info *)param);
+		ret = ioctl_periodic_io_submit(lwis_client, (struct lwis_periodic_io_info *)param,
+					       /*v1=*/false);
+		break;
+	case LWIS_PERIODIC_IO_SUBMIT_V1:
+		ret = ioctl_periodic_io_submit(lwis_client, (struct lwis_periodic_io_info *)param,
+					       /*v1=*/true);
 		break;
 	case LWIS_PERIODIC_IO_CANCEL:
 		ret = ioctl_periodic_io_cancel(lwis_client, (int64_t *)param);
 		break;
+	case LWIS_PERIODIC_IO_RING_SETUP:
+		ret = ioctl_periodic_io_ring_setup(lwis_client,
+						   (struct lwis_periodic_io_ring_info *)param);
+		break;
 	case LWIS_DPM_CLK_UPDATE:
 		ret = ioctl_dpm_clk_update(lwis_dev, (struct lwis_dpm_clk_settings *)param);
 		break;
@@ -18,6 +18,12 @@
  */
 int lwis_ioctl_handler(struct lwis_client *lwis_client, unsigned int type, unsigned long param);
 
+/*
+ *  lwis_ioctl_device_enable_work: Enable the device of a client for
+ *  LWIS_DEVICE_ENABLE_ASYNC, and emit LWIS_EVENT_ID_DEVICE_ENABLED.
+ */
+void lwis_ioctl_device_enable_work(struct work_struct *work);
+
 void lwis_ioctl_pr_err(struct lwis_device *lwis_device, unsigned int ioctl_type, int errno);
 
 #endif /* LWIS_IOCTL_H_ */
@@ -0,0 +1,383 @@
+/*
+ * Google LWIS IOCTL Trace
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-ioctl-trace: " fmt
+
+#include <linux/kernel.h>
+#include <linux/mm.h>
+#include <linux/sched/signal.h>
+#include <linux/slab.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+
+#include "lwis_device.h"
+#include "lwis_ioctl_trace.h"
+#include "lwis_util.h"
+
+/* Payload of the record being built in the scratch buffer */
+struct trace_payload {
+	uint8_t *buf;
+	size_t size;
+	bool truncated;
+};
+
+/* Appends size bytes copied from userspace, returns where they were copied
+ * or NULL if the payload is truncated */
+static void *payload_append(struct trace_payload *payload, const void __user *src, size_t size)
+{
+	void *dst;
+
+	if (payload->truncated) {
+		return NULL;
+	}
+	if (size > LWIS_IOCTL_TRACE_MAX_RECORD_SIZE - sizeof(struct lwis_ioctl_trace_record) -
+			   payload->size ||
+	    copy_from_user(payload->buf + payload->size, src, size)) {
+		payload->truncated = true;
+		return NULL;
+	}
+	dst = payload->buf + payload->size;
+	payload->size += size;
+	return dst;
+}
+
+static void *payload_append_array(struct trace_payload *payload, const void __user *src,
+				  size_t num, size_t elem_size)
+{
+	if (num > LWIS_IOCTL_TRACE_MAX_RECORD_SIZE / elem_size) {
+		payload->truncated = true;
+		return NULL;
+	}
+	return payload_append(payload, src, num * elem_size);
+}
+
+static void payload_append_io_entries(struct trace_payload *payload,
+				      struct lwis_io_entry __user *user_entries, size_t num_entries)
+{
+	struct lwis_io_entry *entries;
+	uint8_t **write_buf;
+	size_t write_size;
+	size_t i;
+
+	entries = payload_append_array(payload, user_entries, num_entries, sizeof(*entries));
+	if (!entries) {
+		return;
+	}
+	for (i = 0; i < num_entries; ++i) {
+		write_buf = lwis_io_entry_write_buf(&entries[i], &write_size);
+		if (write_buf) {
+			payload_append(payload, (void __user *)*write_buf, write_size);
+		}
+	}
+}
+
+/* Same as payload_append_io_entries, for the entries of the _V1 commands */
+static void payload_append_io_entries_v1(struct trace_payload *payload,
+					 struct lwis_io_entry_v1 __user *user_entries,
+					 size_t num_entries)
+{
+	struct lwis_io_entry_v1 *entries;
+	size_t i;
+
+	entries = payload_append_array(payload, user_entries, num_entries, sizeof(*entries));
+	if (!entries) {
+		return;
+	}
+	for (i = 0; i < num_entries; ++i) {
+		if (entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			payload_append(payload, (void __user *)entries[i].rw_batch.buf,
+				       entries[i].rw_batch.size_in_bytes);
+		}
+	}
+}
+
+static void payload_append_transaction(struct trace_payload *payload,
+				       struct lwis_transaction_info *info)
+{
+	if (info->io_entries_handle != LWIS_IO_ENTRIES_HANDLE_NONE) {
+		payload_append_array(payload, (void __user *)info->patches, info->num_patches,
+				     sizeof(struct lwis_io_entry_patch));
+		return;
+	}
+	payload_append_io_entries(payload, (void __user *)info->io_entries, info->num_io_entries);
+}
+
+/* Appends the argument of the ioctl and the arrays it points to */
+static void payload_build(struct trace_payload *payload, unsigned int cmd, unsigned long arg)
+{
+	void *arg_copy;
+	struct lwis_io_entries *io_entries;
+	struct lwis_io_entries_v1 *io_entries_v1;
+	struct lwis_io_entries_upload *upload;
+	struct lwis_transaction_submit_batch *batch;
+	struct lwis_transaction_info *infos;
+	struct lwis_transaction_group_submit *group;
+	struct lwis_transaction_group_member *members;
+	struct lwis_periodic_io_info *periodic_io;
+	struct lwis_periodic_io_info_v1 *periodic_io_v1;
+	struct lwis_transaction_info_v1 *info_v1;
+	struct lwis_event_control_list *controls;
+	struct lwis_event_eventfd_binding *binding;
+	struct lwis_event_filter_list *filters;
+	size_t arg_size;
+	size_t i;
+
+	if (_IOC_DIR(cmd) == _IOC_NONE) {
+		return;
+	}
+	arg_copy = payload_append(payload, (void __user *)arg, _IOC_SIZE(cmd));
+	if (!arg_copy) {
+		return;
+	}
+	arg_size = payload->size;
+
+	switch (cmd) {
+	case LWIS_REG_IO:
+	case LWIS_DEVICE_RESET:
+		io_entries = arg_copy;
+		payload_append_io_entries(payload, (void __user *)io_entries->io_entries,
+					  io_entries->num_io_entries);
+		break;
+	case LWIS_REG_IO_V1:
+	case LWIS_DEVICE_RESET_V1:
+		io_entries_v1 = arg_copy;
+		payload_append_io_entries_v1(payload, (void __user *)io_entries_v1->io_entries,
+					     io_entries_v1->num_io_entries);
+		break;
+	case LWIS_IO_ENTRIES_UPLOAD:
+		upload = arg_copy;
+		payload_append_io_entries(payload, (void __user *)upload->io_entries,
+					  upload->num_io_entries);
+		break;
+	case LWIS_TRANSACTION_SUBMIT:
+	case LWIS_TRANSACTION_REPLACE:
+		payload_append_transaction(payload, arg_copy);
+		break;
+	case LWIS_TRANSACTION_SUBMIT_V1:
+	case LWIS_TRANSACTION_REPLACE_V1:
+		info_v1 = arg_copy;
+		payload_append_io_entries_v1(payload, (void __user *)info_v1->io_entries,
+					     info_v1->num_io_entries);
+		break;
+	case LWIS_TRANSACTION_SUBMIT_BATCH:
+		batch = arg_copy;
+		infos = payload_append_array(payload, (void __user *)batch->transaction_infos,
+					     batch->num_transactions, sizeof(*infos));
+		for (i = 0; infos && i < batch->num_transactions; ++i) {
+			payload_append_transaction(payload, &infos[i]);
+		}
+		break;
+	case LWIS_TRANSACTION_GROUP_SUBMIT:
+		group = arg_copy;
+		members = payload_append_array(payload, (void __user *)group->members,
+					       group->num_members, sizeof(*members));
+		for (i = 0; members && i < group->num_members; ++i) {
+			payload_append_transaction(payload, &members[i].info);
+		}
+		break;
+	case LWIS_PERIODIC_IO_SUBMIT:
+		periodic_io = arg_copy;
+		if (periodic_io->io_entries_handle != LWIS_IO_ENTRIES_HANDLE_NONE) {
+			payload_append_array(payload, (void __user *)periodic_io->patches,
+					     periodic_io->num_patches,
+					     sizeof(struct lwis_io_entry_patch));
+		} else {
+			payload_append_io_entries(payload, (void __user *)periodic_io->io_entries,
+						  periodic_io->num_io_entries);
+		}
+		break;
+	case LWIS_PERIODIC_IO_SUBMIT_V1:
+		periodic_io_v1 = arg_copy;
+		payload_append_io_entries_v1(payload, (void __user *)periodic_io_v1->io_entries,
+					     periodic_io_v1->num_io_entries);
+		break;
+	case LWIS_EVENT_CONTROL_SET:
+		controls = arg_copy;
+		payload_append_array(payload, (void __user *)controls->event_controls,
+				     controls->num_event_controls,
+				     sizeof(*controls->event_controls));
+		break;
+	case LWIS_EVENT_EVENTFD_BIND:
+		binding = arg_copy;
+		payload_append_array(payload, (void __user *)binding->event_ids,
+				     binding->num_event_ids, sizeof(*binding->event_ids));
+		break;
+	case LWIS_EVENT_FILTER_SET:
+		filters = arg_copy;
+		payload_append_array(payload, (void __user *)filters->event_filters,
+				     filters->num_event_filters, sizeof(*filters->event_filters));
+		break;
+	}
+
+	/* Keep the argument only, rather than a part of the arrays */
+	if (payload->truncated) {
+		payload->size = arg_size;
+	}
+}
+
+static void ring_write(struct lwis_ioctl_trace *trace, u64 pos, const void *src, size_t size)
+{
+	size_t offset = pos & (LWIS_IOCTL_TRACE_SIZE - 1);
+	size_t first = min_t(size_t, size, LWIS_IOCTL_TRACE_SIZE - offset);
+
+	memcpy(trace->ring + offset, src, first);
+	memcpy(trace->ring, src + first, size - first);
+}
+
+static void ring_read(struct lwis_ioctl_trace *trace, u64 pos, void *dst, size_t size)
+{
+	size_t offset = pos & (LWIS_IOCTL_TRACE_SIZE - 1);
+	size_t first = min_t(size_t, size, LWIS_IOCTL_TRACE_SIZE - offset);
+
+	memcpy(dst, trace->ring + offset, first);
+	memcpy(dst + first, trace->ring, size - first);
+}
+
+static int ring_copy_to_user(struct lwis_ioctl_trace *trace, u64 pos, char __user *dst,
+			     size_t size)
+{
+	size_t offset = pos & (LWIS_IOCTL_TRACE_SIZE - 1);
+	size_t first = min_t(size_t, size, LWIS_IOCTL_TRACE_SIZE - offset);
+
+	if (copy_to_user(dst, trace->ring + offset, first) ||
+	    copy_to_user(dst + first, trace->ring, size - first)) {
+		return -EFAULT;
+	}
+	return 0;
+}
+
+void lwis_ioctl_trace_init(struct lwis_ioctl_trace *trace)
+{
+	mutex_init(&trace->lock);
+	init_waitqueue_head(&trace->wait_queue);
+}
+
+void lwis_ioctl_trace_free(struct lwis_ioctl_trace *trace)
+{
+	trace->enabled = false;
+	vfree(trace->ring);
+	trace->ring = NULL;
+	kvfree(trace->scratch);
+	trace->scratch = NULL;
+}
+
+int lwis_ioctl_trace_enable(struct lwis_ioctl_trace *trace, bool enable)
+{
+	int ret = 0;
+
+	mutex_lock(&trace->lock);
+	if (enable && !trace->ring) {
+		trace->ring = vmalloc(LWIS_IOCTL_TRACE_SIZE);
+		trace->scratch = kvmalloc(LWIS_IOCTL_TRACE_MAX_RECORD_SIZE, GFP_KERNEL);
+		if (!trace->ring || !trace->scratch) {
+			lwis_ioctl_trace_free(trace);
+			ret = -ENOMEM;
+			goto exit;
+		}
+		trace->head = 0;
+		trace->tail = 0;
+	}
+	WRITE_ONCE(trace->enabled, enable);
+exit:
+	mutex_unlock(&trace->lock);
+	return ret;
+}
+
+void lwis_ioctl_trace_record(struct lwis_client *client, unsigned int cmd, unsigned long arg,
+			     int ret, int64_t start_timestamp_ns)
+{
+	struct lwis_ioctl_trace *trace = &client->lwis_dev->ioctl_trace;
+	struct lwis_ioctl_trace_record *record;
+	struct trace_payload payload;
+	int64_t end_timestamp_ns = ktime_to_ns(lwis_get_time());
+
+	mutex_lock(&trace->lock);
+	if (!trace->enabled) {
+		goto exit;
+	}
+
+	record = (struct lwis_ioctl_trace_record *)trace->scratch;
+	payload.buf = trace->scratch + sizeof(*record);
+	payload.size = 0;
+	payload.truncated = false;
+	payload_build(&payload, cmd, arg);
+
+	memset(record, 0, sizeof(*record));
+	record->size = ALIGN(sizeof(*record) + payload.size, 8);
+	if (record->size > LWIS_IOCTL_TRACE_SIZE - (trace->head - trace->tail)) {
+		trace->num_dropped++;
+		goto exit;
+	}
+
+	if (!client->ioctl_trace_id) {
+		client->ioctl_trace_id = ++trace->num_clients;
+	}
+	record->cmd = cmd;
+	record->client_id = client->ioctl_trace_id;
+	record->ret = ret;
+	record->start_timestamp_ns = start_timestamp_ns;
+	record->duration_ns = end_timestamp_ns - start_timestamp_ns;
+	record->payload_size = payload.size;
+	record->flags = payload.truncated ? LWIS_IOCTL_TRACE_RECORD_FLAG_TRUNCATED : 0;
+	record->num_dropped = trace->num_dropped;
+	trace->num_dropped = 0;
+
+	/* The padding is copied from the scratch buffer, never from the
+	 * previous records, as it is zeroed here */
+	memset(payload.buf + payload.size, 0, record->size - sizeof(*record) - payload.size);
+	ring_write(trace, trace->head, trace->scratch, record->size);
+	WRITE_ONCE(trace->head, trace->head + record->size);
+	wake_up_interruptible(&trace->wait_queue);
+exit:
+	mutex_unlock(&trace->lock);
+}
+
+static bool trace_pending(struct lwis_ioctl_trace *trace)
+{
+	return READ_ONCE(trace->head) != READ_ONCE(trace->tail);
+}
+
+ssize_t lwis_ioctl_trace_read(struct lwis_ioctl_trace *trace, char __user *buf, size_t count,
+			      bool nonblock)
+{
+	struct lwis_ioctl_trace_record record;
+	ssize_t ret;
+	size_t copied = 0;
+
+	mutex_lock(&trace->lock);
+	while (trace->head == trace->tail) {
+		mutex_unlock(&trace->lock);
+		if (nonblock) {
+			return -EAGAIN;
+		}
+		ret = wait_event_interruptible(trace->wait_queue, trace_pending(trace));
+		if (ret) {
+			return ret;
+		}
+		mutex_lock(&trace->lock);
+	}
+
+	while (trace->tail != trace->head) {
+		ring_read(trace, trace->tail, &record, sizeof(record));
+		if (record.size > count - copied) {
+			break;
+		}
+		if (ring_copy_to_user(trace, trace->tail, buf + copied, record.size)) {
+			ret = -EFAULT;
+			goto exit;
+		}
+		WRITE_ONCE(trace->tail, trace->tail + record.size);
+		copied += record.size;
+	}
+	ret = copied ? copied : -EINVAL;
+exit:
+	mutex_unlock(&trace->lock);
+	return ret;
+}
@@ -0,0 +1,89 @@
+/*
+ * Google LWIS IOCTL Trace
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_IOCTL_TRACE_H_
+#define LWIS_IOCTL_TRACE_H_
+
+#include <linux/compiler.h>
+#include <linux/mutex.h>
+#include <linux/types.h>
+#include <linux/wait.h>
+
+#include "lwis_commands.h"
+
+/* LWIS forward declarations */
+struct lwis_client;
+
+/* Size of the ring of records, a power of 2 */
+#define LWIS_IOCTL_TRACE_SIZE (1024 * 1024)
+/* Size of the largest record, larger ones are truncated. A multiple of 8 */
+#define LWIS_IOCTL_TRACE_MAX_RECORD_SIZE (64 * 1024)
+
+/*
+ * struct lwis_ioctl_trace
+ * Ring of the ioctls of the clients of a device, as struct
+ * lwis_ioctl_trace_record. Records are only added while the trace is
+ * enabled, and dropped while the ring is full.
+ */
+struct lwis_ioctl_trace {
+	/* Serializes the recording, reading and enabling */
+	struct mutex lock;
+	bool enabled;
+	/* Allocated when first enabled */
+	uint8_t *ring;
+	/* Record being built */
+	uint8_t *scratch;
+	/* Bytes written to and read from the ring */
+	u64 head;
+	u64 tail;
+	/* Records dropped since the last record */
+	u32 num_dropped;
+	/* Number of clients given an ID */
+	u32 num_clients;
+	/* Woken up when records are added */
+	wait_queue_head_t wait_queue;
+};
+
+void lwis_ioctl_trace_init(struct lwis_ioctl_trace *trace);
+
+void lwis_ioctl_trace_free(struct lwis_ioctl_trace *trace);
+
+/*
+ * lwis_ioctl_trace_enable: Starts or stops the recording. Records left in
+ * the ring can still be read once stopped.
+ *
+ * Alloc: Yes, when first enabled
+ * Returns: 0 on success
+ */
+int lwis_ioctl_trace_enable(struct lwis_ioctl_trace *trace, bool enable);
+
+static inline bool lwis_ioctl_trace_enabled(struct lwis_ioctl_trace *trace)
+{
+	return READ_ONCE(trace->enabled);
+}
+
+/*
+ * lwis_ioctl_trace_record: Records an ioctl of the client, once it returned
+ * ret, copying its argument and the arrays it points to from userspace.
+ */
+void lwis_ioctl_trace_record(struct lwis_client *client, unsigned int cmd, unsigned long arg,
+			     int ret, int64_t start_timestamp_ns);
+
+/*
+ * lwis_ioctl_trace_read: Moves whole records to buf, waiting for one unless
+ * nonblock is set.
+ *
+ * Returns: number of bytes read, -EAGAIN if nonblock and there is no record,
+ * -EINVAL if the next record does not fit in count bytes
+ */
+ssize_t lwis_ioctl_trace_read(struct lwis_ioctl_trace *trace, char __user *buf, size_t count,
+			      bool nonblock);
+
+#endif /* LWIS_IOCTL_TRACE_H_ */
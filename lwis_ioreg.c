@@ -13,10 +13,43 @@
 #include <linux/bitops.h>
 #include <linux/io.h>
 #include <linux/kernel.h>
+#include <linux/log2.h>
+#include <linux/overflow.h>
 #include <linux/slab.h>
+#include <asm/unaligned.h>
 
 #include "lwis_device.h"
 #include "lwis_ioreg.h"
+#include "lwis_util.h"
+
+/* Bitwidth specialized operations of a compiled io entry */
+enum lwis_ioreg_opcode {
+	IOREG_OP_NONE,
+	IOREG_OP_READ8,
+	IOREG_OP_READ16,
+	IOREG_OP_READ32,
+	IOREG_OP_READ64,
+	IOREG_OP_WRITE8,
+	IOREG_OP_WRITE16,
+	IOREG_OP_WRITE32,
+	IOREG_OP_WRITE64,
+	IOREG_OP_READ_BATCH,
+	IOREG_OP_WRITE_BATCH,
+	IOREG_OP_READ_BATCH_WIDE,
+	IOREG_OP_WRITE_BATCH_WIDE,
+};
+
+struct lwis_ioreg_op {
+	/* Resolved and validated register address */
+	void __iomem *addr;
+	enum lwis_ioreg_opcode opcode;
+};
+
+/* Compiled io entries, ops[i] is the operation of io entry i */
+struct lwis_io_program {
+	int num_ops;
+	struct lwis_ioreg_op ops[];
+};
 
 static int find_block_idx_by_name(struct lwis_ioreg_list *list, char *name)
 {
@@ -85,8 +118,18 @@ static int validate_access_size(int access_size, int native_value_bitwidth)
 	return 0;
 }
 
+/* Each block lock gets its own lockdep class, as several are held at once */
+static struct lock_class_key block_lock_keys[BITS_PER_LONG];
+
+/* Index of the lock guarding block bid */
+static inline int block_lock_index(int bid)
+{
+	return min(bid, BITS_PER_LONG - 1);
+}
+
 int lwis_ioreg_list_alloc(struct lwis_ioreg_device *ioreg_dev, int num_blocks)
 {
+	int i;
 	struct lwis_ioreg_list *list;
 
 	BUG_ON(!ioreg_dev);
@@ -103,6 +146,10 @@ int lwis_ioreg_list_alloc(struct lwis_ioreg_device *ioreg_dev, int num_blocks)
 	}
 
 	list->count = num_blocks;
+	for (i = 0; i < num_blocks; ++i) {
+		__mutex_init(&list->block[i].lock, "lwis_ioreg_block_lock",
+			     &block_lock_keys[block_lock_index(i)]);
+	}
 
 	return 0;
 }
@@ -279,6 +326,70 @@ static int ioreg_write_batch_internal(void __iomem *base, uint64_t offset, int v
 	return 0;
 }
 
+/*
+ * Splits a batch at [offset, offset + size_in_bytes) into a head up to the
+ * first 8-byte aligned address, a body of whole 64-bit words and a tail.
+ */
+static void ioreg_batch_split_wide(void __iomem *base, uint64_t offset, size_t size_in_bytes,
+				   size_t *head, size_t *body)
+{
+	uintptr_t addr = (uintptr_t)base + offset;
+
+	*head = min_t(size_t, size_in_bytes, ALIGN(addr, sizeof(uint64_t)) - addr);
+	*body = round_down(size_in_bytes - *head, sizeof(uint64_t));
+}
+
+/*
+ * For blocks with wide access, the 8-byte aligned span of a batch is read 64
+ * bits at a time, the unaligned head and tail use the native width. The span
+ * is aligned in the register block, but not necessarily in buf.
+ */
+static int ioreg_read_batch_wide(void __iomem *base, uint64_t offset, int value_bits,
+				 size_t size_in_bytes, uint8_t *buf)
+{
+	size_t i, head, body;
+	uint8_t *addr = (uint8_t *)base + offset;
+	int ret;
+
+	if (value_bits >= 64) {
+		return ioreg_read_batch_internal(base, offset, value_bits, size_in_bytes, buf);
+	}
+
+	ioreg_batch_split_wide(base, offset, size_in_bytes, &head, &body);
+	ret = ioreg_read_batch_internal(base, offset, value_bits, head, buf);
+	if (ret) {
+		return ret;
+	}
+	for (i = head; i < head + body; i += 8) {
+		put_unaligned(readq_relaxed((void __iomem *)(addr + i)), (uint64_t *)(buf + i));
+	}
+	return ioreg_read_batch_internal(base, offset + head + body, value_bits,
+					 size_in_bytes - head - body, buf + head + body);
+}
+
+static int ioreg_write_batch_wide(void __iomem *base, uint64_t offset, int value_bits,
+				  size_t size_in_bytes, uint8_t *buf)
+{
+	size_t i, head, body;
+	uint8_t *addr = (uint8_t *)base + offset;
+	int ret;
+
+	if (value_bits >= 64) {
+		return ioreg_write_batch_internal(base, offset, value_bits, size_in_bytes, buf);
+	}
+
+	ioreg_batch_split_wide(base, offset, size_in_bytes, &head, &body);
+	ret = ioreg_write_batch_internal(base, offset, value_bits, head, buf);
+	if (ret) {
+		return ret;
+	}
+	for (i = head; i < head + body; i += 8) {
+		writeq_relaxed(get_unaligned((uint64_t *)(buf + i)), (void __iomem *)(addr + i));
+	}
+	return ioreg_write_batch_internal(base, offset + head + body, value_bits,
+					  size_in_bytes - head - body, buf + head + body);
+}
+
 static int ioreg_read_internal(void __iomem *base, uint64_t offset, int value_bits, uint64_t *value)
 {
 	void __iomem *addr = (void __iomem *)((uint8_t *)base + offset);
@@ -326,6 +437,53 @@ static int ioreg_write_internal(void __iomem *base, uint64_t offset, int value_b
 	return 0;
 }
 
+/*
+ * ioreg_write_scatter: Writes each (offset, value) pair of a WRITE_SCATTER
+ * entry to the block at native width, stopping at the first offset that does
+ * not fall within the block.
+ */
+static int ioreg_write_scatter(struct lwis_ioreg_device *ioreg_dev, struct lwis_ioreg *block,
+			       struct lwis_io_entry_write_scatter *scatter)
+{
+	int ret;
+	uint64_t offset;
+	const uint8_t *pair;
+	const uint8_t *end = scatter->buf + scatter->size_in_bytes;
+	const unsigned int value_bits = ioreg_dev->base_dev.native_value_bitwidth;
+	const unsigned int addr_bytes = ioreg_dev->base_dev.native_addr_bitwidth / BITS_PER_BYTE;
+	const unsigned int value_bytes = value_bits / BITS_PER_BYTE;
+	const unsigned int pair_bytes = addr_bytes + value_bytes;
+
+	if (!lwis_scatter_field_width_valid(addr_bytes) ||
+	    !lwis_scatter_field_width_valid(value_bytes)) {
+		dev_err(ioreg_dev->base_dev.dev,
+			"Scatter write of %u byte offsets and %u byte values\n", addr_bytes,
+			value_bytes);
+		return -EINVAL;
+	}
+	if (scatter->size_in_bytes % pair_bytes) {
+		dev_err(ioreg_dev->base_dev.dev,
+			"Scatter write size %zu is not a multiple of the pair size %u\n",
+			scatter->size_in_bytes, pair_bytes);
+		return -EINVAL;
+	}
+
+	for (pair = scatter->buf; pair < end; pair += pair_bytes) {
+		offset = lwis_scatter_field_get(pair, addr_bytes);
+		ret = validate_offset(ioreg_dev, block, offset, value_bytes, addr_bytes);
+		if (ret) {
+			return ret;
+		}
+		ret = ioreg_write_internal(block->base, offset, value_bits,
+					   lwis_scatter_field_get(pair + addr_bytes, value_bytes));
+		if (ret) {
+			return ret;
+		}
+	}
+
+	return 0;
+}
+
 int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entry,
 			   int access_size)
 {
@@ -363,9 +521,17 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 			return ret;
 		}
 
-		ret = ioreg_read_batch_internal(block->base, entry->rw_batch.offset,
-						ioreg_dev->base_dev.native_value_bitwidth,
-						entry->rw_batch.size_in_bytes, entry->rw_batch.buf);
+		if (block->wide_access) {
+			ret = ioreg_read_batch_wide(block->base, entry->rw_batch.offset,
+						    ioreg_dev->base_dev.native_value_bitwidth,
+						    entry->rw_batch.size_in_bytes,
+						    entry->rw_batch.buf);
+		} else {
+			ret = ioreg_read_batch_internal(block->base, entry->rw_batch.offset,
+							ioreg_dev->base_dev.native_value_bitwidth,
+							entry->rw_batch.size_in_bytes,
+							entry->rw_batch.buf);
+		}
 		if (ret) {
 			dev_err(ioreg_dev->base_dev.dev, "Invalid ioreg batch read at:\n");
 			dev_err(ioreg_dev->base_dev.dev, "Offset: 0x%llx, Base: %pK\n",
@@ -395,15 +561,34 @@ int lwis_ioreg_io_entry_rw(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_e
 				entry->rw_batch.offset);
 			return ret;
 		}
-		ret = ioreg_write_batch_internal(block->base, entry->rw_batch.offset,
-						 ioreg_dev->base_dev.native_value_bitwidth,
-						 entry->rw_batch.size_in_bytes,
-						 entry->rw_batch.buf);
+		if (block->wide_access) {
+			ret = ioreg_write_batch_wide(block->base, entry->rw_batch.offset,
+						     ioreg_dev->base_dev.native_value_bitwidth,
+						     entry->rw_batch.size_in_bytes,
+						     entry->rw_batch.buf);
+		} else {
+			ret = ioreg_write_batch_internal(block->base, entry->rw_batch.offset,
+							 ioreg_dev->base_dev.native_value_bitwidth,
+							 entry->rw_batch.size_in_bytes,
+							 entry->rw_batch.buf);
+		}
 		if (ret) {
 			dev_err(ioreg_dev->base_dev.dev, "Invalid ioreg batch write at:\n");
 			dev_err(ioreg_dev->base_dev.dev, "Offset: 0x%08llx, Base: %pK\n",
 				entry->rw_batch.offset, block->base);
 		}
+	} else if (entry->type == LWIS_IO_ENTRY_WRITE_SCATTER) {
+		index = entry->scatter.bid;
+		block = get_block_by_idx(ioreg_dev, index);
+		if (IS_ERR_OR_NULL(block)) {
+			return PTR_ERR(block);
+		}
+
+		ret = ioreg_write_scatter(ioreg_dev, block, &entry->scatter);
+		if (ret) {
+			dev_err(ioreg_dev->base_dev.dev, "Invalid ioreg scatter write at:\n");
+			dev_err(ioreg_dev->base_dev.dev, "Bid: %d, Base: %pK\n", index, block->base);
+		}
 	} else if (entry->type == LWIS_IO_ENTRY_MODIFY) {
 		ret = lwis_ioreg_read(ioreg_dev, entry->mod.bid, entry->mod.offset, &reg_value,
 				      access_size);
@@ -525,6 +710,242 @@ int lwis_ioreg_write(struct lwis_ioreg_device *ioreg_dev, int index, uint64_t of
 	return ioreg_write_internal(block->base, internal_offset, native_value_bitwidth, value);
 }
 
+static int compile_io_entry(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_entry *entry,
+			    struct lwis_ioreg_op *op)
+{
+	int ret;
+	int bid;
+	uint64_t offset;
+	size_t size_in_bytes;
+	struct lwis_ioreg *block;
+	const unsigned int value_bits = ioreg_dev->base_dev.native_value_bitwidth;
+	const int op_index = ilog2(value_bits / BITS_PER_BYTE);
+
+	if (entry->type == LWIS_IO_ENTRY_READ || entry->type == LWIS_IO_ENTRY_WRITE) {
+		bid = entry->rw.bid;
+		offset = entry->rw.offset;
+		size_in_bytes = value_bits / BITS_PER_BYTE;
+		op->opcode = (entry->type == LWIS_IO_ENTRY_READ) ? IOREG_OP_READ8 + op_index :
+								   IOREG_OP_WRITE8 + op_index;
+	} else if (entry->type == LWIS_IO_ENTRY_READ_BATCH ||
+		   entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+		bid = entry->rw_batch.bid;
+		offset = entry->rw_batch.offset;
+		size_in_bytes = entry->rw_batch.size_in_bytes;
+		if (size_in_bytes & (value_bits / BITS_PER_BYTE - 1)) {
+			return -EINVAL;
+		}
+		op->opcode = (entry->type == LWIS_IO_ENTRY_READ_BATCH) ? IOREG_OP_READ_BATCH :
+									 IOREG_OP_WRITE_BATCH;
+	} else {
+		/* Executed through lwis_ioreg_io_entry_rw */
+		op->opcode = IOREG_OP_NONE;
+		op->addr = NULL;
+		return 0;
+	}
+
+	block = get_block_by_idx(ioreg_dev, bid);
+	if (IS_ERR_OR_NULL(block)) {
+		return PTR_ERR(block);
+	}
+
+	ret = validate_offset(ioreg_dev, block, offset, size_in_bytes,
+			      ioreg_dev->base_dev.native_addr_bitwidth / BITS_PER_BYTE);
+	if (ret) {
+		return ret;
+	}
+
+	if (block->wide_access && op->opcode == IOREG_OP_READ_BATCH) {
+		op->opcode = IOREG_OP_READ_BATCH_WIDE;
+	} else if (block->wide_access && op->opcode == IOREG_OP_WRITE_BATCH) {
+		op->opcode = IOREG_OP_WRITE_BATCH_WIDE;
+	}
+
+	op->addr = (void __iomem *)((uint8_t *)block->base + offset);
+	return 0;
+}
+
+struct lwis_io_program *lwis_ioreg_io_program_compile(struct lwis_ioreg_device *ioreg_dev,
+						      struct lwis_io_entry *entries,
+						      int num_entries)
+{
+	int i;
+	int ret;
+	struct lwis_io_program *program;
+	const unsigned int value_bits = ioreg_dev->base_dev.native_value_bitwidth;
+
+	BUG_ON(!ioreg_dev);
+
+	if (num_entries <= 0) {
+		return NULL;
+	}
+
+	if (value_bits != 8 && value_bits != 16 && value_bits != 32 && value_bits != 64) {
+		return NULL;
+	}
+
+	program = kmalloc(struct_size(program, ops, num_entries), GFP_KERNEL);
+	if (!program) {
+		return NULL;
+	}
+
+	program->num_ops = num_entries;
+	for (i = 0; i < num_entries; ++i) {
+		ret = compile_io_entry(ioreg_dev, &entries[i], &program->ops[i]);
+		if (ret) {
+			/* Leave the error to be reported when the entry executes */
+			dev_warn(ioreg_dev->base_dev.dev,
+				 "Cannot compile io_entries[%d] (%d), executing uncompiled\n", i,
+				 ret);
+			kfree(program);
+			return NULL;
+		}
+	}
+
+	return program;
+}
+
+int lwis_ioreg_io_program_run(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_program *program,
+			      struct lwis_io_entry *entries, int first, int num_entries,
+			      int *num_completed)
+{
+	int i;
+	int ret = 0;
+	struct lwis_io_entry *entry;
+	const struct lwis_ioreg_op *op;
+	const unsigned int value_bits = ioreg_dev->base_dev.native_value_bitwidth;
+
+	*num_completed = 0;
+	if (first < 0 || num_entries < 0 || first + num_entries > program->num_ops) {
+		return -EINVAL;
+	}
+
+	op = &program->ops[first];
+	for (i = 0; i < num_entries; ++i, ++op) {
+		entry = &entries[i];
+		switch (op->opcode) {
+		case IOREG_OP_READ8:
+			entry->rw.val = readb_relaxed(op->addr);
+			break;
+		case IOREG_OP_READ16:
+			entry->rw.val = readw_relaxed(op->addr);
+			break;
+		case IOREG_OP_READ32:
+			entry->rw.val = readl_relaxed(op->addr);
+			break;
+		case IOREG_OP_READ64:
+			entry->rw.val = readq_relaxed(op->addr);
+			break;
+		case IOREG_OP_WRITE8:
+			writeb_relaxed((uint8_t)entry->rw.val, op->addr);
+			break;
+		case IOREG_OP_WRITE16:
+			writew_relaxed((uint16_t)entry->rw.val, op->addr);
+			break;
+		case IOREG_OP_WRITE32:
+			writel_relaxed((uint32_t)entry->rw.val, op->addr);
+			break;
+		case IOREG_OP_WRITE64:
+			writeq_relaxed(entry->rw.val, op->addr);
+			break;
+		case IOREG_OP_READ_BATCH:
+			ret = ioreg_read_batch_internal(op->addr, 0, value_bits,
+							entry->rw_batch.size_in_bytes,
+							entry->rw_batch.buf);
+			break;
+		case IOREG_OP_WRITE_BATCH:
+			ret = ioreg_write_batch_internal(op->addr, 0, value_bits,
+							 entry->rw_batch.size_in_bytes,
+							 entry->rw_batch.buf);
+			break;
+		case IOREG_OP_READ_BATCH_WIDE:
+			ret = ioreg_read_batch_wide(op->addr, 0, value_bits,
+						    entry->rw_batch.size_in_bytes,
+						    entry->rw_batch.buf);
+			break;
+		case IOREG_OP_WRITE_BATCH_WIDE:
+			ret = ioreg_write_batch_wide(op->addr, 0, value_bits,
+						     entry->rw_batch.size_in_bytes,
+						     entry->rw_batch.buf);
+			break;
+		default:
+			ret = lwis_ioreg_io_entry_rw(ioreg_dev, entry, value_bits);
+			break;
+		}
+		if (ret) {
+			dev_err(ioreg_dev->base_dev.dev, "ioreg program failed at entry %d (%d)\n",
+				first + i, ret);
+			break;
+		}
+	}
+	*num_completed = i;
+
+	return ret;
+}
+
+unsigned long lwis_ioreg_lock_blocks(struct lwis_ioreg_device *ioreg_dev,
+				     struct lwis_io_entry *entries, int num_entries)
+{
+	int i;
+	int bid;
+	unsigned int index;
+	unsigned long locked = 0;
+	struct lwis_ioreg_list *list = &ioreg_dev->reg_list;
+
+	for (i = 0; i < num_entries; ++i) {
+		switch (entries[i].type) {
+		case LWIS_IO_ENTRY_READ:
+		case LWIS_IO_ENTRY_WRITE:
+			bid = entries[i].rw.bid;
+			break;
+		case LWIS_IO_ENTRY_READ_BATCH:
+		case LWIS_IO_ENTRY_WRITE_BATCH:
+			bid = entries[i].rw_batch.bid;
+			break;
+		case LWIS_IO_ENTRY_MODIFY:
+			bid = entries[i].mod.bid;
+			break;
+		case LWIS_IO_ENTRY_POLL:
+		case LWIS_IO_ENTRY_READ_ASSERT:
+			bid = entries[i].read_assert.bid;
+			break;
+		case LWIS_IO_ENTRY_POLL_US:
+			bid = entries[i].poll.bid;
+			break;
+		case LWIS_IO_ENTRY_WRITE_SCATTER:
+			bid = entries[i].scatter.bid;
+			break;
+		case LWIS_IO_ENTRY_READ_TO_BUFFER:
+			bid = entries[i].read_to_buffer.bid;
+			break;
+		case LWIS_IO_ENTRY_READ_ASSERT_SKIP:
+			bid = entries[i].read_assert_skip.bid;
+			break;
+		default:
+			/* The bid of qos entries is unused, they access no block */
+			continue;
+		}
+		if (bid >= 0 && bid < list->count) {
+			locked |= BIT(block_lock_index(bid));
+		}
+	}
+
+	for_each_set_bit (index, &locked, BITS_PER_LONG) {
+		mutex_lock(&list->block[index].lock);
+	}
+	return locked;
+}
+
+void lwis_ioreg_unlock_blocks(struct lwis_ioreg_device *ioreg_dev, unsigned long locked)
+{
+	unsigned int index;
+	struct lwis_ioreg_list *list = &ioreg_dev->reg_list;
+
+	for_each_set_bit (index, &locked, BITS_PER_LONG) {
+		mutex_unlock(&list->block[index].lock);
+	}
+}
+
 int lwis_ioreg_set_io_barrier(struct lwis_ioreg_device *ioreg_dev, bool use_read_barrier,
 			      bool use_write_barrier)
 {
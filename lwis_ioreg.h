@@ -64,6 +64,40 @@ int lwis_ioreg_read(struct lwis_ioreg_device *ioreg_dev, int index, uint64_t off
 int lwis_ioreg_write(struct lwis_ioreg_device *ioreg_dev, int index, uint64_t offset,
 		     uint64_t value, int access_size);
 
+/*
+ *  lwis_ioreg_io_program_compile: Resolve and validate the register accesses of
+ *  a list of io entries once, for repeated execution.
+ *  Returns: program to be released with kfree, or NULL if the entries cannot
+ *  be compiled.
+ */
+struct lwis_io_program *lwis_ioreg_io_program_compile(struct lwis_ioreg_device *ioreg_dev,
+						      struct lwis_io_entry *entries,
+						      int num_entries);
+
+/*
+ *  lwis_ioreg_io_program_run: Execute entries [first, first + num_entries) of a
+ *  compiled program, entries pointing at io entry first.
+ *  The number of entries fully executed is stored in num_completed.
+ */
+int lwis_ioreg_io_program_run(struct lwis_ioreg_device *ioreg_dev, struct lwis_io_program *program,
+			      struct lwis_io_entry *entries, int first, int num_entries,
+			      int *num_completed);
+
+/*
+ *  lwis_ioreg_lock_blocks: Lock the blocks the io entries access, in ascending
+ *  block order so that executions accessing overlapping sets of blocks cannot
+ *  deadlock. Entries with an invalid bid fail before any access and lock
+ *  nothing.
+ *  Returns: mask of the locks taken, for lwis_ioreg_unlock_blocks.
+ */
+unsigned long lwis_ioreg_lock_blocks(struct lwis_ioreg_device *ioreg_dev,
+				     struct lwis_io_entry *entries, int num_entries);
+
+/*
+ *  lwis_ioreg_unlock_blocks: Unlock the blocks locked by lwis_ioreg_lock_blocks.
+ */
+void lwis_ioreg_unlock_blocks(struct lwis_ioreg_device *ioreg_dev, unsigned long locked);
+
 /*
  * lwis_ioreg_set_io_barrier: Use read/write memory barriers.
  */
@@ -0,0 +1,427 @@
+/*
+ * Google LWIS KUnit Benchmarks
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-kunit-bench: " fmt
+
+#include <kunit/test.h>
+#include <linux/delay.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+
+#include "lwis_commands.h"
+#include "lwis_device.h"
+#include "lwis_event.h"
+#include "lwis_ioreg.h"
+#include "lwis_kunit_fake.h"
+#include "lwis_latency.h"
+#include "lwis_periodic_io.h"
+#include "lwis_transaction.h"
+
+/*
+ * Every result is reported as one line
+ *   bench <name> <parameter>=<value> <metric>=<value> ...
+ * so that runs can be compared by scripts to catch regressions.
+ */
+
+/* Software events of device 0, outside of the generic range */
+#define BENCH_EVENT_ID 0x10000
+#define BENCH_TRIGGER_EVENT_ID 0x10001
+#define BENCH_SUCCESS_EVENT_ID 0x10002
+#define BENCH_ERROR_EVENT_ID 0x10003
+
+/* Emits between two drains of the client event queues */
+#define BENCH_EMIT_BATCH 64
+#define BENCH_EMIT_ITERATIONS 4096
+
+/* Trigger event counter the waiting transactions never reach */
+#define BENCH_FAR_EVENT_COUNTER (1LL << 40)
+#define BENCH_TRIGGER_ROUNDS 16
+
+#define BENCH_TX_PER_TYPE 64
+#define BENCH_TX_NUM_ENTRIES 16
+#define BENCH_TX_BATCH_BYTES 64
+
+#define BENCH_IO_ITERATIONS 256
+
+#define BENCH_PERIODIC_IO_PERIOD_NS (1000 * 1000)
+#define BENCH_PERIODIC_IO_NUM_PERIODS 200
+
+static int lwis_bench_init(struct kunit *test)
+{
+	test->priv = lwis_fake_ioreg_create(test);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, test->priv);
+	return 0;
+}
+
+static void lwis_bench_exit(struct kunit *test)
+{
+	lwis_fake_ioreg_destroy(test->priv);
+}
+
+static struct lwis_device *bench_lwis_dev(struct kunit *test)
+{
+	struct lwis_fake_ioreg *fake = test->priv;
+
+	return &fake->ioreg_dev.base_dev;
+}
+
+static struct lwis_client *bench_client_create(struct kunit *test)
+{
+	struct lwis_client *client = lwis_client_create(bench_lwis_dev(test));
+
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, client);
+	return client;
+}
+
+static void bench_event_queue_enable(struct kunit *test, struct lwis_client *client,
+				     int64_t event_id)
+{
+	struct lwis_event_control control = {
+		.event_id = event_id,
+		.flags = LWIS_EVENT_CONTROL_FLAG_QUEUE_ENABLE,
+	};
+
+	KUNIT_ASSERT_EQ(test, lwis_client_event_control_set(client, &control), 0);
+}
+
+static void bench_io_entry_init(struct lwis_io_entry *entry, int type, uint64_t offset,
+				uint8_t *buf)
+{
+	memset(entry, 0, sizeof(*entry));
+	entry->type = type;
+	switch (type) {
+	case LWIS_IO_ENTRY_READ_BATCH:
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		entry->rw_batch.offset = offset;
+		entry->rw_batch.size_in_bytes = BENCH_TX_BATCH_BYTES;
+		entry->rw_batch.buf = buf;
+		break;
+	case LWIS_IO_ENTRY_MODIFY:
+		entry->mod.offset = offset;
+		entry->mod.val = 0x5a5a;
+		entry->mod.val_mask = 0xffff;
+		break;
+	default:
+		entry->rw.offset = offset;
+		entry->rw.val = 0xa5a5a5a5;
+		break;
+	}
+}
+
+/*
+ * Allocates a transaction the way LWIS_TRANSACTION_SUBMIT does, with
+ * num_entries entries of the given type on consecutive registers.
+ */
+static struct lwis_transaction *bench_transaction_alloc(struct kunit *test, int64_t trigger_id,
+							int64_t trigger_counter, int type,
+							int num_entries)
+{
+	struct lwis_transaction *transaction;
+	struct lwis_io_entry *entries;
+	uint8_t *buf;
+	int i;
+
+	transaction = kzalloc(sizeof(*transaction), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, transaction);
+	entries = kvmalloc_array(num_entries, sizeof(*entries), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, entries);
+
+	for (i = 0; i < num_entries; ++i) {
+		buf = NULL;
+		if (type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			/* Write buffers are owned by the transaction */
+			buf = kvzalloc(BENCH_TX_BATCH_BYTES, GFP_KERNEL);
+			KUNIT_ASSERT_NOT_NULL(test, buf);
+		}
+		bench_io_entry_init(&entries[i], type, i * BENCH_TX_BATCH_BYTES, buf);
+	}
+
+	transaction->info.trigger_event_id = trigger_id;
+	transaction->info.trigger_event_counter = trigger_counter;
+	transaction->info.num_io_entries = num_entries;
+	transaction->info.io_entries = entries;
+	transaction->info.emit_success_event_id = BENCH_SUCCESS_EVENT_ID;
+	transaction->info.emit_error_event_id = BENCH_ERROR_EVENT_ID;
+	transaction->info.io_entries_handle = LWIS_IO_ENTRIES_HANDLE_NONE;
+	return transaction;
+}
+
+static void bench_transaction_submit(struct kunit *test, struct lwis_client *client,
+				     struct lwis_transaction *transaction)
+{
+	unsigned long flags;
+	int ret;
+
+	ret = lwis_transaction_prepare(client, transaction);
+	KUNIT_ASSERT_EQ(test, ret, 0);
+	spin_lock_irqsave(&client->transaction_lock, flags);
+	ret = lwis_transaction_submit_locked(client, transaction);
+	spin_unlock_irqrestore(&client->transaction_lock, flags);
+	KUNIT_ASSERT_EQ(test, ret, 0);
+}
+
+/* Cost of emitting an event to every client listening to it */
+static void lwis_bench_event_emit(struct kunit *test)
+{
+	static const int num_clients[] = { 1, 4, 16 };
+	struct lwis_client *clients[16];
+	struct lwis_device *lwis_dev = bench_lwis_dev(test);
+	u64 start_ns;
+	u64 total_ns;
+	int i, j, k;
+
+	for (i = 0; i < ARRAY_SIZE(num_clients); ++i) {
+		for (j = 0; j < num_clients[i]; ++j) {
+			clients[j] = bench_client_create(test);
+			bench_event_queue_enable(test, clients[j], BENCH_EVENT_ID);
+		}
+
+		total_ns = 0;
+		for (j = 0; j < BENCH_EMIT_ITERATIONS; j += BENCH_EMIT_BATCH) {
+			start_ns = ktime_get_ns();
+			for (k = 0; k < BENCH_EMIT_BATCH; ++k) {
+				lwis_device_event_emit(lwis_dev, BENCH_EVENT_ID, NULL, 0,
+						       /*in_irq=*/false);
+			}
+			total_ns += ktime_get_ns() - start_ns;
+			for (k = 0; k < num_clients[i]; ++k) {
+				lwis_client_event_queue_clear(clients[k]);
+			}
+		}
+		kunit_info(test, "bench event_emit clients=%d ns_per_op=%llu\n", num_clients[i],
+			   div_u64(total_ns, BENCH_EMIT_ITERATIONS));
+
+		for (j = 0; j < num_clients[i]; ++j) {
+			lwis_release_client(clients[j]);
+		}
+	}
+}
+
+/*
+ * Cost of the trigger of one transaction while depth - 1 other ones wait for
+ * a later occurrence of the same event
+ */
+static void lwis_bench_transaction_trigger(struct kunit *test)
+{
+	static const int depths[] = { 1, 16, 256 };
+	struct lwis_client *client = bench_client_create(test);
+	struct lwis_device *lwis_dev = bench_lwis_dev(test);
+	struct list_head pending_events;
+	u64 start_ns;
+	u64 total_ns;
+	int i, j, round;
+
+	for (i = 0; i < ARRAY_SIZE(depths); ++i) {
+		total_ns = 0;
+		for (round = 0; round < BENCH_TRIGGER_ROUNDS; ++round) {
+			for (j = 1; j < depths[i]; ++j) {
+				bench_transaction_submit(
+					test, client,
+					bench_transaction_alloc(test, BENCH_TRIGGER_EVENT_ID,
+								BENCH_FAR_EVENT_COUNTER + j,
+								LWIS_IO_ENTRY_WRITE, 1));
+			}
+			bench_transaction_submit(
+				test, client,
+				bench_transaction_alloc(test, BENCH_TRIGGER_EVENT_ID,
+							LWIS_EVENT_COUNTER_ON_NEXT_OCCURRENCE,
+							LWIS_IO_ENTRY_WRITE, 1));
+
+			INIT_LIST_HEAD(&pending_events);
+			start_ns = ktime_get_ns();
+			lwis_transaction_event_trigger(client, BENCH_TRIGGER_EVENT_ID, round + 1,
+						       &pending_events, /*in_irq=*/false);
+			total_ns += ktime_get_ns() - start_ns;
+
+			lwis_pending_events_emit(lwis_dev, &pending_events, /*in_irq=*/false);
+			/* Cancels the waiting transactions */
+			lwis_transaction_client_flush(client);
+			lwis_client_event_queue_clear(client);
+		}
+		kunit_info(test, "bench transaction_trigger depth=%d ns_per_op=%llu\n", depths[i],
+			   div_u64(total_ns, BENCH_TRIGGER_ROUNDS));
+	}
+
+	lwis_release_client(client);
+}
+
+/* Execution time of immediate transactions per I/O entry, by entry type */
+static void lwis_bench_transaction_process(struct kunit *test)
+{
+	static const struct {
+		int type;
+		const char *name;
+	} types[] = {
+		{ LWIS_IO_ENTRY_READ, "read" },
+		{ LWIS_IO_ENTRY_WRITE, "write" },
+		{ LWIS_IO_ENTRY_MODIFY, "modify" },
+		{ LWIS_IO_ENTRY_READ_BATCH, "read_batch" },
+		{ LWIS_IO_ENTRY_WRITE_BATCH, "write_batch" },
+	};
+	struct lwis_client *client = bench_client_create(test);
+	struct lwis_latency_histogram *execution = &client->latency.stages[LWIS_LATENCY_EXECUTION];
+	struct lwis_transaction *transaction;
+	u64 count;
+	int i, j;
+
+	for (i = 0; i < ARRAY_SIZE(types); ++i) {
+		lwis_latency_reset(&client->latency);
+		for (j = 0; j < BENCH_TX_PER_TYPE; ++j) {
+			transaction = bench_transaction_alloc(test, LWIS_EVENT_ID_NONE, 0,
+							      types[i].type, BENCH_TX_NUM_ENTRIES);
+			bench_transaction_submit(test, client, transaction);
+		}
+		lwis_transaction_client_flush(client);
+
+		count = atomic64_read(&execution->count);
+		KUNIT_EXPECT_EQ(test, count, (u64)BENCH_TX_PER_TYPE);
+		if (count) {
+			kunit_info(test, "bench transaction_process type=%s ns_per_entry=%llu\n",
+				   types[i].name,
+				   div_u64(atomic64_read(&execution->total_ns),
+					   count * BENCH_TX_NUM_ENTRIES));
+		}
+	}
+
+	lwis_release_client(client);
+}
+
+/* Bandwidth of batch register accesses on the memory backed ioreg device */
+static void lwis_bench_ioreg_batch(struct kunit *test)
+{
+	static const size_t sizes[] = { 4, 64, 1024, 16384 };
+	struct lwis_fake_ioreg *fake = test->priv;
+	struct lwis_device *lwis_dev = &fake->ioreg_dev.base_dev;
+	struct lwis_io_entry entry;
+	uint8_t *buf;
+	u64 read_ns;
+	u64 write_ns;
+	u64 start_ns;
+	int i, j;
+
+	buf = kunit_kzalloc(test, sizes[ARRAY_SIZE(sizes) - 1], GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, buf);
+
+	for (i = 0; i < ARRAY_SIZE(sizes); ++i) {
+		memset(&entry, 0, sizeof(entry));
+		entry.rw_batch.size_in_bytes = sizes[i];
+		entry.rw_batch.buf = buf;
+
+		entry.type = LWIS_IO_ENTRY_WRITE_BATCH;
+		start_ns = ktime_get_ns();
+		for (j = 0; j < BENCH_IO_ITERATIONS; ++j) {
+			KUNIT_ASSERT_EQ(test,
+					lwis_ioreg_io_entry_rw(&fake->ioreg_dev, &entry,
+							       lwis_dev->native_value_bitwidth),
+					0);
+		}
+		write_ns = ktime_get_ns() - start_ns;
+
+		entry.type = LWIS_IO_ENTRY_READ_BATCH;
+		start_ns = ktime_get_ns();
+		for (j = 0; j < BENCH_IO_ITERATIONS; ++j) {
+			KUNIT_ASSERT_EQ(test,
+					lwis_ioreg_io_entry_rw(&fake->ioreg_dev, &entry,
+							       lwis_dev->native_value_bitwidth),
+					0);
+		}
+		read_ns = ktime_get_ns() - start_ns;
+
+		kunit_info(test,
+			   "bench ioreg_batch bytes=%zu write_ns_per_op=%llu read_ns_per_op=%llu\n",
+			   sizes[i], div_u64(write_ns, BENCH_IO_ITERATIONS),
+			   div_u64(read_ns, BENCH_IO_ITERATIONS));
+	}
+}
+
+/* Deviation of the interval between two periodic io responses from the period */
+static void lwis_bench_periodic_io_jitter(struct kunit *test)
+{
+	struct lwis_client *client = bench_client_create(test);
+	struct lwis_periodic_io *periodic_io;
+	struct lwis_io_entry *entry;
+	struct lwis_event_entry *event;
+	int64_t prev_ns = 0;
+	u64 jitter_ns;
+	u64 total_jitter_ns = 0;
+	u64 max_jitter_ns = 0;
+	int num_intervals = 0;
+	int num_events = 0;
+
+	periodic_io = kzalloc(sizeof(*periodic_io), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, periodic_io);
+	entry = kvzalloc(sizeof(*entry), GFP_KERNEL);
+	KUNIT_ASSERT_NOT_NULL(test, entry);
+	bench_io_entry_init(entry, LWIS_IO_ENTRY_READ, 0, NULL);
+	periodic_io->info.batch_size = 1;
+	periodic_io->info.period_ns = BENCH_PERIODIC_IO_PERIOD_NS;
+	periodic_io->info.num_io_entries = 1;
+	periodic_io->info.io_entries = entry;
+	periodic_io->info.emit_success_event_id = BENCH_SUCCESS_EVENT_ID;
+	periodic_io->info.emit_error_event_id = BENCH_ERROR_EVENT_ID;
+	periodic_io->info.io_entries_handle = LWIS_IO_ENTRIES_HANDLE_NONE;
+
+	bench_event_queue_enable(test, client, BENCH_SUCCESS_EVENT_ID);
+	if (lwis_periodic_io_submit(client, periodic_io)) {
+		lwis_periodic_io_clean(periodic_io);
+		lwis_release_client(client);
+		KUNIT_FAIL(test, "Failed to submit the periodic io\n");
+		return;
+	}
+	msleep(div_u64((u64)BENCH_PERIODIC_IO_PERIOD_NS * BENCH_PERIODIC_IO_NUM_PERIODS,
+		       NSEC_PER_MSEC));
+	lwis_periodic_io_cancel(client, periodic_io->info.id);
+
+	while (lwis_client_event_pop_front(client, &event) == 0) {
+		num_events++;
+		if (prev_ns) {
+			jitter_ns = abs(event->event_info.timestamp_ns - prev_ns -
+					BENCH_PERIODIC_IO_PERIOD_NS);
+			total_jitter_ns += jitter_ns;
+			max_jitter_ns = max(max_jitter_ns, jitter_ns);
+			num_intervals++;
+		}
+		prev_ns = event->event_info.timestamp_ns;
+		lwis_event_entry_free(event);
+	}
+
+	KUNIT_EXPECT_GT(test, num_intervals, 0);
+	if (num_intervals) {
+		kunit_info(test,
+			   "bench periodic_io_jitter period_ns=%d responses=%d "
+			   "mean_ns=%llu max_ns=%llu\n",
+			   BENCH_PERIODIC_IO_PERIOD_NS, num_events,
+			   div_u64(total_jitter_ns, num_intervals), max_jitter_ns);
+	}
+
+	lwis_release_client(client);
+}
+
+static struct kunit_case lwis_bench_cases[] = {
+	KUNIT_CASE(lwis_bench_event_emit),
+	KUNIT_CASE(lwis_bench_transaction_trigger),
+	KUNIT_CASE(lwis_bench_transaction_process),
+	KUNIT_CASE(lwis_bench_ioreg_batch),
+	KUNIT_CASE(lwis_bench_periodic_io_jitter),
+	{}
+};
+
+static struct kunit_suite lwis_bench_suite = {
+	.name = "lwis-bench",
+	.init = lwis_bench_init,
+	.exit = lwis_bench_exit,
+	.test_cases = lwis_bench_cases,
+};
+
+kunit_test_suites(&lwis_bench_suite);
@@ -0,0 +1,196 @@
+/*
+ * Google LWIS KUnit Fake Devices
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-kunit-fake: " fmt
+
+#include <linux/hashtable.h>
+#include <linux/i2c.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/wait.h>
+
+#include "lwis_event.h"
+#include "lwis_i2c.h"
+#include "lwis_ioreg.h"
+#include "lwis_kunit_fake.h"
+
+/* Big-endian register offset at the start of every write message */
+#define FAKE_I2C_OFFSET_BYTES 2
+
+static int fake_i2c_master_xfer(struct i2c_adapter *adapter, struct i2c_msg *msgs, int num)
+{
+	int i;
+	int j;
+	unsigned int offset = 0;
+	struct lwis_fake_i2c *fake = i2c_get_adapdata(adapter);
+
+	fake->num_transfers++;
+	for (i = 0; i < num; ++i) {
+		if (msgs[i].flags & I2C_M_RD) {
+			/* Reads continue from the offset of the write before them */
+			for (j = 0; j < msgs[i].len; ++j) {
+				if (offset + j >= LWIS_FAKE_I2C_NUM_REGS) {
+					return -EIO;
+				}
+				msgs[i].buf[j] = fake->regs[offset + j];
+			}
+			continue;
+		}
+		if (msgs[i].len < FAKE_I2C_OFFSET_BYTES) {
+			return -EIO;
+		}
+		offset = (msgs[i].buf[0] << 8) | msgs[i].buf[1];
+		for (j = FAKE_I2C_OFFSET_BYTES; j < msgs[i].len; ++j) {
+			if (offset + j - FAKE_I2C_OFFSET_BYTES >= LWIS_FAKE_I2C_NUM_REGS) {
+				return -EIO;
+			}
+			fake->regs[offset + j - FAKE_I2C_OFFSET_BYTES] = msgs[i].buf[j];
+			fake->num_writes[offset + j - FAKE_I2C_OFFSET_BYTES]++;
+		}
+	}
+	return num;
+}
+
+static u32 fake_i2c_functionality(struct i2c_adapter *adapter)
+{
+	return I2C_FUNC_I2C;
+}
+
+static const struct i2c_algorithm fake_i2c_algorithm = {
+	.master_xfer = fake_i2c_master_xfer,
+	.functionality = fake_i2c_functionality,
+};
+
+struct lwis_fake_i2c *lwis_fake_i2c_create(struct kunit *test)
+{
+	struct lwis_fake_i2c *fake;
+	struct lwis_i2c_device *i2c_dev;
+	struct lwis_device *lwis_dev;
+
+	fake = kunit_kzalloc(test, sizeof(*fake), GFP_KERNEL);
+	if (!fake) {
+		return NULL;
+	}
+
+	fake->adapter.owner = THIS_MODULE;
+	fake->adapter.algo = &fake_i2c_algorithm;
+	strscpy(fake->adapter.name, "lwis-fake-i2c", sizeof(fake->adapter.name));
+	i2c_set_adapdata(&fake->adapter, fake);
+	if (i2c_add_adapter(&fake->adapter)) {
+		pr_err("Failed to add fake i2c adapter\n");
+		return NULL;
+	}
+	fake->client.adapter = &fake->adapter;
+	fake->client.addr = 0x10;
+
+	i2c_dev = &fake->i2c_dev;
+	i2c_dev->adapter = &fake->adapter;
+	i2c_dev->client = &fake->client;
+	i2c_dev->address = fake->client.addr;
+	i2c_dev->max_burst_bytes = I2C_DEFAULT_MAX_BURST_BYTES;
+
+	lwis_dev = &i2c_dev->base_dev;
+	lwis_dev->type = DEVICE_TYPE_I2C;
+	strscpy(lwis_dev->name, "fake-i2c", sizeof(lwis_dev->name));
+	lwis_dev->native_addr_bitwidth = FAKE_I2C_OFFSET_BYTES * BITS_PER_BYTE;
+	lwis_dev->native_value_bitwidth = 8;
+	lwis_dev->skip_unchanged_writes = true;
+	mutex_init(&lwis_dev->client_lock);
+	mutex_init(&lwis_dev->reg_rw_lock);
+	INIT_LIST_HEAD(&lwis_dev->clients);
+	hash_init(lwis_dev->event_states);
+	spin_lock_init(&lwis_dev->lock);
+	init_waitqueue_head(&lwis_dev->event_wait_queue);
+
+	/* Freed by lwis_i2c_transfer_deinit, as with ranges from the device tree */
+	i2c_dev->shadow_ranges = kcalloc(1, sizeof(*i2c_dev->shadow_ranges), GFP_KERNEL);
+	if (!i2c_dev->shadow_ranges) {
+		i2c_del_adapter(&fake->adapter);
+		return NULL;
+	}
+	i2c_dev->shadow_ranges[0].start = 0;
+	i2c_dev->shadow_ranges[0].end = LWIS_FAKE_I2C_NUM_REGS - 1;
+	i2c_dev->num_shadow_ranges = 1;
+
+	if (lwis_i2c_transfer_init(i2c_dev)) {
+		lwis_i2c_transfer_deinit(i2c_dev);
+		i2c_del_adapter(&fake->adapter);
+		return NULL;
+	}
+
+	return fake;
+}
+
+void lwis_fake_i2c_destroy(struct lwis_fake_i2c *fake)
+{
+	if (!fake) {
+		return;
+	}
+	lwis_i2c_transfer_deinit(&fake->i2c_dev);
+	i2c_del_adapter(&fake->adapter);
+}
+
+struct lwis_fake_ioreg *lwis_fake_ioreg_create(struct kunit *test)
+{
+	struct lwis_fake_ioreg *fake;
+	struct lwis_ioreg *block;
+	struct lwis_device *lwis_dev;
+
+	fake = kunit_kzalloc(test, sizeof(*fake), GFP_KERNEL);
+	if (!fake) {
+		return NULL;
+	}
+	fake->regs = kunit_kzalloc(test, LWIS_FAKE_IOREG_SIZE, GFP_KERNEL);
+	if (!fake->regs) {
+		return NULL;
+	}
+
+	if (lwis_ioreg_list_alloc(&fake->ioreg_dev, 1)) {
+		return NULL;
+	}
+	block = &fake->ioreg_dev.reg_list.block[0];
+	block->start = 0;
+	block->size = LWIS_FAKE_IOREG_SIZE;
+	block->base = (void __iomem *)fake->regs;
+	block->name = "fake";
+	block->wide_access = true;
+
+	lwis_dev = &fake->ioreg_dev.base_dev;
+	lwis_ioreg_device_ops_set(&fake->ioreg_dev);
+	strscpy(lwis_dev->name, "fake-ioreg", sizeof(lwis_dev->name));
+	/* Events without a device ID in them belong to device 0 */
+	lwis_dev->id = 0;
+	lwis_dev->native_addr_bitwidth = 32;
+	lwis_dev->native_value_bitwidth = 32;
+	mutex_init(&lwis_dev->client_lock);
+	mutex_init(&lwis_dev->reg_rw_lock);
+	INIT_LIST_HEAD(&lwis_dev->clients);
+	hash_init(lwis_dev->event_states);
+	spin_lock_init(&lwis_dev->lock);
+	init_waitqueue_head(&lwis_dev->event_wait_queue);
+
+	return fake;
+}
+
+void lwis_fake_ioreg_destroy(struct lwis_fake_ioreg *fake)
+{
+	unsigned long flags;
+
+	if (!fake) {
+		return;
+	}
+	spin_lock_irqsave(&fake->ioreg_dev.base_dev.lock, flags);
+	lwis_device_event_states_clear_locked(&fake->ioreg_dev.base_dev);
+	spin_unlock_irqrestore(&fake->ioreg_dev.base_dev.lock, flags);
+	lwis_ioreg_list_free(&fake->ioreg_dev);
+}
@@ -0,0 +1,88 @@
+/*
+ * Google LWIS KUnit Fake Devices
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_KUNIT_FAKE_H_
+#define LWIS_KUNIT_FAKE_H_
+
+#include <kunit/test.h>
+#include <linux/types.h>
+
+#include "lwis_device_i2c.h"
+#include "lwis_device_ioreg.h"
+
+/* Register file of the fake i2c device: 16-bit offsets, 8-bit values */
+#define LWIS_FAKE_I2C_NUM_REGS 256
+
+/*
+ *  struct lwis_fake_i2c
+ *  I2C device on an adapter that emulates the register file of a sensor,
+ *  whose registers are cacheable so that unchanged writes can be skipped.
+ */
+struct lwis_fake_i2c {
+	struct lwis_i2c_device i2c_dev;
+	struct i2c_adapter adapter;
+	struct i2c_client client;
+	uint8_t regs[LWIS_FAKE_I2C_NUM_REGS];
+	/* Number of times each register was written on the bus */
+	int num_writes[LWIS_FAKE_I2C_NUM_REGS];
+	/* Number of calls into the adapter */
+	int num_transfers;
+};
+
+/*
+ * lwis_fake_i2c_create: Registers an adapter emulating a register file and
+ * creates an I2C device on it, with the shadow covering every register and
+ * skip_unchanged_writes set. The device is not probed, it only has what the
+ * register access paths use.
+ *
+ * Alloc: Yes, freed with lwis_fake_i2c_destroy
+ * Returns: fake device, or NULL on failure
+ */
+struct lwis_fake_i2c *lwis_fake_i2c_create(struct kunit *test);
+
+/*
+ * lwis_fake_i2c_destroy: Frees the transfer buffers and the shadow of a
+ * device from lwis_fake_i2c_create and removes its adapter, the rest is freed
+ * with the test.
+ */
+void lwis_fake_i2c_destroy(struct lwis_fake_i2c *fake);
+
+/* Size of the register block of the fake ioreg device */
+#define LWIS_FAKE_IOREG_SIZE (64 * 1024)
+
+/*
+ *  struct lwis_fake_ioreg
+ *  IOREG device whose only register block is backed by memory, with 32-bit
+ *  offsets and values, and the operations of a probed ioreg device.
+ */
+struct lwis_fake_ioreg {
+	struct lwis_ioreg_device ioreg_dev;
+	void *regs;
+};
+
+/*
+ * lwis_fake_ioreg_create: Creates an ioreg device on a memory block of
+ * LWIS_FAKE_IOREG_SIZE bytes, as bid 0. The device is not probed, it has what
+ * the register access, event, transaction and periodic io paths use, so that
+ * clients can be created with lwis_client_create.
+ *
+ * Alloc: Yes, freed with lwis_fake_ioreg_destroy
+ * Returns: fake device, or NULL on failure
+ */
+struct lwis_fake_ioreg *lwis_fake_ioreg_create(struct kunit *test);
+
+/*
+ * lwis_fake_ioreg_destroy: Frees the block list and the event states of a
+ * device from lwis_fake_ioreg_create, whose clients must have been released.
+ * The rest is freed with the test.
+ */
+void lwis_fake_ioreg_destroy(struct lwis_fake_ioreg *fake);
+
+#endif /* LWIS_KUNIT_FAKE_H_ */
@@ -0,0 +1,152 @@
+/*
+ * Google LWIS KUnit Regression Tests
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-kunit: " fmt
+
+#include <kunit/test.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include "lwis_commands.h"
+#include "lwis_i2c.h"
+#include "lwis_kunit_fake.h"
+
+static void io_entry_rw_init(struct lwis_io_entry *entry, int type, uint64_t offset, uint64_t val)
+{
+	memset(entry, 0, sizeof(*entry));
+	entry->type = type;
+	entry->rw.bid = 0;
+	entry->rw.offset = offset;
+	entry->rw.val = val;
+}
+
+static void io_entry_batch_init(struct lwis_io_entry *entry, int type, uint64_t offset,
+				uint8_t *buf, size_t size_in_bytes)
+{
+	memset(entry, 0, sizeof(*entry));
+	entry->type = type;
+	entry->rw_batch.bid = 0;
+	entry->rw_batch.offset = offset;
+	entry->rw_batch.buf = buf;
+	entry->rw_batch.size_in_bytes = size_in_bytes;
+}
+
+static int lwis_i2c_test_init(struct kunit *test)
+{
+	test->priv = lwis_fake_i2c_create(test);
+	KUNIT_ASSERT_NOT_ERR_OR_NULL(test, test->priv);
+	return 0;
+}
+
+static void lwis_i2c_test_exit(struct kunit *test)
+{
+	lwis_fake_i2c_destroy(test->priv);
+}
+
+/* Writes a register outside of a group, leaving its shadow value valid */
+static void fake_i2c_prime(struct kunit *test, struct lwis_fake_i2c *fake, uint64_t offset,
+			   uint64_t val)
+{
+	struct lwis_io_entry entry;
+
+	io_entry_rw_init(&entry, LWIS_IO_ENTRY_WRITE, offset, val);
+	KUNIT_ASSERT_EQ(test, lwis_i2c_io_entry_rw(&fake->i2c_dev, &entry), 0);
+	KUNIT_ASSERT_EQ(test, fake->regs[offset], (uint8_t)val);
+}
+
+/*
+ * A write whose value matches the shadow is only skipped when no earlier
+ * entry of its group writes the same register, as the shadow does not see
+ * the group until it is transferred.
+ */
+static void lwis_i2c_group_duplicate_write_test(struct kunit *test)
+{
+	struct lwis_fake_i2c *fake = test->priv;
+	struct lwis_io_entry entries[2];
+	int num_completed;
+	int num_writes;
+
+	fake_i2c_prime(test, fake, 0x10, 1);
+	num_writes = fake->num_writes[0x10];
+
+	io_entry_rw_init(&entries[0], LWIS_IO_ENTRY_WRITE, 0x10, 2);
+	io_entry_rw_init(&entries[1], LWIS_IO_ENTRY_WRITE, 0x10, 1);
+	KUNIT_ASSERT_EQ(test, lwis_i2c_io_entries_rw(&fake->i2c_dev, entries, 2, &num_completed),
+			0);
+	KUNIT_EXPECT_EQ(test, num_completed, 2);
+	KUNIT_EXPECT_EQ(test, fake->regs[0x10], (uint8_t)1);
+	KUNIT_EXPECT_EQ(test, fake->num_writes[0x10], num_writes + 2);
+
+	/* Without the earlier write in the group, the unchanged write is skipped */
+	KUNIT_ASSERT_EQ(test, lwis_i2c_io_entries_rw(&fake->i2c_dev, &entries[1], 1,
+						     &num_completed),
+			0);
+	KUNIT_EXPECT_EQ(test, num_completed, 1);
+	KUNIT_EXPECT_EQ(test, fake->num_writes[0x10], num_writes + 2);
+}
+
+static void lwis_i2c_group_batch_overlap_test(struct kunit *test)
+{
+	struct lwis_fake_i2c *fake = test->priv;
+	struct lwis_io_entry entries[2];
+	uint8_t batch[2] = { 7, 9 };
+	int num_completed;
+
+	fake_i2c_prime(test, fake, 0x11, 5);
+
+	io_entry_batch_init(&entries[0], LWIS_IO_ENTRY_WRITE_BATCH, 0x10, batch, sizeof(batch));
+	io_entry_rw_init(&entries[1], LWIS_IO_ENTRY_WRITE, 0x11, 5);
+	KUNIT_ASSERT_EQ(test, lwis_i2c_io_entries_rw(&fake->i2c_dev, entries, 2, &num_completed),
+			0);
+	KUNIT_EXPECT_EQ(test, num_completed, 2);
+	KUNIT_EXPECT_EQ(test, fake->regs[0x10], (uint8_t)7);
+	KUNIT_EXPECT_EQ(test, fake->regs[0x11], (uint8_t)5);
+}
+
+static void lwis_i2c_scatter_duplicate_write_test(struct kunit *test)
+{
+	struct lwis_fake_i2c *fake = test->priv;
+	struct lwis_io_entry entry;
+	/* Host order (offset, value) pairs of a 16-bit offset, 8-bit value device */
+	uint8_t pairs[2 * (sizeof(uint16_t) + sizeof(uint8_t))];
+	uint16_t offset = 0x12;
+	int num_writes;
+
+	fake_i2c_prime(test, fake, offset, 3);
+	num_writes = fake->num_writes[offset];
+
+	memcpy(&pairs[0], &offset, sizeof(offset));
+	pairs[2] = 4;
+	memcpy(&pairs[3], &offset, sizeof(offset));
+	pairs[5] = 3;
+	memset(&entry, 0, sizeof(entry));
+	entry.type = LWIS_IO_ENTRY_WRITE_SCATTER;
+	entry.scatter.buf = pairs;
+	entry.scatter.size_in_bytes = sizeof(pairs);
+	KUNIT_ASSERT_EQ(test, lwis_i2c_io_entry_rw(&fake->i2c_dev, &entry), 0);
+	KUNIT_EXPECT_EQ(test, fake->regs[offset], (uint8_t)3);
+	KUNIT_EXPECT_EQ(test, fake->num_writes[offset], num_writes + 2);
+}
+
+static struct kunit_case lwis_i2c_test_cases[] = {
+	KUNIT_CASE(lwis_i2c_group_duplicate_write_test),
+	KUNIT_CASE(lwis_i2c_group_batch_overlap_test),
+	KUNIT_CASE(lwis_i2c_scatter_duplicate_write_test),
+	{}
+};
+
+static struct kunit_suite lwis_i2c_test_suite = {
+	.name = "lwis-i2c",
+	.init = lwis_i2c_test_init,
+	.exit = lwis_i2c_test_exit,
+	.test_cases = lwis_i2c_test_cases,
+};
+
+kunit_test_suites(&lwis_i2c_test_suite);
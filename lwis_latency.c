@@ -0,0 +1,96 @@
+/*
+ * Google LWIS Latency Histograms
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-latency: " fmt
+
+#include <linux/bitops.h>
+#include <linux/kernel.h>
+#include <linux/math64.h>
+#include <linux/string.h>
+
+#include "lwis_device.h"
+#include "lwis_latency.h"
+
+static const char *const stage_names[LWIS_LATENCY_NUM_STAGES] = {
+	[LWIS_LATENCY_SUBMIT_TO_TRIGGER] = "submit_to_trigger",
+	[LWIS_LATENCY_TRIGGER_TO_START] = "trigger_to_start",
+	[LWIS_LATENCY_EXECUTION] = "execution",
+	[LWIS_LATENCY_EMIT_TO_DEQUEUE] = "emit_to_dequeue",
+};
+
+static void histogram_record(struct lwis_latency_histogram *hist, int64_t latency_ns)
+{
+	int64_t max_ns;
+	int64_t old_max_ns;
+	u64 latency_us;
+	int bucket;
+
+	if (latency_ns < 0) {
+		latency_ns = 0;
+	}
+	latency_us = div_u64(latency_ns, NSEC_PER_USEC);
+	bucket = min(fls64(latency_us), LWIS_LATENCY_NUM_BUCKETS - 1);
+
+	atomic64_inc(&hist->buckets[bucket]);
+	atomic64_inc(&hist->count);
+	atomic64_add(latency_ns, &hist->total_ns);
+
+	max_ns = atomic64_read(&hist->max_ns);
+	while (latency_ns > max_ns) {
+		old_max_ns = atomic64_cmpxchg(&hist->max_ns, max_ns, latency_ns);
+		if (old_max_ns == max_ns) {
+			break;
+		}
+		max_ns = old_max_ns;
+	}
+}
+
+void lwis_latency_record(struct lwis_client *client, enum lwis_latency_stage stage,
+			 int64_t latency_ns)
+{
+	histogram_record(&client->latency.stages[stage], latency_ns);
+	histogram_record(&client->lwis_dev->latency.stages[stage], latency_ns);
+}
+
+void lwis_latency_reset(struct lwis_latency_stats *stats)
+{
+	struct lwis_latency_histogram *hist;
+	int i, j;
+
+	for (i = 0; i < LWIS_LATENCY_NUM_STAGES; ++i) {
+		hist = &stats->stages[i];
+		for (j = 0; j < LWIS_LATENCY_NUM_BUCKETS; ++j) {
+			atomic64_set(&hist->buckets[j], 0);
+		}
+		atomic64_set(&hist->count, 0);
+		atomic64_set(&hist->total_ns, 0);
+		atomic64_set(&hist->max_ns, 0);
+	}
+}
+
+void lwis_latency_print(struct lwis_latency_stats *stats, const char *owner, char *buffer,
+			size_t buffer_size)
+{
+	struct lwis_latency_histogram *hist;
+	size_t len = strlen(buffer);
+	int i, j;
+
+	for (i = 0; i < LWIS_LATENCY_NUM_STAGES; ++i) {
+		hist = &stats->stages[i];
+		len += scnprintf(buffer + len, buffer_size - len, "%s %s %lld %lld %lld", owner,
+				 stage_names[i], atomic64_read(&hist->count),
+				 atomic64_read(&hist->total_ns), atomic64_read(&hist->max_ns));
+		for (j = 0; j < LWIS_LATENCY_NUM_BUCKETS; ++j) {
+			len += scnprintf(buffer + len, buffer_size - len, " %lld",
+					 atomic64_read(&hist->buckets[j]));
+		}
+		len += scnprintf(buffer + len, buffer_size - len, "\n");
+	}
+}
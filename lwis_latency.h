@@ -0,0 +1,70 @@
+/*
+ * Google LWIS Latency Histograms
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_LATENCY_H_
+#define LWIS_LATENCY_H_
+
+#include <linux/atomic.h>
+#include <linux/types.h>
+
+/* LWIS forward declarations */
+struct lwis_client;
+
+/* Bucket 0 counts the latencies under 1us, bucket i the ones in
+ * [2^(i-1), 2^i) us and the last bucket all the longer ones */
+#define LWIS_LATENCY_NUM_BUCKETS 24
+
+enum lwis_latency_stage {
+	/* From the submission of a transaction to its trigger event */
+	LWIS_LATENCY_SUBMIT_TO_TRIGGER,
+	/* From the trigger, or the submission of an immediate transaction, to
+	 * the start of its execution */
+	LWIS_LATENCY_TRIGGER_TO_START,
+	/* Execution of the I/O entries of a transaction */
+	LWIS_LATENCY_EXECUTION,
+	/* From the emission of an event to its dequeue by the client */
+	LWIS_LATENCY_EMIT_TO_DEQUEUE,
+	LWIS_LATENCY_NUM_STAGES
+};
+
+/* Counters are updated without a lock from any context, a reader may see a
+ * sample counted in one of them and not yet in the others */
+struct lwis_latency_histogram {
+	atomic64_t buckets[LWIS_LATENCY_NUM_BUCKETS];
+	atomic64_t count;
+	atomic64_t total_ns;
+	atomic64_t max_ns;
+};
+
+struct lwis_latency_stats {
+	struct lwis_latency_histogram stages[LWIS_LATENCY_NUM_STAGES];
+};
+
+/*
+ * lwis_latency_record: Counts a latency sample of the stage in the histograms
+ * of the client and of its device.
+ */
+void lwis_latency_record(struct lwis_client *client, enum lwis_latency_stage stage,
+			 int64_t latency_ns);
+
+/*
+ * lwis_latency_reset: Clears the histograms.
+ */
+void lwis_latency_reset(struct lwis_latency_stats *stats);
+
+/*
+ * lwis_latency_print: Appends one line per stage of the histograms to buffer,
+ * as the owner name, the stage name, the count, total and max latency in ns
+ * then the bucket counts, separated by spaces.
+ */
+void lwis_latency_print(struct lwis_latency_stats *stats, const char *owner, char *buffer,
+			size_t buffer_size);
+
+#endif /* LWIS_LATENCY_H_ */
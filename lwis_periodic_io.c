@@ -13,48 +13,79 @@
 #include "lwis_periodic_io.h"
 
 #include <linux/completion.h>
+#include <linux/log2.h>
+#include <linux/mm.h>
 #include <linux/slab.h>
+#include <linux/vmalloc.h>
 #include <linux/workqueue.h>
 
 #include "lwis_event.h"
 #include "lwis_ioreg.h"
+#include "lwis_trace.h"
 #include "lwis_transaction.h"
+#include "lwis_uploaded_io.h"
 #include "lwis_util.h"
 
 static enum hrtimer_restart periodic_io_timer_func(struct hrtimer *timer)
 {
-	ktime_t interval;
+	u64 overrun;
+	int64_t due_periods;
 	unsigned long flags;
 	struct list_head *it_period, *it_period_tmp;
 	struct lwis_periodic_io_list *periodic_io_list;
 	struct lwis_periodic_io *periodic_io;
-	struct lwis_periodic_io_proxy *periodic_io_proxy;
 	struct lwis_client *client;
 	bool active_periodic_io_present = false;
+	bool queue_work_needed = false;
 
 	periodic_io_list = container_of(timer, struct lwis_periodic_io_list, hr_timer);
 	client = periodic_io_list->client;
 
+	/* The timer is forwarded from its previous expiry rather than from now,
+	 * so the deadlines do not drift when the interrupt is served late. The
+	 * overrun is the number of timer periods elapsed since then. */
+	overrun = hrtimer_forward_now(timer, ktime_set(0, periodic_io_list->period_ns));
+	trace_lwis_periodic_io_timer(client->lwis_dev, periodic_io_list->period_ns, overrun);
+
 	/* Go through all periodic io under the chosen periodic list */
 	spin_lock_irqsave(&client->periodic_io_lock, flags);
+	periodic_io_list->expiries += overrun;
 	list_for_each_safe (it_period, it_period_tmp, &periodic_io_list->list) {
 		periodic_io = list_entry(it_period, struct lwis_periodic_io, timer_list_node);
-		if (periodic_io->active) {
-			periodic_io_proxy =
-				kmalloc(sizeof(struct lwis_periodic_io_proxy), GFP_NOWAIT);
-			if (!periodic_io_proxy) {
-				/* Non-fatal, skip this period */
-				pr_warn("Cannot allocate new periodic io proxy.\n");
-			} else {
-				periodic_io_proxy->periodic_io = periodic_io;
-				list_add_tail(&periodic_io_proxy->process_queue_node,
-					      &client->periodic_io_process_queue);
-				active_periodic_io_present = true;
-			}
+		if (!periodic_io->active) {
+			continue;
+		}
+		active_periodic_io_present = true;
+
+		periodic_io->ticks += overrun;
+		due_periods = periodic_io->ticks / periodic_io->divisor;
+		periodic_io->ticks %= periodic_io->divisor;
+		if (due_periods == 0) {
+			continue;
+		}
+		periodic_io->missed_periods += due_periods - 1;
+		lwis_stats_add(client->lwis_dev, LWIS_STAT_PERIODIC_IO_MISSED_PERIODS,
+			       due_periods - 1);
+		if (!(periodic_io->info.flags & LWIS_PERIODIC_IO_FLAG_ABSOLUTE_DEADLINE)) {
+			due_periods = 1;
+		}
+
+		/* The periodic io counts its own expired periods, so it is
+		 * queued at most once and no period is dropped */
+		if (periodic_io->queued_periods == 0) {
+			list_add_tail(&periodic_io->process_queue_node,
+				      &client->periodic_io_process_queue);
 		}
+		periodic_io->queued_periods += due_periods;
+		queue_work_needed = true;
 	}
-	if (active_periodic_io_present) {
-		queue_work(client->periodic_io_wq, &client->periodic_io_work);
+	if (queue_work_needed) {
+		if (client->lwis_dev->rt_worker) {
+			kthread_queue_work(client->lwis_dev->rt_worker,
+					   &client->periodic_io_rt_work);
+		} else {
+			queue_work(client->periodic_io_wq, &client->periodic_io_work);
+		}
 	}
 	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
 	if (!active_periodic_io_present) {
@@ -62,22 +93,27 @@ static enum hrtimer_restart periodic_io_timer_func(struct hrtimer *timer)
 		return HRTIMER_NORESTART;
 	}
 
-	interval = ktime_set(0, periodic_io_list->period_ns);
-	hrtimer_forward_now(timer, interval);
-
 	return HRTIMER_RESTART;
 }
 
+/*
+ * Finds the timer with the longest period that divides period_ns, so periodic
+ * ios whose periods are multiples of each other share one timer interrupt.
+ */
 static struct lwis_periodic_io_list *periodic_io_list_find(struct lwis_client *client,
 							   int64_t period_ns)
 {
+	int i;
 	struct lwis_periodic_io_list *list;
-	hash_for_each_possible (client->timer_list, list, node, period_ns) {
-		if (list->period_ns == period_ns) {
-			return list;
+	struct lwis_periodic_io_list *best = NULL;
+
+	hash_for_each (client->timer_list, i, list, node) {
+		if (period_ns % list->period_ns == 0 &&
+		    (best == NULL || list->period_ns > best->period_ns)) {
+			best = list;
 		}
 	}
-	return NULL;
+	return best;
 }
 
 /* Calling this function requires holding the client's periodic_io_lock */
@@ -95,6 +131,7 @@ static struct lwis_periodic_io_list *periodic_io_list_create_locked(struct lwis_
 	periodic_io_list->client = client;
 	periodic_io_list->period_ns = period_ns;
 	periodic_io_list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
+	periodic_io_list->expiries = 0;
 
 	/* Initialize the periodic io list and add this timer/periodic_io_list
 	 * into the client timer list */
@@ -121,13 +158,14 @@ periodic_io_list_find_or_create_locked(struct lwis_client *client, int64_t perio
 		return periodic_io_list_create_locked(client, period_ns);
 	}
 
-	/* If there is already a timer with the same period and it is inactive,
-	 * then restart the timer */
+	/* If there is already a timer with a compatible period and it is
+	 * inactive, then restart the timer. It is started from now rather than
+	 * from its last expiry, otherwise all the periods since it stopped
+	 * would be accounted as missed. */
 	if (list->hr_timer_state == LWIS_HRTIMER_INACTIVE) {
 		list->hr_timer_state = LWIS_HRTIMER_ACTIVE;
-		/* If this does not restart the hrtimer properly, consider
-		 * repeating the steps when starting a new timer. */
-		hrtimer_restart(&list->hr_timer);
+		list->expiries = 0;
+		hrtimer_start(&list->hr_timer, ktime_set(0, list->period_ns), HRTIMER_MODE_REL);
 	}
 	return list;
 }
@@ -147,19 +185,124 @@ static void push_periodic_io_error_event_locked(struct lwis_periodic_io *periodi
 	resp.batch_size = 0;
 	resp.num_entries_per_period = 0;
 	resp.results_size_bytes = 0;
-
+	resp.missed_periods = periodic_io->missed_periods;
+	periodic_io->missed_periods = 0;
+	resp.ring_start_offset = 0;
+	resp.ring_end_offset = 0;
+
+	if (periodic_io->resp_v1) {
+		struct lwis_periodic_io_response_header_v1 resp_v1 = {
+			.id = resp.id,
+			.error_code = resp.error_code,
+		};
+
+		lwis_pending_event_push(pending_events, info->emit_error_event_id, &resp_v1,
+					sizeof(resp_v1));
+		return;
+	}
 	lwis_pending_event_push(pending_events, info->emit_error_event_id, &resp, sizeof(resp));
 }
 
-static int process_io_entries(struct lwis_client *client,
-			      struct lwis_periodic_io_proxy *periodic_io_proxy,
-			      struct list_head *list_node, struct list_head *pending_events)
+/*
+ * push_periodic_io_response: Pushes the response of resp_size bytes, with
+ * struct lwis_periodic_io_response_header_v1 in place of the current header
+ * if the periodic io was submitted with the first version layout.
+ */
+static void push_periodic_io_response(struct lwis_periodic_io *periodic_io, int64_t event_id,
+				      size_t resp_size, struct list_head *pending_events)
+{
+	struct lwis_periodic_io_response_header *resp = periodic_io->resp;
+	struct lwis_periodic_io_response_header header;
+	struct lwis_periodic_io_response_header_v1 *resp_v1;
+	const size_t shift = sizeof(*resp) - sizeof(*resp_v1);
+
+	if (!periodic_io->resp_v1) {
+		lwis_pending_event_push(pending_events, event_id, (void *)resp, resp_size);
+		return;
+	}
+
+	/* Write the shorter header right before the results, the push copies
+	 * the payload so the current header can be restored right after */
+	header = *resp;
+	resp_v1 = (struct lwis_periodic_io_response_header_v1 *)((uint8_t *)resp + shift);
+	resp_v1->id = header.id;
+	resp_v1->error_code = header.error_code;
+	resp_v1->batch_size = header.batch_size;
+	resp_v1->num_entries_per_period = header.num_entries_per_period;
+	resp_v1->results_size_bytes = header.results_size_bytes;
+	lwis_pending_event_push(pending_events, event_id, (void *)resp_v1, resp_size - shift);
+	*resp = header;
+}
+
+/*
+ * periodic_io_ring_reserve: Reserves room for a record of record_size bytes in
+ * the ring, after a padding record if it would not fit before the end of the
+ * data. The record is only visible to userspace once committed.
+ *
+ * Alloc: No
+ * Returns: the record, or NULL if userspace has not consumed enough of the ring
+ */
+static struct lwis_periodic_io_ring_record *
+periodic_io_ring_reserve(struct lwis_periodic_io_ring *ring, size_t record_size,
+			 uint64_t *record_offset)
+{
+	uint64_t read_offset = smp_load_acquire(&ring->header->read_offset);
+	uint64_t write_offset = ring->write_offset;
+	uint64_t used = write_offset - read_offset;
+	uint32_t pos = write_offset & (ring->data_size - 1);
+	uint32_t tail_room = ring->data_size - pos;
+	size_t needed = record_size > tail_room ? record_size + tail_room : record_size;
+	struct lwis_periodic_io_ring_record *padding;
+
+	/* A read offset ahead of the write offset is bogus, and is handled as a
+	 * full ring just like one that is too far behind */
+	if (used > ring->data_size || needed > ring->data_size - used) {
+		return NULL;
+	}
+
+	if (record_size > tail_room) {
+		if (tail_room >= sizeof(struct lwis_periodic_io_ring_record)) {
+			padding = (struct lwis_periodic_io_ring_record *)(ring->data + pos);
+			padding->id = LWIS_ID_INVALID;
+			padding->size = tail_room;
+			padding->flags = LWIS_PERIODIC_IO_RING_RECORD_FLAG_PADDING;
+		}
+		write_offset += tail_room;
+		pos = 0;
+	}
+
+	*record_offset = write_offset;
+	return (struct lwis_periodic_io_ring_record *)(ring->data + pos);
+}
+
+static void periodic_io_ring_commit(struct lwis_periodic_io_ring *ring, uint64_t record_offset,
+				    size_t record_size)
+{
+	ring->write_offset = record_offset + record_size;
+	/* Publish the record contents before the new write offset */
+	smp_store_release(&ring->header->write_offset, ring->write_offset);
+}
+
+static int periodic_io_register_io(struct lwis_device *lwis_dev,
+				   struct lwis_periodic_io *periodic_io, int index)
+{
+	int num_completed;
+	struct lwis_io_entry *entry = &periodic_io->info.io_entries[index];
+
+	if (periodic_io->program && entry->type != LWIS_IO_ENTRY_MODIFY) {
+		return lwis_dev->vops.register_io_program_run(lwis_dev, periodic_io->program, entry,
+							      index, 1, &num_completed);
+	}
+	return lwis_dev->vops.register_io(lwis_dev, entry, lwis_dev->native_value_bitwidth);
+}
+
+static int process_io_entries(struct lwis_client *client, struct lwis_periodic_io *periodic_io,
+			      struct list_head *pending_events)
 {
 	int i;
 	int ret = 0;
 	struct lwis_io_entry *entry;
 	struct lwis_device *lwis_dev = client->lwis_dev;
-	struct lwis_periodic_io *periodic_io = periodic_io_proxy->periodic_io;
 	struct lwis_periodic_io_info *info = &periodic_io->info;
 	struct lwis_periodic_io_response_header *resp = periodic_io->resp;
 	size_t resp_size;
@@ -167,9 +310,29 @@ static int process_io_entries(struct lwis_client *client,
 	struct lwis_periodic_io_result *io_result;
 	const int reg_value_bytewidth = lwis_dev->native_value_bitwidth / 8;
 	unsigned long flags;
-
-	read_buf = (uint8_t *)resp + sizeof(struct lwis_periodic_io_response_header) +
-		   periodic_io->batch_count * (resp->results_size_bytes / info->batch_size);
+	unsigned long locked;
+	struct lwis_periodic_io_ring *ring = NULL;
+	struct lwis_periodic_io_ring_record *record = NULL;
+	uint64_t record_offset = 0;
+	size_t record_size = 0;
+
+	if (info->flags & LWIS_PERIODIC_IO_FLAG_RING) {
+		ring = client->periodic_io_ring;
+		if (periodic_io->batch_count == 0) {
+			periodic_io->ring_start_offset = ring->write_offset;
+		}
+		record_size = ALIGN(sizeof(struct lwis_periodic_io_ring_record) +
+					    periodic_io->period_results_size,
+				    sizeof(uint64_t));
+		record = periodic_io_ring_reserve(ring, record_size, &record_offset);
+		/* The results of a period that does not fit in the ring are
+		 * read into the response buffer, then dropped */
+		read_buf = record ? record->results :
+				    (uint8_t *)resp + sizeof(struct lwis_periodic_io_response_header);
+	} else {
+		read_buf = (uint8_t *)resp + sizeof(struct lwis_periodic_io_response_header) +
+			   periodic_io->batch_count * periodic_io->period_results_size;
+	}
 
 	/* Use write memory barrier at the beginning of I/O entries if the access protocol
 	 * allows it */
@@ -179,7 +342,9 @@ static int process_io_entries(struct lwis_client *client,
 						   /*use_write_barrier=*/true);
 	}
 
-	mutex_lock(&lwis_dev->reg_rw_lock);
+	trace_lwis_periodic_io_begin(lwis_dev, info->id, info->num_io_entries);
+	locked = lwis_device_register_lock(lwis_dev, info->io_entries, info->num_io_entries,
+					   /*skip_unchanged_writes=*/false);
 	reinit_completion(&periodic_io->io_done);
 	for (i = 0; i < info->num_io_entries; ++i) {
 		/* Abort if periodic io is deactivated during processing.
@@ -191,11 +356,21 @@ static int process_io_entries(struct lwis_client *client,
 			goto event_push;
 		}
 		entry = &info->io_entries[i];
-		if (entry->type == LWIS_IO_ENTRY_WRITE ||
-		    entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
-		    entry->type == LWIS_IO_ENTRY_MODIFY) {
-			ret = lwis_dev->vops.register_io(lwis_dev, entry,
-							 lwis_dev->native_value_bitwidth);
+		if (entry->type == LWIS_IO_ENTRY_WRITE && lwis_dev->vops.register_write_burst) {
+			ret = lwis_dev->vops.register_write_burst(lwis_dev, entry,
+								  info->num_io_entries - i);
+			if (ret < 0) {
+				resp->error_code = ret;
+				goto event_push;
+			}
+			/* Skip over the entries written as part of the burst */
+			i += ret - 1;
+			ret = 0;
+		} else if (entry->type == LWIS_IO_ENTRY_WRITE ||
+			   entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
+			   entry->type == LWIS_IO_ENTRY_WRITE_SCATTER ||
+			   entry->type == LWIS_IO_ENTRY_MODIFY) {
+			ret = periodic_io_register_io(lwis_dev, periodic_io, i);
 			if (ret) {
 				resp->error_code = ret;
 				goto event_push;
@@ -206,8 +381,7 @@ static int process_io_entries(struct lwis_client *client,
 			io_result->io_result.offset = entry->rw.offset;
 			io_result->io_result.num_value_bytes = reg_value_bytewidth;
 			io_result->timestamp_ns = ktime_to_ns(lwis_get_time());
-			ret = lwis_dev->vops.register_io(lwis_dev, entry,
-							 lwis_dev->native_value_bitwidth);
+			ret = periodic_io_register_io(lwis_dev, periodic_io, i);
 			if (ret) {
 				resp->error_code = ret;
 				goto event_push;
@@ -222,15 +396,15 @@ static int process_io_entries(struct lwis_client *client,
 			io_result->io_result.num_value_bytes = entry->rw_batch.size_in_bytes;
 			entry->rw_batch.buf = io_result->io_result.values;
 			io_result->timestamp_ns = ktime_to_ns(lwis_get_time());
-			ret = lwis_dev->vops.register_io(lwis_dev, entry,
-							 lwis_dev->native_value_bitwidth);
+			ret = periodic_io_register_io(lwis_dev, periodic_io, i);
 			if (ret) {
 				resp->error_code = ret;
 				goto event_push;
 			}
 			read_buf += sizeof(struct lwis_periodic_io_result) +
 				    io_result->io_result.num_value_bytes;
-		} else if (entry->type == LWIS_IO_ENTRY_POLL) {
+		} else if (entry->type == LWIS_IO_ENTRY_POLL ||
+			   entry->type == LWIS_IO_ENTRY_POLL_US) {
 			ret = lwis_entry_poll(lwis_dev, entry, /*non_blocking=*/false);
 			if (ret) {
 				resp->error_code = ret;
@@ -250,25 +424,36 @@ static int process_io_entries(struct lwis_client *client,
 	}
 	periodic_io->batch_count++;
 	resp->batch_size = periodic_io->batch_count;
+	if (record) {
+		record->id = info->id;
+		record->size = record_size;
+		record->flags = 0;
+		periodic_io_ring_commit(ring, record_offset, record_size);
+	} else if (ring) {
+		spin_lock_irqsave(&client->periodic_io_lock, flags);
+		periodic_io->missed_periods++;
+		spin_unlock_irqrestore(&client->periodic_io_lock, flags);
+		lwis_stats_add(lwis_dev, LWIS_STAT_PERIODIC_IO_MISSED_PERIODS, 1);
+	}
 
 event_push:
 	complete(&periodic_io->io_done);
-	mutex_unlock(&lwis_dev->reg_rw_lock);
+	lwis_device_register_unlock(lwis_dev, locked);
+	trace_lwis_periodic_io_end(lwis_dev, info->id, resp->error_code);
+	lwis_stats_add(lwis_dev, LWIS_STAT_PERIODIC_IO_RUNS, 1);
 	/* Use read memory barrier at the beginning of I/O entries if the access protocol
 	 * allows it */
 	if (lwis_dev->vops.register_io_barrier != NULL) {
 		lwis_dev->vops.register_io_barrier(lwis_dev, /*use_read_barrier=*/true,
 						   /*use_write_barrier=*/false);
 	}
-	resp_size = sizeof(struct lwis_periodic_io_response_header) +
-		    periodic_io->batch_count * (resp->results_size_bytes / info->batch_size);
-	/* Always remove the process_queue_node from the client
-	 * periodic_io_process_queue */
-	if (list_node) {
-		spin_lock_irqsave(&client->periodic_io_lock, flags);
-		list_del(list_node);
-		kfree(periodic_io_proxy);
-		spin_unlock_irqrestore(&client->periodic_io_lock, flags);
+	/* With a ring, the results are not part of the event payload */
+	resp_size = sizeof(struct lwis_periodic_io_response_header);
+	if (ring) {
+		resp->ring_start_offset = periodic_io->ring_start_offset;
+		resp->ring_end_offset = ring->write_offset;
+	} else {
+		resp_size += periodic_io->batch_count * periodic_io->period_results_size;
 	}
 	/* Only push when the periodic io is executed for batch_size times or
 	 * there is an error */
@@ -285,17 +470,25 @@ event_push:
 		 * size. Push error event, which also copies resp. */
 		resp->results_size_bytes =
 			resp_size - sizeof(struct lwis_periodic_io_response_header);
-		lwis_pending_event_push(pending_events, info->emit_error_event_id, (void *)resp,
-					resp_size);
 
 		/* Flag the periodic io as inactive */
 		spin_lock_irqsave(&client->periodic_io_lock, flags);
 		periodic_io->active = false;
+		resp->missed_periods = periodic_io->missed_periods;
+		periodic_io->missed_periods = 0;
 		spin_unlock_irqrestore(&client->periodic_io_lock, flags);
+
+		push_periodic_io_response(periodic_io, info->emit_error_event_id, resp_size,
+					  pending_events);
 	} else {
 		if (periodic_io->batch_count == info->batch_size) {
-			lwis_pending_event_push(pending_events, info->emit_success_event_id,
-						(void *)resp, resp_size);
+			spin_lock_irqsave(&client->periodic_io_lock, flags);
+			resp->missed_periods = periodic_io->missed_periods;
+			periodic_io->missed_periods = 0;
+			spin_unlock_irqrestore(&client->periodic_io_lock, flags);
+
+			push_periodic_io_response(periodic_io, info->emit_success_event_id,
+						  resp_size, pending_events);
 			periodic_io->batch_count = 0;
 			resp->batch_size = 0;
 		}
@@ -303,34 +496,37 @@ event_push:
 	return ret;
 }
 
-static void periodic_io_work_func(struct work_struct *work)
+static void process_periodic_io_queue(struct lwis_client *client)
 {
 	int error_code;
 	unsigned long flags;
 	struct lwis_periodic_io *periodic_io;
-	struct lwis_periodic_io_proxy *periodic_io_proxy;
-	struct list_head *it_period, *it_period_tmp;
-	struct lwis_client *client = container_of(work, struct lwis_client, periodic_io_work);
 	struct list_head pending_events;
 	INIT_LIST_HEAD(&pending_events);
 
 	spin_lock_irqsave(&client->periodic_io_lock, flags);
-	list_for_each_safe (it_period, it_period_tmp, &client->periodic_io_process_queue) {
-		periodic_io_proxy =
-			list_entry(it_period, struct lwis_periodic_io_proxy, process_queue_node);
-		periodic_io = periodic_io_proxy->periodic_io;
+	while (!list_empty(&client->periodic_io_process_queue)) {
+		periodic_io = list_first_entry(&client->periodic_io_process_queue,
+					       struct lwis_periodic_io, process_queue_node);
+		list_del(&periodic_io->process_queue_node);
 		/* Error indicates the cancellation of the periodic io */
 		if (periodic_io->resp->error_code || !periodic_io->active) {
 			error_code = periodic_io->resp->error_code ? periodic_io->resp->error_code :
 									   -ECANCELED;
-			list_del(&periodic_io_proxy->process_queue_node);
-			kfree(periodic_io_proxy);
+			/* The remaining periods are dropped with it */
+			periodic_io->queued_periods = 0;
 			push_periodic_io_error_event_locked(periodic_io, error_code,
 							    &pending_events);
 		} else {
+			/* Process one period, periodic ios with more periods
+			 * pending go back to the tail so they keep interleaving
+			 * with the others */
+			if (--periodic_io->queued_periods > 0) {
+				list_add_tail(&periodic_io->process_queue_node,
+					      &client->periodic_io_process_queue);
+			}
 			spin_unlock_irqrestore(&client->periodic_io_lock, flags);
-			process_io_entries(client, periodic_io_proxy,
-					   &periodic_io_proxy->process_queue_node, &pending_events);
+			process_io_entries(client, periodic_io, &pending_events);
 			spin_lock_irqsave(&client->periodic_io_lock, flags);
 		}
 	}
@@ -340,6 +536,16 @@ static void periodic_io_work_func(struct work_struct *work)
 				 /*in_irq=*/false);
 }
 
+static void periodic_io_work_func(struct work_struct *work)
+{
+	process_periodic_io_queue(container_of(work, struct lwis_client, periodic_io_work));
+}
+
+static void periodic_io_rt_work_func(struct kthread_work *work)
+{
+	process_periodic_io_queue(container_of(work, struct lwis_client, periodic_io_rt_work));
+}
+
 static int prepare_emit_events(struct lwis_client *client, struct lwis_periodic_io *periodic_io)
 {
 	struct lwis_periodic_io_info *info = &periodic_io->info;
@@ -371,6 +577,8 @@ static int prepare_response(struct lwis_client *client, struct lwis_periodic_io
 	int read_entries = 0;
 	const int reg_value_bytewidth = client->lwis_dev->native_value_bitwidth / 8;
 	unsigned long flags;
+	struct lwis_periodic_io_ring *ring = client->periodic_io_ring;
+	bool use_ring = info->flags & LWIS_PERIODIC_IO_FLAG_RING;
 
 	spin_lock_irqsave(&client->periodic_io_lock, flags);
 	info->id = client->periodic_io_counter;
@@ -387,12 +595,31 @@ static int prepare_response(struct lwis_client *client, struct lwis_periodic_io
 		}
 	}
 
-	/* Periodic io response payload consists of one response header and
-	 * batch_size of batches, each of which contains num_entries_per_period
-	 * pairs of lwis_periodic_io_result and its read_buf. */
-	resp_size = sizeof(struct lwis_periodic_io_response_header) +
-		    read_entries * sizeof(struct lwis_periodic_io_result) * info->batch_size +
-		    read_buf_size * info->batch_size;
+	periodic_io->period_results_size =
+		read_entries * sizeof(struct lwis_periodic_io_result) + read_buf_size;
+
+	if (use_ring) {
+		if (!ring) {
+			pr_err_ratelimited("Periodic io ring is not set up\n");
+			return -ENODEV;
+		}
+		if (ALIGN(sizeof(struct lwis_periodic_io_ring_record) +
+				  periodic_io->period_results_size,
+			  sizeof(uint64_t)) > ring->data_size) {
+			pr_err_ratelimited("Periodic io results do not fit in the ring\n");
+			return -EINVAL;
+		}
+		/* Only one period is buffered here, for when the ring is full */
+		resp_size = sizeof(struct lwis_periodic_io_response_header) +
+			    periodic_io->period_results_size;
+	} else {
+		/* Periodic io response payload consists of one response header
+		 * and batch_size of batches, each of which contains
+		 * num_entries_per_period pairs of lwis_periodic_io_result and
+		 * its read_buf. */
+		resp_size = sizeof(struct lwis_periodic_io_response_header) +
+			    periodic_io->period_results_size * info->batch_size;
+	}
 	periodic_io->resp = kmalloc(resp_size, GFP_KERNEL);
 	if (!periodic_io->resp) {
 		pr_err_ratelimited("Cannot allocate periodic io response\n");
@@ -402,9 +629,11 @@ static int prepare_response(struct lwis_client *client, struct lwis_periodic_io
 	periodic_io->resp->error_code = 0;
 	periodic_io->resp->id = info->id;
 	periodic_io->resp->num_entries_per_period = read_entries;
+	periodic_io->resp->missed_periods = 0;
+	periodic_io->resp->ring_start_offset = 0;
+	periodic_io->resp->ring_end_offset = 0;
 	periodic_io->resp->results_size_bytes =
-		read_entries * sizeof(struct lwis_periodic_io_result) * info->batch_size +
-		read_buf_size * info->batch_size;
+		use_ring ? 0 : periodic_io->period_results_size * info->batch_size;
 
 	periodic_io->batch_count = 0;
 	return 0;
@@ -426,6 +655,12 @@ static int queue_periodic_io_locked(struct lwis_client *client,
 		return -EINVAL;
 	}
 	periodic_io->periodic_io_list = periodic_io_list;
+	periodic_io->divisor = period_ns / periodic_io_list->period_ns;
+	/* Divided periods are anchored at the start of the timer rather than
+	 * at the current timer period, so periodic ios of the same period stay
+	 * in phase and are due on the same expiries */
+	periodic_io->ticks = periodic_io_list->expiries % periodic_io->divisor;
+	periodic_io->missed_periods = 0;
 	list_add_tail(&periodic_io->timer_list_node, &periodic_io_list->list);
 	client->periodic_io_counter++;
 	return 0;
@@ -434,12 +669,23 @@ static int queue_periodic_io_locked(struct lwis_client *client,
 void lwis_periodic_io_clean(struct lwis_periodic_io *periodic_io)
 {
 	int i;
-	for (i = 0; i < periodic_io->info.num_io_entries; ++i) {
-		if (periodic_io->info.io_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
-			kfree(periodic_io->info.io_entries[i].rw_batch.buf);
+	uint8_t **write_buf;
+	size_t write_size;
+
+	if (periodic_io->uploaded) {
+		/* The program belongs to the uploaded entries */
+		lwis_uploaded_io_entries_free(periodic_io->uploaded, periodic_io->info.io_entries);
+	} else {
+		for (i = 0; i < periodic_io->info.num_io_entries; ++i) {
+			write_buf = lwis_io_entry_write_buf(&periodic_io->info.io_entries[i],
+							    &write_size);
+			if (write_buf) {
+				kvfree(*write_buf);
+			}
 		}
+		kvfree(periodic_io->info.io_entries);
+		kfree(periodic_io->program);
 	}
-	kfree(periodic_io->info.io_entries);
 
 	/* resp may not be allocated before the periodic_io is successfully
 	 * submitted */
@@ -454,7 +700,9 @@ int lwis_periodic_io_init(struct lwis_client *client)
 	INIT_LIST_HEAD(&client->periodic_io_process_queue);
 	client->periodic_io_wq = create_workqueue("lwisperiod");
 	INIT_WORK(&client->periodic_io_work, periodic_io_work_func);
+	kthread_init_work(&client->periodic_io_rt_work, periodic_io_rt_work_func);
 	client->periodic_io_counter = 0;
+	client->periodic_io_ring = NULL;
 	hash_init(client->timer_list);
 	return 0;
 }
@@ -467,11 +715,22 @@ int lwis_periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io
 	struct lwis_periodic_io_info *info = &periodic_io->info;
 	struct lwis_io_entry *entry;
 
+	if (info->period_ns <= 0 || info->batch_size <= 0) {
+		pr_err_ratelimited("Invalid period %lld or batch size %d\n", info->period_ns,
+				   info->batch_size);
+		return -EINVAL;
+	}
+	if (info->flags & ~(LWIS_PERIODIC_IO_FLAG_ABSOLUTE_DEADLINE | LWIS_PERIODIC_IO_FLAG_RING)) {
+		pr_err_ratelimited("Invalid periodic io flags 0x%x\n", info->flags);
+		return -EINVAL;
+	}
+
 	periodic_io->contains_multiple_writes = false;
 	for (i = 0; i < info->num_io_entries; ++i) {
 		entry = &info->io_entries[i];
 		if (entry->type == LWIS_IO_ENTRY_WRITE ||
 		    entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
+		    entry->type == LWIS_IO_ENTRY_WRITE_SCATTER ||
 		    entry->type == LWIS_IO_ENTRY_MODIFY) {
 			if (has_one_write) {
 				periodic_io->contains_multiple_writes = true;
@@ -481,6 +740,15 @@ int lwis_periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io
 		}
 	}
 
+	/* Periodic IOs run the same entries on every period, resolve and
+	 * validate their register accesses once here */
+	if (periodic_io->uploaded) {
+		periodic_io->program = periodic_io->uploaded->program;
+	} else if (client->lwis_dev->vops.register_io_compile) {
+		periodic_io->program = client->lwis_dev->vops.register_io_compile(
+			client->lwis_dev, info->io_entries, info->num_io_entries);
+	}
+
 	ret = prepare_emit_events(client, periodic_io);
 	if (ret)
 		return ret;
@@ -493,6 +761,8 @@ int lwis_periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io
 	init_completion(&periodic_io->io_done);
 	complete(&periodic_io->io_done);
 	periodic_io->active = true;
+	periodic_io->queued_periods = 0;
+	INIT_LIST_HEAD(&periodic_io->process_queue_node);
 	spin_lock_irqsave(&client->periodic_io_lock, flags);
 	ret = queue_periodic_io_locked(client, periodic_io);
 	spin_unlock_irqrestore(&client->periodic_io_lock, flags);
@@ -525,6 +795,9 @@ int lwis_periodic_io_client_flush(struct lwis_client *client)
 	if (client->periodic_io_wq) {
 		drain_workqueue(client->periodic_io_wq);
 	}
+	if (client->lwis_dev->rt_worker) {
+		kthread_flush_work(&client->periodic_io_rt_work);
+	}
 	spin_lock_irqsave(&client->periodic_io_lock, flags);
 
 	/* Release the periodic io list of from all timers */
@@ -617,3 +890,81 @@ int lwis_periodic_io_cancel(struct lwis_client *client, int64_t id)
 	}
 	return ret;
 }
+
+int lwis_periodic_io_ring_setup(struct lwis_client *client,
+				struct lwis_periodic_io_ring_info *info)
+{
+	struct lwis_periodic_io_ring *ring;
+	size_t data_offset, mmap_size;
+
+	if (client->periodic_io_ring) {
+		dev_err(client->lwis_dev->dev, "Periodic io ring is already set up\n");
+		return -EBUSY;
+	}
+
+	if (info->data_size < sizeof(struct lwis_periodic_io_ring_record) ||
+	    info->data_size > MAX_PERIODIC_IO_RING_DATA_SIZE || !is_power_of_2(info->data_size)) {
+		dev_err(client->lwis_dev->dev, "Invalid periodic io ring size: %u\n",
+			info->data_size);
+		return -EINVAL;
+	}
+
+	/* Keep the records off the cache line userspace writes read_offset to */
+	data_offset = ALIGN(sizeof(struct lwis_periodic_io_ring_header), SMP_CACHE_BYTES);
+	mmap_size = PAGE_ALIGN(data_offset + info->data_size);
+
+	ring = kzalloc(sizeof(struct lwis_periodic_io_ring), GFP_KERNEL);
+	if (!ring) {
+		dev_err(client->lwis_dev->dev, "Failed to allocate periodic io ring\n");
+		return -ENOMEM;
+	}
+
+	/* vmalloc_user returns zeroed memory that can be mapped to userspace */
+	ring->header = vmalloc_user(mmap_size);
+	if (!ring->header) {
+		dev_err(client->lwis_dev->dev, "Failed to allocate periodic io ring buffer\n");
+		kfree(ring);
+		return -ENOMEM;
+	}
+	ring->header->data_size = info->data_size;
+	ring->header->data_offset = data_offset;
+	ring->data = (uint8_t *)ring->header + data_offset;
+	ring->mmap_size = mmap_size;
+	ring->data_size = info->data_size;
+	ring->write_offset = 0;
+	client->periodic_io_ring = ring;
+
+	info->mmap_size = mmap_size;
+	info->mmap_offset = (uint64_t)PERIODIC_IO_RING_MMAP_PGOFF << PAGE_SHIFT;
+	return 0;
+}
+
+void lwis_periodic_io_ring_free(struct lwis_client *client)
+{
+	struct lwis_periodic_io_ring *ring = client->periodic_io_ring;
+
+	if (!ring) {
+		return;
+	}
+	client->periodic_io_ring = NULL;
+	vfree(ring->header);
+	kfree(ring);
+}
+
+int lwis_periodic_io_ring_mmap(struct lwis_client *client, struct vm_area_struct *vma)
+{
+	struct lwis_periodic_io_ring *ring = client->periodic_io_ring;
+
+	if (!ring) {
+		dev_err(client->lwis_dev->dev, "Periodic io ring is not set up\n");
+		return -ENODEV;
+	}
+
+	if (vma->vm_end - vma->vm_start > ring->mmap_size) {
+		dev_err(client->lwis_dev->dev, "Invalid periodic io ring mapping range\n");
+		return -EINVAL;
+	}
+
+	/* Userspace writes read_offset, everything else it writes is ignored */
+	return remap_vmalloc_range(vma, ring->header, 0);
+}
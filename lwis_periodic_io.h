@@ -13,10 +13,15 @@
 
 #include <linux/completion.h>
 #include <linux/hrtimer.h>
+#include <linux/mm_types.h>
 
 #include "lwis_commands.h"
 #include "lwis_device.h"
 
+/* Page offset userspace maps the periodic io ring at, the event ring is at 0 */
+#define PERIODIC_IO_RING_MMAP_PGOFF 1
+#define MAX_PERIODIC_IO_RING_DATA_SIZE (4 * 1024 * 1024)
+
 enum lwis_hrtimer_state {
 	LWIS_HRTIMER_ACTIVE,
 	LWIS_HRTIMER_INACTIVE,
@@ -30,37 +35,53 @@ enum lwis_hrtimer_state {
 struct lwis_periodic_io {
 	struct lwis_periodic_io_info info;
 	struct lwis_periodic_io_response_header *resp;
+	/* Whether the responses are pushed with struct
+	 * lwis_periodic_io_response_header_v1, for LWIS_PERIODIC_IO_SUBMIT_V1 */
+	bool resp_v1;
 	/* Counter of the execution times within a batch. Reset to 0 after a
 	 * batch is done */
 	int batch_count;
+	/* Size of the results of one period */
+	size_t period_results_size;
+	/* Ring offset of the first record of the current batch */
+	uint64_t ring_start_offset;
 	/* The timer/lwis_periodic_io_list which this periodic_io belongs to */
 	struct lwis_periodic_io_list *periodic_io_list;
+	/* Period of this periodic io in number of timer periods */
+	/* GUARDED_BY(periodic_io_lock) */
+	int64_t divisor;
+	/* Number of timer periods elapsed since this periodic io was last due */
+	/* GUARDED_BY(periodic_io_lock) */
+	int64_t ticks;
+	/* Number of periods missed since the last response */
+	/* GUARDED_BY(periodic_io_lock) */
+	int64_t missed_periods;
 	/* Whether this periodic io is still active */
 	bool active;
 	/* The node in the timer periodic io list */
 	struct list_head timer_list_node;
+	/* Number of expired periods not processed yet. The periodic io is on
+	 * the client periodic io process queue while this is non-zero */
+	/* GUARDED_BY(periodic_io_lock) */
+	unsigned int queued_periods;
+	/* The node in the client periodic io process queue */
+	struct list_head process_queue_node;
 	/* Completion barrier to mark if io processing is ongoing */
 	struct completion io_done;
 	/* A flag to indicate whether the periodic io has more than one writes.
 	 * This will be used on the cancellation policy to prevent partial write
 	 * during cancellation */
 	bool contains_multiple_writes;
-};
-
-// This is a proxy of the Periodic IO. A proxy of the actual periodic io will be
-// created and inserted into the periodic io process queue. When it is their
-// turn to be processed, it redirect the processing to the info and resp in the
-// real periodic io.
-struct lwis_periodic_io_proxy {
-	/* The real periodic io in the timer periodic io list which this process
-	 * queue proxy node is for */
-	struct lwis_periodic_io *periodic_io;
-	/* The node in the periodic io process queue */
-	struct list_head process_queue_node;
+	/* Compiled form of the I/O entries, NULL if they execute uncompiled */
+	struct lwis_io_program *program;
+	/* Uploaded entries the I/O entries come from, which then own the
+	 * write buffers and program, NULL otherwise */
+	struct lwis_uploaded_io *uploaded;
 };
 
 // An entry in the lwis client timer list. It also manages a list of Periodic
-// IOs which share the same timer.
+// IOs which share the same timer, the period of each of them being a multiple
+// of the timer period.
 struct lwis_periodic_io_list {
 	/* High resolution timer */
 	struct hrtimer hr_timer;
@@ -68,6 +89,9 @@ struct lwis_periodic_io_list {
 	int64_t period_ns;
 	/* State of the timer */
 	enum lwis_hrtimer_state hr_timer_state;
+	/* Number of timer periods elapsed since the timer was started */
+	/* GUARDED_BY(periodic_io_lock) */
+	int64_t expiries;
 	/* LWIS client this timer/periodic_io_list belongs to */
 	struct lwis_client *client;
 	/* List of periodic io operations bundled to this timer */
@@ -76,6 +100,21 @@ struct lwis_periodic_io_list {
 	struct hlist_node node;
 };
 
+/*
+ *  struct lwis_periodic_io_ring
+ *  Kernel side bookkeeping of the client periodic io ring that is mapped by
+ *  userspace. The mapped memory starts with struct
+ *  lwis_periodic_io_ring_header.
+ */
+struct lwis_periodic_io_ring {
+	struct lwis_periodic_io_ring_header *header;
+	uint8_t *data;
+	size_t mmap_size;
+	uint32_t data_size;
+	/* Private copy of the write offset, userspace can modify the header */
+	uint64_t write_offset;
+};
+
 int lwis_periodic_io_init(struct lwis_client *client);
 int lwis_periodic_io_client_flush(struct lwis_client *client);
 int lwis_periodic_io_client_cleanup(struct lwis_client *client);
@@ -83,4 +122,34 @@ int lwis_periodic_io_submit(struct lwis_client *client, struct lwis_periodic_io
 int lwis_periodic_io_cancel(struct lwis_client *client, int64_t id);
 void lwis_periodic_io_clean(struct lwis_periodic_io *periodic_io);
 
+/*
+ * lwis_periodic_io_ring_setup: Allocates the periodic io ring of the client,
+ * the ring cannot be resized once set up.
+ *
+ * Locks: lwis_client->lock
+ * Alloc: Yes
+ * Returns: 0 on success, -EBUSY if the ring is already set up
+ */
+int lwis_periodic_io_ring_setup(struct lwis_client *client,
+				struct lwis_periodic_io_ring_info *info);
+
+/*
+ * lwis_periodic_io_ring_free: Frees the periodic io ring of the client, if
+ * any. Must be called after all periodic ios of the client are cleaned up.
+ *
+ * Alloc: No
+ * Returns: None
+ */
+void lwis_periodic_io_ring_free(struct lwis_client *client);
+
+/*
+ * lwis_periodic_io_ring_mmap: Maps the periodic io ring of the client to
+ * userspace.
+ *
+ * Locks: lwis_client->lock
+ * Alloc: No
+ * Returns: 0 on success, -ENODEV if the ring is not set up
+ */
+int lwis_periodic_io_ring_mmap(struct lwis_client *client, struct vm_area_struct *vma);
+
 #endif /* LWIS_PERIODIC_IO_H_ */
\ No newline at end of file
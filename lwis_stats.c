@@ -0,0 +1,153 @@
+/*
+ * Google LWIS Device Statistics
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-stats: " fmt
+
+#include <linux/kernel.h>
+#include <linux/string.h>
+
+#include "lwis_device.h"
+#include "lwis_interrupt.h"
+#include "lwis_stats.h"
+#include "lwis_util.h"
+
+static const char *const stat_names[LWIS_NUM_STATS] = {
+	[LWIS_STAT_REG_READS] = "reg_reads",
+	[LWIS_STAT_REG_WRITES] = "reg_writes",
+	[LWIS_STAT_BYTES_READ] = "bytes_read",
+	[LWIS_STAT_BYTES_WRITTEN] = "bytes_written",
+	[LWIS_STAT_BUS_ERRORS] = "bus_errors",
+	[LWIS_STAT_TRANSACTIONS_EXECUTED] = "transactions_executed",
+	[LWIS_STAT_TRANSACTIONS_CANCELLED] = "transactions_cancelled",
+	[LWIS_STAT_TRANSACTIONS_FAILED] = "transactions_failed",
+	[LWIS_STAT_TRANSACTIONS_LATE] = "transactions_late",
+	[LWIS_STAT_TRANSACTION_ITERATIONS_DROPPED] = "transaction_iterations_dropped",
+	[LWIS_STAT_PERIODIC_IO_RUNS] = "periodic_io_runs",
+	[LWIS_STAT_PERIODIC_IO_MISSED_PERIODS] = "periodic_io_missed_periods",
+	[LWIS_STAT_EVENT_QUEUE_OVERFLOWS] = "event_queue_overflows",
+	[LWIS_STAT_IRQS] = "irqs",
+};
+
+int lwis_stats_init(struct lwis_device *lwis_dev)
+{
+	lwis_dev->stats = alloc_percpu(struct lwis_stats);
+	if (!lwis_dev->stats) {
+		pr_err("Failed to allocate statistics of %s\n", lwis_dev->name);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void lwis_stats_free(struct lwis_device *lwis_dev)
+{
+	free_percpu(lwis_dev->stats);
+	lwis_dev->stats = NULL;
+}
+
+void lwis_stats_add(struct lwis_device *lwis_dev, enum lwis_stat stat, u64 value)
+{
+	/* Events can be emitted before the device is fully probed */
+	if (!lwis_dev->stats) {
+		return;
+	}
+	this_cpu_add(lwis_dev->stats->counters[stat], value);
+}
+
+void lwis_stats_count_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+			 int num_completed, int ret)
+{
+	const size_t value_bytes = lwis_dev->native_value_bitwidth / BITS_PER_BYTE;
+	u64 reads = 0, writes = 0, bytes_read = 0, bytes_written = 0;
+	int i;
+
+	if (ret < 0) {
+		lwis_stats_add(lwis_dev, LWIS_STAT_BUS_ERRORS, 1);
+	}
+
+	for (i = 0; i < num_completed; ++i) {
+		switch (entries[i].type) {
+		case LWIS_IO_ENTRY_READ:
+		case LWIS_IO_ENTRY_POLL:
+		case LWIS_IO_ENTRY_POLL_US:
+		case LWIS_IO_ENTRY_READ_ASSERT:
+		case LWIS_IO_ENTRY_READ_ASSERT_SKIP:
+			reads++;
+			bytes_read += value_bytes;
+			break;
+		case LWIS_IO_ENTRY_READ_BATCH:
+			reads++;
+			bytes_read += entries[i].rw_batch.size_in_bytes;
+			break;
+		case LWIS_IO_ENTRY_READ_TO_BUFFER:
+			reads++;
+			bytes_read += entries[i].read_to_buffer.size_in_bytes;
+			break;
+		case LWIS_IO_ENTRY_WRITE:
+			writes++;
+			bytes_written += value_bytes;
+			break;
+		case LWIS_IO_ENTRY_WRITE_BATCH:
+			writes++;
+			bytes_written += entries[i].rw_batch.size_in_bytes;
+			break;
+		case LWIS_IO_ENTRY_WRITE_SCATTER:
+			writes++;
+			bytes_written += entries[i].scatter.size_in_bytes;
+			break;
+		case LWIS_IO_ENTRY_MODIFY:
+			reads++;
+			writes++;
+			bytes_read += value_bytes;
+			bytes_written += value_bytes;
+			break;
+		default:
+			break;
+		}
+	}
+
+	lwis_stats_add(lwis_dev, LWIS_STAT_REG_READS, reads);
+	lwis_stats_add(lwis_dev, LWIS_STAT_REG_WRITES, writes);
+	lwis_stats_add(lwis_dev, LWIS_STAT_BYTES_READ, bytes_read);
+	lwis_stats_add(lwis_dev, LWIS_STAT_BYTES_WRITTEN, bytes_written);
+}
+
+void lwis_stats_print(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size)
+{
+	u64 totals[LWIS_NUM_STATS] = {};
+	struct lwis_stats *stats;
+	struct lwis_interrupt *irq;
+	size_t len = strlen(buffer);
+	int cpu, i;
+
+	if (lwis_dev->stats) {
+		for_each_possible_cpu (cpu) {
+			stats = per_cpu_ptr(lwis_dev->stats, cpu);
+			for (i = 0; i < LWIS_NUM_STATS; ++i) {
+				totals[i] += READ_ONCE(stats->counters[i]);
+			}
+		}
+	}
+
+	len += scnprintf(buffer + len, buffer_size - len, "bus %s\n",
+			 lwis_device_type_to_string(lwis_dev->type));
+	for (i = 0; i < LWIS_NUM_STATS; ++i) {
+		len += scnprintf(buffer + len, buffer_size - len, "%s %llu\n", stat_names[i],
+				 totals[i]);
+	}
+
+	if (!lwis_dev->irqs) {
+		return;
+	}
+	for (i = 0; i < lwis_dev->irqs->count; ++i) {
+		irq = &lwis_dev->irqs->irq[i];
+		len += scnprintf(buffer + len, buffer_size - len, "irq %s %llu\n", irq->name,
+				 READ_ONCE(irq->count));
+	}
+}
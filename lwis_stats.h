@@ -0,0 +1,78 @@
+/*
+ * Google LWIS Device Statistics
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_STATS_H_
+#define LWIS_STATS_H_
+
+#include <linux/percpu.h>
+#include <linux/types.h>
+
+#include "lwis_commands.h"
+
+/* LWIS forward declarations */
+struct lwis_device;
+
+enum lwis_stat {
+	/* Register accesses completed through the bus of the device */
+	LWIS_STAT_REG_READS,
+	LWIS_STAT_REG_WRITES,
+	LWIS_STAT_BYTES_READ,
+	LWIS_STAT_BYTES_WRITTEN,
+	/* Register accesses failed by the bus */
+	LWIS_STAT_BUS_ERRORS,
+	LWIS_STAT_TRANSACTIONS_EXECUTED,
+	LWIS_STAT_TRANSACTIONS_CANCELLED,
+	LWIS_STAT_TRANSACTIONS_FAILED,
+	/* Transactions started after their deadline, dropped ones included */
+	LWIS_STAT_TRANSACTIONS_LATE,
+	/* Triggers of repeating transactions with all iterations in flight */
+	LWIS_STAT_TRANSACTION_ITERATIONS_DROPPED,
+	LWIS_STAT_PERIODIC_IO_RUNS,
+	LWIS_STAT_PERIODIC_IO_MISSED_PERIODS,
+	LWIS_STAT_EVENT_QUEUE_OVERFLOWS,
+	LWIS_STAT_IRQS,
+	LWIS_NUM_STATS
+};
+
+/* Counters of one CPU, only updated from that CPU so that the hot paths do
+ * not share cache lines. Readers sum them over the possible CPUs. */
+struct lwis_stats {
+	u64 counters[LWIS_NUM_STATS];
+};
+
+/*
+ * lwis_stats_init: Allocates the per-CPU counters of the device.
+ */
+int lwis_stats_init(struct lwis_device *lwis_dev);
+
+/*
+ * lwis_stats_free: Frees the per-CPU counters of the device.
+ */
+void lwis_stats_free(struct lwis_device *lwis_dev);
+
+/*
+ * lwis_stats_add: Adds value to the counter of the device, from any context.
+ */
+void lwis_stats_add(struct lwis_device *lwis_dev, enum lwis_stat stat, u64 value);
+
+/*
+ * lwis_stats_count_io: Counts the register accesses of the num_completed
+ * first entries, and a bus error if ret is negative.
+ */
+void lwis_stats_count_io(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+			 int num_completed, int ret);
+
+/*
+ * lwis_stats_print: Appends one "name value" line per counter of the device
+ * to buffer, followed by the interrupt counts.
+ */
+void lwis_stats_print(struct lwis_device *lwis_dev, char *buffer, size_t buffer_size);
+
+#endif /* LWIS_STATS_H_ */
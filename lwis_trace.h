@@ -0,0 +1,183 @@
+/*
+ * Google LWIS Tracepoints
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#undef TRACE_SYSTEM
+#define TRACE_SYSTEM lwis
+
+#if !defined(LWIS_TRACE_H_) || defined(TRACE_HEADER_MULTI_READ)
+#define LWIS_TRACE_H_
+
+#include <linux/tracepoint.h>
+
+#include "lwis_commands.h"
+#include "lwis_device.h"
+#include "lwis_util.h"
+
+TRACE_EVENT(lwis_event_emit,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t event_id, int64_t event_counter,
+		 size_t payload_size),
+	TP_ARGS(lwis_dev, event_id, event_counter, payload_size),
+	TP_STRUCT__entry(
+		__field(int, device_id)
+		__field(int64_t, event_id)
+		__field(int64_t, event_counter)
+		__field(size_t, payload_size)
+	),
+	TP_fast_assign(
+		__entry->device_id = lwis_dev->id;
+		__entry->event_id = event_id;
+		__entry->event_counter = event_counter;
+		__entry->payload_size = payload_size;
+	),
+	TP_printk("dev=%d event=0x%llx counter=%lld payload=%zu", __entry->device_id,
+		  __entry->event_id, __entry->event_counter, __entry->payload_size)
+);
+
+TRACE_EVENT(lwis_transaction_trigger,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, int64_t event_id),
+	TP_ARGS(lwis_dev, id, event_id),
+	TP_STRUCT__entry(
+		__field(int, device_id)
+		__field(int64_t, id)
+		__field(int64_t, event_id)
+	),
+	TP_fast_assign(
+		__entry->device_id = lwis_dev->id;
+		__entry->id = id;
+		__entry->event_id = event_id;
+	),
+	TP_printk("dev=%d id=%lld event=0x%llx", __entry->device_id, __entry->id,
+		  __entry->event_id)
+);
+
+DECLARE_EVENT_CLASS(lwis_io_begin,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, size_t num_io_entries),
+	TP_ARGS(lwis_dev, id, num_io_entries),
+	TP_STRUCT__entry(
+		__field(int, device_id)
+		__field(int64_t, id)
+		__field(size_t, num_io_entries)
+	),
+	TP_fast_assign(
+		__entry->device_id = lwis_dev->id;
+		__entry->id = id;
+		__entry->num_io_entries = num_io_entries;
+	),
+	TP_printk("dev=%d id=%lld entries=%zu", __entry->device_id, __entry->id,
+		  __entry->num_io_entries)
+);
+
+DECLARE_EVENT_CLASS(lwis_io_end,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, int error_code),
+	TP_ARGS(lwis_dev, id, error_code),
+	TP_STRUCT__entry(
+		__field(int, device_id)
+		__field(int64_t, id)
+		__field(int, error_code)
+	),
+	TP_fast_assign(
+		__entry->device_id = lwis_dev->id;
+		__entry->id = id;
+		__entry->error_code = error_code;
+	),
+	TP_printk("dev=%d id=%lld error=%d", __entry->device_id, __entry->id,
+		  __entry->error_code)
+);
+
+DEFINE_EVENT(lwis_io_begin, lwis_transaction_begin,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, size_t num_io_entries),
+	TP_ARGS(lwis_dev, id, num_io_entries)
+);
+
+DEFINE_EVENT(lwis_io_end, lwis_transaction_end,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, int error_code),
+	TP_ARGS(lwis_dev, id, error_code)
+);
+
+DEFINE_EVENT(lwis_io_begin, lwis_periodic_io_begin,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, size_t num_io_entries),
+	TP_ARGS(lwis_dev, id, num_io_entries)
+);
+
+DEFINE_EVENT(lwis_io_end, lwis_periodic_io_end,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t id, int error_code),
+	TP_ARGS(lwis_dev, id, error_code)
+);
+
+TRACE_EVENT(lwis_periodic_io_timer,
+	TP_PROTO(struct lwis_device *lwis_dev, int64_t period_ns, u64 overrun),
+	TP_ARGS(lwis_dev, period_ns, overrun),
+	TP_STRUCT__entry(
+		__field(int, device_id)
+		__field(int64_t, period_ns)
+		__field(u64, overrun)
+	),
+	TP_fast_assign(
+		__entry->device_id = lwis_dev->id;
+		__entry->period_ns = period_ns;
+		__entry->overrun = overrun;
+	),
+	TP_printk("dev=%d period_ns=%lld overrun=%llu", __entry->device_id, __entry->period_ns,
+		  __entry->overrun)
+);
+
+TRACE_EVENT(lwis_interrupt,
+	TP_PROTO(struct lwis_device *lwis_dev, int irq_number, uint64_t source_value),
+	TP_ARGS(lwis_dev, irq_number, source_value),
+	TP_STRUCT__entry(
+		__field(int, device_id)
+		__field(int, irq_number)
+		__field(uint64_t, source_value)
+	),
+	TP_fast_assign(
+		__entry->device_id = lwis_dev->id;
+		__entry->irq_number = irq_number;
+		__entry->source_value = source_value;
+	),
+	TP_printk("dev=%d irq=%d source=0x%llx", __entry->device_id, __entry->irq_number,
+		  __entry->source_value)
+);
+
+/* Register access of the bus backends. num_entries is the number of entries
+ * requested, ret the number completed or a negative error code */
+TRACE_EVENT(lwis_bus_io,
+	TP_PROTO(struct lwis_device *lwis_dev, struct lwis_io_entry *entries, int num_entries,
+		 int ret),
+	TP_ARGS(lwis_dev, entries, num_entries, ret),
+	TP_STRUCT__entry(
+		__field(int, device_id)
+		__field(int, type)
+		__field(int, bid)
+		__field(uint64_t, offset)
+		__field(int, num_entries)
+		__field(size_t, num_bytes)
+		__field(int, ret)
+	),
+	TP_fast_assign(
+		__entry->device_id = lwis_dev->id;
+		__entry->type = entries[0].type;
+		lwis_io_entry_address(&entries[0], &__entry->bid, &__entry->offset);
+		__entry->num_entries = num_entries;
+		__entry->num_bytes = lwis_io_entries_num_bytes(lwis_dev, entries, num_entries);
+		__entry->ret = ret;
+	),
+	TP_printk("dev=%d type=%d bid=%d offset=0x%llx entries=%d bytes=%zu ret=%d",
+		  __entry->device_id, __entry->type, __entry->bid, __entry->offset,
+		  __entry->num_entries, __entry->num_bytes, __entry->ret)
+);
+
+#endif /* LWIS_TRACE_H_ */
+
+/* This part must be outside the include guard */
+#undef TRACE_INCLUDE_PATH
+#define TRACE_INCLUDE_PATH .
+#undef TRACE_INCLUDE_FILE
+#define TRACE_INCLUDE_FILE lwis_trace
+#include <trace/define_trace.h>
@@ -16,14 +16,23 @@
 #include <linux/kernel.h>
 #include <linux/kthread.h>
 #include <linux/mm.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
-#include <linux/workqueue.h>
+#include <linux/wait.h>
 
+#include "lwis_buffer.h"
 #include "lwis_device.h"
+#include "lwis_device_dpm.h"
 #include "lwis_event.h"
 #include "lwis_ioreg.h"
+#include "lwis_trace.h"
+#include "lwis_uploaded_io.h"
 #include "lwis_util.h"
 
+/* Releases the READ_TO_BUFFER buffers of freed transactions. Owned by the
+ * module so that it can be drained before the module is unloaded. */
+static struct workqueue_struct *read_buffers_release_wq;
+
 #define EXPLICIT_EVENT_COUNTER(x)                                                                  \
 	((x) != LWIS_EVENT_COUNTER_ON_NEXT_OCCURRENCE && (x) != LWIS_EVENT_COUNTER_EVERY_TIME)
 
@@ -50,10 +59,44 @@ static struct lwis_transaction_event_list *event_list_create(struct lwis_client
 	}
 	event_list->event_id = event_id;
 	INIT_LIST_HEAD(&event_list->list);
+	INIT_LIST_HEAD(&event_list->counter_list);
 	hash_add(client->transaction_list, &event_list->node, event_id);
 	return event_list;
 }
 
+/* Calling this function requires holding the client's transaction_lock. */
+static void event_list_add_locked(struct lwis_transaction_event_list *event_list,
+				  struct lwis_transaction *transaction)
+{
+	struct list_head *it_tran;
+	struct lwis_transaction *it;
+	int64_t trigger_counter = transaction->info.trigger_event_counter;
+
+	if (!EXPLICIT_EVENT_COUNTER(trigger_counter)) {
+		list_add_tail(&transaction->event_list_node, &event_list->list);
+		return;
+	}
+
+	/* Transactions are mostly submitted for increasing counters, so search
+	 * the insertion point from the tail. Transactions waiting for the same
+	 * counter keep their submission order. */
+	list_for_each_prev (it_tran, &event_list->counter_list) {
+		it = list_entry(it_tran, struct lwis_transaction, event_list_node);
+		if (it->info.trigger_event_counter <= trigger_counter) {
+			break;
+		}
+	}
+	list_add(&transaction->event_list_node, it_tran);
+}
+
+/* Calling this function requires holding the client's transaction_lock. */
+static void event_list_remove_locked(struct lwis_client *client,
+				     struct lwis_transaction *transaction)
+{
+	list_del(&transaction->event_list_node);
+	xa_erase(&client->transaction_ids, transaction->info.id);
+}
+
 static struct lwis_transaction_event_list *event_list_find_or_create(struct lwis_client *client,
 								     int64_t event_id)
 {
@@ -61,53 +104,145 @@ static struct lwis_transaction_event_list *event_list_find_or_create(struct lwis
 	return (list == NULL) ? event_list_create(client, event_id) : list;
 }
 
-int lwis_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry, bool non_blocking)
+/* Calling this function requires holding the client's transaction_lock. */
+bool lwis_transaction_event_pending_locked(struct lwis_client *client, int64_t event_id)
+{
+	struct lwis_transaction_event_list *event_list = event_list_find(client, event_id);
+
+	return event_list &&
+	       (!list_empty(&event_list->list) || !list_empty(&event_list->counter_list));
+}
+
+static int register_read_assert(struct lwis_device *lwis_dev, int bid, uint64_t offset,
+				uint64_t expected, uint64_t mask)
 {
-	uint64_t val, start;
-	uint64_t timeout_ms = entry->read_assert.timeout_ms;
+	uint64_t val;
 	int ret = 0;
 
-	/* Only read and check once if non_blocking */
-	if (non_blocking) {
-		timeout_ms = 0;
+	ret = lwis_device_single_register_read(lwis_dev, bid, offset, &val,
+					       lwis_dev->native_value_bitwidth);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to read registers: block %d offset 0x%llx\n", bid,
+			offset);
+		return ret;
+	}
+	if ((val & mask) == (expected & mask)) {
+		return 0;
+	}
+	return -EINVAL;
+}
+
+/* Returns the number of entries a READ_ASSERT_SKIP entry skips, 0 if the
+ * register matches, or an error code if it cannot be read */
+static int entry_read_assert_skip(struct lwis_device *lwis_dev, struct lwis_io_entry *entry)
+{
+	struct lwis_io_entry_read_assert_skip *assert = &entry->read_assert_skip;
+	uint64_t val;
+	int ret;
+
+	ret = lwis_device_single_register_read(lwis_dev, assert->bid, assert->offset, &val,
+					       lwis_dev->native_value_bitwidth);
+	if (ret) {
+		dev_err(lwis_dev->dev, "Failed to read registers: block %d offset 0x%llx\n",
+			assert->bid, assert->offset);
+		return ret;
+	}
+	return (val & assert->mask) == (assert->val & assert->mask) ? 0 : assert->num_skip;
+}
+
+/* Returns true once the device emitted the event after *event_counter */
+static bool poll_wake_event_emitted(struct lwis_device *lwis_dev, int64_t event_id,
+				    int64_t *event_counter)
+{
+	int64_t counter;
+
+	if (lwis_device_event_counter_get(lwis_dev, event_id, &counter) ||
+	    counter == *event_counter) {
+		return false;
+	}
+	*event_counter = counter;
+	return true;
+}
+
+static int entry_poll(struct lwis_device *lwis_dev, const struct lwis_io_entry_poll *poll,
+		      bool non_blocking)
+{
+	ktime_t now, deadline, spin_deadline;
+	int64_t event_counter = 0;
+	unsigned long interval_us = poll->interval_us ? poll->interval_us : USEC_PER_MSEC;
+	bool wait_event = poll->wake_event_id != LWIS_EVENT_ID_NONE;
+	int ret;
+
+	/* Sample the event counter before the first read, so that an event
+	 * emitted right after the read is not missed */
+	if (wait_event && !non_blocking) {
+		ret = lwis_device_event_counter_get(lwis_dev, poll->wake_event_id, &event_counter);
+		if (ret) {
+			dev_err(lwis_dev->dev, "Poll wake event 0x%llx does not exist\n",
+				poll->wake_event_id);
+			return ret;
+		}
 	}
 
+	now = lwis_get_time();
+	deadline = ktime_add_us(now, poll->timeout_us);
+	spin_deadline = ktime_add_us(now, min_t(uint32_t, poll->spin_us, MAX_POLL_SPIN_US));
+
 	/* Read until getting the expected value or timeout */
-	val = ~entry->read_assert.val;
-	start = ktime_to_ms(lwis_get_time());
-	while (val != entry->read_assert.val) {
-		ret = lwis_entry_read_assert(lwis_dev, entry);
+	while (true) {
+		ret = register_read_assert(lwis_dev, poll->bid, poll->offset, poll->val,
+					   poll->mask);
 		if (ret == 0) {
-			break;
+			return 0;
 		}
-		if (ktime_to_ms(lwis_get_time()) - start > timeout_ms) {
+		/* Only read and check once if non_blocking */
+		now = lwis_get_time();
+		if (non_blocking || ktime_after(now, deadline)) {
 			dev_err(lwis_dev->dev, "Polling timed out: block %d offset 0x%llx\n",
-				entry->read_assert.bid, entry->read_assert.offset);
+				poll->bid, poll->offset);
 			return -ETIMEDOUT;
 		}
-		/* Sleep for 1ms */
-		usleep_range(1000, 1000);
+		/* Most conditions clear within a few microseconds, do not give
+		 * up the CPU for them */
+		if (ktime_before(now, spin_deadline)) {
+			cpu_relax();
+			continue;
+		}
+		if (wait_event) {
+			wait_event_hrtimeout(lwis_dev->event_wait_queue,
+					     poll_wake_event_emitted(lwis_dev, poll->wake_event_id,
+								     &event_counter),
+					     ktime_sub(deadline, now));
+		} else {
+			usleep_range(interval_us, interval_us);
+		}
 	}
-	return ret;
 }
 
-int lwis_entry_read_assert(struct lwis_device *lwis_dev, struct lwis_io_entry *entry)
+int lwis_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry, bool non_blocking)
 {
-	uint64_t val;
-	int ret = 0;
+	struct lwis_io_entry_poll poll;
 
-	ret = lwis_device_single_register_read(lwis_dev, entry->read_assert.bid,
-					       entry->read_assert.offset, &val,
-					       lwis_dev->native_value_bitwidth);
-	if (ret) {
-		dev_err(lwis_dev->dev, "Failed to read registers: block %d offset 0x%llx\n",
-			entry->read_assert.bid, entry->read_assert.offset);
-		return ret;
+	if (entry->type == LWIS_IO_ENTRY_POLL_US) {
+		return entry_poll(lwis_dev, &entry->poll, non_blocking);
 	}
-	if ((val & entry->read_assert.mask) == (entry->read_assert.val & entry->read_assert.mask)) {
-		return 0;
-	}
-	return -EINVAL;
+
+	/* LWIS_IO_ENTRY_POLL re-reads every millisecond */
+	poll.bid = entry->read_assert.bid;
+	poll.offset = entry->read_assert.offset;
+	poll.val = entry->read_assert.val;
+	poll.mask = entry->read_assert.mask;
+	poll.timeout_us = entry->read_assert.timeout_ms * USEC_PER_MSEC;
+	poll.interval_us = USEC_PER_MSEC;
+	poll.spin_us = 0;
+	poll.wake_event_id = LWIS_EVENT_ID_NONE;
+	return entry_poll(lwis_dev, &poll, non_blocking);
+}
+
+int lwis_entry_read_assert(struct lwis_device *lwis_dev, struct lwis_io_entry *entry)
+{
+	return register_read_assert(lwis_dev, entry->read_assert.bid, entry->read_assert.offset,
+				    entry->read_assert.val, entry->read_assert.mask);
 }
 
 static void save_transaction_to_history(struct lwis_client *client,
@@ -126,28 +261,232 @@ static void save_transaction_to_history(struct lwis_client *client,
 	}
 }
 
+static void free_transaction(struct lwis_transaction *transaction);
+
+/* Calling this function requires holding the client's transaction_lock. */
+static void release_repeating_instance_locked(struct lwis_transaction *instance)
+{
+	struct lwis_transaction *parent = instance->parent;
+	struct lwis_transaction_instance_pool *pool = parent->instance_pool;
+
+	pool->free_mask |= BIT(instance - pool->instances);
+	pool->num_in_flight--;
+	if (pool->parent_released && pool->num_in_flight == 0) {
+		free_transaction(parent);
+	}
+}
+
+/* Freeing repeating transactions and their iterations requires holding the
+ * client's transaction_lock. */
 static void free_transaction(struct lwis_transaction *transaction)
 {
 	int i = 0;
+	uint8_t **write_buf;
+	size_t write_size;
+	struct lwis_transaction_instance_pool *pool = transaction->instance_pool;
+
+	if (transaction->parent) {
+		release_repeating_instance_locked(transaction);
+		return;
+	}
+
+	if (pool) {
+		/* Iterations in flight still reference the I/O entries, the
+		 * last one to complete frees the transaction. */
+		if (pool->num_in_flight > 0) {
+			pool->parent_released = true;
+			return;
+		}
+		kfree(pool->resp_buf);
+		kfree(pool);
+	}
 
 	kfree(transaction->resp);
+	if (transaction->read_buffers) {
+		queue_work(read_buffers_release_wq, &transaction->read_buffers->release_work);
+	}
+	if (transaction->uploaded) {
+		/* The program belongs to the uploaded entries */
+		lwis_uploaded_io_entries_free(transaction->uploaded, transaction->info.io_entries);
+		kfree(transaction);
+		return;
+	}
+
+	kfree(transaction->program);
 	for (i = 0; i < transaction->info.num_io_entries; ++i) {
-		if (transaction->info.io_entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
-			kvfree(transaction->info.io_entries[i].rw_batch.buf);
+		write_buf = lwis_io_entry_write_buf(&transaction->info.io_entries[i], &write_size);
+		if (write_buf) {
+			kvfree(*write_buf);
 		}
 	}
 	kvfree(transaction->info.io_entries);
 	kfree(transaction);
 }
 
+static void group_complete_work_func(struct work_struct *work)
+{
+	struct lwis_transaction_group *group =
+		container_of(work, struct lwis_transaction_group, complete_work);
+
+	if (group->emit_event_id != LWIS_EVENT_ID_NONE) {
+		lwis_device_event_emit(group->lwis_dev, group->emit_event_id, &group->resp,
+				       sizeof(group->resp), /*in_irq=*/false);
+	}
+	kfree(group);
+}
+
+static void group_put(struct lwis_transaction_group *group)
+{
+	if (atomic_dec_and_test(&group->num_pending)) {
+		queue_work(system_highpri_wq, &group->complete_work);
+	}
+}
+
+/* Records the outcome of a group member before it is freed */
+static void group_member_done(struct lwis_transaction *transaction, int error_code)
+{
+	struct lwis_transaction_group *group = transaction->group;
+
+	if (!group) {
+		return;
+	}
+	transaction->group = NULL;
+	group->resp.error_codes[transaction->group_index] = error_code;
+	group_put(group);
+}
+
+/* Returns the number of entries with a lwis_io_result in the response */
+static int num_result_entries(struct lwis_io_entry *entries, int num_entries)
+{
+	int i;
+	int num_results = 0;
+
+	for (i = 0; i < num_entries; ++i) {
+		if (entries[i].type == LWIS_IO_ENTRY_READ ||
+		    entries[i].type == LWIS_IO_ENTRY_READ_BATCH ||
+		    entries[i].type == LWIS_IO_ENTRY_READ_TO_BUFFER) {
+			num_results++;
+		}
+	}
+	return num_results;
+}
+
+static bool is_io_group_entry(struct lwis_io_entry *entry)
+{
+	return entry->type == LWIS_IO_ENTRY_READ || entry->type == LWIS_IO_ENTRY_READ_BATCH ||
+	       entry->type == LWIS_IO_ENTRY_WRITE || entry->type == LWIS_IO_ENTRY_WRITE_BATCH;
+}
+
+/*
+ * Execute the run of register read/write entries starting at io_entries[first]
+ * with a single call into the compiled program, or register_io_group if the
+ * entries are not compiled, and store the read results in the response buffer
+ * at *read_buf_ptr. The number of entries fully executed is stored in
+ * num_completed.
+ */
+static int process_io_entry_group(struct lwis_device *lwis_dev, struct lwis_transaction_info *info,
+				  struct lwis_io_program *program, int first,
+				  uint8_t **read_buf_ptr, int *num_completed)
+{
+	int i;
+	int last;
+	int ret;
+	struct lwis_io_entry *entry;
+	struct lwis_io_result *io_result;
+	uint8_t *read_buf = *read_buf_ptr;
+	const int reg_value_bytewidth = lwis_dev->native_value_bitwidth / 8;
+
+	/* Read batches are read straight into their response slot */
+	for (last = first; last < info->num_io_entries && is_io_group_entry(&info->io_entries[last]);
+	     ++last) {
+		entry = &info->io_entries[last];
+		if (entry->type == LWIS_IO_ENTRY_READ) {
+			read_buf += sizeof(struct lwis_io_result) + reg_value_bytewidth;
+		} else if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
+			io_result = (struct lwis_io_result *)read_buf;
+			io_result->bid = entry->rw_batch.bid;
+			io_result->offset = entry->rw_batch.offset;
+			io_result->num_value_bytes = entry->rw_batch.size_in_bytes;
+			entry->rw_batch.buf = io_result->values;
+			read_buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
+		}
+	}
+
+	if (program) {
+		ret = lwis_dev->vops.register_io_program_run(lwis_dev, program,
+							     &info->io_entries[first], first,
+							     last - first, num_completed);
+	} else {
+		ret = lwis_dev->vops.register_io_group(lwis_dev, &info->io_entries[first],
+						       last - first, num_completed);
+	}
+
+	read_buf = *read_buf_ptr;
+	for (i = first; i < first + *num_completed; ++i) {
+		entry = &info->io_entries[i];
+		if (entry->type == LWIS_IO_ENTRY_READ) {
+			io_result = (struct lwis_io_result *)read_buf;
+			io_result->bid = entry->rw.bid;
+			io_result->offset = entry->rw.offset;
+			io_result->num_value_bytes = reg_value_bytewidth;
+			memcpy(io_result->values, &entry->rw.val, reg_value_bytewidth);
+			read_buf += sizeof(struct lwis_io_result) + reg_value_bytewidth;
+		} else if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
+			read_buf += sizeof(struct lwis_io_result) + entry->rw_batch.size_in_bytes;
+		}
+	}
+	*read_buf_ptr = read_buf;
+
+	return ret;
+}
+
+/* Reads the registers of a READ_TO_BUFFER entry as a READ_BATCH straight into
+ * the buffer mapped at submission. */
+static int process_read_to_buffer(struct lwis_device *lwis_dev,
+				  struct lwis_transaction_read_buffers *read_buffers,
+				  struct lwis_io_entry *entry)
+{
+	struct lwis_io_entry batch_entry;
+	int i;
+
+	for (i = 0; i < read_buffers->num_buffers; ++i) {
+		if (read_buffers->buffers[i].fd == entry->read_to_buffer.fd) {
+			break;
+		}
+	}
+	if (i == read_buffers->num_buffers) {
+		return -ENOENT;
+	}
+
+	batch_entry.type = LWIS_IO_ENTRY_READ_BATCH;
+	batch_entry.rw_batch.bid = entry->read_to_buffer.bid;
+	batch_entry.rw_batch.offset = entry->read_to_buffer.offset;
+	batch_entry.rw_batch.size_in_bytes = entry->read_to_buffer.size_in_bytes;
+	batch_entry.rw_batch.buf =
+		(uint8_t *)read_buffers->buffers[i].vaddr + entry->read_to_buffer.buf_offset;
+	return lwis_dev->vops.register_io(lwis_dev, &batch_entry, lwis_dev->native_value_bitwidth);
+}
+
+static void cancel_transaction(struct lwis_client *client, struct lwis_transaction *transaction,
+			       int error_code, struct list_head *pending_events);
+static void process_chained_transactions(struct lwis_client *client,
+					 struct lwis_transaction *transaction, int error_code,
+					 struct list_head *pending_events, bool in_irq);
+
 static int process_transaction(struct lwis_client *client, struct lwis_transaction *transaction,
 			       struct list_head *pending_events, bool in_irq)
 {
 	int i;
 	int ret = 0;
+	int num_completed;
+	int num_skipped_results = 0;
 	struct lwis_io_entry *entry;
 	struct lwis_device *lwis_dev = client->lwis_dev;
 	struct lwis_transaction_info *info = &transaction->info;
+	struct lwis_io_program *program =
+		transaction->parent ? transaction->parent->program : transaction->program;
+	struct lwis_transaction_read_buffers *read_buffers =
+		transaction->parent ? transaction->parent->read_buffers : transaction->read_buffers;
 	struct lwis_transaction_response_header *resp = transaction->resp;
 	size_t resp_size;
 	uint8_t *read_buf;
@@ -155,6 +494,14 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 	const int reg_value_bytewidth = lwis_dev->native_value_bitwidth / 8;
 	int64_t process_duration_ns = 0;
 	int64_t process_timestamp = ktime_to_ns(lwis_get_time());
+	unsigned long flags;
+	unsigned long locked = 0;
+
+	if (transaction->trigger_timestamp_ns) {
+		lwis_latency_record(client, LWIS_LATENCY_TRIGGER_TO_START,
+				    ktime_to_ns(ktime_get()) - transaction->trigger_timestamp_ns);
+	}
+	trace_lwis_transaction_begin(lwis_dev, info->id, info->num_io_entries);
 
 	resp_size = sizeof(struct lwis_transaction_response_header) + resp->results_size_bytes;
 	read_buf = (uint8_t *)resp + sizeof(struct lwis_transaction_response_header);
@@ -169,14 +516,38 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 	}
 
 	if (!in_irq) {
-		mutex_lock(&lwis_dev->reg_rw_lock);
+		locked = lwis_device_register_lock(lwis_dev, info->io_entries, info->num_io_entries,
+						   info->skip_unchanged_writes);
 	}
 
 	for (i = 0; i < info->num_io_entries; ++i) {
 		entry = &info->io_entries[i];
-		if (entry->type == LWIS_IO_ENTRY_WRITE ||
-		    entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
-		    entry->type == LWIS_IO_ENTRY_MODIFY) {
+		if ((program || lwis_dev->vops.register_io_group) && is_io_group_entry(entry)) {
+			ret = process_io_entry_group(lwis_dev, info, program, i, &read_buf,
+						     &num_completed);
+			i += num_completed;
+			if (ret) {
+				resp->completion_index = i - 1;
+				resp->error_code = ret;
+				entry = &info->io_entries[i];
+				break;
+			}
+			/* Skip over the entries executed as part of the group */
+			i--;
+		} else if (entry->type == LWIS_IO_ENTRY_WRITE && lwis_dev->vops.register_write_burst) {
+			ret = lwis_dev->vops.register_write_burst(lwis_dev, entry,
+								  info->num_io_entries - i);
+			if (ret < 0) {
+				resp->error_code = ret;
+				break;
+			}
+			/* Skip over the entries written as part of the burst */
+			i += ret - 1;
+			ret = 0;
+		} else if (entry->type == LWIS_IO_ENTRY_WRITE ||
+			   entry->type == LWIS_IO_ENTRY_WRITE_BATCH ||
+			   entry->type == LWIS_IO_ENTRY_WRITE_SCATTER ||
+			   entry->type == LWIS_IO_ENTRY_MODIFY) {
 			ret = lwis_dev->vops.register_io(lwis_dev, entry,
 							 lwis_dev->native_value_bitwidth);
 			if (ret) {
@@ -209,7 +580,19 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 				break;
 			}
 			read_buf += sizeof(struct lwis_io_result) + io_result->num_value_bytes;
-		} else if (entry->type == LWIS_IO_ENTRY_POLL) {
+		} else if (entry->type == LWIS_IO_ENTRY_READ_TO_BUFFER) {
+			io_result = (struct lwis_io_result *)read_buf;
+			io_result->bid = entry->read_to_buffer.bid;
+			io_result->offset = entry->read_to_buffer.offset;
+			io_result->num_value_bytes = 0;
+			ret = process_read_to_buffer(lwis_dev, read_buffers, entry);
+			if (ret) {
+				resp->error_code = ret;
+				break;
+			}
+			read_buf += sizeof(struct lwis_io_result);
+		} else if (entry->type == LWIS_IO_ENTRY_POLL ||
+			   entry->type == LWIS_IO_ENTRY_POLL_US) {
 			ret = lwis_entry_poll(lwis_dev, entry, in_irq);
 			if (ret) {
 				resp->error_code = ret;
@@ -221,6 +604,22 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 				resp->error_code = ret;
 				break;
 			}
+		} else if (entry->type == LWIS_IO_ENTRY_QOS) {
+			ret = lwis_dpm_update_qos(lwis_dev, &entry->qos.setting);
+			if (ret) {
+				resp->error_code = ret;
+				break;
+			}
+		} else if (entry->type == LWIS_IO_ENTRY_READ_ASSERT_SKIP) {
+			ret = entry_read_assert_skip(lwis_dev, entry);
+			if (ret < 0) {
+				resp->error_code = ret;
+				break;
+			}
+			/* The skipped entries count as completed */
+			num_skipped_results += num_result_entries(&info->io_entries[i + 1], ret);
+			i += ret;
+			ret = 0;
 		} else {
 			dev_err(lwis_dev->dev, "Unrecognized io_entry command\n");
 			resp->error_code = -EINVAL;
@@ -230,10 +629,24 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 	}
 
 	if (!in_irq) {
-		mutex_unlock(&lwis_dev->reg_rw_lock);
+		lwis_device_register_unlock(lwis_dev, locked);
+	}
+
+	/* Skipped read entries leave no hole in the results */
+	if (num_skipped_results) {
+		resp->num_entries -= num_skipped_results;
+		resp->results_size_bytes = read_buf - (uint8_t *)(resp + 1);
+		resp_size = sizeof(struct lwis_transaction_response_header) +
+			    resp->results_size_bytes;
 	}
 
 	process_duration_ns = ktime_to_ns(lwis_get_time() - process_timestamp);
+	lwis_latency_record(client, LWIS_LATENCY_EXECUTION, process_duration_ns);
+	trace_lwis_transaction_end(lwis_dev, info->id, resp->error_code);
+	lwis_stats_add(lwis_dev, LWIS_STAT_TRANSACTIONS_EXECUTED, 1);
+	if (resp->error_code) {
+		lwis_stats_add(lwis_dev, LWIS_STAT_TRANSACTIONS_FAILED, 1);
+	}
 
 	/* Use read memory barrier at the end of I/O entries if the access protocol
 	 * allows it */
@@ -255,22 +668,40 @@ static int process_transaction(struct lwis_client *client, struct lwis_transacti
 		}
 	}
 	save_transaction_to_history(client, info, process_timestamp, process_duration_ns);
-	if (info->trigger_event_counter == LWIS_EVENT_COUNTER_EVERY_TIME) {
-		/* Only clean the transaction struct for this iteration. The
-                 * I/O entries are not being freed. */
-		kfree(transaction->resp);
-		kfree(transaction);
+	if (!transaction->parent && !list_empty(&transaction->chained)) {
+		process_chained_transactions(client, transaction, resp->error_code,
+					     pending_events, in_irq);
+	}
+	if (transaction->parent) {
+		/* Only return this iteration to its repeating transaction. The
+		 * I/O entries are not being freed. */
+		spin_lock_irqsave(&client->transaction_lock, flags);
+		release_repeating_instance_locked(transaction);
+		spin_unlock_irqrestore(&client->transaction_lock, flags);
 	} else {
+		group_member_done(transaction, resp->error_code);
 		free_transaction(transaction);
 	}
 	return ret;
 }
 
-static void cancel_transaction(struct lwis_transaction *transaction, int error_code,
-			       struct list_head *pending_events)
+/* Calling this function requires holding the client's transaction_lock. */
+static void cancel_transaction(struct lwis_client *client, struct lwis_transaction *transaction,
+			       int error_code, struct list_head *pending_events)
 {
 	struct lwis_transaction_info *info = &transaction->info;
 	struct lwis_transaction_response_header resp;
+	struct lwis_transaction *chained, *tmp;
+
+	/* Transactions chained to a cancelled one never run */
+	if (!transaction->parent) {
+		list_for_each_entry_safe (chained, tmp, &transaction->chained, event_list_node) {
+			event_list_remove_locked(client, chained);
+			cancel_transaction(client, chained, -ECANCELED, pending_events);
+		}
+	}
+
+	lwis_stats_add(client->lwis_dev, LWIS_STAT_TRANSACTIONS_CANCELLED, 1);
 	resp.id = info->id;
 	resp.error_code = error_code;
 	resp.num_entries = 0;
@@ -281,28 +712,142 @@ static void cancel_transaction(struct lwis_transaction *transaction, int error_c
 		lwis_pending_event_push(pending_events, info->emit_error_event_id, &resp,
 					sizeof(resp));
 	}
+	group_member_done(transaction, error_code);
 	free_transaction(transaction);
 }
 
+static bool chain_condition_met(struct lwis_transaction *chained, int error_code)
+{
+	switch (chained->info.chain_condition) {
+	case LWIS_TRANSACTION_CHAIN_ON_SUCCESS:
+		return error_code == 0;
+	case LWIS_TRANSACTION_CHAIN_ON_ERROR:
+		return error_code != 0;
+	default:
+		return true;
+	}
+}
+
+/* Runs the transactions chained to a transaction that completed with
+ * error_code right away, in the same context, or cancels them if their
+ * condition is not met. Their own chained transactions are handled the same
+ * way once they complete, the chain depth bounding the recursion. */
+static void process_chained_transactions(struct lwis_client *client,
+					 struct lwis_transaction *transaction, int error_code,
+					 struct list_head *pending_events, bool in_irq)
+{
+	struct lwis_transaction *chained, *tmp;
+	struct list_head chain;
+	unsigned long flags;
+
+	INIT_LIST_HEAD(&chain);
+
+	spin_lock_irqsave(&client->transaction_lock, flags);
+	list_for_each_entry_safe (chained, tmp, &transaction->chained, event_list_node) {
+		event_list_remove_locked(client, chained);
+		if (chained->resp->error_code) {
+			cancel_transaction(client, chained, chained->resp->error_code,
+					   pending_events);
+		} else if (!chain_condition_met(chained, error_code)) {
+			cancel_transaction(client, chained, -ECANCELED, pending_events);
+		} else {
+			list_add_tail(&chained->event_list_node, &chain);
+		}
+	}
+	spin_unlock_irqrestore(&client->transaction_lock, flags);
+
+	list_for_each_entry_safe (chained, tmp, &chain, event_list_node) {
+		list_del(&chained->event_list_node);
+		chained->trigger_timestamp_ns = ktime_to_ns(ktime_get());
+		trace_lwis_transaction_trigger(client->lwis_dev, chained->info.id,
+					       chained->info.trigger_event_id);
+		process_transaction(client, chained, pending_events, in_irq);
+	}
+}
+
+/* Sets the deadline relative to the trigger time of the transaction */
+static void deadline_set(struct lwis_transaction *transaction)
+{
+	if (!transaction->info.deadline_us) {
+		transaction->deadline_ns = S64_MAX;
+		return;
+	}
+	transaction->deadline_ns = transaction->trigger_timestamp_ns +
+				   (int64_t)transaction->info.deadline_us * NSEC_PER_USEC;
+}
+
+/* Inserts the transaction in a process queue sorted by ascending deadline,
+ * after the transactions with the same deadline. Calling this function
+ * requires holding the client's transaction_lock. */
+static void process_queue_add_locked(struct list_head *process_queue,
+				     struct lwis_transaction *transaction)
+{
+	struct lwis_transaction *it;
+
+	/* Most transactions have no deadline, or a later one than the queued
+	 * ones, so search the insertion point from the tail */
+	list_for_each_entry_reverse (it, process_queue, process_queue_node) {
+		if (it->deadline_ns <= transaction->deadline_ns) {
+			list_add(&transaction->process_queue_node, &it->process_queue_node);
+			return;
+		}
+	}
+	list_add(&transaction->process_queue_node, process_queue);
+}
+
+/* Reports a transaction starting lateness_ns after its deadline */
+static void deadline_missed(struct lwis_client *client, int64_t id, int64_t lateness_ns,
+			    bool dropped)
+{
+	struct lwis_transaction_deadline_missed_event_payload payload;
+
+	lwis_stats_add(client->lwis_dev, LWIS_STAT_TRANSACTIONS_LATE, 1);
+	dev_warn_ratelimited(client->lwis_dev->dev,
+			     "Transaction %lld started %lld ns after its deadline%s\n", id,
+			     lateness_ns, dropped ? ", dropped" : "");
+	payload.id = id;
+	payload.lateness_ns = lateness_ns;
+	payload.dropped = dropped;
+	payload.reserved = 0;
+	lwis_device_error_event_emit(client->lwis_dev,
+				     LWIS_ERROR_EVENT_ID_TRANSACTION_DEADLINE_MISSED, &payload,
+				     sizeof(payload));
+}
+
 static void process_transactions_in_queue(struct lwis_client *client,
 					  struct list_head *transaction_queue, bool in_irq)
 {
 	unsigned long flags;
 	struct lwis_transaction *transaction;
-	struct list_head *it_tran, *it_tran_tmp;
 	struct list_head pending_events;
+	int64_t id;
+	int64_t lateness_ns;
 
 	INIT_LIST_HEAD(&pending_events);
 
 	spin_lock_irqsave(&client->transaction_lock, flags);
-	list_for_each_safe (it_tran, it_tran_tmp, transaction_queue) {
-		transaction = list_entry(it_tran, struct lwis_transaction, process_queue_node);
+	/* Transactions deferred while the lock is released may go ahead of the
+	 * remaining ones, so the queue is always taken from its front */
+	while (!list_empty(transaction_queue)) {
+		transaction = list_first_entry(transaction_queue, struct lwis_transaction,
+					       process_queue_node);
 		list_del(&transaction->process_queue_node);
+		id = transaction->info.id;
+		lateness_ns = ktime_to_ns(ktime_get()) - transaction->deadline_ns;
 		if (transaction->resp->error_code) {
-			cancel_transaction(transaction, transaction->resp->error_code,
+			cancel_transaction(client, transaction, transaction->resp->error_code,
 					   &pending_events);
+		} else if (lateness_ns > 0 && (transaction->info.deadline_flags &
+					       LWIS_TRANSACTION_DEADLINE_FLAG_DROP)) {
+			cancel_transaction(client, transaction, -ETIME, &pending_events);
+			spin_unlock_irqrestore(&client->transaction_lock, flags);
+			deadline_missed(client, id, lateness_ns, /*dropped=*/true);
+			spin_lock_irqsave(&client->transaction_lock, flags);
 		} else {
 			spin_unlock_irqrestore(&client->transaction_lock, flags);
+			if (lateness_ns > 0) {
+				deadline_missed(client, id, lateness_ns, /*dropped=*/false);
+			}
 			process_transaction(client, transaction, &pending_events, in_irq);
 			spin_lock_irqsave(&client->transaction_lock, flags);
 		}
@@ -312,51 +857,126 @@ static void process_transactions_in_queue(struct lwis_client *client,
 	lwis_pending_events_emit(client->lwis_dev, &pending_events, in_irq);
 }
 
-static void transaction_tasklet_func(unsigned long data)
+static void transaction_work_func(struct kthread_work *work)
 {
-	struct lwis_client *client = (struct lwis_client *)data;
+	struct lwis_client *client = container_of(work, struct lwis_client, transaction_work);
 
-	process_transactions_in_queue(client, &client->transaction_process_queue_tasklet,
-				      /*in_irq=*/true);
+	process_transactions_in_queue(client, &client->transaction_process_queue, /*in_irq=*/false);
 }
 
-static void transaction_work_func(struct work_struct *work)
+static void transaction_rt_work_func(struct kthread_work *work)
 {
-	struct lwis_client *client = container_of(work, struct lwis_client, transaction_work);
+	struct lwis_client *client = container_of(work, struct lwis_client, transaction_rt_work);
 
-	process_transactions_in_queue(client, &client->transaction_process_queue, /*in_irq=*/false);
+	process_transactions_in_queue(client, &client->transaction_process_queue_rt,
+				      /*in_irq=*/false);
 }
 
-int lwis_transaction_init(struct lwis_client *client)
+/* Defers the processing of client->transaction_process_queue to a worker. */
+static void transaction_queue_work(struct lwis_client *client)
 {
-	spin_lock_init(&client->transaction_lock);
-	INIT_LIST_HEAD(&client->transaction_process_queue_tasklet);
-	tasklet_init(&client->transaction_tasklet, transaction_tasklet_func, (unsigned long)client);
-	INIT_LIST_HEAD(&client->transaction_process_queue);
-	client->transaction_wq = create_workqueue("lwistran");
-	INIT_WORK(&client->transaction_work, transaction_work_func);
-	client->transaction_counter = 0;
-	hash_init(client->transaction_list);
-	return 0;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (lwis_dev->rt_worker && lwis_dev->rt_worker_transactions) {
+		kthread_queue_work(lwis_dev->rt_worker, &client->transaction_work);
+	} else {
+		kthread_queue_work(client->transaction_worker, &client->transaction_work);
+	}
 }
 
-int lwis_transaction_clear(struct lwis_client *client)
+/* Defers the processing of client->transaction_process_queue_rt to the real-time
+ * worker of the device, or to the client worker if the device has none. */
+static void transaction_queue_rt_work(struct lwis_client *client)
 {
-	int ret;
+	struct lwis_device *lwis_dev = client->lwis_dev;
 
-	ret = lwis_transaction_client_flush(client);
-	if (ret) {
-		dev_err(client->lwis_dev->dev,
-			"Failed to wait for all in-process transactions to complete (%d)\n", ret);
-		return ret;
+	if (lwis_dev->rt_worker) {
+		kthread_queue_work(lwis_dev->rt_worker, &client->transaction_rt_work);
+	} else {
+		kthread_queue_work(client->transaction_worker, &client->transaction_rt_work);
+	}
+}
+
+int lwis_transaction_module_init(void)
+{
+	read_buffers_release_wq = alloc_workqueue("lwis_read_buffers", WQ_UNBOUND, 0);
+	if (!read_buffers_release_wq) {
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+void lwis_transaction_module_deinit(void)
+{
+	/* Runs the pending buffer releases before freeing the workqueue */
+	destroy_workqueue(read_buffers_release_wq);
+	read_buffers_release_wq = NULL;
+}
+
+int lwis_transaction_init(struct lwis_client *client)
+{
+	spin_lock_init(&client->transaction_lock);
+	INIT_LIST_HEAD(&client->transaction_process_queue_rt);
+	kthread_init_work(&client->transaction_rt_work, transaction_rt_work_func);
+	INIT_LIST_HEAD(&client->transaction_process_queue);
+	client->transaction_worker = kthread_create_worker(0, "lwis_tran_%s", client->lwis_dev->name);
+	if (IS_ERR(client->transaction_worker)) {
+		dev_err(client->lwis_dev->dev, "Failed to create transaction worker\n");
+		return PTR_ERR(client->transaction_worker);
 	}
-	tasklet_kill(&client->transaction_tasklet);
-	if (client->transaction_wq) {
-		destroy_workqueue(client->transaction_wq);
+	kthread_init_work(&client->transaction_work, transaction_work_func);
+	client->transaction_counter = 0;
+	hash_init(client->transaction_list);
+	xa_init(&client->transaction_ids);
+	return 0;
+}
+
+int lwis_transaction_clear(struct lwis_client *client)
+{
+	int ret;
+
+	ret = lwis_transaction_client_flush(client);
+	if (ret) {
+		dev_err(client->lwis_dev->dev,
+			"Failed to wait for all in-process transactions to complete (%d)\n", ret);
+		return ret;
 	}
+	kthread_destroy_worker(client->transaction_worker);
+	xa_destroy(&client->transaction_ids);
 	return 0;
 }
 
+void lwis_transaction_client_resume(struct lwis_client *client, int error_code)
+{
+	struct lwis_transaction *transaction, *tmp;
+	struct list_head pending_events;
+	unsigned long flags;
+
+	if (error_code) {
+		INIT_LIST_HEAD(&pending_events);
+		spin_lock_irqsave(&client->transaction_lock, flags);
+		list_splice_tail_init(&client->transaction_process_queue_rt,
+				      &client->transaction_process_queue);
+		list_for_each_entry_safe (transaction, tmp, &client->transaction_process_queue,
+					  process_queue_node) {
+			list_del(&transaction->process_queue_node);
+			cancel_transaction(client, transaction, error_code, &pending_events);
+		}
+		spin_unlock_irqrestore(&client->transaction_lock, flags);
+		lwis_pending_events_emit(client->lwis_dev, &pending_events, /*in_irq=*/false);
+		return;
+	}
+
+	spin_lock_irqsave(&client->transaction_lock, flags);
+	if (!list_empty(&client->transaction_process_queue_rt)) {
+		transaction_queue_rt_work(client);
+	}
+	if (!list_empty(&client->transaction_process_queue)) {
+		transaction_queue_work(client);
+	}
+	spin_unlock_irqrestore(&client->transaction_lock, flags);
+}
+
 int lwis_transaction_client_flush(struct lwis_client *client)
 {
 	unsigned long flags;
@@ -377,29 +997,31 @@ int lwis_transaction_client_flush(struct lwis_client *client)
 		    LWIS_EVENT_ID_CLIENT_CLEANUP) {
 			continue;
 		}
+		list_splice_tail_init(&it_evt_list->counter_list, &it_evt_list->list);
 		list_for_each_safe (it_tran, it_tran_tmp, &it_evt_list->list) {
 			transaction = list_entry(it_tran, struct lwis_transaction, event_list_node);
-			list_del(&transaction->event_list_node);
-			cancel_transaction(transaction, -ECANCELED, NULL);
+			event_list_remove_locked(client, transaction);
+			cancel_transaction(client, transaction, -ECANCELED, NULL);
 		}
 		hash_del(&it_evt_list->node);
 		kfree(it_evt_list);
 	}
 	spin_unlock_irqrestore(&client->transaction_lock, flags);
 
-	if (client->transaction_wq) {
-		drain_workqueue(client->transaction_wq);
-	}
+	kthread_flush_work(&client->transaction_work);
+	kthread_flush_work(&client->transaction_rt_work);
 
 	spin_lock_irqsave(&client->transaction_lock, flags);
-	/* This shouldn't happen after drain_workqueue, but check anyway. */
+	/* This shouldn't happen after flushing the workers, but check anyway. */
+	list_splice_tail_init(&client->transaction_process_queue_rt,
+			      &client->transaction_process_queue);
 	if (!list_empty(&client->transaction_process_queue)) {
 		dev_warn(client->lwis_dev->dev, "Still transaction entries in process queue\n");
 		list_for_each_safe (it_tran, it_tran_tmp, &client->transaction_process_queue) {
 			transaction =
 				list_entry(it_tran, struct lwis_transaction, process_queue_node);
 			list_del(&transaction->process_queue_node);
-			cancel_transaction(transaction, -ECANCELED, NULL);
+			cancel_transaction(client, transaction, -ECANCELED, NULL);
 		}
 	}
 	spin_unlock_irqrestore(&client->transaction_lock, flags);
@@ -447,11 +1069,12 @@ int lwis_transaction_client_cleanup(struct lwis_client *client)
 		return 0;
 	}
 
+	list_splice_tail_init(&it_evt_list->counter_list, &it_evt_list->list);
 	list_for_each_safe (it_tran, it_tran_tmp, &it_evt_list->list) {
 		transaction = list_entry(it_tran, struct lwis_transaction, event_list_node);
-		list_del(&transaction->event_list_node);
+		event_list_remove_locked(client, transaction);
 		if (transaction->resp->error_code || client->lwis_dev->enabled == 0) {
-			cancel_transaction(transaction, -ECANCELED, NULL);
+			cancel_transaction(client, transaction, -ECANCELED, NULL);
 		} else {
 			spin_unlock_irqrestore(&client->transaction_lock, flags);
 			process_transaction(client, transaction, &pending_events, in_irq);
@@ -478,7 +1101,7 @@ int lwis_transaction_client_cleanup(struct lwis_client *client)
 		if (event->event_info.payload_size <=
 			sizeof(struct lwis_transaction_response_header)) {
 			list_del(&event->node);
-			kfree(event);
+			lwis_event_entry_free(event);
 			continue;
 		}
 		resp = (struct lwis_transaction_response_header *)
@@ -496,15 +1119,18 @@ int lwis_transaction_client_cleanup(struct lwis_client *client)
 		}
 
 		list_del(&event->node);
-		kfree(event);
+		lwis_event_entry_free(event);
 	}
 
 	return 0;
 }
 
-static int check_transaction_param_locked(struct lwis_client *client,
-					  struct lwis_transaction *transaction,
-					  bool allow_counter_eq)
+/* Checks the trigger counter against the current one. Done under the
+ * transaction_lock so that no trigger can run between the check and queueing
+ * the transaction. */
+static int check_trigger_counter_locked(struct lwis_client *client,
+					struct lwis_transaction *transaction,
+					bool allow_counter_eq)
 {
 	struct lwis_device_event_state *event_state;
 	struct lwis_transaction_info *info = &transaction->info;
@@ -525,7 +1151,8 @@ static int check_transaction_param_locked(struct lwis_client *client,
 			info->current_trigger_event_counter = 0;
 		} else {
 			/* Event found, return current counter to userspace */
-			info->current_trigger_event_counter = event_state->event_counter;
+			info->current_trigger_event_counter =
+				atomic64_read(&event_state->event_counter);
 		}
 	}
 
@@ -546,6 +1173,90 @@ static int check_transaction_param_locked(struct lwis_client *client,
 		}
 	}
 
+	return 0;
+}
+
+static bool is_dma_address_reg(struct lwis_device *lwis_dev, int bid, uint64_t offset)
+{
+	int i;
+
+	for (i = 0; i < lwis_dev->num_dma_address_regs; ++i) {
+		if (lwis_dev->dma_address_regs[i].bid == bid &&
+		    lwis_dev->dma_address_regs[i].offset == offset) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Checks that the addresses written to DMA address registers are in buffers
+ * enrolled by the client, 0 being allowed to clear a register. */
+static int check_dma_addresses(struct lwis_client *client, struct lwis_transaction_info *info)
+{
+	struct lwis_device *lwis_dev = client->lwis_dev;
+	struct lwis_io_entry *entry;
+	int i;
+
+	for (i = 0; i < info->num_io_entries; ++i) {
+		entry = &info->io_entries[i];
+		if (entry->type != LWIS_IO_ENTRY_WRITE || entry->rw.val == 0 ||
+		    !is_dma_address_reg(lwis_dev, entry->rw.bid, entry->rw.offset)) {
+			continue;
+		}
+		if (!lwis_client_enrolled_buffer_find_range(client, entry->rw.val, 1)) {
+			dev_err_ratelimited(lwis_dev->dev,
+					    "DMA address 0x%llx not in an enrolled buffer\n",
+					    entry->rw.val);
+			return -EINVAL;
+		}
+	}
+	return 0;
+}
+
+static int check_transaction_param(struct lwis_client *client,
+				   struct lwis_transaction *transaction)
+{
+	struct lwis_transaction_info *info = &transaction->info;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+	int i;
+	int ret;
+
+	/* QoS votes only make sense on the DPM device, which in turn has no
+	 * registers to access */
+	for (i = 0; i < info->num_io_entries; ++i) {
+		if ((info->io_entries[i].type == LWIS_IO_ENTRY_QOS) !=
+		    (lwis_dev->type == DEVICE_TYPE_DPM)) {
+			dev_err(lwis_dev->dev, "io_entries[%d] type %d not supported on %s\n", i,
+				info->io_entries[i].type, lwis_dev->name);
+			return -EINVAL;
+		}
+		if (info->io_entries[i].type == LWIS_IO_ENTRY_READ_ASSERT_SKIP &&
+		    info->io_entries[i].read_assert_skip.num_skip >= info->num_io_entries - i) {
+			dev_err(lwis_dev->dev, "io_entries[%d] skips past the last entry\n", i);
+			return -EINVAL;
+		}
+	}
+
+	if (info->chain_condition != LWIS_TRANSACTION_CHAIN_NONE &&
+	    (info->chain_condition > LWIS_TRANSACTION_CHAIN_ALWAYS ||
+	     info->trigger_event_id != LWIS_EVENT_ID_NONE)) {
+		dev_err(lwis_dev->dev, "Invalid chained transaction\n");
+		return -EINVAL;
+	}
+
+	if (info->deadline_flags & ~LWIS_TRANSACTION_DEADLINE_FLAG_DROP) {
+		dev_err(lwis_dev->dev, "Invalid transaction deadline flags 0x%x\n",
+			info->deadline_flags);
+		return -EINVAL;
+	}
+
+	if (lwis_dev->num_dma_address_regs > 0) {
+		ret = check_dma_addresses(client, info);
+		if (ret) {
+			return ret;
+		}
+	}
+
 	/* Make sure sw events exist in event table */
 	if (IS_ERR_OR_NULL(lwis_device_event_state_find_or_create(lwis_dev,
 								  info->emit_success_event_id)) ||
@@ -559,10 +1270,19 @@ static int check_transaction_param_locked(struct lwis_client *client,
 		return -EINVAL;
 	}
 
+	/* Create the trigger event state now, so that adding the listener with
+	 * the transaction_lock held does not allocate */
+	if (info->trigger_event_id != LWIS_EVENT_ID_NONE &&
+	    IS_ERR_OR_NULL(lwis_device_event_state_find_or_create(lwis_dev,
+								  info->trigger_event_id))) {
+		dev_err(lwis_dev->dev, "Cannot create trigger event for transaction");
+		return -EINVAL;
+	}
+
 	return 0;
 }
 
-static int prepare_response_locked(struct lwis_client *client, struct lwis_transaction *transaction)
+static int prepare_response(struct lwis_client *client, struct lwis_transaction *transaction)
 {
 	struct lwis_transaction_info *info = &transaction->info;
 	struct lwis_io_entry *entry;
@@ -572,8 +1292,6 @@ static int prepare_response_locked(struct lwis_client *client, struct lwis_trans
 	int read_entries = 0;
 	const int reg_value_bytewidth = client->lwis_dev->native_value_bitwidth / 8;
 
-	info->id = client->transaction_counter;
-
 	for (i = 0; i < info->num_io_entries; ++i) {
 		entry = &info->io_entries[i];
 		if (entry->type == LWIS_IO_ENTRY_READ) {
@@ -582,6 +1300,8 @@ static int prepare_response_locked(struct lwis_client *client, struct lwis_trans
 		} else if (entry->type == LWIS_IO_ENTRY_READ_BATCH) {
 			read_buf_size += entry->rw_batch.size_in_bytes;
 			read_entries++;
+		} else if (entry->type == LWIS_IO_ENTRY_READ_TO_BUFFER) {
+			read_entries++;
 		}
 	}
 
@@ -589,15 +1309,13 @@ static int prepare_response_locked(struct lwis_client *client, struct lwis_trans
 	// offset pairs.
 	resp_size = sizeof(struct lwis_transaction_response_header) +
 		    read_entries * sizeof(struct lwis_io_result) + read_buf_size;
-	/* Revisit the use of GFP_ATOMIC here. Reason for this to be atomic is
-	 * because this function can be called by transaction_replace while
-	 * holding onto a spinlock. */
-	transaction->resp = kmalloc(resp_size, GFP_ATOMIC);
+	transaction->resp = kmalloc(resp_size, GFP_KERNEL);
 	if (!transaction->resp) {
 		dev_err(client->lwis_dev->dev, "Cannot allocate transaction response\n");
 		return -ENOMEM;
 	}
-	transaction->resp->id = info->id;
+	/* The id is assigned when the transaction is queued */
+	transaction->resp->id = LWIS_ID_INVALID;
 	transaction->resp->error_code = 0;
 	transaction->resp->completion_index = 0;
 	transaction->resp->num_entries = read_entries;
@@ -606,33 +1324,290 @@ static int prepare_response_locked(struct lwis_client *client, struct lwis_trans
 	return 0;
 }
 
+static int create_instance_pool(struct lwis_client *client, struct lwis_transaction *transaction)
+{
+	const int num_instances = client->lwis_dev->transaction_instance_pool_size;
+	int i;
+	struct lwis_transaction_instance_pool *pool;
+	const size_t resp_size = ALIGN(sizeof(struct lwis_transaction_response_header) +
+					       transaction->resp->results_size_bytes,
+				       sizeof(uint64_t));
+
+	pool = kmalloc(struct_size(pool, instances, num_instances), GFP_KERNEL);
+	if (!pool) {
+		dev_err(client->lwis_dev->dev, "Cannot allocate transaction instance pool\n");
+		return -ENOMEM;
+	}
+
+	pool->resp_buf = kmalloc_array(num_instances, resp_size, GFP_KERNEL);
+	if (!pool->resp_buf) {
+		dev_err(client->lwis_dev->dev, "Cannot allocate transaction instance responses\n");
+		kfree(pool);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < num_instances; ++i) {
+		pool->instances[i].resp =
+			(struct lwis_transaction_response_header *)(pool->resp_buf + i * resp_size);
+		pool->instances[i].parent = transaction;
+		pool->instances[i].instance_pool = NULL;
+		pool->instances[i].program = NULL;
+		pool->instances[i].uploaded = NULL;
+		pool->instances[i].read_buffers = NULL;
+		pool->instances[i].trigger_timestamp_ns = 0;
+	}
+	pool->free_mask = GENMASK(num_instances - 1, 0);
+	pool->num_in_flight = 0;
+	pool->parent_released = false;
+
+	transaction->instance_pool = pool;
+	return 0;
+}
+
+static void read_buffers_release_work(struct work_struct *work)
+{
+	struct lwis_transaction_read_buffers *read_buffers =
+		container_of(work, struct lwis_transaction_read_buffers, release_work);
+	int i;
+
+	for (i = 0; i < read_buffers->num_buffers; ++i) {
+		dma_buf_vunmap(read_buffers->buffers[i].dma_buf, read_buffers->buffers[i].vaddr);
+		dma_buf_put(read_buffers->buffers[i].dma_buf);
+	}
+	kfree(read_buffers);
+}
+
+/* Takes a reference to and maps each buffer the READ_TO_BUFFER entries read
+ * into, so that processing them does not have to in the trigger context. */
+static int map_read_buffers(struct lwis_client *client, struct lwis_transaction *transaction)
+{
+	struct lwis_transaction_info *info = &transaction->info;
+	struct lwis_transaction_read_buffers *read_buffers;
+	struct lwis_io_entry_read_to_buffer *read_to_buffer;
+	struct dma_buf *dma_buf;
+	void *vaddr;
+	int num_entries = 0;
+	int i, j;
+	int ret;
+
+	for (i = 0; i < info->num_io_entries; ++i) {
+		if (info->io_entries[i].type == LWIS_IO_ENTRY_READ_TO_BUFFER) {
+			num_entries++;
+		}
+	}
+	if (num_entries == 0) {
+		return 0;
+	}
+
+	read_buffers = kzalloc(struct_size(read_buffers, buffers, num_entries), GFP_KERNEL);
+	if (!read_buffers) {
+		return -ENOMEM;
+	}
+	INIT_WORK(&read_buffers->release_work, read_buffers_release_work);
+
+	for (i = 0; i < info->num_io_entries; ++i) {
+		if (info->io_entries[i].type != LWIS_IO_ENTRY_READ_TO_BUFFER) {
+			continue;
+		}
+		read_to_buffer = &info->io_entries[i].read_to_buffer;
+		for (j = 0; j < read_buffers->num_buffers; ++j) {
+			if (read_buffers->buffers[j].fd == read_to_buffer->fd) {
+				break;
+			}
+		}
+		if (j == read_buffers->num_buffers) {
+			dma_buf = lwis_client_dma_buf_get(client, read_to_buffer->fd);
+			if (IS_ERR(dma_buf)) {
+				ret = PTR_ERR(dma_buf);
+				goto error_release;
+			}
+			vaddr = dma_buf_vmap(dma_buf);
+			if (!vaddr) {
+				dev_err(client->lwis_dev->dev, "Failed to map buffer fd %d\n",
+					read_to_buffer->fd);
+				dma_buf_put(dma_buf);
+				ret = -ENOMEM;
+				goto error_release;
+			}
+			read_buffers->buffers[j].fd = read_to_buffer->fd;
+			read_buffers->buffers[j].dma_buf = dma_buf;
+			read_buffers->buffers[j].vaddr = vaddr;
+			read_buffers->num_buffers++;
+		}
+		dma_buf = read_buffers->buffers[j].dma_buf;
+		if (read_to_buffer->size_in_bytes == 0 ||
+		    read_to_buffer->buf_offset > dma_buf->size ||
+		    read_to_buffer->size_in_bytes > dma_buf->size - read_to_buffer->buf_offset) {
+			dev_err(client->lwis_dev->dev,
+				"io_entries[%d] reads %zu bytes at %zu of a %zu byte buffer\n", i,
+				read_to_buffer->size_in_bytes, read_to_buffer->buf_offset,
+				dma_buf->size);
+			ret = -EINVAL;
+			goto error_release;
+		}
+	}
+
+	transaction->read_buffers = read_buffers;
+	return 0;
+
+error_release:
+	read_buffers_release_work(&read_buffers->release_work);
+	return ret;
+}
+
+/* Frees what lwis_transaction_prepare allocated, for a transaction that failed
+ * to be queued. May be called with spinlocks held, so the read buffers, whose
+ * unmapping can sleep, are released from a work. */
+static void unprepare_transaction(struct lwis_transaction *transaction)
+{
+	if (transaction->read_buffers) {
+		queue_work(read_buffers_release_wq, &transaction->read_buffers->release_work);
+		transaction->read_buffers = NULL;
+	}
+	if (transaction->instance_pool) {
+		kfree(transaction->instance_pool->resp_buf);
+		kfree(transaction->instance_pool);
+		transaction->instance_pool = NULL;
+	}
+	kfree(transaction->resp);
+	transaction->resp = NULL;
+}
+
+int lwis_transaction_prepare(struct lwis_client *client, struct lwis_transaction *transaction)
+{
+	int ret;
+
+	transaction->resp = NULL;
+	transaction->instance_pool = NULL;
+	transaction->read_buffers = NULL;
+	transaction->trigger_timestamp_ns = 0;
+	INIT_LIST_HEAD(&transaction->chained);
+	transaction->chain_depth = 1;
+	transaction->deadline_ns = S64_MAX;
+	transaction->group = NULL;
+
+	ret = check_transaction_param(client, transaction);
+	if (ret) {
+		return ret;
+	}
+
+	ret = prepare_response(client, transaction);
+	if (ret) {
+		return ret;
+	}
+
+	if (transaction->info.trigger_event_id != LWIS_EVENT_ID_NONE &&
+	    transaction->info.trigger_event_counter == LWIS_EVENT_COUNTER_EVERY_TIME) {
+		ret = create_instance_pool(client, transaction);
+		if (ret) {
+			unprepare_transaction(transaction);
+			return ret;
+		}
+	}
+
+	ret = map_read_buffers(client, transaction);
+	if (ret) {
+		unprepare_transaction(transaction);
+		return ret;
+	}
+
+	return 0;
+}
+
+/* Chains the transaction to its parent, which must be waiting for its trigger.
+ * Calling this function requires holding the client's transaction_lock. */
+static int chain_transaction_locked(struct lwis_client *client,
+				    struct lwis_transaction *transaction)
+{
+	struct lwis_transaction_info *info = &transaction->info;
+	struct lwis_transaction *parent = NULL;
+	int ret;
+
+	if (info->chain_parent_id >= 0) {
+		parent = xa_load(&client->transaction_ids, info->chain_parent_id);
+	}
+	if (!parent) {
+		dev_err(client->lwis_dev->dev, "Transaction %lld is not waiting to be chained to\n",
+			info->chain_parent_id);
+		return -ENOENT;
+	}
+	if (parent->resp->error_code || parent->instance_pool) {
+		dev_err(client->lwis_dev->dev,
+			"Cannot chain to cancelled or repeating transaction %lld\n",
+			info->chain_parent_id);
+		return -EINVAL;
+	}
+	if (parent->chain_depth >= LWIS_TRANSACTION_CHAIN_MAX_DEPTH) {
+		dev_err(client->lwis_dev->dev, "Transaction chain too long\n");
+		return -E2BIG;
+	}
+
+	ret = xa_err(xa_store(&client->transaction_ids, info->id, transaction, GFP_ATOMIC));
+	if (ret) {
+		return ret;
+	}
+	transaction->chain_depth = parent->chain_depth + 1;
+	list_add_tail(&transaction->event_list_node, &parent->chained);
+	return 0;
+}
+
 /* Calling this function requires holding the client's transaction_lock. */
 static int queue_transaction_locked(struct lwis_client *client,
 				    struct lwis_transaction *transaction)
 {
 	struct lwis_transaction_event_list *event_list;
 	struct lwis_transaction_info *info = &transaction->info;
+	int ret;
+
+	info->id = client->transaction_counter;
+	transaction->resp->id = info->id;
+	info->submission_timestamp_ns = ktime_to_ns(ktime_get());
 
-	if (info->trigger_event_id == LWIS_EVENT_ID_NONE) {
-		/* Immediate trigger. */
+	if (info->chain_condition != LWIS_TRANSACTION_CHAIN_NONE) {
+		ret = chain_transaction_locked(client, transaction);
+		if (ret) {
+			unprepare_transaction(transaction);
+			return ret;
+		}
+	} else if (info->trigger_event_id == LWIS_EVENT_ID_NONE) {
+		transaction->trigger_timestamp_ns = info->submission_timestamp_ns;
+		deadline_set(transaction);
+		/* Immediate trigger, held while an asynchronous device enable runs
+		   and processed by lwis_transaction_client_resume() */
 		if (info->run_at_real_time) {
-			list_add_tail(&transaction->process_queue_node, &client->transaction_process_queue_tasklet);
-			tasklet_schedule(&client->transaction_tasklet);
+			process_queue_add_locked(&client->transaction_process_queue_rt,
+						 transaction);
+			if (!READ_ONCE(client->enable_pending)) {
+				transaction_queue_rt_work(client);
+			}
 		} else {
-			list_add_tail(&transaction->process_queue_node, &client->transaction_process_queue);
-			queue_work(client->transaction_wq, &client->transaction_work);
+			process_queue_add_locked(&client->transaction_process_queue, transaction);
+			if (!READ_ONCE(client->enable_pending)) {
+				transaction_queue_work(client);
+			}
 		}
 	} else {
 		/* Trigger by event. */
+		ret = lwis_device_event_listener_add(client, info->trigger_event_id);
+		if (ret) {
+			dev_err(client->lwis_dev->dev, "Cannot listen to the trigger event\n");
+			unprepare_transaction(transaction);
+			return ret;
+		}
 		event_list = event_list_find_or_create(client, info->trigger_event_id);
 		if (!event_list) {
 			dev_err(client->lwis_dev->dev, "Cannot create transaction event list\n");
-			kfree(transaction->resp);
+			unprepare_transaction(transaction);
 			return -EINVAL;
 		}
-		list_add_tail(&transaction->event_list_node, &event_list->list);
+		ret = xa_err(xa_store(&client->transaction_ids, info->id, transaction, GFP_ATOMIC));
+		if (ret) {
+			dev_err(client->lwis_dev->dev, "Cannot index transaction\n");
+			unprepare_transaction(transaction);
+			return ret;
+		}
+		event_list_add_locked(event_list, transaction);
 	}
-	info->submission_timestamp_ns = ktime_to_ns(ktime_get());
 	client->transaction_counter++;
 	return 0;
 }
@@ -642,51 +1617,59 @@ int lwis_transaction_submit_locked(struct lwis_client *client, struct lwis_trans
 	int ret;
 	struct lwis_transaction_info *info = &transaction->info;
 
-	ret = check_transaction_param_locked(client, transaction,
-					     /*allow_counter_eq=*/info->allow_counter_eq);
-
+	ret = check_trigger_counter_locked(client, transaction,
+					   /*allow_counter_eq=*/info->allow_counter_eq);
 	if (ret) {
+		unprepare_transaction(transaction);
 		return ret;
 	}
 
-	ret = prepare_response_locked(client, transaction);
-	if (ret) {
-		return ret;
-	}
+	return queue_transaction_locked(client, transaction);
+}
 
-	ret = queue_transaction_locked(client, transaction);
-	return ret;
+/* Reports a trigger of a repeating transaction that found all its iterations
+ * in flight, with its error event carrying -ENOSPC. Calling this function
+ * requires holding the client's transaction_lock. */
+static void iteration_dropped(struct lwis_client *client, struct lwis_transaction *transaction,
+			      int64_t event_counter, struct list_head *pending_events)
+{
+	struct lwis_transaction_response_header resp;
+
+	lwis_stats_add(client->lwis_dev, LWIS_STAT_TRANSACTION_ITERATIONS_DROPPED, 1);
+	dev_warn_ratelimited(client->lwis_dev->dev,
+			     "Iteration of transaction %lld dropped at counter %lld\n",
+			     transaction->info.id, event_counter);
+
+	resp.id = transaction->info.id;
+	resp.error_code = -ENOSPC;
+	resp.num_entries = 0;
+	resp.results_size_bytes = 0;
+	resp.completion_index = -1;
+	lwis_pending_event_push(pending_events, transaction->info.emit_error_event_id, &resp,
+				sizeof(resp));
 }
 
 static struct lwis_transaction *
 new_repeating_transaction_iteration(struct lwis_client *client,
 				    struct lwis_transaction *transaction)
 {
+	struct lwis_transaction_instance_pool *pool = transaction->instance_pool;
 	struct lwis_transaction *new_instance;
-	uint8_t *resp_buf;
-
-	/* Construct a new instance for repeating transactions */
-	new_instance = kmalloc(sizeof(struct lwis_transaction), GFP_ATOMIC);
-	if (!new_instance) {
-		dev_err(client->lwis_dev->dev,
-			"Failed to allocate repeating transaction instance\n");
-		return NULL;
-	}
-	memcpy(&new_instance->info, &transaction->info, sizeof(struct lwis_transaction_info));
+	int slot;
 
-	/* Allocate response buffer */
-	resp_buf = kmalloc(sizeof(struct lwis_transaction_response_header) +
-				   transaction->resp->results_size_bytes,
-			   GFP_ATOMIC);
-	if (!resp_buf) {
-		kfree(new_instance);
-		dev_err(client->lwis_dev->dev,
-			"Failed to allocate repeating transaction response\n");
+	/* The trigger path never allocates instances, the iteration is dropped
+	 * when all the preallocated ones are in flight */
+	if (!pool->free_mask) {
 		return NULL;
 	}
-	memcpy(resp_buf, transaction->resp, sizeof(struct lwis_transaction_response_header));
-	new_instance->resp = (struct lwis_transaction_response_header *)resp_buf;
 
+	slot = __ffs(pool->free_mask);
+	pool->free_mask &= ~BIT(slot);
+	new_instance = &pool->instances[slot];
+	memcpy(&new_instance->info, &transaction->info, sizeof(struct lwis_transaction_info));
+	memcpy(new_instance->resp, transaction->resp,
+	       sizeof(struct lwis_transaction_response_header));
+	pool->num_in_flight++;
 	return new_instance;
 }
 
@@ -697,27 +1680,68 @@ static void defer_transaction_locked(struct lwis_client *client,
 {
 	unsigned long flags = 0;
 	if (del_event_list_node) {
-		list_del(&transaction->event_list_node);
+		event_list_remove_locked(client, transaction);
 	}
 
-	/* I2C read/write cannot be executed in IRQ context */
-	if (in_irq && client->lwis_dev->type == DEVICE_TYPE_I2C) {
-		list_add_tail(&transaction->process_queue_node, &client->transaction_process_queue);
-		return;
+	transaction->trigger_timestamp_ns = ktime_to_ns(ktime_get());
+	trace_lwis_transaction_trigger(client->lwis_dev, transaction->info.id,
+				       transaction->info.trigger_event_id);
+	/* Iterations of a repeating transaction share its submission time */
+	if (!transaction->parent) {
+		lwis_latency_record(client, LWIS_LATENCY_SUBMIT_TO_TRIGGER,
+				    transaction->trigger_timestamp_ns -
+					    transaction->info.submission_timestamp_ns);
 	}
 
-	if (transaction->info.run_in_event_context) {
+	/* I2C read/write and QoS votes cannot be executed in IRQ context, but
+	 * can on the real-time worker */
+	if (transaction->info.run_in_event_context &&
+	    !(in_irq && (client->lwis_dev->type == DEVICE_TYPE_I2C ||
+			 client->lwis_dev->type == DEVICE_TYPE_DPM))) {
 		spin_unlock_irqrestore(&client->transaction_lock, flags);
 		process_transaction(client, transaction, pending_events, in_irq);
 		spin_lock_irqsave(&client->transaction_lock, flags);
 	} else if (transaction->info.run_at_real_time) {
-		list_add_tail(&transaction->process_queue_node,
-			      &client->transaction_process_queue_tasklet);
+		deadline_set(transaction);
+		process_queue_add_locked(&client->transaction_process_queue_rt, transaction);
 	} else {
-		list_add_tail(&transaction->process_queue_node, &client->transaction_process_queue);
+		deadline_set(transaction);
+		process_queue_add_locked(&client->transaction_process_queue, transaction);
 	}
 }
 
+/*
+ * Defers the transactions of the sorted counter list waiting for
+ * event_counter, from it on and up to the first one submitted after max_id,
+ * and returns where the next call resumes. Transactions waiting for the same
+ * counter are in submission order, so this interleaves them with the other
+ * transactions of the event by increasing ID.
+ * Calling this function requires holding the client's transaction_lock.
+ */
+static struct list_head *defer_counter_transactions_locked(struct lwis_client *client,
+							   struct list_head *it,
+							   struct list_head *counter_list,
+							   int64_t event_counter, int64_t max_id,
+							   struct list_head *pending_events,
+							   bool in_irq)
+{
+	struct lwis_transaction *transaction;
+	struct list_head *next;
+
+	while (it != counter_list) {
+		transaction = list_entry(it, struct lwis_transaction, event_list_node);
+		if (transaction->info.trigger_event_counter != event_counter ||
+		    transaction->info.id > max_id) {
+			break;
+		}
+		next = it->next;
+		defer_transaction_locked(client, transaction, pending_events, in_irq,
+					 /* del_event_list_node */ true);
+		it = next;
+	}
+	return it;
+}
+
 int lwis_transaction_event_trigger(struct lwis_client *client, int64_t event_id,
 				   int64_t event_counter, struct list_head *pending_events,
 				   bool in_irq)
@@ -725,6 +1749,7 @@ int lwis_transaction_event_trigger(struct lwis_client *client, int64_t event_id,
 	unsigned long flags;
 	struct lwis_transaction_event_list *event_list;
 	struct list_head *it_tran, *it_tran_tmp;
+	struct list_head *it_counter;
 	struct lwis_transaction *transaction;
 	struct lwis_transaction *new_instance;
 	int64_t trigger_counter = 0;
@@ -733,48 +1758,63 @@ int lwis_transaction_event_trigger(struct lwis_client *client, int64_t event_id,
 	spin_lock_irqsave(&client->transaction_lock, flags);
 	event_list = event_list_find(client, event_id);
 	/* No event found, just return. */
-	if (event_list == NULL || list_empty(&event_list->list)) {
+	if (event_list == NULL ||
+	    (list_empty(&event_list->list) && list_empty(&event_list->counter_list))) {
 		spin_unlock_irqrestore(&client->transaction_lock, flags);
 		return 0;
 	}
 
-	/* Go through all transactions under the chosen event list. */
+	/* Only transactions waiting for this event counter are taken from the
+	 * sorted counter list, the ones queued for later counters stay
+	 * untouched. */
+	list_for_each (it_counter, &event_list->counter_list) {
+		transaction = list_entry(it_counter, struct lwis_transaction, event_list_node);
+		if (transaction->info.trigger_event_counter >= event_counter) {
+			break;
+		}
+	}
+
+	/* Go through the transactions triggered on any occurrence, and run the
+	 * ones waiting for this counter in between, in submission order. */
 	list_for_each_safe (it_tran, it_tran_tmp, &event_list->list) {
 		transaction = list_entry(it_tran, struct lwis_transaction, event_list_node);
+		it_counter = defer_counter_transactions_locked(client, it_counter,
+							       &event_list->counter_list,
+							       event_counter, transaction->info.id,
+							       pending_events, in_irq);
 		if (transaction->resp->error_code) {
 			list_add_tail(&transaction->process_queue_node,
 				      &client->transaction_process_queue);
-			list_del(&transaction->event_list_node);
+			event_list_remove_locked(client, transaction);
 			continue;
 		}
 
-		/* Compare current event with trigger event counter to make
-		 * sure this transaction needs to be executed now. */
 		trigger_counter = transaction->info.trigger_event_counter;
-		if (trigger_counter == LWIS_EVENT_COUNTER_ON_NEXT_OCCURRENCE ||
-		    trigger_counter == event_counter) {
+		if (trigger_counter == LWIS_EVENT_COUNTER_ON_NEXT_OCCURRENCE) {
 			defer_transaction_locked(client, transaction, pending_events, in_irq,
 						 /* del_event_list_node */ true);
 		} else if (trigger_counter == LWIS_EVENT_COUNTER_EVERY_TIME) {
 			new_instance = new_repeating_transaction_iteration(client, transaction);
 			if (!new_instance) {
-				transaction->resp->error_code = -ENOMEM;
-				list_add_tail(&transaction->process_queue_node,
-					      &client->transaction_process_queue);
-				list_del(&transaction->event_list_node);
+				/* The transaction stays armed for the next
+				 * occurrences */
+				iteration_dropped(client, transaction, event_counter,
+						  pending_events);
 				continue;
 			}
 			defer_transaction_locked(client, new_instance, pending_events, in_irq,
 						 /* del_event_list_node */ false);
 		}
 	}
+	defer_counter_transactions_locked(client, it_counter, &event_list->counter_list,
+					  event_counter, S64_MAX, pending_events, in_irq);
 
 	/* Schedule deferred transactions */
-	if (!list_empty(&client->transaction_process_queue_tasklet)) {
-		tasklet_schedule(&client->transaction_tasklet);
+	if (!list_empty(&client->transaction_process_queue_rt)) {
+		transaction_queue_rt_work(client);
 	}
 	if (!list_empty(&client->transaction_process_queue)) {
-		queue_work(client->transaction_wq, &client->transaction_work);
+		transaction_queue_work(client);
 	}
 
 	spin_unlock_irqrestore(&client->transaction_lock, flags);
@@ -785,22 +1825,28 @@ int lwis_transaction_event_trigger(struct lwis_client *client, int64_t event_id,
 /* Calling this function requires holding the client's transaction_lock. */
 static int cancel_waiting_transaction_locked(struct lwis_client *client, int64_t id)
 {
-	int i;
-	struct hlist_node *tmp;
-	struct list_head *it_tran, *it_tran_tmp;
-	struct lwis_transaction_event_list *it_evt_list;
+	struct lwis_transaction_event_list *event_list;
 	struct lwis_transaction *transaction;
 
-	hash_for_each_safe (client->transaction_list, i, tmp, it_evt_list, node) {
-		list_for_each_safe (it_tran, it_tran_tmp, &it_evt_list->list) {
-			transaction = list_entry(it_tran, struct lwis_transaction, event_list_node);
-			if (transaction->info.id == id) {
-				transaction->resp->error_code = -ECANCELED;
-				return 0;
-			}
-		}
+	if (id < 0) {
+		return -ENOENT;
+	}
+	transaction = xa_load(&client->transaction_ids, id);
+	if (!transaction) {
+		return -ENOENT;
 	}
-	return -ENOENT;
+
+	transaction->resp->error_code = -ECANCELED;
+	/* Cancelled chained transactions stay chained until their parent
+	 * completes */
+	if (transaction->info.chain_condition == LWIS_TRANSACTION_CHAIN_NONE &&
+	    EXPLICIT_EVENT_COUNTER(transaction->info.trigger_event_counter)) {
+		/* Cancelled transactions are flushed on the next occurrence of
+		 * the event */
+		event_list = event_list_find(client, transaction->info.trigger_event_id);
+		list_move_tail(&transaction->event_list_node, &event_list->list);
+	}
+	return 0;
 }
 
 int lwis_transaction_cancel(struct lwis_client *client, int64_t id)
@@ -815,27 +1861,316 @@ int lwis_transaction_cancel(struct lwis_client *client, int64_t id)
 	return ret;
 }
 
+/* Takes back a transaction queue_transaction_locked() queued, which nothing
+ * processed yet since the transaction_lock is still held, without emitting any
+ * event. Later transactions chained to it must be taken back first. The
+ * listener of its trigger event is kept, as when a transaction is cancelled. */
+static void unqueue_transaction_locked(struct lwis_client *client,
+				       struct lwis_transaction *transaction)
+{
+	struct lwis_transaction_info *info = &transaction->info;
+
+	if (info->chain_condition != LWIS_TRANSACTION_CHAIN_NONE ||
+	    info->trigger_event_id != LWIS_EVENT_ID_NONE) {
+		event_list_remove_locked(client, transaction);
+	} else {
+		list_del(&transaction->process_queue_node);
+	}
+	unprepare_transaction(transaction);
+}
+
+int lwis_transaction_submit_batch(struct lwis_client *client,
+				  struct lwis_transaction **transactions,
+				  struct lwis_transaction_info *infos, int32_t *errors,
+				  size_t num_transactions)
+{
+	unsigned long flags;
+	size_t num_prepared;
+	size_t num_queued;
+	size_t i;
+	int ret = 0;
+
+	for (num_prepared = 0; num_prepared < num_transactions; ++num_prepared) {
+		ret = lwis_transaction_prepare(client, transactions[num_prepared]);
+		if (ret) {
+			errors[num_prepared] = ret;
+			goto out_unprepare;
+		}
+	}
+
+	spin_lock_irqsave(&client->transaction_lock, flags);
+	for (i = 0; i < num_transactions; ++i) {
+		ret = check_trigger_counter_locked(client, transactions[i],
+						   transactions[i]->info.allow_counter_eq);
+		if (ret) {
+			errors[i] = ret;
+			spin_unlock_irqrestore(&client->transaction_lock, flags);
+			goto out_unprepare;
+		}
+	}
+
+	for (num_queued = 0; num_queued < num_transactions; ++num_queued) {
+		ret = queue_transaction_locked(client, transactions[num_queued]);
+		if (ret) {
+			errors[num_queued] = ret;
+			break;
+		}
+		infos[num_queued] = transactions[num_queued]->info;
+	}
+
+	if (!ret) {
+		for (i = 0; i < num_transactions; ++i) {
+			errors[i] = 0;
+			transactions[i] = NULL;
+		}
+		spin_unlock_irqrestore(&client->transaction_lock, flags);
+		return 0;
+	}
+
+	/* Nothing ran yet as the lock is held, the transactions queued before
+	 * the failure are taken back without any event, and give back their
+	 * IDs */
+	for (i = num_queued; i > 0; --i) {
+		unqueue_transaction_locked(client, transactions[i - 1]);
+	}
+	client->transaction_counter -= num_queued;
+	/* The failing transaction was unprepared when queued */
+	for (i = num_queued + 1; i < num_transactions; ++i) {
+		unprepare_transaction(transactions[i]);
+	}
+	spin_unlock_irqrestore(&client->transaction_lock, flags);
+	return ret;
+
+out_unprepare:
+	for (i = 0; i < num_prepared; ++i) {
+		unprepare_transaction(transactions[i]);
+	}
+	return ret;
+}
+
 int lwis_transaction_replace_locked(struct lwis_client *client,
 				    struct lwis_transaction *transaction)
 {
 	int ret;
 
-	ret = check_transaction_param_locked(client, transaction,
-					     /*allow_counter_eq=*/false);
+	ret = check_trigger_counter_locked(client, transaction,
+					   /*allow_counter_eq=*/false);
 	if (ret) {
+		unprepare_transaction(transaction);
 		return ret;
 	}
 
 	ret = cancel_waiting_transaction_locked(client, transaction->info.id);
 	if (ret) {
+		unprepare_transaction(transaction);
 		return ret;
 	}
 
-	ret = prepare_response_locked(client, transaction);
+	return queue_transaction_locked(client, transaction);
+}
+
+/* Sorts the distinct clients by address, the order their transaction_lock is
+ * taken in */
+static int group_lock_order(struct lwis_client **clients, int num_members,
+			    struct lwis_client **locked)
+{
+	int num_locked = 0;
+	int i, j;
+
+	for (i = 0; i < num_members; ++i) {
+		j = 0;
+		while (j < num_locked && locked[j] < clients[i]) {
+			j++;
+		}
+		if (j < num_locked && locked[j] == clients[i]) {
+			continue;
+		}
+		memmove(&locked[j + 1], &locked[j], (num_locked - j) * sizeof(*locked));
+		locked[j] = clients[i];
+		num_locked++;
+	}
+	return num_locked;
+}
+
+/* Serializes the group submissions, so that lockdep accepts the client locks
+ * of their members being taken together */
+static DEFINE_MUTEX(group_clients_lock);
+
+int lwis_transaction_group_clients_lock(struct lwis_client *caller, struct lwis_client **clients,
+					int num_members, struct lwis_client **locked)
+{
+	int num_locked = group_lock_order(clients, num_members, locked);
+	int i;
+
+	mutex_lock(&group_clients_lock);
+	for (i = 0; i < num_locked; ++i) {
+		/* The lock of the calling client is already held */
+		if (locked[i] != caller) {
+			mutex_lock_nest_lock(&locked[i]->lock, &group_clients_lock);
+		}
+	}
+	return num_locked;
+}
+
+void lwis_transaction_group_clients_unlock(struct lwis_client *caller, struct lwis_client **locked,
+					   int num_locked)
+{
+	int i;
+
+	for (i = num_locked - 1; i >= 0; --i) {
+		if (locked[i] != caller) {
+			mutex_unlock(&locked[i]->lock);
+		}
+	}
+	mutex_unlock(&group_clients_lock);
+}
+
+/* Copies the info of every member to infos, with an invalid id, for a group
+ * that is not queued */
+static void group_infos_invalid(struct lwis_transaction **transactions,
+				struct lwis_transaction_info *infos, int num_members)
+{
+	int i;
+
+	for (i = 0; i < num_members; ++i) {
+		infos[i] = transactions[i]->info;
+		infos[i].id = LWIS_ID_INVALID;
+	}
+}
+
+int lwis_transaction_group_prepare(struct lwis_device *lwis_dev, struct lwis_client **clients,
+				   struct lwis_transaction **transactions,
+				   struct lwis_transaction_info *infos, int num_members)
+{
+	struct lwis_transaction_info *info;
+	int ret = 0;
+	int i;
+
+	for (i = 0; i < num_members; ++i) {
+		info = &transactions[i]->info;
+		if (info->trigger_event_id == LWIS_EVENT_ID_NONE ||
+		    info->trigger_event_counter == LWIS_EVENT_COUNTER_EVERY_TIME ||
+		    info->chain_condition != LWIS_TRANSACTION_CHAIN_NONE) {
+			dev_err(lwis_dev->dev,
+				"Group members must be triggered once by an event, unchained\n");
+			group_infos_invalid(transactions, infos, num_members);
+			return -EINVAL;
+		}
+	}
+
+	for (i = 0; i < num_members; ++i) {
+		ret = lwis_transaction_prepare(clients[i], transactions[i]);
+		if (ret) {
+			break;
+		}
+	}
 	if (ret) {
+		while (--i >= 0) {
+			unprepare_transaction(transactions[i]);
+		}
+		group_infos_invalid(transactions, infos, num_members);
+	}
+	return ret;
+}
+
+int lwis_transaction_group_submit(struct lwis_device *lwis_dev, int64_t emit_event_id,
+				  struct lwis_client **clients,
+				  struct lwis_transaction **transactions,
+				  struct lwis_transaction_info *infos, int num_members)
+{
+	struct lwis_client *locked[LWIS_TRANSACTION_GROUP_MAX_MEMBERS];
+	struct lwis_transaction_group *group;
+	unsigned long flags;
+	int num_locked;
+	int num_queued = 0;
+	int ret = 0;
+	int i;
+
+	group = kzalloc(sizeof(*group), GFP_KERNEL);
+	if (!group) {
+		ret = -ENOMEM;
+		goto out_unprepare;
+	}
+	group->lwis_dev = lwis_dev;
+	group->emit_event_id = emit_event_id;
+	atomic_set(&group->num_pending, num_members + 1);
+	INIT_WORK(&group->complete_work, group_complete_work_func);
+	group->resp.num_members = num_members;
+	for (i = 0; i < num_members; ++i) {
+		group->resp.ids[i] = LWIS_ID_INVALID;
+	}
+
+	num_locked = group_lock_order(clients, num_members, locked);
+	local_irq_save(flags);
+	for (i = 0; i < num_locked; ++i) {
+		spin_lock_nested(&locked[i]->transaction_lock, i);
+	}
+
+	for (i = 0; i < num_members; ++i) {
+		ret = check_trigger_counter_locked(clients[i], transactions[i],
+						   /*allow_counter_eq=*/false);
+		if (ret) {
+			goto out_unlock;
+		}
+	}
+
+	for (i = 0; i < num_members; ++i) {
+		if (ret) {
+			unprepare_transaction(transactions[i]);
+			infos[i] = transactions[i]->info;
+			infos[i].id = LWIS_ID_INVALID;
+			atomic_dec(&group->num_pending);
+			continue;
+		}
+		transactions[i]->group = group;
+		transactions[i]->group_index = i;
+		ret = queue_transaction_locked(clients[i], transactions[i]);
+		if (ret) {
+			transactions[i]->group = NULL;
+			infos[i] = transactions[i]->info;
+			infos[i].id = LWIS_ID_INVALID;
+			atomic_dec(&group->num_pending);
+			continue;
+		}
+		group->resp.ids[i] = transactions[i]->info.id;
+		infos[i] = transactions[i]->info;
+		num_queued++;
+	}
+
+	/* The members queued before the failure complete the group once
+	 * cancelled */
+	for (i = 0; i < num_members; ++i) {
+		if (group->resp.ids[i] == LWIS_ID_INVALID) {
+			continue;
+		}
+		if (ret) {
+			cancel_waiting_transaction_locked(clients[i], group->resp.ids[i]);
+		}
+		transactions[i] = NULL;
+	}
+
+	for (i = num_locked - 1; i >= 0; --i) {
+		spin_unlock(&locked[i]->transaction_lock);
+	}
+	local_irq_restore(flags);
+
+	if (!num_queued) {
+		kfree(group);
 		return ret;
 	}
+	group_put(group);
+	return ret;
 
-	ret = queue_transaction_locked(client, transaction);
+out_unlock:
+	for (i = num_locked - 1; i >= 0; --i) {
+		spin_unlock(&locked[i]->transaction_lock);
+	}
+	local_irq_restore(flags);
+out_unprepare:
+	for (i = 0; i < num_members; ++i) {
+		unprepare_transaction(transactions[i]);
+	}
+	group_infos_invalid(transactions, infos, num_members);
+	kfree(group);
 	return ret;
 }
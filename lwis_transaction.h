@@ -11,11 +11,36 @@
 #ifndef LWIS_TRANSACTION_H_
 #define LWIS_TRANSACTION_H_
 
+#include <linux/workqueue.h>
+
 #include "lwis_commands.h"
 
 /* LWIS forward declarations */
 struct lwis_device;
 struct lwis_client;
+struct lwis_transaction_instance_pool;
+struct lwis_io_program;
+struct lwis_uploaded_io;
+struct dma_buf;
+
+/* Default number of preallocated iteration instances per repeating
+ * transaction, unless set by the transaction-instance-pool-size device tree
+ * property. A trigger occurring while all of them are in flight is dropped,
+ * and the transaction error event is emitted with -ENOSPC. */
+#define LWIS_TRANSACTION_INSTANCE_POOL_SIZE 8
+
+/* Buffers the READ_TO_BUFFER entries of a transaction read into, referenced
+ * and mapped at submission. Transactions can be freed with the client's
+ * transaction_lock held, so releasing them is left to a work. */
+struct lwis_transaction_read_buffers {
+	struct work_struct release_work;
+	int num_buffers;
+	struct {
+		int fd;
+		struct dma_buf *dma_buf;
+		void *vaddr;
+	} buffers[];
+};
 
 /* Transaction entry. Each entry belongs to two queues:
  * 1) Event list: Transactions are sorted by event IDs. This is to search for
@@ -28,6 +53,68 @@ struct lwis_transaction {
 	struct lwis_transaction_response_header *resp;
 	struct list_head event_list_node;
 	struct list_head process_queue_node;
+	/* Repeating transaction this instance is an iteration of, NULL
+	 * otherwise */
+	struct lwis_transaction *parent;
+	/* Preallocated iteration instances, only used by repeating
+	 * (LWIS_EVENT_COUNTER_EVERY_TIME) transactions */
+	struct lwis_transaction_instance_pool *instance_pool;
+	/* Compiled form of the I/O entries, only used by repeating
+	 * transactions and uploaded entries. Iterations use the program of
+	 * their parent */
+	struct lwis_io_program *program;
+	/* Uploaded entries the I/O entries come from, which then own the
+	 * write buffers and program, NULL otherwise */
+	struct lwis_uploaded_io *uploaded;
+	/* Buffers of the READ_TO_BUFFER entries, NULL if there are none.
+	 * Iterations use the buffers of their parent */
+	struct lwis_transaction_read_buffers *read_buffers;
+	/* ktime_get() time of the trigger, or of the submission of immediate
+	 * transactions, 0 if the transaction was not triggered */
+	int64_t trigger_timestamp_ns;
+	/* Transactions chained to this one, linked by their event_list_node,
+	 * which run or are cancelled once it completes */
+	struct list_head chained;
+	/* Number of transactions in the chain ending with this one */
+	int chain_depth;
+	/* ktime_get() time the transaction is to start by once deferred to a
+	 * worker, S64_MAX if it has no deadline */
+	int64_t deadline_ns;
+	/* Group the transaction is a member of, NULL otherwise */
+	struct lwis_transaction_group *group;
+	int group_index;
+};
+
+/* Transactions of several clients submitted with
+ * lwis_transaction_group_submit. Members complete in the contexts of their own
+ * devices, some with a transaction_lock held, so the completion of the group
+ * is emitted from a work. */
+struct lwis_transaction_group {
+	/* Device emitting the completion of the group */
+	struct lwis_device *lwis_dev;
+	int64_t emit_event_id;
+	/* Members yet to complete, plus one held by the submission */
+	atomic_t num_pending;
+	struct work_struct complete_work;
+	struct lwis_transaction_group_response resp;
+};
+
+/* Iteration instances and response buffers of a repeating transaction are
+ * allocated once at submission so that the trigger path does not need to
+ * allocate memory. Access is guarded by the client's transaction_lock.
+ */
+struct lwis_transaction_instance_pool {
+	/* Backing memory of the response buffers of all instances */
+	uint8_t *resp_buf;
+	/* Bitmap of instance slots that are available */
+	unsigned long free_mask;
+	/* Number of iterations that are queued or being processed */
+	int num_in_flight;
+	/* Set when the parent transaction is released while iterations are
+	 * still in flight, the last iteration frees the parent */
+	bool parent_released;
+	/* Iteration instances, lwis_dev->transaction_instance_pool_size */
+	struct lwis_transaction instances[];
 };
 
 /* For debugging purposes, keeps track of the transaction information, as
@@ -41,16 +128,34 @@ struct lwis_transaction_history {
 
 struct lwis_transaction_event_list {
 	int64_t event_id;
+	/* Transactions checked on every occurrence of the event: the ones
+	 * triggered on next occurrence or every time, and cancelled ones waiting
+	 * to be flushed */
 	struct list_head list;
+	/* Transactions waiting for a specific event counter, sorted by
+	 * ascending trigger_event_counter */
+	struct list_head counter_list;
 	struct hlist_node node;
 };
 
+/* Upper bound of the busy-waiting phase of LWIS_IO_ENTRY_POLL_US */
+#define MAX_POLL_SPIN_US 50
+
 int lwis_entry_poll(struct lwis_device *lwis_dev, struct lwis_io_entry *entry, bool non_blocking);
 int lwis_entry_read_assert(struct lwis_device *lwis_dev, struct lwis_io_entry *entry);
 
+/* Allocates and frees the module-wide state of the transactions. Deinit waits
+ * for the transactions already freed to release their read buffers, and is
+ * called once all the clients are released. */
+int lwis_transaction_module_init(void);
+void lwis_transaction_module_deinit(void);
+
 int lwis_transaction_init(struct lwis_client *client);
 int lwis_transaction_clear(struct lwis_client *client);
 int lwis_transaction_client_flush(struct lwis_client *client);
+/* Processes the immediate transactions held while the client's asynchronous
+ * device enable ran, or cancels them with error_code if the enable failed. */
+void lwis_transaction_client_resume(struct lwis_client *client, int error_code);
 int lwis_transaction_client_cleanup(struct lwis_client *client);
 
 int lwis_transaction_event_trigger(struct lwis_client *client, int64_t event_id,
@@ -58,11 +163,64 @@ int lwis_transaction_event_trigger(struct lwis_client *client, int64_t event_id,
 				   bool in_irq);
 int lwis_transaction_cancel(struct lwis_client *client, int64_t id);
 
+/* Validates the transaction and allocates its response and instance pool,
+ * without holding lwis_client->transaction_lock, so that the locked submit
+ * and replace only check the trigger counter and queue it. */
+int lwis_transaction_prepare(struct lwis_client *client, struct lwis_transaction *transaction);
+
 /* Expects lwis_client->transaction_lock to be acquired before calling
- * the following functions. */
+ * the following functions. The transaction must have been prepared with
+ * lwis_transaction_prepare, which is undone if they fail. */
 int lwis_transaction_submit_locked(struct lwis_client *client,
 				   struct lwis_transaction *transaction);
 int lwis_transaction_replace_locked(struct lwis_client *client,
 				    struct lwis_transaction *transaction);
+bool lwis_transaction_event_pending_locked(struct lwis_client *client, int64_t event_id);
+
+/* Prepares and queues the transactions of one client under one acquisition of
+ * its transaction_lock, so that no trigger is processed between two of them.
+ * Either all of them are queued, their info copied to infos and set to NULL in
+ * transactions, or none is and the error of the first one failing is
+ * returned, the other ones being unprepared. errors, which the caller fills
+ * with -ECANCELED, is set to 0 on success or to the error of the failing one.
+ */
+int lwis_transaction_submit_batch(struct lwis_client *client,
+				  struct lwis_transaction **transactions,
+				  struct lwis_transaction_info *infos, int32_t *errors,
+				  size_t num_transactions);
+
+/* Takes the lock of the distinct clients of a group, but the one of caller,
+ * which is already held, in a stable order. locked receives the clients in
+ * that order, for lwis_transaction_group_clients_unlock.
+ * Returns: the number of distinct clients
+ */
+int lwis_transaction_group_clients_lock(struct lwis_client *caller, struct lwis_client **clients,
+					int num_members, struct lwis_client **locked);
+void lwis_transaction_group_clients_unlock(struct lwis_client *caller, struct lwis_client **locked,
+					   int num_locked);
+
+/* Validates and prepares the members of a group, to be called with the locks
+ * of their clients held. On failure, the members prepared are unprepared and
+ * their info is copied to infos with an invalid id.
+ */
+int lwis_transaction_group_prepare(struct lwis_device *lwis_dev, struct lwis_client **clients,
+				   struct lwis_transaction **transactions,
+				   struct lwis_transaction_info *infos, int num_members);
+
+/* Queues the prepared transactions of clients as one group, taking the
+ * transaction_lock of every client, so that no trigger is processed between
+ * the checks of their trigger counters. The members are triggered by the same
+ * event and counter, set in their info. The info of every member is copied to
+ * infos once queued, and the queued members are set to NULL in transactions,
+ * the other ones being unprepared. A member failing to be queued cancels the
+ * ones queued before it.
+ *
+ * Alloc: Yes, the group
+ * Returns: 0 on success
+ */
+int lwis_transaction_group_submit(struct lwis_device *lwis_dev, int64_t emit_event_id,
+				  struct lwis_client **clients,
+				  struct lwis_transaction **transactions,
+				  struct lwis_transaction_info *infos, int num_members);
 
 #endif /* LWIS_TRANSACTION_H_ */
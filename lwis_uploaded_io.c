@@ -0,0 +1,170 @@
+/*
+ * Google LWIS Uploaded IO Entries
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define pr_fmt(fmt) KBUILD_MODNAME "-uploaded-io: " fmt
+
+#include <linux/hashtable.h>
+#include <linux/mm.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+
+#include "lwis_device.h"
+#include "lwis_uploaded_io.h"
+#include "lwis_util.h"
+
+static void io_entries_free(struct lwis_io_entry *io_entries, size_t num_io_entries)
+{
+	int i;
+	uint8_t **write_buf;
+	size_t write_size;
+
+	for (i = 0; i < num_io_entries; ++i) {
+		write_buf = lwis_io_entry_write_buf(&io_entries[i], &write_size);
+		if (write_buf) {
+			kvfree(*write_buf);
+		}
+	}
+	kvfree(io_entries);
+}
+
+static void uploaded_io_put(struct lwis_uploaded_io *uploaded)
+{
+	if (refcount_dec_and_test(&uploaded->refcount)) {
+		io_entries_free(uploaded->io_entries, uploaded->num_io_entries);
+		kfree(uploaded->program);
+		kfree(uploaded);
+	}
+}
+
+static struct lwis_uploaded_io *uploaded_io_find(struct lwis_client *client, int64_t handle)
+{
+	struct lwis_uploaded_io *uploaded;
+
+	hash_for_each_possible (client->uploaded_io, uploaded, node, handle) {
+		if (uploaded->handle == handle) {
+			return uploaded;
+		}
+	}
+	return NULL;
+}
+
+int lwis_uploaded_io_add(struct lwis_client *client, struct lwis_io_entry *io_entries,
+			 size_t num_io_entries, int64_t *handle)
+{
+	struct lwis_uploaded_io *uploaded;
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	uploaded = kmalloc(sizeof(struct lwis_uploaded_io), GFP_KERNEL);
+	if (!uploaded) {
+		dev_err(lwis_dev->dev, "Failed to allocate uploaded io entries\n");
+		io_entries_free(io_entries, num_io_entries);
+		return -ENOMEM;
+	}
+
+	refcount_set(&uploaded->refcount, 1);
+	uploaded->num_io_entries = num_io_entries;
+	uploaded->io_entries = io_entries;
+	uploaded->program = NULL;
+	/* Resolve and validate the register accesses once for all submissions */
+	if (lwis_dev->vops.register_io_compile) {
+		uploaded->program =
+			lwis_dev->vops.register_io_compile(lwis_dev, io_entries, num_io_entries);
+	}
+
+	/* Handles start at 1, as LWIS_IO_ENTRIES_HANDLE_NONE is 0 */
+	uploaded->handle = ++client->uploaded_io_counter;
+	hash_add(client->uploaded_io, &uploaded->node, uploaded->handle);
+	*handle = uploaded->handle;
+
+	return 0;
+}
+
+int lwis_uploaded_io_release(struct lwis_client *client, int64_t handle)
+{
+	struct lwis_uploaded_io *uploaded = uploaded_io_find(client, handle);
+
+	if (!uploaded) {
+		return -ENOENT;
+	}
+
+	hash_del(&uploaded->node);
+	uploaded_io_put(uploaded);
+	return 0;
+}
+
+void lwis_uploaded_io_clear(struct lwis_client *client)
+{
+	int i;
+	struct hlist_node *tmp;
+	struct lwis_uploaded_io *uploaded;
+
+	hash_for_each_safe (client->uploaded_io, i, tmp, uploaded, node) {
+		hash_del(&uploaded->node);
+		uploaded_io_put(uploaded);
+	}
+}
+
+int lwis_uploaded_io_instantiate(struct lwis_client *client, int64_t handle,
+				 const struct lwis_io_entry_patch *patches, size_t num_patches,
+				 struct lwis_uploaded_io **uploaded,
+				 struct lwis_io_entry **io_entries)
+{
+	size_t i;
+	struct lwis_io_entry *entry;
+	struct lwis_io_entry *k_entries;
+	struct lwis_uploaded_io *found = uploaded_io_find(client, handle);
+	struct lwis_device *lwis_dev = client->lwis_dev;
+
+	if (!found) {
+		dev_err(lwis_dev->dev, "Unknown uploaded io entries handle %lld\n", handle);
+		return -ENOENT;
+	}
+
+	/* Processing writes read values and read batch buffers into the
+	 * entries, so every submission runs its own copy. Write buffers stay
+	 * shared with the uploaded entries */
+	k_entries = kvmalloc_array(found->num_io_entries, sizeof(struct lwis_io_entry), GFP_KERNEL);
+	if (!k_entries) {
+		dev_err(lwis_dev->dev, "Failed to allocate io entries\n");
+		return -ENOMEM;
+	}
+	memcpy(k_entries, found->io_entries, found->num_io_entries * sizeof(struct lwis_io_entry));
+
+	for (i = 0; i < num_patches; ++i) {
+		if (patches[i].index >= found->num_io_entries) {
+			dev_err(lwis_dev->dev, "Patch index %u out of range\n", patches[i].index);
+			kvfree(k_entries);
+			return -EINVAL;
+		}
+		entry = &k_entries[patches[i].index];
+		if (entry->type == LWIS_IO_ENTRY_WRITE) {
+			entry->rw.val = patches[i].val;
+		} else if (entry->type == LWIS_IO_ENTRY_MODIFY) {
+			entry->mod.val = patches[i].val;
+		} else {
+			dev_err(lwis_dev->dev, "Cannot patch io entry %u of type %d\n",
+				patches[i].index, entry->type);
+			kvfree(k_entries);
+			return -EINVAL;
+		}
+	}
+
+	refcount_inc(&found->refcount);
+	*uploaded = found;
+	*io_entries = k_entries;
+	return 0;
+}
+
+void lwis_uploaded_io_entries_free(struct lwis_uploaded_io *uploaded,
+				   struct lwis_io_entry *io_entries)
+{
+	kvfree(io_entries);
+	uploaded_io_put(uploaded);
+}
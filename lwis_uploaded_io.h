@@ -0,0 +1,100 @@
+/*
+ * Google LWIS Uploaded IO Entries
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef LWIS_UPLOADED_IO_H_
+#define LWIS_UPLOADED_IO_H_
+
+#include <linux/refcount.h>
+#include <linux/types.h>
+
+#include "lwis_commands.h"
+
+/* LWIS forward declarations */
+struct lwis_client;
+struct lwis_io_program;
+
+/*
+ * struct lwis_uploaded_io
+ * IO entries uploaded once by a client, that transactions and periodic ios
+ * reference by handle instead of copying them from userspace on every
+ * submission. The entries are immutable apart from the outputs of their
+ * execution, patched values run from a private copy of the entries.
+ */
+struct lwis_uploaded_io {
+	int64_t handle;
+	/* One reference for the client table, one per submission using it */
+	refcount_t refcount;
+	size_t num_io_entries;
+	/* Write buffers are deep copied and owned with the entries */
+	struct lwis_io_entry *io_entries;
+	/* Compiled form of the entries, NULL if they execute uncompiled */
+	struct lwis_io_program *program;
+	struct hlist_node node;
+};
+
+/*
+ * lwis_uploaded_io_add: Adds the io_entries, with their write buffers
+ * already copied from userspace, to the client table and returns the new
+ * handle. Ownership of io_entries is transferred, also on error.
+ *
+ * Locks: lwis_client->lock
+ * Alloc: Yes
+ * Returns: 0 on success
+ */
+int lwis_uploaded_io_add(struct lwis_client *client, struct lwis_io_entry *io_entries,
+			 size_t num_io_entries, int64_t *handle);
+
+/*
+ * lwis_uploaded_io_release: Removes the uploaded entries from the client
+ * table. Submissions still using them keep them alive.
+ *
+ * Locks: lwis_client->lock
+ * Alloc: No
+ * Returns: 0 on success, -ENOENT if the handle is unknown
+ */
+int lwis_uploaded_io_release(struct lwis_client *client, int64_t handle);
+
+/*
+ * lwis_uploaded_io_clear: Releases all uploaded entries of the client.
+ *
+ * Locks: lwis_client->lock
+ * Alloc: No
+ * Returns: None
+ */
+void lwis_uploaded_io_clear(struct lwis_client *client);
+
+/*
+ * lwis_uploaded_io_instantiate: Looks up the uploaded entries of handle and
+ * returns in *io_entries the entries a submission executes, a private shallow
+ * copy of the uploaded entries with the patched values. The reference taken
+ * is returned in *uploaded and dropped with lwis_uploaded_io_entries_free.
+ *
+ * Locks: lwis_client->lock
+ * Alloc: Yes
+ * Returns: 0 on success, -ENOENT if the handle is unknown, -EINVAL if a patch
+ * does not refer to a WRITE or MODIFY entry
+ */
+int lwis_uploaded_io_instantiate(struct lwis_client *client, int64_t handle,
+				 const struct lwis_io_entry_patch *patches, size_t num_patches,
+				 struct lwis_uploaded_io **uploaded,
+				 struct lwis_io_entry **io_entries);
+
+/*
+ * lwis_uploaded_io_entries_free: Frees the io_entries returned by
+ * lwis_uploaded_io_instantiate and drops the reference to uploaded.
+ *
+ * Locks: None
+ * Alloc: No
+ * Returns: None
+ */
+void lwis_uploaded_io_entries_free(struct lwis_uploaded_io *uploaded,
+				   struct lwis_io_entry *io_entries);
+
+#endif /* LWIS_UPLOADED_IO_H_ */
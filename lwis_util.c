@@ -77,6 +77,30 @@ int lwis_device_single_register_read(struct lwis_device *lwis_dev, int bid, uint
 	return ret;
 }
 
+unsigned long lwis_device_register_lock(struct lwis_device *lwis_dev,
+					struct lwis_io_entry *entries, int num_entries,
+					bool skip_unchanged_writes)
+{
+	if (lwis_dev->vops.register_lock) {
+		return lwis_dev->vops.register_lock(lwis_dev, entries, num_entries);
+	}
+
+	mutex_lock(&lwis_dev->reg_rw_lock);
+	lwis_dev->skip_unchanged_writes = skip_unchanged_writes;
+	return 0;
+}
+
+void lwis_device_register_unlock(struct lwis_device *lwis_dev, unsigned long locked)
+{
+	if (lwis_dev->vops.register_unlock) {
+		lwis_dev->vops.register_unlock(lwis_dev, locked);
+		return;
+	}
+
+	lwis_dev->skip_unchanged_writes = false;
+	mutex_unlock(&lwis_dev->reg_rw_lock);
+}
+
 const char *lwis_device_type_to_string(int32_t type)
 {
 	switch (type) {
@@ -93,3 +117,76 @@ const char *lwis_device_type_to_string(int32_t type)
 		return "UNKNOWN";
 	}
 }
+
+size_t lwis_io_entries_num_bytes(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				 int num_entries)
+{
+	size_t num_bytes = 0;
+	int i;
+
+	for (i = 0; i < num_entries; ++i) {
+		switch (entries[i].type) {
+		case LWIS_IO_ENTRY_READ_BATCH:
+		case LWIS_IO_ENTRY_WRITE_BATCH:
+			num_bytes += entries[i].rw_batch.size_in_bytes;
+			break;
+		case LWIS_IO_ENTRY_WRITE_SCATTER:
+			num_bytes += entries[i].scatter.size_in_bytes;
+			break;
+		case LWIS_IO_ENTRY_READ_TO_BUFFER:
+			num_bytes += entries[i].read_to_buffer.size_in_bytes;
+			break;
+		case LWIS_IO_ENTRY_QOS:
+			break;
+		default:
+			num_bytes += lwis_dev->native_value_bitwidth / BITS_PER_BYTE;
+			break;
+		}
+	}
+	return num_bytes;
+}
+
+void lwis_io_entry_address(struct lwis_io_entry *entry, int *bid, uint64_t *offset)
+{
+	switch (entry->type) {
+	case LWIS_IO_ENTRY_READ:
+	case LWIS_IO_ENTRY_WRITE:
+		*bid = entry->rw.bid;
+		*offset = entry->rw.offset;
+		break;
+	case LWIS_IO_ENTRY_READ_BATCH:
+	case LWIS_IO_ENTRY_WRITE_BATCH:
+		*bid = entry->rw_batch.bid;
+		*offset = entry->rw_batch.offset;
+		break;
+	case LWIS_IO_ENTRY_MODIFY:
+		*bid = entry->mod.bid;
+		*offset = entry->mod.offset;
+		break;
+	case LWIS_IO_ENTRY_POLL:
+	case LWIS_IO_ENTRY_READ_ASSERT:
+		*bid = entry->read_assert.bid;
+		*offset = entry->read_assert.offset;
+		break;
+	case LWIS_IO_ENTRY_POLL_US:
+		*bid = entry->poll.bid;
+		*offset = entry->poll.offset;
+		break;
+	case LWIS_IO_ENTRY_WRITE_SCATTER:
+		*bid = entry->scatter.bid;
+		*offset = 0;
+		break;
+	case LWIS_IO_ENTRY_READ_TO_BUFFER:
+		*bid = entry->read_to_buffer.bid;
+		*offset = entry->read_to_buffer.offset;
+		break;
+	case LWIS_IO_ENTRY_READ_ASSERT_SKIP:
+		*bid = entry->read_assert_skip.bid;
+		*offset = entry->read_assert_skip.offset;
+		break;
+	default:
+		*bid = -1;
+		*offset = 0;
+		break;
+	}
+}
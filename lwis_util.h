@@ -13,6 +13,7 @@
 
 #include <linux/kernel.h>
 #include <linux/ktime.h>
+#include <linux/string.h>
 
 #include "lwis_commands.h"
 
@@ -46,12 +47,105 @@ int lwis_device_single_register_write(struct lwis_device *lwis_dev, int bid, uin
 int lwis_device_single_register_read(struct lwis_device *lwis_dev, int bid, uint64_t offset,
 				     uint64_t *value, int access_size);
 
+/*
+ * lwis_device_register_lock: Serializes the register access of the entries
+ * with the other clients of the device. Devices with register_lock only lock
+ * the register blocks the entries access, the others lock reg_rw_lock and set
+ * skip_unchanged_writes for the duration.
+ *
+ * Returns: the locks taken, to be passed to lwis_device_register_unlock
+ */
+unsigned long lwis_device_register_lock(struct lwis_device *lwis_dev,
+					struct lwis_io_entry *entries, int num_entries,
+					bool skip_unchanged_writes);
+
+/*
+ * lwis_device_register_unlock: Releases the locks taken by
+ * lwis_device_register_lock.
+ */
+void lwis_device_register_unlock(struct lwis_device *lwis_dev, unsigned long locked);
+
 /*
  * lwis_device_type_to_string: Converts the LWIS device type into a human-
  * readable string. Useful for debug logging.
  */
 const char *lwis_device_type_to_string(int32_t type);
 
+/*
+ * lwis_io_entries_num_bytes: Returns the number of register bytes the
+ * entries read or write, counting the native value width of the device for
+ * the single register entries. Used by the bus tracepoints.
+ */
+size_t lwis_io_entries_num_bytes(struct lwis_device *lwis_dev, struct lwis_io_entry *entries,
+				 int num_entries);
+
+/*
+ * lwis_io_entry_address: Sets *bid and *offset to the register the entry
+ * accesses first. The offset of write_scatter entries, which carry theirs in
+ * the buffer, is 0, and both are -1 and 0 for entries that access no register.
+ */
+void lwis_io_entry_address(struct lwis_io_entry *entry, int *bid, uint64_t *offset);
+
+/*
+ * lwis_io_entry_write_buf: Returns a pointer to the buffer field of an io
+ * entry that carries a userspace buffer to write, and that buffer's size in
+ * *size_in_bytes, or NULL for every other entry type. Entry submission deep
+ * copies these buffers, and entry cleanup frees them.
+ */
+static inline uint8_t **lwis_io_entry_write_buf(struct lwis_io_entry *entry,
+						 size_t *size_in_bytes)
+{
+	if (entry->type == LWIS_IO_ENTRY_WRITE_BATCH) {
+		*size_in_bytes = entry->rw_batch.size_in_bytes;
+		return &entry->rw_batch.buf;
+	}
+	if (entry->type == LWIS_IO_ENTRY_WRITE_SCATTER) {
+		*size_in_bytes = entry->scatter.size_in_bytes;
+		return &entry->scatter.buf;
+	}
+	return NULL;
+}
+
+/*
+ * lwis_scatter_field_width_valid: Whether num_bytes is a field width of the
+ * (offset, value) pairs of a WRITE_SCATTER entry, 1, 2, 4 or 8 bytes.
+ */
+static inline bool lwis_scatter_field_width_valid(unsigned int num_bytes)
+{
+	return num_bytes == 1 || num_bytes == 2 || num_bytes == 4 || num_bytes == 8;
+}
+
+/*
+ * lwis_scatter_field_get: Returns the num_bytes wide host order field at buf,
+ * which need not be aligned, as used by the (offset, value) pairs of a
+ * WRITE_SCATTER entry. Callers check the width with
+ * lwis_scatter_field_width_valid first, other widths read as 0.
+ */
+static inline uint64_t lwis_scatter_field_get(const uint8_t *buf, int num_bytes)
+{
+	uint8_t val8;
+	uint16_t val16;
+	uint32_t val32;
+	uint64_t val64;
+
+	switch (num_bytes) {
+	case 1:
+		val8 = *buf;
+		return val8;
+	case 2:
+		memcpy(&val16, buf, sizeof(val16));
+		return val16;
+	case 4:
+		memcpy(&val32, buf, sizeof(val32));
+		return val32;
+	case 8:
+		memcpy(&val64, buf, sizeof(val64));
+		return val64;
+	default:
+		return 0;
+	}
+}
+
 /*
  * lwis_get_time: Returns time since boot, this uses CLOCK_BOOTTIME which
  * does not stop during system suspend.
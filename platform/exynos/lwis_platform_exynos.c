@@ -71,6 +71,8 @@ iovmm_fault_handler(struct iommu_domain *domain, struct device *dev, unsigned lo
 	pr_err("\n");
 	lwis_debug_print_buffer_info(lwis_dev);
 	pr_err("\n");
+	lwis_debug_print_buffer_at(lwis_dev, fault_addr);
+	pr_err("\n");
 	pr_err("###############################################\n");
 
 #ifdef ENABLE_PAGE_FAULT_PANIC
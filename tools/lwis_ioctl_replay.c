@@ -0,0 +1,754 @@
+/*
+ * Google LWIS IOCTL Replay
+ *
+ * Copyright (c) 2022 Google, LLC
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+/*
+ * Replays the ioctls recorded by the ioctl_trace debugfs file of a LWIS device
+ * against a device, and reports the latency of each command and the overall
+ * throughput. A trace is captured with:
+ *
+ *   echo 1 > /sys/kernel/debug/lwis/<device>/ioctl_trace
+ *   cat /sys/kernel/debug/lwis/<device>/ioctl_trace > trace.bin
+ *
+ * and replayed with:
+ *
+ *   lwis_ioctl_replay [-f] [-s speed] [-c client_id] trace.bin /dev/lwis-<device>
+ *
+ * Every recorded client is replayed on its own fd of the device, in record
+ * order, at the recorded pace scaled by speed, or back to back with -f. The
+ * transaction, periodic io and uploaded io entries IDs returned when recording
+ * are translated to the ones returned by the replay. Records referencing
+ * resources the trace does not carry (buffer fds, eventfds, other devices) are
+ * skipped, as are the ones truncated when recording.
+ *
+ * Built against the uapi header of the driver:
+ *
+ *   $(CC) -O2 -I.. -o lwis_ioctl_replay lwis_ioctl_replay.c
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lwis_commands.h"
+
+#define MAX_CLIENTS 16
+
+/* Translation of the IDs returned when recording to the replayed ones */
+struct id_map {
+	int64_t *keys;
+	int64_t *values;
+	size_t capacity;
+	size_t count;
+};
+
+struct replay_client {
+	uint32_t client_id;
+	int fd;
+	struct id_map transaction_ids;
+	struct id_map periodic_io_ids;
+	struct id_map io_entries_handles;
+};
+
+struct command_stats {
+	unsigned int cmd;
+	const char *name;
+	int64_t *latencies_ns;
+	size_t count;
+	size_t capacity;
+	size_t num_failed;
+	size_t num_diverged;
+	int64_t recorded_total_ns;
+};
+
+/* Output buffers of the ioctl being replayed, freed once it returns */
+struct out_bufs {
+	void **bufs;
+	size_t count;
+	size_t capacity;
+};
+
+/* Walks the payload of a record, in the order it was appended */
+struct cursor {
+	uint8_t *pos;
+	uint8_t *end;
+};
+
+struct replay {
+	const char *device_path;
+	struct replay_client clients[MAX_CLIENTS];
+	size_t num_clients;
+	struct out_bufs out;
+	size_t num_io_entries;
+};
+
+static struct command_stats command_stats[] = {
+#define COMMAND(c) { .cmd = c, .name = #c }
+	COMMAND(LWIS_DEVICE_ENABLE),
+	COMMAND(LWIS_DEVICE_ENABLE_ASYNC),
+	COMMAND(LWIS_DEVICE_DISABLE),
+	COMMAND(LWIS_DEVICE_POWER_DOWN_DELAY),
+	COMMAND(LWIS_TIME_QUERY),
+	COMMAND(LWIS_REG_IO),
+	COMMAND(LWIS_REG_IO_V1),
+	COMMAND(LWIS_DEVICE_RESET),
+	COMMAND(LWIS_DEVICE_RESET_V1),
+	COMMAND(LWIS_EVENT_CONTROL_GET),
+	COMMAND(LWIS_EVENT_CONTROL_SET),
+	COMMAND(LWIS_EVENT_DEQUEUE),
+	COMMAND(LWIS_TRANSACTION_SUBMIT),
+	COMMAND(LWIS_TRANSACTION_SUBMIT_V1),
+	COMMAND(LWIS_TRANSACTION_REPLACE),
+	COMMAND(LWIS_TRANSACTION_REPLACE_V1),
+	COMMAND(LWIS_TRANSACTION_CANCEL),
+	COMMAND(LWIS_TRANSACTION_SUBMIT_BATCH),
+	COMMAND(LWIS_IO_ENTRIES_UPLOAD),
+	COMMAND(LWIS_IO_ENTRIES_RELEASE),
+	COMMAND(LWIS_PERIODIC_IO_SUBMIT),
+	COMMAND(LWIS_PERIODIC_IO_SUBMIT_V1),
+	COMMAND(LWIS_PERIODIC_IO_CANCEL),
+#undef COMMAND
+};
+
+static struct command_stats *command_stats_find(unsigned int cmd)
+{
+	size_t i;
+
+	for (i = 0; i < sizeof(command_stats) / sizeof(command_stats[0]); ++i) {
+		if (command_stats[i].cmd == cmd) {
+			return &command_stats[i];
+		}
+	}
+	return NULL;
+}
+
+static void *xrealloc(void *ptr, size_t size)
+{
+	ptr = realloc(ptr, size);
+	if (!ptr) {
+		fprintf(stderr, "Out of memory\n");
+		exit(EXIT_FAILURE);
+	}
+	return ptr;
+}
+
+static size_t id_map_slot(const struct id_map *map, int64_t key)
+{
+	size_t slot = ((uint64_t)key * 0x9e3779b97f4a7c15ULL) & (map->capacity - 1);
+
+	while (map->keys[slot] != LWIS_ID_INVALID && map->keys[slot] != key) {
+		slot = (slot + 1) & (map->capacity - 1);
+	}
+	return slot;
+}
+
+static void id_map_set(struct id_map *map, int64_t key, int64_t value)
+{
+	struct id_map old = *map;
+	size_t slot;
+	size_t i;
+
+	if (key == LWIS_ID_INVALID) {
+		return;
+	}
+	/* Grow at half full, re-inserting every entry */
+	if ((map->count + 1) * 2 > map->capacity) {
+		map->capacity = old.capacity ? old.capacity * 2 : 64;
+		map->keys = xrealloc(NULL, map->capacity * sizeof(*map->keys));
+		map->values = xrealloc(NULL, map->capacity * sizeof(*map->values));
+		for (i = 0; i < map->capacity; ++i) {
+			map->keys[i] = LWIS_ID_INVALID;
+		}
+		map->count = 0;
+		for (i = 0; i < old.capacity; ++i) {
+			if (old.keys[i] != LWIS_ID_INVALID) {
+				id_map_set(map, old.keys[i], old.values[i]);
+			}
+		}
+		free(old.keys);
+		free(old.values);
+	}
+	slot = id_map_slot(map, key);
+	if (map->keys[slot] == LWIS_ID_INVALID) {
+		map->count++;
+	}
+	map->keys[slot] = key;
+	map->values[slot] = value;
+}
+
+/* Returns the replayed ID of key, or LWIS_ID_INVALID if it has none */
+static int64_t id_map_get(const struct id_map *map, int64_t key)
+{
+	size_t slot;
+
+	if (!map->capacity) {
+		return LWIS_ID_INVALID;
+	}
+	slot = id_map_slot(map, key);
+	return map->keys[slot] == key ? map->values[slot] : LWIS_ID_INVALID;
+}
+
+static void *cursor_take(struct cursor *cursor, size_t num, size_t elem_size)
+{
+	void *data = cursor->pos;
+
+	if (elem_size && num > (size_t)(cursor->end - cursor->pos) / elem_size) {
+		return NULL;
+	}
+	cursor->pos += num * elem_size;
+	return data;
+}
+
+static void *out_buf_alloc(struct replay *replay, size_t size)
+{
+	void *buf;
+
+	if (replay->out.count == replay->out.capacity) {
+		replay->out.capacity = replay->out.capacity ? replay->out.capacity * 2 : 16;
+		replay->out.bufs = xrealloc(replay->out.bufs,
+					    replay->out.capacity * sizeof(*replay->out.bufs));
+	}
+	buf = calloc(1, size ? size : 1);
+	if (buf) {
+		replay->out.bufs[replay->out.count++] = buf;
+	}
+	return buf;
+}
+
+static void out_bufs_free(struct replay *replay)
+{
+	while (replay->out.count) {
+		free(replay->out.bufs[--replay->out.count]);
+	}
+}
+
+/* Points the entries, taken from the payload, to the buffers of the payload */
+static int fixup_io_entries(struct replay *replay, struct cursor *cursor,
+			    struct lwis_io_entry **entries_ptr, size_t num_entries)
+{
+	struct lwis_io_entry *entries;
+	size_t i;
+
+	entries = cursor_take(cursor, num_entries, sizeof(*entries));
+	if (!entries) {
+		return -EINVAL;
+	}
+	for (i = 0; i < num_entries; ++i) {
+		switch (entries[i].type) {
+		case LWIS_IO_ENTRY_READ_BATCH:
+			entries[i].rw_batch.buf =
+				out_buf_alloc(replay, entries[i].rw_batch.size_in_bytes);
+			if (!entries[i].rw_batch.buf) {
+				return -ENOMEM;
+			}
+			break;
+		case LWIS_IO_ENTRY_WRITE_BATCH:
+			entries[i].rw_batch.buf =
+				cursor_take(cursor, entries[i].rw_batch.size_in_bytes, 1);
+			if (!entries[i].rw_batch.buf) {
+				return -EINVAL;
+			}
+			break;
+		case LWIS_IO_ENTRY_WRITE_SCATTER:
+			entries[i].scatter.buf =
+				cursor_take(cursor, entries[i].scatter.size_in_bytes, 1);
+			if (!entries[i].scatter.buf) {
+				return -EINVAL;
+			}
+			break;
+		case LWIS_IO_ENTRY_READ_TO_BUFFER:
+			/* The buffer fd is the one of the recorded process */
+			return -EOPNOTSUPP;
+		}
+	}
+	*entries_ptr = entries;
+	replay->num_io_entries += num_entries;
+	return 0;
+}
+
+static int fixup_io_entries_v1(struct replay *replay, struct cursor *cursor,
+			       struct lwis_io_entry_v1 **entries_ptr, size_t num_entries)
+{
+	struct lwis_io_entry_v1 *entries;
+	size_t i;
+
+	entries = cursor_take(cursor, num_entries, sizeof(*entries));
+	if (!entries) {
+		return -EINVAL;
+	}
+	for (i = 0; i < num_entries; ++i) {
+		if (entries[i].type == LWIS_IO_ENTRY_READ_BATCH) {
+			entries[i].rw_batch.buf =
+				out_buf_alloc(replay, entries[i].rw_batch.size_in_bytes);
+			if (!entries[i].rw_batch.buf) {
+				return -ENOMEM;
+			}
+		} else if (entries[i].type == LWIS_IO_ENTRY_WRITE_BATCH) {
+			entries[i].rw_batch.buf =
+				cursor_take(cursor, entries[i].rw_batch.size_in_bytes, 1);
+			if (!entries[i].rw_batch.buf) {
+				return -EINVAL;
+			}
+		}
+	}
+	*entries_ptr = entries;
+	replay->num_io_entries += num_entries;
+	return 0;
+}
+
+static int fixup_transaction(struct replay *replay, struct replay_client *client,
+			     struct cursor *cursor, struct lwis_transaction_info *info)
+{
+	if (info->chain_parent_id != LWIS_TRANSACTION_CHAIN_NONE) {
+		info->chain_parent_id = id_map_get(&client->transaction_ids, info->chain_parent_id);
+	}
+	if (info->io_entries_handle != LWIS_IO_ENTRIES_HANDLE_NONE) {
+		info->io_entries_handle =
+			id_map_get(&client->io_entries_handles, info->io_entries_handle);
+		info->patches = cursor_take(cursor, info->num_patches, sizeof(*info->patches));
+		return info->patches ? 0 : -EINVAL;
+	}
+	return fixup_io_entries(replay, cursor, &info->io_entries, info->num_io_entries);
+}
+
+static int fixup_periodic_io(struct replay *replay, struct replay_client *client,
+			     struct cursor *cursor, struct lwis_periodic_io_info *info)
+{
+	if (info->io_entries_handle != LWIS_IO_ENTRIES_HANDLE_NONE) {
+		info->io_entries_handle =
+			id_map_get(&client->io_entries_handles, info->io_entries_handle);
+		info->patches = cursor_take(cursor, info->num_patches, sizeof(*info->patches));
+		return info->patches ? 0 : -EINVAL;
+	}
+	return fixup_io_entries(replay, cursor, &info->io_entries, info->num_io_entries);
+}
+
+static struct replay_client *client_get(struct replay *replay, uint32_t client_id)
+{
+	struct replay_client *client;
+	size_t i;
+
+	for (i = 0; i < replay->num_clients; ++i) {
+		if (replay->clients[i].client_id == client_id) {
+			return &replay->clients[i];
+		}
+	}
+	if (replay->num_clients == MAX_CLIENTS) {
+		fprintf(stderr, "More than %d clients, skipping client %u\n", MAX_CLIENTS,
+			client_id);
+		return NULL;
+	}
+	client = &replay->clients[replay->num_clients];
+	memset(client, 0, sizeof(*client));
+	client->client_id = client_id;
+	client->fd = open(replay->device_path, O_RDWR);
+	if (client->fd < 0) {
+		fprintf(stderr, "Failed to open %s: %s\n", replay->device_path, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	replay->num_clients++;
+	return client;
+}
+
+static int64_t now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void sleep_until_ns(int64_t target_ns)
+{
+	struct timespec ts = {
+		.tv_sec = target_ns / 1000000000LL,
+		.tv_nsec = target_ns % 1000000000LL,
+	};
+
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR) {
+	}
+}
+
+static void stats_add(struct command_stats *stats, int64_t latency_ns,
+		      const struct lwis_ioctl_trace_record *record, int ret)
+{
+	if (stats->count == stats->capacity) {
+		stats->capacity = stats->capacity ? stats->capacity * 2 : 256;
+		stats->latencies_ns = xrealloc(stats->latencies_ns,
+					       stats->capacity * sizeof(*stats->latencies_ns));
+	}
+	stats->latencies_ns[stats->count++] = latency_ns;
+	stats->recorded_total_ns += record->duration_ns;
+	if (ret < 0) {
+		stats->num_failed++;
+	}
+	if ((ret < 0) != (record->ret < 0)) {
+		stats->num_diverged++;
+	}
+}
+
+/*
+ * Replays one record on the fd of its client. Returns -EOPNOTSUPP if the
+ * record cannot be replayed, the result of the ioctl otherwise.
+ */
+static int replay_record(struct replay *replay, const struct lwis_ioctl_trace_record *record,
+			 uint8_t *payload, int64_t *latency_ns)
+{
+	struct replay_client *client;
+	struct cursor cursor = { payload, payload + record->payload_size };
+	unsigned int cmd = record->cmd;
+	void *arg = NULL;
+	int64_t *recorded_ids = NULL;
+	int64_t recorded_id = LWIS_ID_INVALID;
+	int64_t *replayed_id = NULL;
+	int64_t *id_arg;
+	struct id_map *ids = NULL;
+	struct lwis_io_entries *io_entries;
+	struct lwis_io_entries_v1 *io_entries_v1;
+	struct lwis_io_entries_upload *upload;
+	struct lwis_transaction_info *info;
+	struct lwis_transaction_info_v1 *info_v1;
+	struct lwis_transaction_submit_batch *batch = NULL;
+	struct lwis_periodic_io_info *periodic_io;
+	struct lwis_periodic_io_info_v1 *periodic_io_v1;
+	struct lwis_event_control_list *controls;
+	struct lwis_event_info *event_info;
+	int64_t start_ns;
+	size_t i;
+	int ret;
+
+	if (!command_stats_find(cmd)) {
+		return -EOPNOTSUPP;
+	}
+	client = client_get(replay, record->client_id);
+	if (!client) {
+		return -EOPNOTSUPP;
+	}
+	if (_IOC_DIR(cmd) != _IOC_NONE) {
+		arg = cursor_take(&cursor, _IOC_SIZE(cmd), 1);
+		if (!arg) {
+			return -EOPNOTSUPP;
+		}
+	}
+
+	switch (cmd) {
+	case LWIS_REG_IO:
+	case LWIS_DEVICE_RESET:
+		io_entries = arg;
+		ret = fixup_io_entries(replay, &cursor, &io_entries->io_entries,
+				       io_entries->num_io_entries);
+		break;
+	case LWIS_REG_IO_V1:
+	case LWIS_DEVICE_RESET_V1:
+		io_entries_v1 = arg;
+		ret = fixup_io_entries_v1(replay, &cursor, &io_entries_v1->io_entries,
+					  io_entries_v1->num_io_entries);
+		break;
+	case LWIS_EVENT_CONTROL_SET:
+		controls = arg;
+		controls->event_controls = cursor_take(&cursor, controls->num_event_controls,
+						       sizeof(*controls->event_controls));
+		ret = controls->event_controls ? 0 : -EINVAL;
+		break;
+	case LWIS_EVENT_DEQUEUE:
+		event_info = arg;
+		ret = 0;
+		if (event_info->payload_buffer) {
+			event_info->payload_buffer =
+				out_buf_alloc(replay, event_info->payload_buffer_size);
+			ret = event_info->payload_buffer ? 0 : -ENOMEM;
+		}
+		break;
+	case LWIS_TRANSACTION_SUBMIT:
+	case LWIS_TRANSACTION_REPLACE:
+		info = arg;
+		recorded_id = info->id;
+		replayed_id = &info->id;
+		ids = &client->transaction_ids;
+		ret = fixup_transaction(replay, client, &cursor, info);
+		break;
+	case LWIS_TRANSACTION_SUBMIT_V1:
+	case LWIS_TRANSACTION_REPLACE_V1:
+		info_v1 = arg;
+		recorded_id = info_v1->id;
+		replayed_id = &info_v1->id;
+		ids = &client->transaction_ids;
+		ret = fixup_io_entries_v1(replay, &cursor, &info_v1->io_entries,
+					  info_v1->num_io_entries);
+		break;
+	case LWIS_TRANSACTION_SUBMIT_BATCH:
+		batch = arg;
+		batch->errors = NULL;
+		batch->transaction_infos = cursor_take(&cursor, batch->num_transactions,
+						       sizeof(*batch->transaction_infos));
+		if (!batch->transaction_infos) {
+			ret = -EINVAL;
+			break;
+		}
+		recorded_ids = xrealloc(NULL, (batch->num_transactions + 1) * sizeof(int64_t));
+		ret = 0;
+		for (i = 0; !ret && i < batch->num_transactions; ++i) {
+			recorded_ids[i] = batch->transaction_infos[i].id;
+			ret = fixup_transaction(replay, client, &cursor,
+						&batch->transaction_infos[i]);
+		}
+		break;
+	case LWIS_IO_ENTRIES_UPLOAD:
+		upload = arg;
+		recorded_id = upload->handle;
+		replayed_id = &upload->handle;
+		ids = &client->io_entries_handles;
+		ret = fixup_io_entries(replay, &cursor, &upload->io_entries,
+				       upload->num_io_entries);
+		break;
+	case LWIS_PERIODIC_IO_SUBMIT:
+		periodic_io = arg;
+		recorded_id = periodic_io->id;
+		replayed_id = &periodic_io->id;
+		ids = &client->periodic_io_ids;
+		ret = fixup_periodic_io(replay, client, &cursor, periodic_io);
+		break;
+	case LWIS_PERIODIC_IO_SUBMIT_V1:
+		periodic_io_v1 = arg;
+		recorded_id = periodic_io_v1->id;
+		replayed_id = &periodic_io_v1->id;
+		ids = &client->periodic_io_ids;
+		ret = fixup_io_entries_v1(replay, &cursor, &periodic_io_v1->io_entries,
+					  periodic_io_v1->num_io_entries);
+		break;
+	case LWIS_TRANSACTION_CANCEL:
+	case LWIS_PERIODIC_IO_CANCEL:
+	case LWIS_IO_ENTRIES_RELEASE:
+		id_arg = arg;
+		ids = cmd == LWIS_TRANSACTION_CANCEL ? &client->transaction_ids :
+		      cmd == LWIS_PERIODIC_IO_CANCEL ? &client->periodic_io_ids :
+						       &client->io_entries_handles;
+		*id_arg = id_map_get(ids, *id_arg);
+		ret = 0;
+		break;
+	default:
+		ret = 0;
+		break;
+	}
+	if (ret) {
+		ret = -EOPNOTSUPP;
+		goto exit;
+	}
+
+	start_ns = now_ns();
+	ret = ioctl(client->fd, cmd, arg);
+	*latency_ns = now_ns() - start_ns;
+	if (ret < 0) {
+		ret = -errno;
+		goto exit;
+	}
+
+	/* The outputs are only meaningful if the recorded ioctl succeeded too */
+	if (record->ret < 0) {
+		goto exit;
+	}
+	if (replayed_id) {
+		id_map_set(ids, recorded_id, *replayed_id);
+	}
+	if (batch) {
+		for (i = 0; i < batch->num_transactions; ++i) {
+			id_map_set(&client->transaction_ids, recorded_ids[i],
+				   batch->transaction_infos[i].id);
+		}
+	}
+exit:
+	free(recorded_ids);
+	out_bufs_free(replay);
+	return ret;
+}
+
+static int compare_int64(const void *a, const void *b)
+{
+	int64_t x = *(const int64_t *)a;
+	int64_t y = *(const int64_t *)b;
+
+	return (x > y) - (x < y);
+}
+
+static double percentile_us(const struct command_stats *stats, unsigned int percent)
+{
+	return stats->latencies_ns[(stats->count - 1) * percent / 100] / 1000.0;
+}
+
+static void report(const struct replay *replay, size_t num_replayed, size_t num_skipped,
+		   uint64_t num_dropped, int64_t elapsed_ns, int64_t max_lateness_ns)
+{
+	struct command_stats *stats;
+	int64_t total_ns;
+	double elapsed_s = elapsed_ns / 1e9;
+	size_t i;
+	size_t j;
+
+	printf("%-28s %8s %7s %8s %9s %9s %9s %9s %12s\n", "command", "count", "failed",
+	       "diverged", "mean_us", "p50_us", "p99_us", "max_us", "recorded_us");
+	for (i = 0; i < sizeof(command_stats) / sizeof(command_stats[0]); ++i) {
+		stats = &command_stats[i];
+		if (!stats->count) {
+			continue;
+		}
+		qsort(stats->latencies_ns, stats->count, sizeof(*stats->latencies_ns),
+		      compare_int64);
+		total_ns = 0;
+		for (j = 0; j < stats->count; ++j) {
+			total_ns += stats->latencies_ns[j];
+		}
+		printf("%-28s %8zu %7zu %8zu %9.1f %9.1f %9.1f %9.1f %12.1f\n", stats->name,
+		       stats->count, stats->num_failed, stats->num_diverged,
+		       total_ns / 1000.0 / stats->count, percentile_us(stats, 50),
+		       percentile_us(stats, 99), percentile_us(stats, 100),
+		       stats->recorded_total_ns / 1000.0 / stats->count);
+	}
+	printf("\n%zu ioctls replayed on %zu clients in %.3f s: %.1f ioctls/s, %.1f io entries/s\n",
+	       num_replayed, replay->num_clients, elapsed_s,
+	       elapsed_s > 0 ? num_replayed / elapsed_s : 0.0,
+	       elapsed_s > 0 ? replay->num_io_entries / elapsed_s : 0.0);
+	printf("%zu records skipped, %llu dropped while recording, max lateness %.1f us\n",
+	       num_skipped, (unsigned long long)num_dropped, max_lateness_ns / 1000.0);
+}
+
+static int read_trace(const char *path, uint8_t **data, size_t *size)
+{
+	FILE *file;
+	size_t capacity = 1 << 20;
+	size_t n;
+
+	file = fopen(path, "rb");
+	if (!file) {
+		fprintf(stderr, "Failed to open %s: %s\n", path, strerror(errno));
+		return -errno;
+	}
+	*data = NULL;
+	*size = 0;
+	do {
+		if (!*data || *size == capacity) {
+			capacity = *data ? capacity * 2 : capacity;
+			*data = xrealloc(*data, capacity);
+		}
+		n = fread(*data + *size, 1, capacity - *size, file);
+		*size += n;
+	} while (n);
+	fclose(file);
+	return 0;
+}
+
+static void usage(const char *name)
+{
+	fprintf(stderr,
+		"Usage: %s [-f] [-s speed] [-c client_id] <trace> <device>\n"
+		"  -f            replay the ioctls back to back instead of at the recorded pace\n"
+		"  -s speed      scale the recorded pace, 2 replaying twice as fast\n"
+		"  -c client_id  only replay the ioctls of one recorded client\n",
+		name);
+}
+
+int main(int argc, char **argv)
+{
+	struct replay replay = { 0 };
+	const struct lwis_ioctl_trace_record *record;
+	struct command_stats *stats;
+	uint8_t *trace = NULL;
+	uint8_t *payload = NULL;
+	size_t trace_size = 0;
+	size_t offset;
+	size_t num_replayed = 0;
+	size_t num_skipped = 0;
+	uint64_t num_dropped = 0;
+	uint32_t only_client = 0;
+	bool paced = true;
+	double speed = 1.0;
+	int64_t first_record_ns = 0;
+	int64_t start_ns = 0;
+	int64_t target_ns;
+	int64_t latency_ns;
+	int64_t max_lateness_ns = 0;
+	int opt;
+	int ret;
+
+	while ((opt = getopt(argc, argv, "fs:c:")) != -1) {
+		switch (opt) {
+		case 'f':
+			paced = false;
+			break;
+		case 's':
+			speed = strtod(optarg, NULL);
+			break;
+		case 'c':
+			only_client = strtoul(optarg, NULL, 0);
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (argc - optind != 2 || speed <= 0) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	replay.device_path = argv[optind + 1];
+	if (read_trace(argv[optind], &trace, &trace_size)) {
+		return EXIT_FAILURE;
+	}
+
+	for (offset = 0; trace_size - offset >= sizeof(*record); offset += record->size) {
+		record = (const struct lwis_ioctl_trace_record *)(trace + offset);
+		if (record->size < sizeof(*record) || record->size > trace_size - offset ||
+		    record->payload_size > record->size - sizeof(*record)) {
+			fprintf(stderr, "Malformed record at offset %zu\n", offset);
+			break;
+		}
+		num_dropped += record->num_dropped;
+		if (only_client && record->client_id != only_client) {
+			continue;
+		}
+
+		if (!start_ns) {
+			first_record_ns = record->start_timestamp_ns;
+			start_ns = now_ns();
+		}
+		if (paced) {
+			target_ns = record->start_timestamp_ns - first_record_ns;
+			target_ns = start_ns + (int64_t)(target_ns / speed);
+			sleep_until_ns(target_ns);
+			if (now_ns() - target_ns > max_lateness_ns) {
+				max_lateness_ns = now_ns() - target_ns;
+			}
+		}
+
+		/* The ioctl writes its outputs to the payload, keep the trace intact */
+		payload = xrealloc(payload, record->payload_size + 1);
+		memcpy(payload, record + 1, record->payload_size);
+		ret = replay_record(&replay, record, payload, &latency_ns);
+		if (ret == -EOPNOTSUPP) {
+			num_skipped++;
+			continue;
+		}
+		stats = command_stats_find(record->cmd);
+		stats_add(stats, latency_ns, record, ret);
+		num_replayed++;
+	}
+
+	report(&replay, num_replayed, num_skipped, num_dropped, now_ns() - start_ns,
+	       max_lateness_ns);
+	free(payload);
+	free(trace);
+	return EXIT_SUCCESS;
+}